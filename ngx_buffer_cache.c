@@ -121,6 +121,9 @@ ngx_buffer_cache_reset(ngx_buffer_cache_sh_t *cache)
 	ngx_queue_init(&cache->used_queue);
 	ngx_queue_init(&cache->free_queue);
 
+	// the entries array is reused from its start, invalidate the local copies
+	cache->generation++;
+
 	// update stats (everything is evicted)
 	cache->stats.evicted = cache->stats.store_ok;
 	cache->stats.evicted_bytes = cache->stats.store_bytes;
@@ -172,10 +175,12 @@ ngx_buffer_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 	sh->buffers_end = shm_zone->shm.addr + shm_zone->shm.size;
 	sh->access_time = 0;
 
-	// reset the stats
+	// reset the stats and the lock table
 	ngx_memzero(&sh->stats, sizeof(sh->stats));
+	ngx_memzero(sh->locks, sizeof(sh->locks));
 
 	// reset the cache status
+	sh->generation = 0;
 	ngx_buffer_cache_reset(sh);
 	sh->reset = 0;
 
@@ -208,12 +213,16 @@ ngx_buffer_cache_free_oldest_entry(ngx_buffer_cache_sh_t *cache, uint32_t expira
 		return NULL;
 	}
 	
+	// remove from rb tree, detached entries were already removed
+	if (entry->state != CES_DETACHED)
+	{
+		ngx_rbtree_delete(&cache->rbtree, &entry->node);
+	}
+
 	// update the state
+	(void)ngx_atomic_fetch_add(&entry->version, 1);
 	entry->state = CES_FREE;
 
-	// remove from rb tree
-	ngx_rbtree_delete(&cache->rbtree, &entry->node);
-
 	// move from used_queue to free_queue
 	ngx_queue_remove(&entry->queue_node);
 	ngx_queue_insert_tail(&cache->free_queue, &entry->queue_node);
@@ -256,6 +265,7 @@ ngx_buffer_cache_get_free_entry(ngx_buffer_cache_sh_t *cache)
 		cache->entries_end++;
 
 		// initialize the state and add to free queue
+		(void)ngx_atomic_fetch_add(&entry->version, 1);
 		entry->state = CES_FREE;
 		ngx_queue_insert_tail(&cache->free_queue, &entry->queue_node);
 		return entry;
@@ -322,45 +332,400 @@ ngx_buffer_cache_get_free_buffer(
 	return NULL;
 }
 
-ngx_flag_t
-ngx_buffer_cache_fetch(
+/*
+	process local cache:
+	an optional per-process LRU that holds copies of recently fetched shared entries,
+	hits on this cache do not require locking the shared memory mutex. 
+	the entries keep a pointer to the shared entry along with its version, a local hit
+	is returned only if the shared entry was not evicted or replaced since it was copied. 
+	the check is performed without taking the mutex - the version of a shared entry is a single 
+	word that is incremented (with a full barrier) before the entry is freed, reused or detached, 
+	so a matching version means that the entry did not change since it was copied. 
+	a reset of the shared cache is detected by the generation counter.
+	the token of entries returned from the local cache is the local entry id with 
+	LOCAL_TOKEN_FLAG enabled, in order to route their release to the local cache.
+	entries that are removed while in use, are moved to the released queue and freed 
+	once their reference count drops to zero.
+*/
+
+static void
+ngx_buffer_cache_local_rbtree_insert_value(
+	ngx_rbtree_node_t *temp,
+	ngx_rbtree_node_t *node,
+	ngx_rbtree_node_t *sentinel)
+{
+	ngx_buffer_cache_local_entry_t *n, *t;
+	ngx_rbtree_node_t **p;
+
+	for (;;)
+	{
+		n = (ngx_buffer_cache_local_entry_t *)node;
+		t = (ngx_buffer_cache_local_entry_t *)temp;
+
+		if (node->key != temp->key)
+		{
+			p = (node->key < temp->key) ? &temp->left : &temp->right;
+		}
+		else
+		{
+			p = (ngx_memcmp(n->key, t->key, BUFFER_CACHE_KEY_SIZE) < 0)
+				? &temp->left : &temp->right;
+		}
+
+		if (*p == sentinel)
+		{
+			break;
+		}
+
+		temp = *p;
+	}
+
+	*p = node;
+	node->parent = temp;
+	node->left = sentinel;
+	node->right = sentinel;
+	ngx_rbt_red(node);
+}
+
+static ngx_buffer_cache_local_entry_t *
+ngx_buffer_cache_local_rbtree_lookup(ngx_rbtree_t *rbtree, const u_char* key, uint32_t hash)
+{
+	ngx_buffer_cache_local_entry_t *n;
+	ngx_rbtree_node_t *node, *sentinel;
+	ngx_int_t rc;
+
+	node = rbtree->root;
+	sentinel = rbtree->sentinel;
+
+	while (node != sentinel)
+	{
+		n = (ngx_buffer_cache_local_entry_t *)node;
+
+		if (hash != node->key)
+		{
+			node = (hash < node->key) ? node->left : node->right;
+			continue;
+		}
+
+		rc = ngx_memcmp(key, n->key, BUFFER_CACHE_KEY_SIZE);
+		if (rc < 0)
+		{
+			node = node->left;
+			continue;
+		}
+
+		if (rc > 0)
+		{
+			node = node->right;
+			continue;
+		}
+
+		return n;
+	}
+
+	return NULL;
+}
+
+static void
+ngx_buffer_cache_local_free_entry(ngx_buffer_cache_local_t* local, ngx_buffer_cache_local_entry_t* entry)
+{
+	local->size -= entry->alloc_size;
+	ngx_free(entry);
+}
+
+static void
+ngx_buffer_cache_local_remove(ngx_buffer_cache_local_t* local, ngx_buffer_cache_local_entry_t* entry)
+{
+	ngx_rbtree_delete(&local->rbtree, &entry->node);
+	ngx_queue_remove(&entry->queue_node);
+
+	if (entry->ref_count > 0)
+	{
+		ngx_queue_insert_tail(&local->released_queue, &entry->queue_node);
+		return;
+	}
+
+	ngx_buffer_cache_local_free_entry(local, entry);
+}
+
+static ngx_flag_t
+ngx_buffer_cache_local_fetch(
 	ngx_buffer_cache_t* cache,
 	u_char* key,
+	uint32_t hash,
 	ngx_str_t* buffer,
 	uint32_t* token)
 {
-	ngx_buffer_cache_entry_t* entry;
+	ngx_buffer_cache_local_entry_t* entry;
+	ngx_buffer_cache_local_t* local = cache->local;
+	ngx_buffer_cache_entry_t* shared_entry;
+	ngx_buffer_cache_sh_t *sh = cache->sh;
+
+	if (local == NULL)
+	{
+		return 0;
+	}
+
+	entry = ngx_buffer_cache_local_rbtree_lookup(&local->rbtree, key, hash);
+	if (entry == NULL)
+	{
+		return 0;
+	}
+
+	if (cache->expiration != 0 && ngx_time() >= (time_t)(entry->write_time + cache->expiration))
+	{
+		ngx_buffer_cache_local_remove(local, entry);
+		return 0;
+	}
+
+	// make sure the shared entry was not evicted / replaced since it was copied
+	shared_entry = entry->shared_entry;
+	if (sh->reset || 
+		sh->generation != entry->generation ||
+		shared_entry->version != entry->version)
+	{
+		ngx_buffer_cache_local_remove(local, entry);
+		return 0;
+	}
+
+	// move to the end of the lru
+	ngx_queue_remove(&entry->queue_node);
+	ngx_queue_insert_tail(&local->used_queue, &entry->queue_node);
+
+	entry->ref_count++;
+	local->pending_hits++;
+
+	buffer->data = entry->buffer;
+	buffer->len = entry->buffer_size;
+	*token = entry->id | LOCAL_TOKEN_FLAG;
+
+	return 1;
+}
+
+static ngx_buffer_cache_local_t*
+ngx_buffer_cache_local_create(void)
+{
+	ngx_buffer_cache_local_t* local;
+
+	local = ngx_alloc(sizeof(*local), ngx_cycle->log);
+	if (local == NULL)
+	{
+		return NULL;
+	}
+
+	ngx_rbtree_init(&local->rbtree, &local->sentinel, ngx_buffer_cache_local_rbtree_insert_value);
+	ngx_queue_init(&local->used_queue);
+	ngx_queue_init(&local->released_queue);
+	local->size = 0;
+	local->pending_hits = 0;
+	local->last_id = 0;
+
+	return local;
+}
+
+/* Note: on success, the shared entry is released, and the buffer / token are updated to the local copy */
+static void
+ngx_buffer_cache_local_store(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	uint32_t hash,
+	ngx_buffer_cache_entry_t* shared_entry,
+	ngx_atomic_uint_t generation,
+	ngx_atomic_uint_t version,
+	ngx_str_t* buffer,
+	uint32_t* token)
+{
+	ngx_buffer_cache_local_entry_t* entry;
+	ngx_buffer_cache_local_t* local;
+	ngx_queue_t* q;
+	size_t alloc_size;
+
+	alloc_size = ngx_align(sizeof(*entry), BUFFER_ALIGNMENT) + buffer->len + 1;
+	if (alloc_size > cache->local_size)
+	{
+		return;
+	}
+
+	local = cache->local;
+	if (local == NULL)
+	{
+		local = ngx_buffer_cache_local_create();
+		if (local == NULL)
+		{
+			return;
+		}
+
+		cache->local = local;
+	}
+
+	// if the entry was removed while in use, and the shared entry did not change, reuse it
+	for (q = ngx_queue_head(&local->released_queue);
+		q != ngx_queue_sentinel(&local->released_queue);
+		q = ngx_queue_next(q))
+	{
+		entry = container_of(q, ngx_buffer_cache_local_entry_t, queue_node);
+		if (entry->shared_entry == shared_entry &&
+			entry->generation == generation &&
+			entry->version == version)
+		{
+			ngx_queue_remove(&entry->queue_node);
+			goto insert;
+		}
+	}
+
+	// free the least recently used entries
+	while (local->size + alloc_size > cache->local_size && 
+		!ngx_queue_empty(&local->used_queue))
+	{
+		entry = container_of(ngx_queue_head(&local->used_queue), ngx_buffer_cache_local_entry_t, queue_node);
+		ngx_buffer_cache_local_remove(local, entry);
+	}
+
+	entry = ngx_memalign(BUFFER_ALIGNMENT, alloc_size, ngx_cycle->log);
+	if (entry == NULL)
+	{
+		return;
+	}
+
+	entry->node.key = hash;
+	ngx_memcpy(entry->key, key, BUFFER_CACHE_KEY_SIZE);
+	entry->buffer = (u_char*)entry + ngx_align(sizeof(*entry), BUFFER_ALIGNMENT);
+	entry->buffer_size = buffer->len;
+	entry->alloc_size = alloc_size;
+	entry->ref_count = 0;
+	entry->shared_entry = shared_entry;
+	entry->generation = generation;
+	entry->version = version;
+	entry->write_time = shared_entry->write_time;		// the shared entry is referenced, and cannot be reused
+	entry->id = ++local->last_id & ~LOCAL_TOKEN_FLAG;
+
+	// Note: the shared buffer is null terminated
+	ngx_memcpy(entry->buffer, buffer->data, buffer->len + 1);
+
+	local->size += alloc_size;
+
+insert:
+
+	ngx_rbtree_insert(&local->rbtree, &entry->node);
+	ngx_queue_insert_tail(&local->used_queue, &entry->queue_node);
+	entry->ref_count++;
+
+	ngx_buffer_cache_release(cache, key, *token);
+
+	buffer->data = entry->buffer;
+	*token = entry->id | LOCAL_TOKEN_FLAG;
+}
+
+static void
+ngx_buffer_cache_local_release(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	uint32_t token)
+{
+	ngx_buffer_cache_local_entry_t* entry;
+	ngx_buffer_cache_local_t* local = cache->local;
+	ngx_queue_t* q;
+
+	if (local == NULL)
+	{
+		return;
+	}
+
+	token &= ~LOCAL_TOKEN_FLAG;
+
+	entry = ngx_buffer_cache_local_rbtree_lookup(&local->rbtree, key, ngx_crc32_short(key, BUFFER_CACHE_KEY_SIZE));
+	if (entry != NULL && 
+		entry->id == token &&
+		entry->ref_count > 0)
+	{
+		entry->ref_count--;
+		return;
+	}
+
+	for (q = ngx_queue_head(&local->released_queue);
+		q != ngx_queue_sentinel(&local->released_queue);
+		q = ngx_queue_next(q))
+	{
+		entry = container_of(q, ngx_buffer_cache_local_entry_t, queue_node);
+		if (entry->id != token ||
+			ngx_memcmp(entry->key, key, BUFFER_CACHE_KEY_SIZE) != 0)
+		{
+			continue;
+		}
+
+		entry->ref_count--;
+		if (entry->ref_count <= 0)
+		{
+			ngx_queue_remove(&entry->queue_node);
+			ngx_buffer_cache_local_free_entry(local, entry);
+		}
+		return;
+	}
+}
+
+static ngx_flag_t
+ngx_buffer_cache_fetch_internal(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	uint32_t stale_time,
+	ngx_str_t* buffer,
+	uint32_t* token)
+{
+	ngx_buffer_cache_entry_t* entry = NULL;
 	ngx_buffer_cache_sh_t *sh = cache->sh;
+	ngx_atomic_uint_t generation = 0;
+	ngx_atomic_uint_t version = 0;
 	ngx_flag_t result = 0;
 	uint32_t hash;
 
 	hash = ngx_crc32_short(key, BUFFER_CACHE_KEY_SIZE);
 
+	if (stale_time == 0 && 
+		ngx_buffer_cache_local_fetch(cache, key, hash, buffer, token))
+	{
+		return 1;
+	}
+
 	ngx_shmtx_lock(&cache->shpool->mutex);
 
+	if (cache->local != NULL)
+	{
+		sh->stats.local_hit += cache->local->pending_hits;
+		cache->local->pending_hits = 0;
+	}
+
 	if (!sh->reset)
 	{
 		entry = ngx_buffer_cache_rbtree_lookup(&sh->rbtree, key, hash);
 		if (entry != NULL && entry->state == CES_READY && 
-			(cache->expiration == 0 || ngx_time() < (time_t)(entry->write_time + cache->expiration)))
+			(cache->expiration == 0 || ngx_time() < (time_t)(entry->write_time + cache->expiration + stale_time)))
 		{
 			result = 1;
 
 			// update stats
-			sh->stats.fetch_hit++;
+			if (stale_time == 0)
+			{
+				sh->stats.fetch_hit++;
+			}
+			else
+			{
+				sh->stats.fetch_stale++;
+			}
 			sh->stats.fetch_bytes += entry->buffer_size;
 
 			// copy buffer pointer and size
 			buffer->data = entry->start_offset;
 			buffer->len = entry->buffer_size;
-			*token = entry->write_time;
+			*token = ngx_buffer_cache_entry_token(sh, entry);
+			generation = sh->generation;
+			version = entry->version;
 
 			// Note: setting the access time of the entry and cache to prevent it 
 			//		from being freed while the caller uses the buffer
 			sh->access_time = entry->access_time = ngx_time();
 			(void)ngx_atomic_fetch_add(&entry->ref_count, 1);
 		}
-		else
+		else if (stale_time == 0)
 		{
 			// update stats
 			sh->stats.fetch_miss++;
@@ -369,9 +734,93 @@ ngx_buffer_cache_fetch(
 
 	ngx_shmtx_unlock(&cache->shpool->mutex);
 
+	if (result && stale_time == 0 && cache->local_size > 0)
+	{
+		ngx_buffer_cache_local_store(cache, key, hash, entry, generation, version, buffer, token);
+	}
+
 	return result;
 }
 
+ngx_flag_t
+ngx_buffer_cache_fetch(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_str_t* buffer,
+	uint32_t* token)
+{
+	return ngx_buffer_cache_fetch_internal(cache, key, 0, buffer, token);
+}
+
+ngx_flag_t
+ngx_buffer_cache_fetch_stale(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_str_t* buffer,
+	uint32_t* token)
+{
+	if (cache->stale_time == 0 || cache->expiration == 0)
+	{
+		return 0;
+	}
+
+	return ngx_buffer_cache_fetch_internal(cache, key, cache->stale_time, buffer, token);
+}
+
+/*
+	errors are stored under a key derived from the original key, so that they do not prevent 
+	the original key from being stored. the write time is saved with the error, since the 
+	error expiration may be shorter than the expiration of the cache
+*/
+static void
+ngx_buffer_cache_get_error_key(u_char* key, u_char* result)
+{
+	ngx_memcpy(result, key, BUFFER_CACHE_KEY_SIZE);
+	result[0] ^= 0xff;
+}
+
+ngx_flag_t
+ngx_buffer_cache_fetch_error(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_int_t* status)
+{
+	ngx_buffer_cache_error_t error;
+	u_char error_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_str_t buffer;
+	uint32_t token;
+
+	if (cache->error_expiration == 0)
+	{
+		return 0;
+	}
+
+	ngx_buffer_cache_get_error_key(key, error_key);
+
+	if (!ngx_buffer_cache_fetch(cache, error_key, &buffer, &token))
+	{
+		return 0;
+	}
+
+	if (buffer.len != sizeof(error))
+	{
+		ngx_buffer_cache_release(cache, error_key, token);
+		return 0;
+	}
+
+	ngx_memcpy(&error, buffer.data, sizeof(error));
+
+	ngx_buffer_cache_release(cache, error_key, token);
+
+	if (ngx_time() >= (time_t)(error.write_time + cache->error_expiration))
+	{
+		return 0;
+	}
+
+	*status = error.status;
+	return 1;
+}
+
 void
 ngx_buffer_cache_release(
 	ngx_buffer_cache_t* cache,
@@ -380,6 +829,75 @@ ngx_buffer_cache_release(
 {
 	ngx_buffer_cache_entry_t* entry;
 	ngx_buffer_cache_sh_t *sh = cache->sh;
+
+	if (token & LOCAL_TOKEN_FLAG)
+	{
+		ngx_buffer_cache_local_release(cache, key, token);
+		return;
+	}
+
+	ngx_shmtx_lock(&cache->shpool->mutex);
+
+	if (!sh->reset && token > 0)
+	{
+		entry = sh->entries_start + (token - 1);
+		if (entry < sh->entries_end && 
+			(entry->state == CES_READY || entry->state == CES_DETACHED) && 
+			entry->ref_count > 0 &&
+			ngx_memcmp(entry->key, key, BUFFER_CACHE_KEY_SIZE) == 0)
+		{
+			(void)ngx_atomic_fetch_add(&entry->ref_count, -1);
+		}
+	}
+
+	ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+void
+ngx_buffer_cache_touch(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	uint32_t token)
+{
+	ngx_buffer_cache_entry_t* entry;
+	ngx_buffer_cache_sh_t *sh = cache->sh;
+
+	if (token & LOCAL_TOKEN_FLAG)
+	{
+		// local entries are never freed while they are referenced
+		return;
+	}
+
+	ngx_shmtx_lock(&cache->shpool->mutex);
+
+	if (!sh->reset && token > 0)
+	{
+		entry = sh->entries_start + (token - 1);
+		if (entry < sh->entries_end && 
+			(entry->state == CES_READY || entry->state == CES_DETACHED) && 
+			entry->ref_count > 0 &&
+			ngx_memcmp(entry->key, key, BUFFER_CACHE_KEY_SIZE) == 0)
+		{
+			entry->access_time = ngx_time();
+		}
+	}
+
+	ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+/*
+	returns an identifier of the current entry of the key, without referencing it. the identifier 
+	changes when the entry is replaced, or stored again after it was evicted
+*/
+ngx_flag_t
+ngx_buffer_cache_get_entry_id(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	uint64_t* id)
+{
+	ngx_buffer_cache_entry_t* entry;
+	ngx_buffer_cache_sh_t *sh = cache->sh;
+	ngx_flag_t result = 0;
 	uint32_t hash;
 
 	hash = ngx_crc32_short(key, BUFFER_CACHE_KEY_SIZE);
@@ -389,22 +907,33 @@ ngx_buffer_cache_release(
 	if (!sh->reset)
 	{
 		entry = ngx_buffer_cache_rbtree_lookup(&sh->rbtree, key, hash);
-		if (entry != NULL && entry->state == CES_READY && (uint32_t)entry->write_time == token)
+		if (entry != NULL && entry->state == CES_READY &&
+			(cache->expiration == 0 || ngx_time() < (time_t)(entry->write_time + cache->expiration)))
 		{
-			(void)ngx_atomic_fetch_add(&entry->ref_count, -1);
+			*id = ((uint64_t)ngx_buffer_cache_entry_token(sh, entry) << 32) | (uint32_t)entry->version;
+			result = 1;
 		}
 	}
 
 	ngx_shmtx_unlock(&cache->shpool->mutex);
+
+	return result;
 }
 
-ngx_flag_t
-ngx_buffer_cache_store_gather(
+/*
+	when replace_expiration is not zero, an existing entry that was written more than 
+	replace_expiration seconds ago is detached, and the new entry is stored in its place.
+	REPLACE_ALWAYS detaches the existing entry regardless of its write time
+*/
+static ngx_flag_t
+ngx_buffer_cache_store_internal(
 	ngx_buffer_cache_t* cache, 
 	u_char* key, 
 	ngx_str_t* buffers,
-	size_t buffer_count)
+	size_t buffer_count,
+	uint32_t replace_expiration)
 {
+	ngx_buffer_cache_entry_t* expired_entry = NULL;
 	ngx_buffer_cache_entry_t* entry;
 	ngx_buffer_cache_sh_t *sh = cache->sh;
 	ngx_str_t* cur_buffer;
@@ -443,24 +972,40 @@ ngx_buffer_cache_store_gather(
 		{
 			for (evictions = MAX_EVICTIONS_PER_STORE; evictions > 0; evictions--)
 			{
-				if (!ngx_buffer_cache_free_oldest_entry(sh, cache->expiration))
+				if (!ngx_buffer_cache_free_oldest_entry(sh, cache->expiration + cache->stale_time))
 				{
 					break;
 				}
 			}
 		}
 
-		// make sure the entry does not already exist
+		// make sure the entry does not already exist, or replace it if it expired
 		entry = ngx_buffer_cache_rbtree_lookup(&sh->rbtree, key, hash);
 		if (entry != NULL)
 		{
-			sh->stats.store_exists++;
-			ngx_shmtx_unlock(&cache->shpool->mutex);
-			return 0;
+			if (replace_expiration == 0 ||
+				entry->state != CES_READY ||
+				(replace_expiration != REPLACE_ALWAYS && 
+				ngx_time() < (time_t)(entry->write_time + replace_expiration)))
+			{
+				sh->stats.store_exists++;
+				ngx_shmtx_unlock(&cache->shpool->mutex);
+				return 0;
+			}
+
+			expired_entry = entry;
 		}
 
 		// enable the reset flag before we start making any changes
 		sh->reset = 1;
+
+		if (expired_entry != NULL)
+		{
+			// Note: the buffer of the entry remains allocated until the entry reaches the head of the queue
+			ngx_rbtree_delete(&sh->rbtree, &expired_entry->node);
+			(void)ngx_atomic_fetch_add(&expired_entry->version, 1);
+			expired_entry->state = CES_DETACHED;
+		}
 	}
 
 	// allocate a new entry
@@ -534,6 +1079,28 @@ error:
 	return 0;
 }
 
+ngx_flag_t
+ngx_buffer_cache_store_gather(
+	ngx_buffer_cache_t* cache, 
+	u_char* key, 
+	ngx_str_t* buffers,
+	size_t buffer_count)
+{
+	// Note: when stale entries are kept, an expired entry is replaced with the new one
+	return ngx_buffer_cache_store_internal(cache, key, buffers, buffer_count, 
+		cache->stale_time != 0 ? cache->expiration : 0);
+}
+
+ngx_flag_t
+ngx_buffer_cache_replace_gather(
+	ngx_buffer_cache_t* cache, 
+	u_char* key, 
+	ngx_str_t* buffers,
+	size_t buffer_count)
+{
+	return ngx_buffer_cache_store_internal(cache, key, buffers, buffer_count, REPLACE_ALWAYS);
+}
+
 ngx_flag_t
 ngx_buffer_cache_store(
 	ngx_buffer_cache_t* cache,
@@ -549,6 +1116,120 @@ ngx_buffer_cache_store(
 	return ngx_buffer_cache_store_gather(cache, key, &buffer, 1);
 }
 
+ngx_flag_t
+ngx_buffer_cache_store_error(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_int_t status)
+{
+	ngx_buffer_cache_error_t error;
+	u_char error_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_str_t buffer;
+	uint32_t expiration;
+
+	if (cache->error_expiration == 0)
+	{
+		return 0;
+	}
+
+	ngx_buffer_cache_get_error_key(key, error_key);
+
+	error.status = status;
+	error.write_time = ngx_time();
+
+	buffer.data = (u_char*)&error;
+	buffer.len = sizeof(error);
+
+	// replace the previous error of this key once it can no longer be fetched
+	expiration = cache->error_expiration;
+	if (cache->expiration != 0 && cache->expiration < expiration)
+	{
+		expiration = cache->expiration;
+	}
+
+	return ngx_buffer_cache_store_internal(cache, error_key, &buffer, 1, expiration);
+}
+
+/*
+	the lock table is used to let a single process build a buffer that is missing from
+	the cache, while other processes wait for it to be stored. the table has a fixed size,
+	when it is full, the lock is granted without being recorded. locks are released 
+	explicitly, or implicitly once their expiration time passes (e.g. if the process 
+	that held the lock was killed)
+*/
+ngx_flag_t
+ngx_buffer_cache_lock(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	time_t expiration)
+{
+	ngx_buffer_cache_lock_t* free_lock = NULL;
+	ngx_buffer_cache_lock_t* cur_lock;
+	ngx_buffer_cache_lock_t* locks_end;
+	ngx_buffer_cache_sh_t *sh = cache->sh;
+	time_t now = ngx_time();
+
+	ngx_shmtx_lock(&cache->shpool->mutex);
+
+	locks_end = sh->locks + LOCK_TABLE_SIZE;
+	for (cur_lock = sh->locks; cur_lock < locks_end; cur_lock++)
+	{
+		if (cur_lock->expires <= now)
+		{
+			if (free_lock == NULL)
+			{
+				free_lock = cur_lock;
+			}
+			continue;
+		}
+
+		if (ngx_memcmp(cur_lock->key, key, BUFFER_CACHE_KEY_SIZE) == 0)
+		{
+			sh->stats.lock_busy++;
+			ngx_shmtx_unlock(&cache->shpool->mutex);
+			return 0;
+		}
+	}
+
+	if (free_lock != NULL)
+	{
+		ngx_memcpy(free_lock->key, key, BUFFER_CACHE_KEY_SIZE);
+		free_lock->expires = now + expiration;
+	}
+
+	sh->stats.lock_ok++;
+
+	ngx_shmtx_unlock(&cache->shpool->mutex);
+
+	return 1;
+}
+
+void
+ngx_buffer_cache_unlock(
+	ngx_buffer_cache_t* cache,
+	u_char* key)
+{
+	ngx_buffer_cache_lock_t* cur_lock;
+	ngx_buffer_cache_lock_t* locks_end;
+	ngx_buffer_cache_sh_t *sh = cache->sh;
+	time_t now = ngx_time();
+
+	ngx_shmtx_lock(&cache->shpool->mutex);
+
+	locks_end = sh->locks + LOCK_TABLE_SIZE;
+	for (cur_lock = sh->locks; cur_lock < locks_end; cur_lock++)
+	{
+		if (cur_lock->expires > now &&
+			ngx_memcmp(cur_lock->key, key, BUFFER_CACHE_KEY_SIZE) == 0)
+		{
+			cur_lock->expires = 0;
+			break;
+		}
+	}
+
+	ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
 void
 ngx_buffer_cache_get_stats(
 	ngx_buffer_cache_t* cache,
@@ -588,6 +1269,8 @@ ngx_buffer_cache_create(ngx_conf_t *cf, ngx_str_t *name, size_t size, time_t exp
 	}
 
 	cache->expiration = expiration;
+	cache->local_size = 0;
+	cache->local = NULL;
 
 	cache->shm_zone = ngx_shared_memory_add(cf, name, size, tag);
 	if (cache->shm_zone == NULL)
@@ -607,3 +1290,21 @@ ngx_buffer_cache_create(ngx_conf_t *cf, ngx_str_t *name, size_t size, time_t exp
 
 	return cache;
 }
+
+void
+ngx_buffer_cache_set_local_size(ngx_buffer_cache_t* cache, size_t size)
+{
+	cache->local_size = size;
+}
+
+void
+ngx_buffer_cache_set_stale_time(ngx_buffer_cache_t* cache, time_t stale_time)
+{
+	cache->stale_time = stale_time;
+}
+
+void
+ngx_buffer_cache_set_error_expiration(ngx_buffer_cache_t* cache, time_t expiration)
+{
+	cache->error_expiration = expiration;
+}
@@ -19,9 +19,13 @@ typedef struct {
 	ngx_atomic_t fetch_hit;
 	ngx_atomic_t fetch_bytes;
 	ngx_atomic_t fetch_miss;
+	ngx_atomic_t fetch_stale;
 	ngx_atomic_t evicted;
 	ngx_atomic_t evicted_bytes;
 	ngx_atomic_t reset;
+	ngx_atomic_t lock_ok;
+	ngx_atomic_t lock_busy;
+	ngx_atomic_t local_hit;
 
 	// updated only when the stats are fetched
 	ngx_atomic_t entries;
@@ -35,11 +39,36 @@ ngx_flag_t ngx_buffer_cache_fetch(
 	ngx_str_t* buffer,
 	uint32_t* token);
 
+// Note: returns entries that expired less than stale_time seconds ago
+ngx_flag_t ngx_buffer_cache_fetch_stale(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_str_t* buffer,
+	uint32_t* token);
+
+ngx_flag_t ngx_buffer_cache_fetch_error(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_int_t* status);
+
 void ngx_buffer_cache_release(
 	ngx_buffer_cache_t* cache,
 	u_char* key,
 	uint32_t token);
 
+// Note: a referenced entry is protected from eviction for ENTRY_LOCK_EXPIRATION seconds after it is 
+//		accessed, entries that are held longer have to be touched periodically
+void ngx_buffer_cache_touch(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	uint32_t token);
+
+// Note: the id changes when the entry of the key is replaced, returns 0 when the key has no valid entry
+ngx_flag_t ngx_buffer_cache_get_entry_id(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	uint64_t* id);
+
 ngx_flag_t ngx_buffer_cache_store(
 	ngx_buffer_cache_t* cache,
 	u_char* key,
@@ -52,6 +81,27 @@ ngx_flag_t ngx_buffer_cache_store_gather(
 	ngx_str_t* buffers,
 	size_t buffer_count);
 
+// Note: an existing entry of the key is replaced by the new entry, unless it is still being written
+ngx_flag_t ngx_buffer_cache_replace_gather(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_str_t* buffers,
+	size_t buffer_count);
+
+ngx_flag_t ngx_buffer_cache_store_error(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_int_t status);
+
+ngx_flag_t ngx_buffer_cache_lock(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	time_t expiration);
+
+void ngx_buffer_cache_unlock(
+	ngx_buffer_cache_t* cache,
+	u_char* key);
+
 void ngx_buffer_cache_get_stats(
 	ngx_buffer_cache_t* cache,
 	ngx_buffer_cache_stats_t* stats);
@@ -65,4 +115,16 @@ ngx_buffer_cache_t* ngx_buffer_cache_create(
 	time_t expiration, 
 	void *tag);
 
+void ngx_buffer_cache_set_local_size(
+	ngx_buffer_cache_t* cache,
+	size_t size);
+
+void ngx_buffer_cache_set_stale_time(
+	ngx_buffer_cache_t* cache,
+	time_t stale_time);
+
+void ngx_buffer_cache_set_error_expiration(
+	ngx_buffer_cache_t* cache,
+	time_t expiration);
+
 #endif // _NGX_BUFFER_CACHE_H_INCLUDED_
@@ -7,18 +7,25 @@
 // macros
 #define container_of(ptr, type, member) (type *)((char *)(ptr) - offsetof(type, member))
 
+// Note: the token of a shared entry is its index + 1, so that it is never zero
+#define ngx_buffer_cache_entry_token(sh, entry) ((uint32_t)((entry) - (sh)->entries_start) + 1)
+
 // constants
 #define CACHE_LOCK_EXPIRATION (5)
 #define ENTRY_LOCK_EXPIRATION (5)
 #define ENTRIES_ALLOC_MARGIN (1024)		// 1K entries ~= 100KB, we reserve this space to make sure allocating entries does not become the bottleneck
 #define BUFFER_ALIGNMENT (16)
 #define MAX_EVICTIONS_PER_STORE (128)
+#define LOCK_TABLE_SIZE (64)
+#define LOCAL_TOKEN_FLAG (0x80000000)		// shared tokens are entry indexes, and never reach this value
+#define REPLACE_ALWAYS (0xffffffff)
 
 // enums
 enum {
 	CES_FREE,
 	CES_ALLOCATED,
 	CES_READY,
+	CES_DETACHED,		// replaced by a newer entry, freed when it reaches the head of the queue
 };
 
 // typedefs
@@ -29,13 +36,25 @@ typedef struct {
 	size_t buffer_size;
 	ngx_atomic_t state;
 	ngx_atomic_t ref_count;
+	ngx_atomic_t version;		// incremented whenever the entry is reused or detached, invalidates the local copies
 	time_t access_time;
 	time_t write_time;
 	u_char key[BUFFER_CACHE_KEY_SIZE];
 } ngx_buffer_cache_entry_t;
 
+typedef struct {
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	time_t expires;
+} ngx_buffer_cache_lock_t;
+
+typedef struct {
+	ngx_int_t status;
+	time_t write_time;
+} ngx_buffer_cache_error_t;
+
 typedef struct {
 	ngx_atomic_t reset;
+	ngx_atomic_t generation;		// incremented on reset, invalidates the local copies of the entries
 	time_t access_time;
 	ngx_rbtree_t rbtree;
 	ngx_rbtree_node_t sentinel;
@@ -48,13 +67,45 @@ typedef struct {
 	u_char* buffers_read;
 	u_char* buffers_write;
 	ngx_buffer_cache_stats_t stats;
+	ngx_buffer_cache_lock_t locks[LOCK_TABLE_SIZE];
 } ngx_buffer_cache_sh_t;
 
+typedef struct {
+	ngx_rbtree_node_t node;
+	ngx_queue_t queue_node;
+	u_char* buffer;
+	size_t buffer_size;
+	size_t alloc_size;
+	ngx_uint_t ref_count;
+	ngx_buffer_cache_entry_t* shared_entry;
+	ngx_atomic_uint_t generation;
+	ngx_atomic_uint_t version;
+	time_t write_time;
+	uint32_t id;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+} ngx_buffer_cache_local_entry_t;
+
+typedef struct {
+	ngx_rbtree_t rbtree;
+	ngx_rbtree_node_t sentinel;
+	ngx_queue_t used_queue;
+	ngx_queue_t released_queue;		// entries that were removed while still in use
+	size_t size;
+	ngx_uint_t pending_hits;		// not yet added to the shared stats
+	uint32_t last_id;
+} ngx_buffer_cache_local_t;
+
 struct ngx_buffer_cache_s {
 	ngx_buffer_cache_sh_t *sh;
 	ngx_slab_pool_t *shpool;
 
 	uint32_t expiration;
+	uint32_t stale_time;
+	uint32_t error_expiration;
+
+	// process local cache
+	size_t local_size;
+	ngx_buffer_cache_local_t* local;
 
 	ngx_shm_zone_t *shm_zone;
 };
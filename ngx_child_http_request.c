@@ -19,6 +19,8 @@ typedef struct {
 	// fixed
 	ngx_child_request_callback_t callback;
 	void* callback_context;
+	ngx_perf_upstream_counter_t* upstream_counter;
+	ngx_uint_t* upstream_status;
 
 	// deferred init
 	ngx_buf_t* response_buffer;
@@ -165,6 +167,11 @@ ngx_child_request_wev_handler(ngx_http_request_t *r)
 		}
 	}
 
+	if (ctx->upstream_status != NULL)
+	{
+		*ctx->upstream_status = u != NULL ? u->headers_in.status_n : 0;
+	}
+
 	// get the final error code
 	rc = ctx->error_code;
 	if (rc == NGX_OK && is_in_memory(ctx) && u != NULL)
@@ -229,6 +236,22 @@ ngx_child_request_wev_handler(ngx_http_request_t *r)
 		content_length = 0;
 	}
 
+	// update the upstream counters
+	if (ctx->upstream_counter != NULL)
+	{
+		(void)ngx_atomic_fetch_add(&ctx->upstream_counter->requests, 1);
+		(void)ngx_atomic_fetch_add(&ctx->upstream_counter->bytes, content_length);
+		if (rc != NGX_OK)
+		{
+			(void)ngx_atomic_fetch_add(&ctx->upstream_counter->errors, 1);
+		}
+
+		if (u != NULL && u->peer.cached)
+		{
+			(void)ngx_atomic_fetch_add(&ctx->upstream_counter->reused_connections, 1);
+		}
+	}
+
 	if (ctx->callback != NULL)
 	{
 		// notify the caller
@@ -593,6 +616,8 @@ ngx_child_request_start(
 
 	child_ctx->callback = callback;
 	child_ctx->callback_context = callback_context;
+	child_ctx->upstream_counter = params->upstream_counter;
+	child_ctx->upstream_status = params->upstream_status;
 	child_ctx->response_buffer = response_buffer;
 
 #if defined(nginx_version) && nginx_version >= 1013010
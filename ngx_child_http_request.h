@@ -3,6 +3,7 @@
 
 // includes
 #include <ngx_http.h>
+#include "ngx_perf_counters.h"
 
 // typedefs
 typedef void(*ngx_child_request_callback_t)(void* context, ngx_int_t rc, ngx_buf_t* buf, ssize_t bytes_read);
@@ -16,6 +17,8 @@ typedef struct {
 	ngx_table_elt_t extra_header;
 	ngx_flag_t proxy_range;
 	ngx_flag_t proxy_all_headers;
+	ngx_perf_upstream_counter_t* upstream_counter;		// optional
+	ngx_uint_t* upstream_status;		// optional, receives the status returned by the upstream, 0 if none was received
 } ngx_child_request_params_t;
 
 // functions
@@ -114,11 +114,14 @@ ngx_file_reader_init(
 	state->directio = clcf->directio;
 	state->log_not_found = clcf->log_not_found;
 	state->log = r->connection->log;
-#if (NGX_HAVE_FILE_AIO)
-	state->use_aio = clcf->aio;
 	state->read_callback = read_callback;
 	state->callback_context = callback_context;
+#if (NGX_HAVE_FILE_AIO)
+	state->use_aio = clcf->aio;
 #endif // NGX_HAVE_FILE_AIO
+#if (NGX_HAVE_LIBURING)
+	state->use_uring = (flags & OPEN_FILE_IO_URING) != 0;
+#endif // NGX_HAVE_LIBURING
 
 	rc = ngx_file_reader_init_open_file_info(&of, r, clcf, path);
 	if (rc != NGX_OK)
@@ -185,11 +188,14 @@ ngx_file_reader_init_async(
 	state->directio = clcf->directio;
 	state->log_not_found = clcf->log_not_found;
 	state->log = r->connection->log;
-#if (NGX_HAVE_FILE_AIO)
-	state->use_aio = clcf->aio;
 	state->read_callback = read_callback;
 	state->callback_context = callback_context;
+#if (NGX_HAVE_FILE_AIO)
+	state->use_aio = clcf->aio;
 #endif // NGX_HAVE_FILE_AIO
+#if (NGX_HAVE_LIBURING)
+	state->use_uring = (flags & OPEN_FILE_IO_URING) != 0;
+#endif // NGX_HAVE_LIBURING
 
 	open_context = *context;
 
@@ -322,6 +328,93 @@ ngx_file_reader_enable_directio(ngx_file_reader_state_t* state)
 	return NGX_OK;
 }
 
+#if !(NGX_WIN32)
+
+static void
+ngx_file_reader_unmap(void* data)
+{
+	ngx_file_reader_state_t* state = data;
+
+	if (munmap(state->map_start, state->map_size) != 0)
+	{
+		ngx_log_error(NGX_LOG_ALERT, state->log, ngx_errno,
+			"ngx_file_reader_unmap: munmap \"%s\" failed", state->file.name.data);
+	}
+}
+
+// Note: on success, buf points into a read only mapping of the file, buf->start is set to NULL
+//		to indicate that the buffer must not be reused. NGX_DECLINED is returned when the range
+//		cannot be mapped, the caller should fall back to a regular read in this case
+ngx_int_t
+ngx_file_reader_map(ngx_file_reader_state_t* state, ngx_buf_t *buf, size_t size, off_t offset, size_t padding)
+{
+	ngx_pool_cleanup_t* cln;
+	u_char* p;
+	off_t end;
+
+	if (state->map_start == NULL)
+	{
+		if (state->map_failed || 
+			state->file_size <= 0 || 
+			(uint64_t)state->file_size > NGX_MAX_SIZE_T_VALUE)
+		{
+			return NGX_DECLINED;
+		}
+
+		cln = ngx_pool_cleanup_add(state->r->pool, 0);
+		if (cln == NULL)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, state->log, 0,
+				"ngx_file_reader_map: ngx_pool_cleanup_add failed");
+			return NGX_HTTP_INTERNAL_SERVER_ERROR;
+		}
+
+		p = mmap(NULL, (size_t)state->file_size, PROT_READ, MAP_SHARED, state->file.fd, 0);
+		if (p == MAP_FAILED)
+		{
+			ngx_log_error(NGX_LOG_WARN, state->log, ngx_errno,
+				"ngx_file_reader_map: mmap \"%s\" failed", state->file.name.data);
+			state->map_failed = 1;
+			return NGX_DECLINED;
+		}
+
+		state->map_start = p;
+		state->map_size = (size_t)state->file_size;
+
+		cln->handler = ngx_file_reader_unmap;
+		cln->data = state;
+	}
+
+	if (offset >= state->file_size)
+	{
+		return NGX_DECLINED;
+	}
+
+	end = offset + size;
+	if (end > state->file_size)
+	{
+		end = state->file_size;
+	}
+
+	// the consumers may read up to padding bytes past the end of the data, 
+	// make sure they remain inside the last mapped page
+	if (end + (off_t)padding > (off_t)ngx_align(state->file_size, (off_t)ngx_pagesize))
+	{
+		return NGX_DECLINED;
+	}
+
+	ngx_log_debug2(NGX_LOG_DEBUG_HTTP, state->log, 0, "ngx_file_reader_map: mapped offset %O size %O", offset, end - offset);
+
+	buf->start = NULL;
+	buf->end = NULL;
+	buf->pos = state->map_start + offset;
+	buf->last = state->map_start + end;
+
+	return NGX_OK;
+}
+
+#endif // !NGX_WIN32
+
 size_t 
 ngx_file_reader_get_size(void* context)
 {
@@ -338,6 +431,184 @@ ngx_file_reader_get_path(void* context, ngx_str_t* path)
 	*path = ctx->file.name;
 }
 
+#if (NGX_HAVE_LIBURING)
+
+static void
+ngx_file_reader_uring_completed(void* data, ssize_t res)
+{
+	ngx_file_reader_state_t* state = data;
+	ngx_http_request_t *r;
+	ngx_connection_t *c;
+	ngx_int_t rc;
+
+	r = state->r;
+	c = r->connection;
+
+	r->main->blocked--;
+	r->aio = 0;
+
+	if (res < 0)
+	{
+		ngx_set_errno(-res);
+		ngx_log_error(NGX_LOG_ERR, state->log, -res, 
+			"ngx_file_reader_uring_completed: read \"%s\" failed", state->file.name.data);
+		rc = NGX_ERROR;
+		res = 0;
+	}
+	else
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, state->log, 0, "ngx_file_reader_uring_completed: read returned %z", res);
+		state->buf->last += res;
+		rc = NGX_OK;
+	}
+
+	state->read_callback(state->callback_context, rc, NULL, res);
+
+	ngx_http_run_posted_requests(c);
+}
+
+static ngx_int_t
+ngx_file_reader_uring_read(ngx_file_reader_state_t* state, ngx_buf_t *buf, size_t size, off_t offset)
+{
+	ngx_int_t rc;
+
+	state->uring_req.handler = ngx_file_reader_uring_completed;
+	state->uring_req.data = state;
+
+	rc = ngx_io_uring_read(&state->uring_req, state->file.fd, buf->last, size, offset, state->log);
+	if (rc != NGX_AGAIN)
+	{
+		// io_uring unavailable, don't try again for this file
+		state->use_uring = 0;
+		return rc;
+	}
+
+	state->r->main->blocked++;
+	state->r->aio = 1;
+
+	state->buf = buf;
+	return NGX_AGAIN;
+}
+
+#endif // NGX_HAVE_LIBURING
+
+#if (NGX_THREADS)
+
+typedef struct {
+	ngx_file_reader_state_t* state;
+	ngx_perf_counters_t* perf_counters;
+	ngx_fd_t fd;
+	u_char* buf;
+	size_t size;
+	off_t offset;
+	ssize_t nbytes;
+	ngx_err_t err;
+	ngx_perf_counter_context(perf_counter_context);
+} ngx_file_reader_thread_read_ctx_t;
+
+// Note: runs on the thread pool, must not access the request
+static void
+ngx_file_reader_thread_read_handler(void *data, ngx_log_t *log)
+{
+	ngx_file_reader_thread_read_ctx_t* ctx = data;
+
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_READ_FILE_QUEUE);
+
+	ngx_perf_counter_start(ctx->perf_counter_context);
+
+	ctx->nbytes = pread(ctx->fd, ctx->buf, ctx->size, ctx->offset);
+	ctx->err = ctx->nbytes < 0 ? ngx_errno : 0;
+
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_READ_FILE_THREAD);
+}
+
+static void
+ngx_file_reader_thread_read_event_handler(ngx_event_t *ev)
+{
+	ngx_file_reader_thread_read_ctx_t* ctx = ev->data;
+	ngx_file_reader_state_t* state = ctx->state;
+	ngx_http_request_t *r;
+	ngx_connection_t *c;
+	ssize_t bytes_read;
+	ngx_int_t rc;
+
+	r = state->r;
+	c = r->connection;
+
+	r->main->blocked--;
+	r->aio = 0;
+
+	if (ctx->nbytes < 0)
+	{
+		ngx_set_errno(ctx->err);
+		ngx_log_error(NGX_LOG_ERR, state->log, ctx->err,
+			"ngx_file_reader_thread_read_event_handler: pread \"%s\" failed", state->file.name.data);
+		rc = NGX_ERROR;
+		bytes_read = 0;
+	}
+	else
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, state->log, 0, "ngx_file_reader_thread_read_event_handler: pread returned %z", ctx->nbytes);
+		state->buf->last += ctx->nbytes;
+		rc = NGX_OK;
+		bytes_read = ctx->nbytes;
+	}
+
+	state->read_callback(state->callback_context, rc, NULL, bytes_read);
+
+	ngx_http_run_posted_requests(c);
+}
+
+static ngx_int_t
+ngx_file_reader_thread_read(ngx_file_reader_state_t* state, ngx_buf_t *buf, size_t size, off_t offset)
+{
+	ngx_file_reader_thread_read_ctx_t* ctx;
+	ngx_thread_task_t* task;
+
+	task = state->read_task;
+	if (task == NULL)
+	{
+		task = ngx_thread_task_alloc(state->r->pool, sizeof(*ctx));
+		if (task == NULL)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, state->log, 0,
+				"ngx_file_reader_thread_read: ngx_thread_task_alloc failed");
+			return NGX_ERROR;
+		}
+
+		task->handler = ngx_file_reader_thread_read_handler;
+		task->event.handler = ngx_file_reader_thread_read_event_handler;
+		task->event.data = task->ctx;
+
+		state->read_task = task;
+	}
+
+	ctx = task->ctx;
+	ctx->state = state;
+	ctx->perf_counters = state->perf_counters;
+	ctx->fd = state->file.fd;
+	ctx->buf = buf->last;
+	ctx->size = size;
+	ctx->offset = offset;
+
+	ngx_perf_counter_start(ctx->perf_counter_context);
+
+	if (ngx_thread_task_post(state->read_thread_pool, task) != NGX_OK)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, state->log, 0,
+			"ngx_file_reader_thread_read: ngx_thread_task_post failed");
+		return NGX_ERROR;
+	}
+
+	state->r->main->blocked++;
+	state->r->aio = 1;
+
+	state->buf = buf;
+	return NGX_AGAIN;
+}
+
+#endif // NGX_THREADS
+
 #if (NGX_HAVE_FILE_AIO)
 
 static void
@@ -387,6 +658,21 @@ ngx_async_file_read(ngx_file_reader_state_t* state, ngx_buf_t *buf, size_t size,
 
 	ngx_log_debug2(NGX_LOG_DEBUG_HTTP, state->log, 0, "ngx_async_file_read: reading offset %O size %uz", offset, size);
 
+#if (NGX_HAVE_LIBURING)
+	if (state->use_uring && 
+		ngx_file_reader_uring_read(state, buf, size, offset) == NGX_AGAIN)
+	{
+		return NGX_AGAIN;
+	}
+#endif // NGX_HAVE_LIBURING
+
+#if (NGX_THREADS)
+	if (state->read_thread_pool != NULL)
+	{
+		return ngx_file_reader_thread_read(state, buf, size, offset);
+	}
+#endif // NGX_THREADS
+
 	if (state->use_aio)
 	{
 		rc = ngx_file_aio_read(&state->file, buf->last, size, offset, state->r->pool);
@@ -429,6 +715,21 @@ ngx_async_file_read(ngx_file_reader_state_t* state, ngx_buf_t *buf, size_t size,
 
 	ngx_log_debug2(NGX_LOG_DEBUG_HTTP, state->log, 0, "ngx_async_file_read: reading offset %O size %uz", offset, size);
 
+#if (NGX_HAVE_LIBURING)
+	if (state->use_uring && 
+		ngx_file_reader_uring_read(state, buf, size, offset) == NGX_AGAIN)
+	{
+		return NGX_AGAIN;
+	}
+#endif // NGX_HAVE_LIBURING
+
+#if (NGX_THREADS)
+	if (state->read_thread_pool != NULL)
+	{
+		return ngx_file_reader_thread_read(state, buf, size, offset);
+	}
+#endif // NGX_THREADS
+
 	rc = ngx_read_file(&state->file, buf->last, size, offset);
 	if (rc < 0)
 	{
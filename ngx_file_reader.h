@@ -11,8 +11,15 @@
 #include "ngx_async_open_file_cache.h"
 #endif // NGX_THREADS
 
+#if (NGX_HAVE_LIBURING)
+#include "ngx_io_uring.h"
+#endif // NGX_HAVE_LIBURING
+
+#include "ngx_perf_counters.h"
+
 // constants
 #define OPEN_FILE_NO_CACHE (0x1)
+#define OPEN_FILE_IO_URING (0x2)
 
 // typedefs
 typedef void (*ngx_async_read_callback_t)(void* context, ngx_int_t rc, ngx_buf_t* buf, ssize_t bytes_read);
@@ -24,12 +31,26 @@ typedef struct {
 	ngx_flag_t log_not_found;
 	ngx_log_t* log;
 	off_t file_size;
-#if (NGX_HAVE_FILE_AIO)
-	ngx_flag_t use_aio;
+	ngx_perf_counters_t* perf_counters;
 	ngx_async_read_callback_t read_callback;
 	void* callback_context;
 	ngx_buf_t* buf;
+#if (NGX_HAVE_FILE_AIO)
+	ngx_flag_t use_aio;
 #endif // NGX_HAVE_FILE_AIO
+#if (NGX_HAVE_LIBURING)
+	ngx_flag_t use_uring;
+	ngx_io_uring_request_t uring_req;
+#endif // NGX_HAVE_LIBURING
+#if (NGX_THREADS)
+	ngx_thread_pool_t* read_thread_pool;
+	ngx_thread_task_t* read_task;
+#endif // NGX_THREADS
+#if !(NGX_WIN32)
+	u_char* map_start;
+	size_t map_size;
+	ngx_flag_t map_failed;
+#endif // !NGX_WIN32
 } ngx_file_reader_state_t;
 
 // functions
@@ -66,4 +87,8 @@ ngx_int_t ngx_async_file_read(ngx_file_reader_state_t* state, ngx_buf_t *buf, si
 
 ngx_int_t ngx_file_reader_enable_directio(ngx_file_reader_state_t* state);
 
+#if !(NGX_WIN32)
+ngx_int_t ngx_file_reader_map(ngx_file_reader_state_t* state, ngx_buf_t *buf, size_t size, off_t offset, size_t padding);
+#endif // !NGX_WIN32
+
 #endif // _NGX_FILE_READER_H_INCLUDED_
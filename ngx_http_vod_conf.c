@@ -88,6 +88,7 @@ ngx_http_vod_create_loc_conf(ngx_conf_t *cf)
 	conf->max_frame_count = NGX_CONF_UNSET_UINT;
 	conf->segment_max_frame_count = NGX_CONF_UNSET_UINT;
 	conf->cache_buffer_size = NGX_CONF_UNSET_SIZE;
+	conf->file_mmap = NGX_CONF_UNSET;
 	conf->max_upstream_headers_size = NGX_CONF_UNSET_SIZE;
 	conf->ignore_edit_list = NGX_CONF_UNSET;
 	conf->parse_hdlr_name = NGX_CONF_UNSET;
@@ -95,6 +96,11 @@ ngx_http_vod_create_loc_conf(ngx_conf_t *cf)
 	conf->max_mapping_response_size = NGX_CONF_UNSET_SIZE;
 
 	conf->metadata_cache = NGX_CONF_UNSET_PTR;
+	conf->segment_cache = NGX_CONF_UNSET_PTR;
+	conf->segment_size_cache = NGX_CONF_UNSET_PTR;
+	conf->response_cache_gzip_level = NGX_CONF_UNSET;
+	conf->cache_lock = NGX_CONF_UNSET;
+	conf->cache_lock_timeout = NGX_CONF_UNSET_MSEC;
 	conf->dynamic_mapping_cache = NGX_CONF_UNSET_PTR;
 	for (type = 0; type < CACHE_TYPE_COUNT; type++)
 	{
@@ -117,7 +123,11 @@ ngx_http_vod_create_loc_conf(ngx_conf_t *cf)
 
 #if (NGX_THREADS)
 	conf->open_file_thread_pool = NGX_CONF_UNSET_PTR;
+	conf->read_file_thread_pool = NGX_CONF_UNSET_PTR;
 #endif // NGX_THREADS
+#if (NGX_HAVE_LIBURING)
+	conf->file_io_uring = NGX_CONF_UNSET;
+#endif // NGX_HAVE_LIBURING
 
 	// submodules
 	for (cur_module = submodules; *cur_module != NULL; cur_module++)
@@ -190,6 +200,11 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 	}
 
 	ngx_conf_merge_ptr_value(conf->metadata_cache, prev->metadata_cache, NULL);
+	ngx_conf_merge_ptr_value(conf->segment_cache, prev->segment_cache, NULL);
+	ngx_conf_merge_ptr_value(conf->segment_size_cache, prev->segment_size_cache, NULL);
+	ngx_conf_merge_value(conf->response_cache_gzip_level, prev->response_cache_gzip_level, 0);
+	ngx_conf_merge_value(conf->cache_lock, prev->cache_lock, 0);
+	ngx_conf_merge_msec_value(conf->cache_lock_timeout, prev->cache_lock_timeout, 5000);
 	ngx_conf_merge_ptr_value(conf->dynamic_mapping_cache, prev->dynamic_mapping_cache, NULL);
 
 	for (type = 0; type < CACHE_TYPE_COUNT; type++)
@@ -209,6 +224,7 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 	ngx_conf_merge_uint_value(conf->max_frame_count, prev->max_frame_count, 1024 * 1024);
 	ngx_conf_merge_uint_value(conf->segment_max_frame_count, prev->segment_max_frame_count, 64 * 1024);
 	ngx_conf_merge_size_value(conf->cache_buffer_size, prev->cache_buffer_size, 256 * 1024);
+	ngx_conf_merge_value(conf->file_mmap, prev->file_mmap, 0);
 	ngx_conf_merge_size_value(conf->max_upstream_headers_size, prev->max_upstream_headers_size, 4 * 1024);
 
 	if (conf->output_buffer_pool == NULL)
@@ -313,7 +329,11 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
 #if (NGX_THREADS)
 	ngx_conf_merge_ptr_value(conf->open_file_thread_pool, prev->open_file_thread_pool, NULL);
+	ngx_conf_merge_ptr_value(conf->read_file_thread_pool, prev->read_file_thread_pool, NULL);
 #endif // NGX_THREADS
+#if (NGX_HAVE_LIBURING)
+	ngx_conf_merge_value(conf->file_io_uring, prev->file_io_uring, 0);
+#endif // NGX_HAVE_LIBURING
 
 	// validate vod_upstream / vod_upstream_host_header used when needed
 	if (conf->request_handler == ngx_http_vod_remote_request_handler)
@@ -326,6 +346,13 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 		}
 	}
 
+	if (conf->response_cache_gzip_level < 0 || conf->response_cache_gzip_level > 9)
+	{
+		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+			"\"vod_response_cache_gzip_level\" must be between 0 and 9");
+		return NGX_CONF_ERROR;
+	}
+
 	if (conf->segmenter.segment_duration <= 0)
 	{
 		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
@@ -638,8 +665,13 @@ ngx_http_vod_cache_command(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
 	ngx_buffer_cache_t **cache = (ngx_buffer_cache_t **)((u_char*)conf + cmd->offset);
 	ngx_str_t  *value;
+	ngx_str_t param_value;
+	ngx_uint_t arg_count;
+	ssize_t local_size;
 	ssize_t size;
+	time_t error_expiration;
 	time_t expiration;
+	time_t stale_time;
 
 	value = cf->args->elts;
 
@@ -669,7 +701,63 @@ ngx_http_vod_cache_command(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 		return NGX_CONF_ERROR;
 	}
 
-	if (cf->args->nelts > 3)
+	// process the named params (local cache size / stale time / error expiration)
+	arg_count = cf->args->nelts;
+	local_size = 0;
+	stale_time = 0;
+	error_expiration = 0;
+
+	for (; arg_count > 3; arg_count--)
+	{
+		if (value[arg_count - 1].len > sizeof("local=") - 1 &&
+			ngx_strncmp(value[arg_count - 1].data, "local=", sizeof("local=") - 1) == 0)
+		{
+			param_value.data = value[arg_count - 1].data + sizeof("local=") - 1;
+			param_value.len = value[arg_count - 1].len - (sizeof("local=") - 1);
+
+			local_size = ngx_parse_size(&param_value);
+			if (local_size == NGX_ERROR)
+			{
+				ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+					"invalid local size %V", &param_value);
+				return NGX_CONF_ERROR;
+			}
+		}
+		else if (value[arg_count - 1].len > sizeof("stale=") - 1 &&
+			ngx_strncmp(value[arg_count - 1].data, "stale=", sizeof("stale=") - 1) == 0)
+		{
+			param_value.data = value[arg_count - 1].data + sizeof("stale=") - 1;
+			param_value.len = value[arg_count - 1].len - (sizeof("stale=") - 1);
+
+			stale_time = ngx_parse_time(&param_value, 1);
+			if (stale_time == (time_t)NGX_ERROR)
+			{
+				ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+					"invalid stale time %V", &param_value);
+				return NGX_CONF_ERROR;
+			}
+		}
+		else if (value[arg_count - 1].len > sizeof("errors=") - 1 &&
+			ngx_strncmp(value[arg_count - 1].data, "errors=", sizeof("errors=") - 1) == 0)
+		{
+			param_value.data = value[arg_count - 1].data + sizeof("errors=") - 1;
+			param_value.len = value[arg_count - 1].len - (sizeof("errors=") - 1);
+
+			error_expiration = ngx_parse_time(&param_value, 1);
+			if (error_expiration == (time_t)NGX_ERROR)
+			{
+				ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+					"invalid errors expiration %V", &param_value);
+				return NGX_CONF_ERROR;
+			}
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (arg_count > 3)
 	{
 		expiration = ngx_parse_time(&value[3], 1);
 		if (expiration == (time_t)NGX_ERROR) 
@@ -685,13 +773,17 @@ ngx_http_vod_cache_command(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 	}
 
 	*cache = ngx_buffer_cache_create(cf, &value[1], size, expiration, &ngx_http_vod_module);
-	if (*cache == NULL)
+	if (*cache == NULL || *cache == NGX_CONF_ERROR)
 	{
 		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
 			"failed to create cache");
 		return NGX_CONF_ERROR;
 	}
 
+	ngx_buffer_cache_set_local_size(*cache, local_size);
+	ngx_buffer_cache_set_stale_time(*cache, stale_time);
+	ngx_buffer_cache_set_error_expiration(*cache, error_expiration);
+
 	return NGX_CONF_OK;
 }
 
@@ -992,26 +1084,61 @@ ngx_command_t ngx_http_vod_commands[] = {
 	
 	// mp4 reading parameters
 	{ ngx_string("vod_metadata_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1234,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, metadata_cache),
 	NULL },
 
 	{ ngx_string("vod_response_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1234,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, response_cache[CACHE_TYPE_VOD]),
 	NULL },
 
 	{ ngx_string("vod_live_response_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1234,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, response_cache[CACHE_TYPE_LIVE]),
 	NULL },
 
+	{ ngx_string("vod_response_cache_gzip_level"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, response_cache_gzip_level),
+	NULL },
+
+	{ ngx_string("vod_segment_cache"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1234,
+	ngx_http_vod_cache_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, segment_cache),
+	NULL },
+
+	{ ngx_string("vod_segment_size_cache"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1234,
+	ngx_http_vod_cache_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, segment_size_cache),
+	NULL },
+
+	{ ngx_string("vod_cache_lock"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_FLAG,
+	ngx_conf_set_flag_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, cache_lock),
+	NULL },
+
+	{ ngx_string("vod_cache_lock_timeout"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_msec_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, cache_lock_timeout),
+	NULL },
+
 	{ ngx_string("vod_initial_read_size"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
 	ngx_conf_set_size_slot,
@@ -1054,6 +1181,13 @@ ngx_command_t ngx_http_vod_commands[] = {
 	offsetof(ngx_http_vod_loc_conf_t, cache_buffer_size),
 	NULL },
 
+	{ ngx_string("vod_file_mmap"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_flag_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, file_mmap),
+	NULL },
+
 	{ ngx_string("vod_ignore_edit_list"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
 	ngx_conf_set_flag_slot,
@@ -1106,21 +1240,21 @@ ngx_command_t ngx_http_vod_commands[] = {
 
 	// path request parameters - mapped mode only
 	{ ngx_string("vod_mapping_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, mapping_cache[CACHE_TYPE_VOD]),
 	NULL },
 
 	{ ngx_string("vod_live_mapping_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, mapping_cache[CACHE_TYPE_LIVE]),
 	NULL },
 
 	{ ngx_string("vod_dynamic_mapping_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, dynamic_mapping_cache),
@@ -1293,7 +1427,7 @@ ngx_command_t ngx_http_vod_commands[] = {
 	NULL },
 
 	{ ngx_string("vod_drm_info_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, drm_info_cache),
@@ -1378,8 +1512,24 @@ ngx_command_t ngx_http_vod_commands[] = {
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, open_file_thread_pool),
 	NULL },
+
+	{ ngx_string("vod_read_file_thread_pool"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE1,
+	ngx_http_vod_thread_pool_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, read_file_thread_pool),
+	NULL },
 #endif // NGX_THREADS
 
+#if (NGX_HAVE_LIBURING)
+	{ ngx_string("vod_file_io_uring"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_flag_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, file_io_uring),
+	NULL },
+#endif // NGX_HAVE_LIBURING
+
 #include "ngx_http_vod_dash_commands.h"
 #include "ngx_http_vod_hds_commands.h"
 #include "ngx_http_vod_hls_commands.h"
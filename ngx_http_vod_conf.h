@@ -48,12 +48,18 @@ struct ngx_http_vod_loc_conf_s {
 	ngx_http_complex_value_t *segments_base_url;
 	ngx_buffer_cache_t* metadata_cache;
 	ngx_buffer_cache_t* response_cache[CACHE_TYPE_COUNT];
+	ngx_int_t response_cache_gzip_level;
+	ngx_buffer_cache_t* segment_cache;
+	ngx_buffer_cache_t* segment_size_cache;
+	ngx_flag_t cache_lock;
+	ngx_msec_t cache_lock_timeout;
 	size_t initial_read_size;
 	size_t max_metadata_size;
 	size_t max_frames_size;
 	ngx_uint_t max_frame_count;
 	ngx_uint_t segment_max_frame_count;
 	size_t cache_buffer_size;
+	ngx_flag_t file_mmap;
 	buffer_pool_t* output_buffer_pool;
 	size_t max_upstream_headers_size;
 	ngx_flag_t ignore_edit_list;
@@ -104,8 +110,13 @@ struct ngx_http_vod_loc_conf_s {
 
 #if (NGX_THREADS)
 	ngx_thread_pool_t *open_file_thread_pool;
+	ngx_thread_pool_t *read_file_thread_pool;
 #endif // NGX_THREADS
 
+#if (NGX_HAVE_LIBURING)
+	ngx_flag_t file_io_uring;
+#endif // NGX_HAVE_LIBURING
+
 	// derived fields
 	ngx_hash_t uri_params_hash;
 	ngx_hash_t pd_uri_params_hash;
@@ -222,6 +222,7 @@ ngx_http_vod_hls_init_segment_encryption(
 	ngx_http_vod_submodule_context_t* submodule_context,
 	segment_writer_t* segment_writer,
 	ngx_uint_t container_format,
+	bool_t in_place,
 	hls_encryption_params_t* encryption_params)
 {
 	aes_cbc_encrypt_context_t* encrypted_write_context;
@@ -245,7 +246,8 @@ ngx_http_vod_hls_init_segment_encryption(
 	}
 	else
 	{
-		// Note: should not use buffer pool for fmp4 since the buffers have varying sizes
+		// Note: should not use buffer pool for fmp4 since the buffers have varying sizes,
+		//		can't encrypt in place since the frame buffers may be shared (e.g. read cache / silence)
 		buffer_pool = NULL;
 	}
 
@@ -255,6 +257,7 @@ ngx_http_vod_hls_init_segment_encryption(
 		segment_writer->write_tail,
 		segment_writer->context,
 		buffer_pool,
+		in_place,
 		encryption_params->key,
 		encryption_params->iv);
 	if (rc != VOD_OK)
@@ -407,8 +410,9 @@ ngx_http_vod_hls_handle_master_playlist(
 }
 
 static ngx_int_t 
-ngx_http_vod_hls_handle_index_playlist(
+ngx_http_vod_hls_build_index_playlist(
 	ngx_http_vod_submodule_context_t* submodule_context,
+	bool_t skip_segments,
 	ngx_str_t* response,
 	ngx_str_t* content_type)
 {
@@ -486,12 +490,21 @@ ngx_http_vod_hls_handle_index_playlist(
 		&segments_base_url,
 		&encryption_params,
 		container_format,
+		skip_segments,
+		submodule_context->request_params.media_sequence,
 		&submodule_context->media_set,
-		response);
+		&submodule_context->last_media_sequence,
+		&submodule_context->response_chain,
+		&response->len);
+	if (rc == VOD_AGAIN)
+	{
+		return NGX_AGAIN;
+	}
+
 	if (rc != VOD_OK)
 	{
 		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
-			"ngx_http_vod_hls_handle_index_playlist: m3u8_builder_build_index_playlist failed %i", rc);
+			"ngx_http_vod_hls_build_index_playlist: m3u8_builder_build_index_playlist failed %i", rc);
 		return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
 	}
 
@@ -501,6 +514,24 @@ ngx_http_vod_hls_handle_index_playlist(
 	return NGX_OK;
 }
 
+static ngx_int_t 
+ngx_http_vod_hls_handle_index_playlist(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* response,
+	ngx_str_t* content_type)
+{
+	return ngx_http_vod_hls_build_index_playlist(submodule_context, FALSE, response, content_type);
+}
+
+static ngx_int_t 
+ngx_http_vod_hls_handle_delta_index_playlist(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* response,
+	ngx_str_t* content_type)
+{
+	return ngx_http_vod_hls_build_index_playlist(submodule_context, TRUE, response, content_type);
+}
+
 static ngx_int_t
 ngx_http_vod_hls_handle_iframe_playlist(
 	ngx_http_vod_submodule_context_t* submodule_context,
@@ -597,6 +628,84 @@ ngx_http_vod_hls_handle_encryption_key(
 	return NGX_OK;
 }
 
+static ngx_int_t
+ngx_http_vod_hls_init_segment_size_key(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	hls_mpegts_muxer_conf_t* muxer_conf,
+	hls_encryption_params_t* encryption_params,
+	u_char* key)
+{
+	media_set_t* media_set = &submodule_context->media_set;
+	media_clip_source_t* cur_source;
+	media_track_t* cur_track;
+	ngx_md5_t md5;
+	ngx_int_t rc;
+
+	// calc the key from the host + uri + the parameters that affect the segment size
+	ngx_md5_init(&md5);
+
+	rc = ngx_http_vod_update_base_url_key(submodule_context->r, submodule_context->conf, &md5);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	ngx_md5_update(&md5, submodule_context->r->uri.data, submodule_context->r->uri.len);
+
+	// add the identity of the source files and of the segment frames, so that a change of the 
+	// mapping / files behind the same uri does not return a previously calculated size
+	for (cur_source = media_set->sources_head; cur_source != NULL; cur_source = cur_source->next)
+	{
+		ngx_md5_update(&md5, cur_source->file_key, sizeof(cur_source->file_key));
+	}
+
+	for (cur_track = media_set->filtered_tracks; cur_track < media_set->filtered_tracks_end; cur_track++)
+	{
+		ngx_md5_update(&md5, &cur_track->frame_count, sizeof(cur_track->frame_count));
+		ngx_md5_update(&md5, &cur_track->key_frame_count, sizeof(cur_track->key_frame_count));
+		ngx_md5_update(&md5, &cur_track->total_frames_size, sizeof(cur_track->total_frames_size));
+		ngx_md5_update(&md5, &cur_track->total_frames_duration, sizeof(cur_track->total_frames_duration));
+		ngx_md5_update(&md5, &cur_track->first_frame_time_offset, sizeof(cur_track->first_frame_time_offset));
+		ngx_md5_update(&md5, cur_track->media_info.extra_data.data, cur_track->media_info.extra_data.len);
+	}
+
+	ngx_md5_update(&md5, &muxer_conf->interleave_frames, sizeof(muxer_conf->interleave_frames));
+	ngx_md5_update(&md5, &muxer_conf->align_frames, sizeof(muxer_conf->align_frames));
+	ngx_md5_update(&md5, &muxer_conf->align_pts, sizeof(muxer_conf->align_pts));
+	ngx_md5_update(&md5, muxer_conf->id3_data.data, muxer_conf->id3_data.len);
+	ngx_md5_update(&md5, &encryption_params->type, sizeof(encryption_params->type));
+	if (encryption_params->type != HLS_ENC_NONE)
+	{
+		ngx_md5_update(&md5, encryption_params->key, AES_BLOCK_SIZE);
+		ngx_md5_update(&md5, encryption_params->iv, AES_BLOCK_SIZE);
+	}
+	ngx_md5_final(key, &md5);
+
+	return NGX_OK;
+}
+
+static size_t
+ngx_http_vod_hls_fetch_segment_size(ngx_buffer_cache_t* cache, u_char* key)
+{
+	ngx_str_t cache_buffer;
+	uint32_t token;
+	size_t result = 0;
+
+	if (!ngx_buffer_cache_fetch(cache, key, &cache_buffer, &token))
+	{
+		return 0;
+	}
+
+	if (cache_buffer.len == sizeof(result))
+	{
+		ngx_memcpy(&result, cache_buffer.data, sizeof(result));
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	return result;
+}
+
 static ngx_int_t
 ngx_http_vod_hls_init_ts_frame_processor(
 	ngx_http_vod_submodule_context_t* submodule_context,
@@ -609,15 +718,26 @@ ngx_http_vod_hls_init_ts_frame_processor(
 {
 	hls_encryption_params_t encryption_params;
 	hls_mpegts_muxer_conf_t muxer_conf;
+	ngx_buffer_cache_t* size_cache = submodule_context->conf->segment_size_cache;
 	hls_muxer_state_t* state;
+	u_char size_key[BUFFER_CACHE_KEY_SIZE];
+	size_t cached_size = 0;
 	vod_status_t rc;
 	bool_t reuse_output_buffers;
-
 #if (NGX_HAVE_OPENSSL_EVP)
+	bool_t in_place;
+
+	// Note: the mpegts muxer writes only buffers allocated by its write queue, and hands them over 
+	//		to the writer. the buffers can be encrypted in place when they hold a whole number of aes 
+	//		blocks, i.e. when the number of packets that fit in a buffer is a multiple of 4
+	in_place = ((write_buffer_queue_get_buffer_size(&submodule_context->request_context) / 
+		MPEGTS_PACKET_SIZE) & 0x03) == 0;
+
 	rc = ngx_http_vod_hls_init_segment_encryption(
 		submodule_context,
 		segment_writer,
 		HLS_CONTAINER_MPEGTS,
+		in_place,
 		&encryption_params);
 	if (rc != NGX_OK)
 	{
@@ -631,7 +751,8 @@ ngx_http_vod_hls_init_ts_frame_processor(
 		return ngx_http_vod_status_to_ngx_error(submodule_context->r, VOD_BAD_REQUEST);
 	}
 
-	reuse_output_buffers = encryption_params.type == HLS_ENC_AES_128;
+	// when the buffers are encrypted to new buffers, the muxer can reuse them
+	reuse_output_buffers = encryption_params.type == HLS_ENC_AES_128 && !in_place;
 #else
 	encryption_params.type = HLS_ENC_NONE;
 	reuse_output_buffers = FALSE;
@@ -643,6 +764,20 @@ ngx_http_vod_hls_init_ts_frame_processor(
 		return rc;
 	}
 
+	// the segment size calculation requires a pass over all the frames, try to get it from the cache
+	if (size_cache != NULL)
+	{
+		rc = ngx_http_vod_hls_init_segment_size_key(submodule_context, &muxer_conf, &encryption_params, size_key);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+
+		cached_size = ngx_http_vod_hls_fetch_segment_size(size_cache, size_key);
+	}
+
+	*response_size = cached_size;
+
 	rc = hls_muxer_init_segment(
 		&submodule_context->request_context,
 		&muxer_conf,
@@ -662,6 +797,11 @@ ngx_http_vod_hls_init_ts_frame_processor(
 		return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
 	}
 
+	if (size_cache != NULL && cached_size == 0 && *response_size != 0)
+	{
+		ngx_buffer_cache_store(size_cache, size_key, (u_char*)response_size, sizeof(*response_size));
+	}
+
 	if (encryption_params.type == HLS_ENC_AES_128 && 
 		*response_size != 0)
 	{
@@ -762,6 +902,7 @@ ngx_http_vod_hls_handle_mp4_init_segment(
 			NULL,
 			NULL,
 			NULL,
+			FALSE,
 			encryption_params.key,
 			encryption_params.iv);
 		if (rc != VOD_OK)
@@ -819,6 +960,7 @@ ngx_http_vod_hls_init_fmp4_frame_processor(
 		submodule_context,
 		segment_writer,
 		HLS_CONTAINER_FMP4,
+		FALSE,
 		&encryption_params);
 	if (rc != NGX_OK)
 	{
@@ -1023,6 +1165,16 @@ static const ngx_http_vod_request_t hls_index_request = {
 	NULL,
 };
 
+static const ngx_http_vod_request_t hls_delta_index_request = {
+	REQUEST_FLAG_SINGLE_TRACK_PER_MEDIA_TYPE | REQUEST_FLAG_TIME_DEPENDENT_ON_LIVE | REQUEST_FLAG_DELTA_UPDATE,
+	PARSE_BASIC_METADATA_ONLY,
+	REQUEST_CLASS_MANIFEST,
+	SUPPORTED_CODECS | VOD_CODEC_FLAG(WEBVTT),
+	HLS_TIMESCALE,
+	ngx_http_vod_hls_handle_delta_index_playlist,
+	NULL,
+};
+
 static const ngx_http_vod_request_t hls_iframes_request = {
 	REQUEST_FLAG_SINGLE_TRACK_PER_MEDIA_TYPE | REQUEST_FLAG_PARSE_ALL_CLIPS,
 	PARSE_FLAG_FRAMES_ALL_EXCEPT_OFFSETS | PARSE_FLAG_PARSED_EXTRA_DATA_SIZE,
@@ -1118,6 +1270,8 @@ ngx_http_vod_hls_create_loc_conf(
 	conf->encryption_method = NGX_CONF_UNSET_UINT;
 	conf->output_iv = NGX_CONF_UNSET;
 	conf->m3u8_config.output_iframes_playlist = NGX_CONF_UNSET;
+	conf->m3u8_config.delta_updates = NGX_CONF_UNSET;
+	conf->m3u8_config.blocking_reload = NGX_CONF_UNSET;
 	conf->m3u8_config.force_unmuxed_segments = NGX_CONF_UNSET;
 	conf->m3u8_config.container_format = NGX_CONF_UNSET_UINT;
 }
@@ -1134,6 +1288,8 @@ ngx_http_vod_hls_merge_loc_conf(
 	ngx_conf_merge_value(conf->absolute_iframe_urls, prev->absolute_iframe_urls, 0);
 	ngx_conf_merge_value(conf->output_iv, prev->output_iv, 0);
 	ngx_conf_merge_value(conf->m3u8_config.output_iframes_playlist, prev->m3u8_config.output_iframes_playlist, 1);
+	ngx_conf_merge_value(conf->m3u8_config.delta_updates, prev->m3u8_config.delta_updates, 0);
+	ngx_conf_merge_value(conf->m3u8_config.blocking_reload, prev->m3u8_config.blocking_reload, 0);
 
 	ngx_conf_merge_str_value(conf->master_file_name_prefix, prev->master_file_name_prefix, "master");
 	ngx_conf_merge_str_value(conf->m3u8_config.index_file_name_prefix, prev->m3u8_config.index_file_name_prefix, "index");
@@ -1211,6 +1367,7 @@ ngx_http_vod_hls_parse_uri_file_name(
 	const ngx_http_vod_request_t** request)
 {
 	uint32_t flags;
+	ngx_str_t value;
 	ngx_int_t rc;
 
 	// ts segment
@@ -1260,7 +1417,33 @@ ngx_http_vod_hls_parse_uri_file_name(
 		// make sure the file name begins with 'index' or 'iframes'
 		if (ngx_http_vod_starts_with(start_pos, end_pos, &conf->hls.m3u8_config.index_file_name_prefix))
 		{
-			*request = &hls_index_request;
+			if (conf->hls.m3u8_config.delta_updates &&
+				ngx_http_arg(r, (u_char *) "_HLS_skip", sizeof("_HLS_skip") - 1, &value) == NGX_OK &&
+				value.len == sizeof("YES") - 1 &&
+				ngx_strncmp(value.data, "YES", sizeof("YES") - 1) == 0)
+			{
+				*request = &hls_delta_index_request;
+			}
+			else
+			{
+				*request = &hls_index_request;
+			}
+
+			if (conf->hls.m3u8_config.blocking_reload &&
+				ngx_http_arg(r, (u_char *) "_HLS_msn", sizeof("_HLS_msn") - 1, &value) == NGX_OK)
+			{
+				rc = ngx_atoi(value.data, value.len);
+				if (rc == NGX_ERROR || rc > NGX_MAX_UINT32_VALUE)
+				{
+					ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+						"ngx_http_vod_hls_parse_uri_file_name: invalid media sequence \"%V\"", &value);
+					return ngx_http_vod_status_to_ngx_error(r, VOD_BAD_REQUEST);
+				}
+
+				// Note: media sequence numbers start from 1, so 0 is always available
+				request_params->media_sequence = rc;
+			}
+
 			start_pos += conf->hls.m3u8_config.index_file_name_prefix.len;
 			flags = 0;
 		}
@@ -27,6 +27,11 @@
 #include "vod/media_set_parser.h"
 #include "vod/manifest_utils.h"
 #include "vod/input/silence_generator.h"
+#include "vod/udrm.h"
+
+#if (NGX_HTTP_GZIP && NGX_HAVE_ZLIB)
+#include <zlib.h>
+#endif // NGX_HTTP_GZIP && NGX_HAVE_ZLIB
 
 #if (NGX_HAVE_LIB_AV_CODEC)
 #include "ngx_http_vod_thumb.h"
@@ -47,6 +52,13 @@
 // constants
 #define OPEN_FILE_FALLBACK_ENABLED (0x80000000)
 #define MAX_STALE_RETRIES (2)
+#define CACHE_HOLD_TOUCH_INTERVAL (2000)
+#define CACHE_LOCK_POLL_INTERVAL (50)
+#define UPDATE_WAIT_INTERVAL (500)
+#define UPDATE_WAIT_POLL_INTERVAL (50)
+#define UPDATE_WAIT_TIMEOUT_SEGMENTS (3)
+#define MAX_CACHE_LOCKS (4)
+#define INCOMPLETE_RETRY_AFTER "1"		// seconds
 
 enum {
 	// mapping state machine
@@ -56,6 +68,7 @@ enum {
 
 	// main state machine
 	STATE_READ_DRM_INFO,
+	STATE_FETCH_SEGMENT,
 	STATE_READ_METADATA_INITIAL,
 	STATE_READ_METADATA_OPEN_FILE,
 	STATE_READ_METADATA_READ,
@@ -85,6 +98,7 @@ typedef ngx_int_t(*ngx_http_vod_dump_part_t)(void* context, off_t start, off_t e
 typedef size_t(*ngx_http_vod_get_size_t)(void* context);
 typedef void(*ngx_http_vod_get_path_t)(void* context, ngx_str_t* path);
 typedef ngx_int_t(*ngx_http_vod_enable_directio_t)(void* context);
+typedef ngx_int_t(*ngx_http_vod_map_func_t)(void* context, ngx_buf_t *buf, size_t size, off_t offset, size_t padding);
 
 typedef ngx_int_t(*ngx_http_vod_dump_request_t)(void* context);
 typedef ngx_int_t(*ngx_http_vod_mapping_apply_t)(ngx_http_vod_ctx_t *ctx, ngx_str_t* mapping, int* cache_index);
@@ -97,7 +111,9 @@ typedef struct {
 
 typedef struct {
 	size_t content_type_len;
+	size_t gzip_response_len;		// the gzip response, if exists, follows the identity response
 	uint32_t media_set_type;
+	uint32_t last_media_sequence;		// the last media sequence of a blocking reload playlist, 0 if the playlist does not block
 } response_cache_header_t;
 
 typedef struct {
@@ -105,12 +121,35 @@ typedef struct {
 	ngx_chain_t* chain_head;
 	ngx_chain_t* chain_end;
 	size_t total_size;
+	size_t content_length;		// the length reported in the response header, 0 if the header was not sent
+
+	// segment cache
+	ngx_array_t* cache_parts;
+	size_t cache_size;
 } ngx_http_vod_write_segment_context_t;
 
+typedef struct {
+	ngx_buffer_cache_t* cache;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	uint32_t token;
+	ngx_event_t touch;
+} ngx_http_vod_cache_hold_t;
+
+typedef struct {
+	ngx_buffer_cache_t* cache;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+} ngx_http_vod_cache_lock_t;
+
+typedef struct {
+	request_params_t request_params;
+	media_set_t media_set;
+} ngx_http_vod_parsed_request_t;
+
 typedef struct {
 	ngx_http_request_t* r;
 	ngx_str_t cur_remote_suburi;
 	ngx_str_t upstream_location;
+	ngx_uint_t upstream_counter;
 } ngx_http_vod_http_reader_state_t;
 
 typedef struct {
@@ -137,6 +176,7 @@ struct ngx_http_vod_reader_s {
 	ngx_http_vod_get_path_t get_path;
 	ngx_http_vod_enable_directio_t enable_directio;
 	ngx_http_vod_async_read_func_t read;
+	ngx_http_vod_map_func_t map;
 };
 
 struct ngx_http_vod_ctx_s {
@@ -173,6 +213,7 @@ struct ngx_http_vod_ctx_s {
 	void* metadata_reader_context;
 	ngx_str_t* metadata_parts;
 	size_t metadata_part_count;
+	ngx_flag_t metadata_resumed;
 
 	// read frames state
 	media_base_metadata_t* base_metadata;
@@ -203,6 +244,32 @@ struct ngx_http_vod_ctx_s {
 	ngx_http_vod_write_segment_context_t write_segment_buffer_context;
 	media_notification_t* notification;
 	uint32_t frames_bytes_read;
+
+	// cache locks
+	ngx_http_vod_cache_lock_t cache_locks[MAX_CACHE_LOCKS];
+	ngx_uint_t cache_lock_count;
+	ngx_queue_t cache_lock_queue;		// in cache_lock_holders while cache_lock_count is not zero
+	ngx_event_t cache_lock_wait;
+	ngx_msec_t cache_lock_wait_start;
+	ngx_queue_t cache_lock_wait_queue;
+	u_char cache_lock_wait_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_flag_t cache_lock_waiting;
+
+	// stale cache entries
+	ngx_buffer_cache_t* stale_cache;		// holds an expired entry that is being refreshed
+	ngx_flag_t stale_fallback;
+	ngx_uint_t upstream_status;		// status returned by the upstream for the last mapping / drm info request
+
+	// blocking reload
+	ngx_event_t update_wait;
+	ngx_msec_t update_wait_start;
+	ngx_queue_t update_wait_queue;
+	u_char update_wait_key[BUFFER_CACHE_KEY_SIZE];		// the key of the media set mapping
+	ngx_buffer_cache_t** update_wait_caches;			// the caches that may hold the mapping
+	uint32_t update_wait_cache_count;
+	uint64_t update_wait_entry_id;			// the cache entry of the mapping when the wait started
+	ngx_flag_t update_wait_cached;
+	ngx_http_vod_parsed_request_t* parsed_request;		// set only for blocking reload requests, which may be restarted
 };
 
 // typedefs
@@ -214,6 +281,7 @@ typedef struct {
 
 // forward declarations
 static ngx_int_t ngx_http_vod_run_state_machine(ngx_http_vod_ctx_t *ctx);
+static ngx_int_t ngx_http_vod_update_wait_restart(ngx_http_vod_ctx_t *ctx);
 static ngx_int_t ngx_http_vod_send_notification(ngx_http_vod_ctx_t *ctx);
 static ngx_int_t ngx_http_vod_init_process(ngx_cycle_t *cycle);
 static void ngx_http_vod_exit_process();
@@ -247,6 +315,14 @@ ngx_module_t  ngx_http_vod_module = {
 static ngx_str_t options_content_type = ngx_string("text/plain");
 static ngx_str_t empty_file_string = ngx_string("empty");
 static ngx_str_t empty_string = ngx_null_string;
+static u_char delta_update_key_suffix[] = "/delta";
+
+// Note: the requests of the current process that wait for a media set update
+static ngx_queue_t update_waiters;
+
+// Note: the requests of the current process that hold / wait for cache locks
+static ngx_queue_t cache_lock_holders;
+static ngx_queue_t cache_lock_waiters;
 
 static media_format_t* media_formats[] = {
 	&mp4_format,
@@ -267,6 +343,11 @@ static ngx_http_vod_reader_t reader_file_with_fallback = {
 	ngx_file_reader_get_path,
 	(ngx_http_vod_enable_directio_t)ngx_file_reader_enable_directio,
 	(ngx_http_vod_async_read_func_t)ngx_async_file_read,
+#if !(NGX_WIN32)
+	(ngx_http_vod_map_func_t)ngx_file_reader_map,
+#else
+	NULL,
+#endif // !NGX_WIN32
 };
 
 static ngx_http_vod_reader_t reader_file = {
@@ -277,6 +358,11 @@ static ngx_http_vod_reader_t reader_file = {
 	ngx_file_reader_get_path,
 	(ngx_http_vod_enable_directio_t)ngx_file_reader_enable_directio,
 	(ngx_http_vod_async_read_func_t)ngx_async_file_read,
+#if !(NGX_WIN32)
+	(ngx_http_vod_map_func_t)ngx_file_reader_map,
+#else
+	NULL,
+#endif // !NGX_WIN32
 };
 
 static ngx_http_vod_reader_t reader_http = {
@@ -287,6 +373,7 @@ static ngx_http_vod_reader_t reader_http = {
 	ngx_http_vod_http_reader_get_path,
 	NULL,
 	(ngx_http_vod_async_read_func_t)ngx_http_vod_async_http_read,
+	NULL,
 };
 
 static const u_char wvm_file_magic[] = { 0x00, 0x00, 0x01, 0xba, 0x44, 0x00, 0x04, 0x00, 0x04, 0x01 };
@@ -936,14 +1023,22 @@ ngx_buffer_cache_store_gather_perf(
 	ngx_buffer_cache_t* cache,
 	u_char* key,
 	ngx_str_t* buffers,
-	size_t buffer_count)
+	size_t buffer_count,
+	ngx_flag_t replace)
 {
 	ngx_perf_counter_context(pcctx);
 	ngx_flag_t result;
 
 	ngx_perf_counter_start(pcctx);
 
-	result = ngx_buffer_cache_store_gather(cache, key, buffers, buffer_count);
+	if (replace)
+	{
+		result = ngx_buffer_cache_replace_gather(cache, key, buffers, buffer_count);
+	}
+	else
+	{
+		result = ngx_buffer_cache_store_gather(cache, key, buffers, buffer_count);
+	}
 
 	ngx_perf_counter_end(perf_counters, pcctx, PC_STORE_CACHE);
 
@@ -958,7 +1053,8 @@ ngx_buffer_cache_store_multipart_perf(
 	ngx_buffer_cache_t* cache,
 	u_char* key,
 	multipart_cache_header_t* header,
-	ngx_str_t* parts)
+	ngx_str_t* parts,
+	ngx_flag_t replace)
 {
 	ngx_str_t* buffers;
 	ngx_str_t* cur_part;
@@ -998,7 +1094,8 @@ ngx_buffer_cache_store_multipart_perf(
 		cache,
 		key,
 		buffers,
-		part_count + 1);
+		part_count + 1,
+		replace);
 }
 
 static ngx_flag_t
@@ -1183,230 +1280,959 @@ ngx_http_vod_finalize_request(ngx_http_vod_ctx_t *ctx, ngx_int_t rc)
 	ngx_http_finalize_request(ctx->submodule_context.r, rc);
 }
 
-static ngx_int_t
-ngx_http_vod_alloc_read_buffer(ngx_http_vod_ctx_t *ctx, size_t size, off_t alignment)
-{
-	u_char* start = ctx->read_buffer.start;
+////// Cache locks
 
-	size += VOD_BUFFER_PADDING_SIZE;		// for null termination / ffmpeg padding
+/*
+	wakes the requests of the current process that wait for the lock, the entry was either stored, 
+	or the request that held the lock completed without storing it
+*/
+static void
+ngx_http_vod_cache_lock_notify(u_char* key)
+{
+	ngx_http_vod_ctx_t *ctx;
+	ngx_queue_t *q;
+	ngx_queue_t *next;
 
-	if (start == NULL ||										// no buffer
-		start + size > ctx->read_buffer.end ||					// buffer too small
-		((intptr_t)start & (alignment - 1)) != 0)	// buffer not conforming to alignment
+	for (q = ngx_queue_head(&cache_lock_waiters);
+		q != ngx_queue_sentinel(&cache_lock_waiters);
+		q = next)
 	{
-		if (alignment > 1)
-		{
-			start = ngx_pmemalign(ctx->submodule_context.request_context.pool, size, alignment);
-		}
-		else
+		next = ngx_queue_next(q);
+
+		ctx = ngx_queue_data(q, ngx_http_vod_ctx_t, cache_lock_wait_queue);
+		if (ngx_memcmp(ctx->cache_lock_wait_key, key, BUFFER_CACHE_KEY_SIZE) != 0)
 		{
-			start = ngx_palloc(ctx->submodule_context.request_context.pool, size);
+			continue;
 		}
 
-		if (start == NULL)
+		ngx_queue_remove(q);
+		ctx->cache_lock_wait_queue.next = NULL;
+
+		if (ctx->cache_lock_wait.timer_set)
 		{
-			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_alloc_read_buffer: failed to allocate read buffer of size %uz", size);
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_ALLOC_FAILED);
+			ngx_del_timer(&ctx->cache_lock_wait);
 		}
 
-		ctx->read_buffer.start = start;
-		ctx->read_buffer.end = start + size;
-		ctx->read_buffer.temporary = 1;
+		ngx_post_event(&ctx->cache_lock_wait, &ngx_posted_events);
 	}
+}
 
-	ctx->read_buffer.pos = start;
-	ctx->read_buffer.last = start;
+static ngx_flag_t
+ngx_http_vod_cache_lock_held_locally(u_char* key)
+{
+	ngx_http_vod_cache_lock_t* cur_lock;
+	ngx_http_vod_cache_lock_t* locks_end;
+	ngx_http_vod_ctx_t *ctx;
+	ngx_queue_t *q;
 
-	return NGX_OK;
-}
+	for (q = ngx_queue_head(&cache_lock_holders);
+		q != ngx_queue_sentinel(&cache_lock_holders);
+		q = ngx_queue_next(q))
+	{
+		ctx = ngx_queue_data(q, ngx_http_vod_ctx_t, cache_lock_queue);
 
-////// DRM
+		locks_end = ctx->cache_locks + ctx->cache_lock_count;
+		for (cur_lock = ctx->cache_locks; cur_lock < locks_end; cur_lock++)
+		{
+			if (ngx_memcmp(cur_lock->key, key, BUFFER_CACHE_KEY_SIZE) == 0)
+			{
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
 
 static void
-ngx_http_vod_copy_drm_info(ngx_http_vod_ctx_t *ctx)
+ngx_http_vod_cache_lock_wait_stop(ngx_http_vod_ctx_t *ctx)
 {
-	media_sequence_t* ref_sequence = ctx->cur_sequence;
-	media_sequence_t* cur_sequence;
+	if (ctx->cache_lock_wait.timer_set)
+	{
+		ngx_del_timer(&ctx->cache_lock_wait);
+	}
 
-	for (cur_sequence = ref_sequence + 1;
-		cur_sequence < ctx->submodule_context.media_set.sequences_end;
-		cur_sequence++)
+	if (ctx->cache_lock_wait.posted)
 	{
-		cur_sequence->drm_info = ref_sequence->drm_info;
+		ngx_delete_posted_event(&ctx->cache_lock_wait);
+	}
+
+	if (ctx->cache_lock_wait_queue.next != NULL)
+	{
+		ngx_queue_remove(&ctx->cache_lock_wait_queue);
+		ctx->cache_lock_wait_queue.next = NULL;
 	}
 }
 
 static void
-ngx_http_vod_drm_info_request_finished(void* context, ngx_int_t rc, ngx_buf_t* response, ssize_t content_length)
+ngx_http_vod_cache_lock_cleanup(void *data)
 {
-	ngx_http_vod_loc_conf_t *conf;
-	ngx_http_vod_ctx_t *ctx;
-	ngx_http_request_t *r = context;
-	ngx_str_t drm_info;
+	ngx_http_vod_ctx_t *ctx = data;
+	ngx_http_vod_cache_lock_t* cur_lock;
+	ngx_http_vod_cache_lock_t* locks_end;
 
-	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
-	conf = ctx->submodule_context.conf;
+	ngx_http_vod_cache_lock_wait_stop(ctx);
 
-	if (rc != NGX_OK)
+	if (ctx->cache_lock_count <= 0)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_drm_info_request_finished: upstream request failed %i", rc);
-		goto finalize_request;
+		return;
 	}
 
-	if (response->last >= response->end)
+	ngx_queue_remove(&ctx->cache_lock_queue);
+
+	locks_end = ctx->cache_locks + ctx->cache_lock_count;
+	ctx->cache_lock_count = 0;
+
+	for (cur_lock = ctx->cache_locks; cur_lock < locks_end; cur_lock++)
 	{
-		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-			"ngx_http_vod_drm_info_request_finished: not enough room in buffer for null terminator");
-		rc = NGX_HTTP_BAD_GATEWAY;
-		goto finalize_request;
+		ngx_buffer_cache_unlock(cur_lock->cache, cur_lock->key);
+		ngx_http_vod_cache_lock_notify(cur_lock->key);
 	}
+}
 
-	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_GET_DRM_INFO);
-
-	drm_info.data = response->pos;
-	drm_info.len = content_length;
-	*response->last = '\0';
+static void
+ngx_http_vod_cache_lock_wait_handler(ngx_event_t *ev)
+{
+	ngx_http_vod_ctx_t *ctx = ev->data;
+	ngx_connection_t *c = ctx->submodule_context.r->connection;
+	ngx_int_t rc;
 
-	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
-		"ngx_http_vod_drm_info_request_finished: result %V", &drm_info);
+	ngx_http_vod_cache_lock_wait_stop(ctx);
 
-	// parse the drm info
-	rc = conf->submodule.parse_drm_info(&ctx->submodule_context, &drm_info, &ctx->cur_sequence->drm_info);
-	if (rc != NGX_OK)
+	rc = ctx->state_machine(ctx);
+	if (rc != NGX_AGAIN)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_drm_info_request_finished: invalid drm info response %V", &drm_info);
-		rc = NGX_HTTP_SERVICE_UNAVAILABLE;
-		goto finalize_request;
+		ngx_http_vod_finalize_request(ctx, rc);
 	}
 
-	// save to cache
-	if (conf->drm_info_cache != NULL)
+	ngx_http_run_posted_requests(c);
+}
+
+static ngx_int_t
+ngx_http_vod_cache_lock_init(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_pool_cleanup_t *cln;
+
+	if (ctx->cache_lock_wait.handler != NULL)
 	{
-		if (ngx_buffer_cache_store_perf(
-			ctx->perf_counters,
-			conf->drm_info_cache,
-			ctx->child_request_key,
-			drm_info.data,
-			drm_info.len))
-		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_drm_info_request_finished: stored in drm info cache");
-		}
-		else
-		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_drm_info_request_finished: failed to store drm info in cache");
-		}
+		return NGX_OK;
 	}
 
-	if (conf->drm_single_key)
+	// make sure the locks and the timer are released when the request completes
+	cln = ngx_pool_cleanup_add(r->pool, 0);
+	if (cln == NULL)
 	{
-		ngx_http_vod_copy_drm_info(ctx);
-		ctx->cur_sequence = ctx->submodule_context.media_set.sequences_end;
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_cache_lock_init: ngx_pool_cleanup_add failed");
+		return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
 	}
-	else
+
+	cln->handler = ngx_http_vod_cache_lock_cleanup;
+	cln->data = ctx;
+
+	ctx->cache_lock_wait.handler = ngx_http_vod_cache_lock_wait_handler;
+	ctx->cache_lock_wait.data = ctx;
+	ctx->cache_lock_wait.log = r->connection->log;
+	ctx->cache_lock_wait.cancelable = 1;
+
+	return NGX_OK;
+}
+
+static void
+ngx_http_vod_cache_lock_add(ngx_http_vod_ctx_t *ctx, ngx_buffer_cache_t* cache, u_char* key)
+{
+	ngx_http_vod_cache_lock_t* lock;
+
+	if (ctx->cache_lock_count <= 0)
 	{
-		ctx->cur_sequence++;
+		ngx_queue_insert_tail(&cache_lock_holders, &ctx->cache_lock_queue);
 	}
 
-	rc = ngx_http_vod_run_state_machine(ctx);
-	if (rc == NGX_AGAIN)
+	lock = &ctx->cache_locks[ctx->cache_lock_count++];
+	lock->cache = cache;
+	ngx_memcpy(lock->key, key, BUFFER_CACHE_KEY_SIZE);
+}
+
+/*
+	same as ngx_http_vod_cache_lock, except that it does not wait for the lock, 
+	returns NGX_DECLINED when the lock is held by another request
+*/
+static ngx_int_t
+ngx_http_vod_cache_try_lock(ngx_http_vod_ctx_t *ctx, ngx_buffer_cache_t* cache, u_char* key)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_int_t rc;
+
+	if (!conf->cache_lock || cache == NULL)
 	{
-		return;
+		return NGX_OK;
 	}
 
+	rc = ngx_http_vod_cache_lock_init(ctx);
 	if (rc != NGX_OK)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_drm_info_request_finished: ngx_http_vod_run_state_machine failed %i", rc);
+		return rc;
 	}
 
-finalize_request:
+	if (ctx->cache_lock_count >= MAX_CACHE_LOCKS)
+	{
+		return NGX_OK;
+	}
 
-	ngx_http_vod_finalize_request(ctx, rc);
+	if (!ngx_buffer_cache_lock(cache, key, (conf->cache_lock_timeout + 999) / 1000))
+	{
+		return NGX_DECLINED;
+	}
+
+	ngx_http_vod_cache_lock_add(ctx, cache, key);
+	return NGX_OK;
 }
 
+/*
+	called after a cache miss, returns NGX_OK when the caller should build the missing cache entry, 
+	and NGX_AGAIN when another request is already building it. in the latter case, ctx->state_machine 
+	is called again when the lock is released, and is expected to retry fetching from the cache.
+	a lock that is held by another process is polled, since its release cannot be signaled
+*/
 static ngx_int_t
-ngx_http_vod_state_machine_get_drm_info(ngx_http_vod_ctx_t *ctx)
+ngx_http_vod_cache_lock(ngx_http_vod_ctx_t *ctx, ngx_buffer_cache_t* cache, u_char* key)
 {
-	ngx_child_request_params_t child_params;
 	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
 	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_msec_t elapsed;
+	ngx_flag_t waited;
 	ngx_int_t rc;
-	ngx_str_t drm_info;
-	ngx_str_t base_uri;
-	ngx_md5_t md5;
-	uint32_t cache_token;
 
-	for (;
-		ctx->cur_sequence < ctx->submodule_context.media_set.sequences_end;
-		ctx->cur_sequence++)
+	if (!conf->cache_lock || cache == NULL)
 	{
-		// get the request uri
-		if (conf->drm_request_uri != NULL)
-		{
-			if (ngx_http_complex_value(
-				r,
-				conf->drm_request_uri,
-				&base_uri) != NGX_OK)
-			{
-				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-					"ngx_http_vod_state_machine_get_drm_info: ngx_http_complex_value failed");
-				return NGX_ERROR;
-			}
-		}
-		else
-		{
-			base_uri = ctx->cur_sequence->stripped_uri;
-		}
+		return NGX_OK;
+	}
 
-		if (conf->drm_info_cache != NULL)
-		{
-			// generate a request key
-			ngx_md5_init(&md5);
-			ngx_md5_update(&md5, conf->drm_upstream_location.data, conf->drm_upstream_location.len);
-			ngx_md5_update(&md5, base_uri.data, base_uri.len);
-			ngx_md5_final(ctx->child_request_key, &md5);
+	rc = ngx_http_vod_cache_lock_init(ctx);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
 
-			// try to read the drm info from cache
-			if (ngx_buffer_cache_fetch_perf(
-				ctx->perf_counters, 
-				conf->drm_info_cache, 
-				ctx->child_request_key,
-				&drm_info, 
-				&cache_token))
-			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-					"ngx_http_vod_state_machine_get_drm_info: drm info cache hit, size is %uz", drm_info.len);
+	if (ctx->cache_lock_count >= MAX_CACHE_LOCKS)
+	{
+		return NGX_OK;
+	}
 
-				rc = conf->submodule.parse_drm_info(&ctx->submodule_context, &drm_info, &ctx->cur_sequence->drm_info);
-				if (rc != NGX_OK)
-				{
-					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-						"ngx_http_vod_state_machine_get_drm_info: invalid drm info in cache %V", &drm_info);
-					return rc;
-				}
+	waited = ctx->cache_lock_waiting &&
+		ngx_memcmp(ctx->cache_lock_wait_key, key, BUFFER_CACHE_KEY_SIZE) == 0;
 
-				ngx_buffer_cache_release(
-					conf->drm_info_cache,
-					ctx->child_request_key, 
-					cache_token);
+	// Note: the lock expires after the lock timeout, in case the process holding it was killed
+	if (ngx_buffer_cache_lock(cache, key, (conf->cache_lock_timeout + 999) / 1000))
+	{
+		ctx->cache_lock_waiting = 0;
 
-				if (conf->drm_single_key)
-				{
-					ngx_http_vod_copy_drm_info(ctx);
-					ctx->cur_sequence = ctx->submodule_context.media_set.sequences_end - 1;
-				}
+		if (waited)
+		{
+			// the request that held the lock completed without storing the entry (e.g. non-cacheable),
+			// continue without the lock in order to avoid serializing all the waiting requests
+			ngx_buffer_cache_unlock(cache, key);
+			return NGX_OK;
+		}
 
-				continue;
-			}
-			else
+		ngx_http_vod_cache_lock_add(ctx, cache, key);
+		return NGX_OK;
+	}
+
+	if (!waited)
+	{
+		ctx->cache_lock_waiting = 1;
+		ctx->cache_lock_wait_start = ngx_current_msec;
+		ngx_memcpy(ctx->cache_lock_wait_key, key, BUFFER_CACHE_KEY_SIZE);
+	}
+
+	elapsed = ngx_current_msec - ctx->cache_lock_wait_start;
+	if (elapsed >= conf->cache_lock_timeout)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_cache_lock: lock wait timed out");
+		ctx->cache_lock_waiting = 0;
+		return NGX_OK;
+	}
+
+	ngx_queue_insert_tail(&cache_lock_waiters, &ctx->cache_lock_wait_queue);
+
+	if (ngx_http_vod_cache_lock_held_locally(key))
+	{
+		// woken by ngx_http_vod_cache_lock_notify, the timer only enforces the lock timeout
+		ngx_add_timer(&ctx->cache_lock_wait, conf->cache_lock_timeout - elapsed);
+	}
+	else
+	{
+		ngx_add_timer(&ctx->cache_lock_wait, CACHE_LOCK_POLL_INTERVAL);
+	}
+
+	return NGX_AGAIN;
+}
+
+static void
+ngx_http_vod_cache_unlock(ngx_http_vod_ctx_t *ctx, u_char* key)
+{
+	ngx_http_vod_cache_lock_t* cur_lock;
+	ngx_http_vod_cache_lock_t* last_lock;
+
+	if (ctx->cache_lock_count <= 0)
+	{
+		return;
+	}
+
+	last_lock = ctx->cache_locks + ctx->cache_lock_count - 1;
+	for (cur_lock = ctx->cache_locks; cur_lock <= last_lock; cur_lock++)
+	{
+		if (ngx_memcmp(cur_lock->key, key, BUFFER_CACHE_KEY_SIZE) != 0)
+		{
+			continue;
+		}
+
+		ngx_buffer_cache_unlock(cur_lock->cache, cur_lock->key);
+
+		*cur_lock = *last_lock;
+		ctx->cache_lock_count--;
+		if (ctx->cache_lock_count <= 0)
+		{
+			ngx_queue_remove(&ctx->cache_lock_queue);
+		}
+
+		ngx_http_vod_cache_lock_notify(key);
+		break;
+	}
+}
+
+////// Blocking reload
+
+static void
+ngx_http_vod_update_wait_cleanup(void *data)
+{
+	ngx_http_vod_ctx_t *ctx = data;
+
+	if (ctx->update_wait.timer_set)
+	{
+		ngx_del_timer(&ctx->update_wait);
+	}
+
+	if (ctx->update_wait.posted)
+	{
+		ngx_delete_posted_event(&ctx->update_wait);
+	}
+
+	if (ctx->update_wait_queue.next != NULL)
+	{
+		ngx_queue_remove(&ctx->update_wait_queue);
+		ctx->update_wait_queue.next = NULL;
+	}
+}
+
+static ngx_flag_t
+ngx_http_vod_update_wait_get_entry_id(ngx_http_vod_ctx_t *ctx, uint64_t* id)
+{
+	uint32_t cache_index;
+
+	for (cache_index = 0; cache_index < ctx->update_wait_cache_count; cache_index++)
+	{
+		if (ctx->update_wait_caches[cache_index] != NULL &&
+			ngx_buffer_cache_get_entry_id(ctx->update_wait_caches[cache_index], ctx->update_wait_key, id))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+	called when the wait timer expires, returns 1 when the cached mapping did not change, 
+	in this case the request keeps waiting without being restarted
+*/
+static ngx_flag_t
+ngx_http_vod_update_wait_poll(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	uint64_t id;
+
+	if (!ctx->update_wait_cached ||
+		ngx_current_msec - ctx->update_wait_start >= 
+			UPDATE_WAIT_TIMEOUT_SEGMENTS * conf->segmenter.segment_duration ||
+		!ngx_http_vod_update_wait_get_entry_id(ctx, &id) ||
+		id != ctx->update_wait_entry_id)
+	{
+		return 0;
+	}
+
+	ngx_queue_insert_tail(&update_waiters, &ctx->update_wait_queue);
+
+	ngx_add_timer(&ctx->update_wait, UPDATE_WAIT_POLL_INTERVAL);
+
+	return 1;
+}
+
+static void
+ngx_http_vod_update_wait_handler(ngx_event_t *ev)
+{
+	ngx_http_vod_ctx_t *ctx = ev->data;
+	ngx_connection_t *c = ctx->submodule_context.r->connection;
+	ngx_int_t rc;
+
+	ngx_http_vod_update_wait_cleanup(ctx);
+
+	if (ev->timedout)
+	{
+		ev->timedout = 0;
+
+		if (ngx_http_vod_update_wait_poll(ctx))
+		{
+			return;
+		}
+	}
+
+	rc = ngx_http_vod_update_wait_restart(ctx);
+	if (rc != NGX_AGAIN)
+	{
+		ngx_http_vod_finalize_request(ctx, rc);
+	}
+
+	ngx_http_run_posted_requests(c);
+}
+
+/*
+	called when a media set mapping is fetched, wakes the requests that wait for an update of this mapping.
+	requests waiting in other processes are not notified, they poll the mapping cache
+*/
+static void
+ngx_http_vod_update_notify(u_char* key)
+{
+	ngx_http_vod_ctx_t *ctx;
+	ngx_queue_t *q;
+	ngx_queue_t *next;
+
+	for (q = ngx_queue_head(&update_waiters);
+		q != ngx_queue_sentinel(&update_waiters);
+		q = next)
+	{
+		next = ngx_queue_next(q);
+
+		ctx = ngx_queue_data(q, ngx_http_vod_ctx_t, update_wait_queue);
+		if (ngx_memcmp(ctx->update_wait_key, key, BUFFER_CACHE_KEY_SIZE) != 0)
+		{
+			continue;
+		}
+
+		ngx_queue_remove(q);
+		ctx->update_wait_queue.next = NULL;
+
+		if (ctx->update_wait.timer_set)
+		{
+			ngx_del_timer(&ctx->update_wait);
+		}
+
+		ngx_post_event(&ctx->update_wait, &ngx_posted_events);
+	}
+}
+
+/*
+	called when the requested media sequence is not available yet, the request waits until the media set
+	mapping is updated, and is then restarted. a request of this process that fetches the mapping wakes 
+	the request, an update by another process is detected by polling the entry of the mapping in the cache.
+	the wait ends with an error if the media sequence does not become available in time
+*/
+static ngx_int_t
+ngx_http_vod_wait_for_update(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_pool_cleanup_t *cln;
+
+	if (ngx_current_msec - ctx->update_wait_start >= 
+		UPDATE_WAIT_TIMEOUT_SEGMENTS * conf->segmenter.segment_duration)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_wait_for_update: media sequence %uD did not become available in time",
+			ctx->submodule_context.request_params.media_sequence);
+		return NGX_HTTP_SERVICE_UNAVAILABLE;
+	}
+
+	// Note: the context is reused when the request is restarted, the cleanup is added only once
+	if (ctx->update_wait.handler == NULL)
+	{
+		cln = ngx_pool_cleanup_add(r->pool, 0);
+		if (cln == NULL)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_wait_for_update: ngx_pool_cleanup_add failed");
+			return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+		}
+
+		cln->handler = ngx_http_vod_update_wait_cleanup;
+		cln->data = ctx;
+
+		ctx->update_wait.handler = ngx_http_vod_update_wait_handler;
+		ctx->update_wait.data = ctx;
+		ctx->update_wait.log = r->connection->log;
+		ctx->update_wait.cancelable = 1;
+	}
+
+	// don't block other requests while waiting
+	ngx_http_vod_cache_lock_cleanup(ctx);
+
+	ngx_queue_insert_tail(&update_waiters, &ctx->update_wait_queue);
+
+	// Note: when the mapping is not cached, an update can be detected only by restarting the request
+	ctx->update_wait_cached = ngx_http_vod_update_wait_get_entry_id(ctx, &ctx->update_wait_entry_id);
+
+	ngx_add_timer(&ctx->update_wait, ctx->update_wait_cached ? UPDATE_WAIT_POLL_INTERVAL : UPDATE_WAIT_INTERVAL);
+
+	return NGX_AGAIN;
+}
+
+static ngx_buffer_cache_t*
+ngx_http_vod_get_error_cache(ngx_buffer_cache_t** caches, uint32_t cache_count)
+{
+	uint32_t cache_index;
+
+	// Note: errors are stored in the first configured cache, so that the error expiration does not 
+	//		depend on the key
+	for (cache_index = 0; cache_index < cache_count; cache_index++)
+	{
+		if (caches[cache_index] != NULL)
+		{
+			return caches[cache_index];
+		}
+	}
+
+	return NULL;
+}
+
+static ngx_buffer_cache_t*
+ngx_http_vod_get_lock_cache(ngx_buffer_cache_t** caches, uint32_t cache_count, u_char* key)
+{
+	ngx_buffer_cache_t* configured[CACHE_TYPE_COUNT];
+	uint32_t configured_count = 0;
+	uint32_t cache_index;
+
+	for (cache_index = 0; cache_index < cache_count && configured_count < CACHE_TYPE_COUNT; cache_index++)
+	{
+		if (caches[cache_index] != NULL)
+		{
+			configured[configured_count++] = caches[cache_index];
+		}
+	}
+
+	if (configured_count <= 0)
+	{
+		return NULL;
+	}
+
+	// Note: the cache that will eventually hold the entry is unknown in advance, the locks are spread 
+	//		across the configured caches according to the key, which is an md5 hash
+	return configured[key[0] % configured_count];
+}
+
+static ngx_int_t
+ngx_http_vod_alloc_read_buffer(ngx_http_vod_ctx_t *ctx, size_t size, off_t alignment)
+{
+	u_char* start = ctx->read_buffer.start;
+
+	size += VOD_BUFFER_PADDING_SIZE;		// for null termination / ffmpeg padding
+
+	if (start == NULL ||										// no buffer
+		start + size > ctx->read_buffer.end ||					// buffer too small
+		((intptr_t)start & (alignment - 1)) != 0)	// buffer not conforming to alignment
+	{
+		if (alignment > 1)
+		{
+			start = ngx_pmemalign(ctx->submodule_context.request_context.pool, size, alignment);
+		}
+		else
+		{
+			start = ngx_palloc(ctx->submodule_context.request_context.pool, size);
+		}
+
+		if (start == NULL)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_alloc_read_buffer: failed to allocate read buffer of size %uz", size);
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_ALLOC_FAILED);
+		}
+
+		ctx->read_buffer.start = start;
+		ctx->read_buffer.end = start + size;
+		ctx->read_buffer.temporary = 1;
+	}
+
+	ctx->read_buffer.pos = start;
+	ctx->read_buffer.last = start;
+
+	return NGX_OK;
+}
+
+////// Stale cache entries
+
+/*
+	called after a cache miss, checks for a cached upstream error and for a stale copy of the entry.
+	returns NGX_OK when the stale copy should be used, NGX_DECLINED when the entry should be fetched
+	from upstream, or the status of the cached error. when a stale copy exists and this request
+	got the lock to refresh it, ctx->stale_cache is set, so that the stale copy can be used if the
+	refresh fails. the other requests use the stale copy while the entry is refreshed
+*/
+static ngx_int_t
+ngx_http_vod_cache_fetch_stale(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_buffer_cache_t** caches,
+	uint32_t cache_count,
+	u_char* key,
+	ngx_str_t* buffer,
+	uint32_t* token,
+	int* cache_index)
+{
+	ngx_buffer_cache_t* error_cache;
+	ngx_buffer_cache_t* lock_cache;
+	ngx_flag_t fallback;
+	ngx_int_t error;
+	ngx_int_t rc;
+	uint32_t i;
+
+	fallback = ctx->stale_fallback;
+	ctx->stale_fallback = 0;
+	ctx->stale_cache = NULL;
+
+	error_cache = ngx_http_vod_get_error_cache(caches, cache_count);
+	if (error_cache == NULL)
+	{
+		return NGX_DECLINED;
+	}
+
+	lock_cache = ngx_http_vod_get_lock_cache(caches, cache_count, key);
+
+	if (ngx_buffer_cache_fetch_error(error_cache, key, &error))
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_cache_fetch_stale: cached upstream error %i", error);
+		fallback = 1;
+	}
+	else
+	{
+		error = NGX_DECLINED;
+	}
+
+	for (i = 0; i < cache_count; i++)
+	{
+		if (caches[i] != NULL && 
+			ngx_buffer_cache_fetch_stale(caches[i], key, buffer, token))
+		{
+			break;
+		}
+	}
+
+	if (i >= cache_count)
+	{
+		return error;
+	}
+
+	if (!fallback)
+	{
+		// let a single request refresh the entry
+		rc = ngx_http_vod_cache_try_lock(ctx, lock_cache, key);
+		if (rc != NGX_DECLINED)
+		{
+			ngx_buffer_cache_release(caches[i], key, *token);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+
+			ctx->stale_cache = caches[i];
+			return NGX_DECLINED;
+		}
+	}
+
+	ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+		"ngx_http_vod_cache_fetch_stale: using stale entry");
+
+	*cache_index = i;
+	return NGX_OK;
+}
+
+/*
+	called when fetching an entry from upstream fails, caches the error and returns NGX_OK 
+	when the stale copy of the entry should be used instead.
+	only errors that were returned by the upstream are cached, failures to reach the upstream
+	(e.g. connect timeouts) are not, since they are usually transient
+*/
+static ngx_int_t
+ngx_http_vod_cache_upstream_error(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_buffer_cache_t** caches,
+	uint32_t cache_count,
+	u_char* key,
+	ngx_int_t rc)
+{
+	ngx_buffer_cache_t* cache;
+	ngx_flag_t cacheable;
+
+	if (ctx->upstream_status != 0)
+	{
+		cacheable = ctx->upstream_status == NGX_HTTP_NOT_FOUND ||
+			ctx->upstream_status >= NGX_HTTP_INTERNAL_SERVER_ERROR;
+	}
+	else
+	{
+		// no response was received - either a local file, or an upstream that could not be reached
+		cacheable = rc == NGX_HTTP_NOT_FOUND;
+	}
+
+	cache = ngx_http_vod_get_error_cache(caches, cache_count);
+	if (cache != NULL && 
+		cacheable &&
+		ngx_buffer_cache_store_error(cache, key, rc))
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_cache_upstream_error: stored error %i in cache", rc);
+	}
+
+	ngx_http_vod_cache_unlock(ctx, key);
+
+	if (ctx->stale_cache == NULL)
+	{
+		return NGX_DECLINED;
+	}
+
+	ngx_log_error(NGX_LOG_WARN, ctx->submodule_context.request_context.log, 0,
+		"ngx_http_vod_cache_upstream_error: upstream request failed %i, using stale entry", rc);
+
+	ctx->stale_cache = NULL;
+	ctx->stale_fallback = 1;
+	return NGX_OK;
+}
+
+////// DRM
+
+static void
+ngx_http_vod_copy_drm_info(ngx_http_vod_ctx_t *ctx)
+{
+	media_sequence_t* ref_sequence = ctx->cur_sequence;
+	media_sequence_t* cur_sequence;
+
+	for (cur_sequence = ref_sequence + 1;
+		cur_sequence < ctx->submodule_context.media_set.sequences_end;
+		cur_sequence++)
+	{
+		cur_sequence->drm_info = ref_sequence->drm_info;
+	}
+}
+
+static void
+ngx_http_vod_drm_info_request_finished(void* context, ngx_int_t rc, ngx_buf_t* response, ssize_t content_length)
+{
+	ngx_http_vod_loc_conf_t *conf;
+	ngx_http_vod_ctx_t *ctx;
+	ngx_http_request_t *r = context;
+	ngx_str_t drm_info;
+
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+	conf = ctx->submodule_context.conf;
+
+	if (rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_drm_info_request_finished: upstream request failed %i", rc);
+		goto upstream_error;
+	}
+
+	if (response->last >= response->end)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_drm_info_request_finished: not enough room in buffer for null terminator");
+		rc = NGX_HTTP_BAD_GATEWAY;
+		goto finalize_request;
+	}
+
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_GET_DRM_INFO);
+
+	drm_info.data = response->pos;
+	drm_info.len = content_length;
+	*response->last = '\0';
+
+	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
+		"ngx_http_vod_drm_info_request_finished: result %V", &drm_info);
+
+	// parse the drm info
+	rc = conf->submodule.parse_drm_info(&ctx->submodule_context, &drm_info, &ctx->cur_sequence->drm_info);
+	if (rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_drm_info_request_finished: invalid drm info response %V", &drm_info);
+		rc = NGX_HTTP_SERVICE_UNAVAILABLE;
+		goto upstream_error;
+	}
+
+	// save to cache
+	if (conf->drm_info_cache != NULL)
+	{
+		if (ngx_buffer_cache_store_perf(
+			ctx->perf_counters,
+			conf->drm_info_cache,
+			ctx->child_request_key,
+			drm_info.data,
+			drm_info.len))
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_drm_info_request_finished: stored in drm info cache");
+		}
+		else
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_drm_info_request_finished: failed to store drm info in cache");
+		}
+
+		ngx_http_vod_cache_unlock(ctx, ctx->child_request_key);
+		ctx->stale_cache = NULL;
+	}
+
+	if (conf->drm_single_key)
+	{
+		ngx_http_vod_copy_drm_info(ctx);
+		ctx->cur_sequence = ctx->submodule_context.media_set.sequences_end;
+	}
+	else
+	{
+		ctx->cur_sequence++;
+	}
+
+run_state_machine:
+
+	rc = ngx_http_vod_run_state_machine(ctx);
+	if (rc == NGX_AGAIN)
+	{
+		return;
+	}
+
+	if (rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_drm_info_request_finished: ngx_http_vod_run_state_machine failed %i", rc);
+	}
+
+finalize_request:
+
+	ngx_http_vod_finalize_request(ctx, rc);
+	return;
+
+upstream_error:
+
+	// Note: when a stale copy of the drm info exists, the state machine will use it
+	if (conf->drm_info_cache != NULL &&
+		ngx_http_vod_cache_upstream_error(ctx, &conf->drm_info_cache, 1, ctx->child_request_key, rc) == NGX_OK)
+	{
+		goto run_state_machine;
+	}
+
+	ngx_http_vod_finalize_request(ctx, rc);
+}
+
+static ngx_int_t
+ngx_http_vod_state_machine_get_drm_info(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_child_request_params_t child_params;
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_int_t rc;
+	ngx_str_t drm_info;
+	ngx_str_t base_uri;
+	ngx_md5_t md5;
+	ngx_flag_t found;
+	uint32_t cache_token;
+	int cache_index;
+
+	for (;
+		ctx->cur_sequence < ctx->submodule_context.media_set.sequences_end;
+		ctx->cur_sequence++)
+	{
+		// get the request uri
+		if (conf->drm_request_uri != NULL)
+		{
+			if (ngx_http_complex_value(
+				r,
+				conf->drm_request_uri,
+				&base_uri) != NGX_OK)
+			{
+				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+					"ngx_http_vod_state_machine_get_drm_info: ngx_http_complex_value failed");
+				return NGX_ERROR;
+			}
+		}
+		else
+		{
+			base_uri = ctx->cur_sequence->stripped_uri;
+		}
+
+		if (conf->drm_info_cache != NULL)
+		{
+			// generate a request key
+			ngx_md5_init(&md5);
+			ngx_md5_update(&md5, conf->drm_upstream_location.data, conf->drm_upstream_location.len);
+			ngx_md5_update(&md5, base_uri.data, base_uri.len);
+			ngx_md5_final(ctx->child_request_key, &md5);
+
+			// try to read the drm info from cache
+			found = ngx_buffer_cache_fetch_perf(
+				ctx->perf_counters, 
+				conf->drm_info_cache, 
+				ctx->child_request_key,
+				&drm_info, 
+				&cache_token);
+			if (!found)
 			{
 				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
 					"ngx_http_vod_state_machine_get_drm_info: drm info cache miss");
+
+				rc = ngx_http_vod_cache_fetch_stale(
+					ctx,
+					&conf->drm_info_cache,
+					1,
+					ctx->child_request_key,
+					&drm_info,
+					&cache_token,
+					&cache_index);
+				if (rc == NGX_OK)
+				{
+					found = 1;
+				}
+				else if (rc != NGX_DECLINED)
+				{
+					return rc;
+				}
+			}
+
+			if (found)
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+					"ngx_http_vod_state_machine_get_drm_info: drm info cache hit, size is %uz", drm_info.len);
+
+				rc = conf->submodule.parse_drm_info(&ctx->submodule_context, &drm_info, &ctx->cur_sequence->drm_info);
+				if (rc != NGX_OK)
+				{
+					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_get_drm_info: invalid drm info in cache %V", &drm_info);
+					return rc;
+				}
+
+				ngx_buffer_cache_release(
+					conf->drm_info_cache,
+					ctx->child_request_key, 
+					cache_token);
+
+				if (conf->drm_single_key)
+				{
+					ngx_http_vod_copy_drm_info(ctx);
+					ctx->cur_sequence = ctx->submodule_context.media_set.sequences_end - 1;
+				}
+
+				continue;
 			}
 		}
 
@@ -1422,6 +2248,8 @@ ngx_http_vod_state_machine_get_drm_info(ngx_http_vod_ctx_t *ctx)
 		ngx_memzero(&child_params, sizeof(child_params));
 		child_params.method = NGX_HTTP_GET;
 		child_params.base_uri = base_uri;
+		child_params.upstream_counter = ngx_perf_counter_get_upstream(ctx->perf_counters, PU_DRM_UPSTREAM);
+		child_params.upstream_status = &ctx->upstream_status;
 
 		ngx_perf_counter_start(ctx->perf_counter_context);
 
@@ -1828,6 +2656,11 @@ ngx_http_vod_parse_metadata(
 	case VOD_AGAIN:
 		return NGX_AGAIN;
 
+	case VOD_INCOMPLETE:
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
+			"ngx_http_vod_parse_metadata: read_frames(%V) returned incomplete", &ctx->format->name);
+		return NGX_DECLINED;
+
 	default:
 		ngx_log_debug2(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
 			"ngx_http_vod_parse_metadata: read_frames(%V) failed %i", &ctx->format->name, rc);
@@ -1873,6 +2706,7 @@ ngx_http_vod_identify_format(ngx_http_vod_ctx_t* ctx, ngx_str_t* buffer)
 			&ctx->submodule_context.request_context,
 			buffer,
 			ctx->submodule_context.conf->max_metadata_size,
+			ctx->submodule_context.conf->metadata_cache != NULL ? MEDIA_READER_FLAG_CACHED : 0,
 			&ctx->metadata_reader_context);
 		if (rc == VOD_NOT_FOUND)
 		{
@@ -2338,6 +3172,64 @@ ngx_http_vod_open_file(ngx_http_vod_ctx_t* ctx, media_clip_source_t* source)
 	return source->reader->open(ctx->submodule_context.r, &source->mapped_uri, 0, &source->reader_context);
 }
 
+static ngx_int_t
+ngx_http_vod_resume_metadata(ngx_http_vod_ctx_t* ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_int_t rc;
+
+	if (ctx->format->resume_metadata_reader == NULL)
+	{
+		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_resume_metadata: resuming the metadata is not supported for %V", &ctx->format->name);
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_UNEXPECTED);
+	}
+
+	// let a single request continue reading the metadata, the others fetch it from the cache once it is stored
+	rc = ngx_http_vod_cache_lock(ctx, conf->metadata_cache, ctx->cur_source->file_key);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	rc = ctx->format->resume_metadata_reader(
+		&ctx->submodule_context.request_context,
+		ctx->metadata_parts,
+		ctx->metadata_part_count,
+		conf->max_metadata_size,
+		&ctx->metadata_reader_context);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_resume_metadata: resume_metadata_reader(%V) failed %i", &ctx->format->name, rc);
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+	}
+
+	ctx->metadata_resumed = 1;
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_retry_later(ngx_http_request_t* r)
+{
+	ngx_table_elt_t* h;
+
+	h = ngx_list_push(&r->headers_out.headers);
+	if (h == NULL)
+	{
+		return NGX_HTTP_INTERNAL_SERVER_ERROR;
+	}
+
+	h->hash = 1;
+#if (nginx_version >= 1023000)
+	h->next = NULL;
+#endif
+	ngx_str_set(&h->key, "Retry-After");
+	ngx_str_set(&h->value, INCOMPLETE_RETRY_AFTER);
+
+	return ngx_http_vod_status_to_ngx_error(r, VOD_INCOMPLETE);
+}
+
 static ngx_int_t
 ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 {
@@ -2379,6 +3271,7 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 				ctx->metadata_parts[0].len = 0;
 				ctx->metadata_parts[0].data = (void*)(ctx->metadata_parts + 1);
 				ctx->metadata_parts[0].data[0] = '\0';
+				ctx->metadata_part_count = 1;
 				multipart_header.type = FORMAT_ID_WEBVTT;
 				metadata_loaded = TRUE;
 			}
@@ -2395,12 +3288,19 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 				{
 					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
 						"ngx_http_vod_state_machine_parse_metadata: metadata cache hit");
+					ctx->metadata_part_count = multipart_header.part_count;
 					metadata_loaded = TRUE;
 				}
 				else
 				{
 					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
 						"ngx_http_vod_state_machine_parse_metadata: metadata cache miss");
+
+					rc = ngx_http_vod_cache_lock(ctx, conf->metadata_cache, cur_source->file_key);
+					if (rc != NGX_OK)
+					{
+						return rc;
+					}
 				}
 			}
 
@@ -2414,34 +3314,57 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 				}
 
 				rc = ngx_http_vod_parse_metadata(ctx, 1);
-
-				if (cache_token && 
-					ctx->request != NULL)		// in case of progressive, the metadata parts are used in clipper_build_header
+				if (rc == NGX_DECLINED)
 				{
-					ngx_buffer_cache_release(
-						conf->metadata_cache,
-						cur_source->file_key,
-						cache_token);
-				}
+					// the metadata does not cover the request (e.g. a partial mkv cluster index),
+					// continue reading it from the file
+					rc = ngx_http_vod_resume_metadata(ctx);
 
-				if (rc == NGX_OK)
-				{
-					ctx->cur_source = cur_source->next;
-					if (ctx->cur_source == NULL)
+					if (cache_token)
 					{
-						return NGX_OK;
+						ngx_buffer_cache_release(
+							conf->metadata_cache,
+							cur_source->file_key,
+							cache_token);
 					}
-					break;
-				}
 
-				if (rc != NGX_AGAIN)
-				{
-					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_parse_metadata failed %i", rc);
-					return rc;
+					if (rc != NGX_OK)
+					{
+						return rc;
+					}
+
+					ctx->state = STATE_READ_METADATA_OPEN_FILE;
 				}
+				else
+				{
+					if (cache_token && 
+						ctx->request != NULL)		// in case of progressive, the metadata parts are used in clipper_build_header
+					{
+						ngx_buffer_cache_release(
+							conf->metadata_cache,
+							cur_source->file_key,
+							cache_token);
+					}
+
+					if (rc == NGX_OK)
+					{
+						ctx->cur_source = cur_source->next;
+						if (ctx->cur_source == NULL)
+						{
+							return NGX_OK;
+						}
+						break;
+					}
+
+					if (rc != NGX_AGAIN)
+					{
+						ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+							"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_parse_metadata failed %i", rc);
+						return rc;
+					}
 
-				ctx->state = STATE_READ_FRAMES_OPEN_FILE;
+					ctx->state = STATE_READ_FRAMES_OPEN_FILE;
+				}
 			}
 			else
 			{
@@ -2474,7 +3397,10 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 			// read the file header
 			r->connection->log->action = "reading media header";
 			ctx->state = STATE_READ_METADATA_READ;
-			ctx->metadata_reader_context = NULL;
+			if (!ctx->metadata_resumed)
+			{
+				ctx->metadata_reader_context = NULL;
+			}
 
 			ctx->read_offset = 0;
 			ctx->read_size = conf->initial_read_size;
@@ -2513,7 +3439,7 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 
 			// parse the metadata
 			rc = ngx_http_vod_parse_metadata(ctx, 0);
-			if (rc != NGX_OK && rc != NGX_AGAIN)
+			if (rc != NGX_OK && rc != NGX_AGAIN && rc != NGX_DECLINED)
 			{
 				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
 					"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_parse_metadata failed %i", rc);
@@ -2533,7 +3459,8 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 					conf->metadata_cache,
 					cur_source->file_key,
 					&multipart_header,
-					ctx->metadata_parts))
+					ctx->metadata_parts,
+					ctx->metadata_resumed))		// the resumed metadata replaces the partial metadata
 				{
 					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
 						"ngx_http_vod_state_machine_parse_metadata: stored metadata in cache");
@@ -2543,8 +3470,12 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
 						"ngx_http_vod_state_machine_parse_metadata: failed to store metadata in cache");
 				}
+
+				ngx_http_vod_cache_unlock(ctx, cur_source->file_key);
 			}
 
+			ctx->metadata_resumed = 0;
+
 			if (ctx->request != NULL)
 			{
 				// no longer need the metadata buffer
@@ -2552,6 +3483,12 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 				ctx->read_buffer.start = NULL;
 			}
 
+			if (rc == NGX_DECLINED)
+			{
+				// the metadata that was read so far was saved, the request is retried after more of it is read
+				return ngx_http_vod_retry_later(r);
+			}
+
 			if (rc == NGX_OK)
 			{
 				// move to the next source
@@ -2802,68 +3739,294 @@ ngx_http_vod_update_track_timescale(
 	if (track->media_info.full_duration == 0)
 	{
 		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-			"ngx_http_vod_update_track_timescale: full duration is zero following rescale");
-		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
+			"ngx_http_vod_update_track_timescale: full duration is zero following rescale");
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
+	}
+
+	if (track->media_info.media_type == MEDIA_TYPE_VIDEO)
+	{
+		if (track->media_info.min_frame_duration != 0)
+		{
+			track->media_info.min_frame_duration =
+				rescale_time(track->media_info.min_frame_duration, cur_timescale, new_timescale);
+			if (track->media_info.min_frame_duration == 0)
+			{
+				ngx_log_error(NGX_LOG_WARN, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_update_track_timescale: min frame duration is zero following rescale");
+				track->media_info.min_frame_duration = 1;
+			}
+		}
+
+		track->media_info.u.video.initial_pts_delay =
+			rescale_time(track->media_info.u.video.initial_pts_delay, cur_timescale, new_timescale);
+	}
+
+	track->media_info.timescale = new_timescale;
+	track->media_info.frames_timescale = new_timescale;
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_update_timescale(ngx_http_vod_ctx_t *ctx)
+{
+	media_set_t* media_set = &ctx->submodule_context.media_set;
+	media_track_t* track;
+	ngx_int_t rc;
+
+	for (track = media_set->filtered_tracks; track < media_set->filtered_tracks_end; track++)
+	{
+		rc = ngx_http_vod_update_track_timescale(
+			ctx, 
+			track, 
+			ctx->request->timescale, 
+			ctx->submodule_context.request_params.pts_delay);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+	}
+
+	return NGX_OK;
+}
+
+////// Metadata request handling
+
+static void
+ngx_http_vod_store_metadata_response(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_buffer_cache_t* cache,
+	ngx_str_t* content_type,
+	ngx_str_t* response,
+	ngx_str_t* gzip_response)
+{
+	response_cache_header_t cache_header;
+	ngx_chain_t* response_chain = ctx->submodule_context.response_chain;
+	ngx_chain_t* cl;
+	ngx_str_t* cache_buffers;
+	ngx_str_t* cur_buffer;
+	size_t buffer_count;
+
+	// header + content type + response buffers + gzip response
+	buffer_count = 3;
+	if (response_chain != NULL)
+	{
+		for (cl = response_chain; cl != NULL; cl = cl->next)
+		{
+			buffer_count++;
+		}
+	}
+	else
+	{
+		buffer_count++;
+	}
+
+	cache_buffers = ngx_palloc(ctx->submodule_context.request_context.pool, sizeof(cache_buffers[0]) * buffer_count);
+	if (cache_buffers == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_store_metadata_response: ngx_palloc failed");
+		return;
+	}
+
+	cache_header.content_type_len = content_type->len;
+	cache_header.gzip_response_len = gzip_response->len;
+	cache_header.media_set_type = ctx->submodule_context.media_set.type;
+	cache_header.last_media_sequence = ctx->submodule_context.last_media_sequence;
+	cache_buffers[0].data = (u_char*)&cache_header;
+	cache_buffers[0].len = sizeof(cache_header);
+	cache_buffers[1] = *content_type;
+
+	cur_buffer = cache_buffers + 2;
+	if (response_chain != NULL)
+	{
+		for (cl = response_chain; cl != NULL; cl = cl->next)
+		{
+			cur_buffer->data = cl->buf->pos;
+			cur_buffer->len = cl->buf->last - cl->buf->pos;
+			cur_buffer++;
+		}
+	}
+	else
+	{
+		*cur_buffer++ = *response;
+	}
+
+	*cur_buffer = *gzip_response;
+
+	// Note: a blocking reload request builds the playlist only when the cached one does not contain
+	//		the requested media sequence, the new playlist replaces it
+	if (ngx_buffer_cache_store_gather_perf(
+		ctx->perf_counters, 
+		cache, 
+		ctx->request_key, 
+		cache_buffers, 
+		buffer_count, 
+		ctx->submodule_context.request_params.media_sequence != 0))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_store_metadata_response: stored in response cache");
+	}
+	else
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_store_metadata_response: failed to store response in cache");
+	}
+}
+
+#if (NGX_HTTP_GZIP && NGX_HAVE_ZLIB)
+static ngx_int_t
+ngx_http_vod_gzip_metadata_response(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_str_t* response,
+	ngx_str_t* result)
+{
+	ngx_chain_t* cl;
+	z_stream zstream;
+	size_t alloc_size;
+	int rc;
+
+	ngx_memzero(&zstream, sizeof(zstream));
+
+	// Note: adding 16 to the window bits in order to get a gzip wrapper
+	rc = deflateInit2(
+		&zstream, 
+		(int)ctx->submodule_context.conf->response_cache_gzip_level, 
+		Z_DEFLATED, 
+		MAX_WBITS + 16, 
+		MAX_MEM_LEVEL - 1, 
+		Z_DEFAULT_STRATEGY);
+	if (rc != Z_OK)
+	{
+		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_gzip_metadata_response: deflateInit2 failed %d", rc);
+		return NGX_ERROR;
+	}
+
+	alloc_size = deflateBound(&zstream, response->len);
+
+	result->data = ngx_palloc(ctx->submodule_context.request_context.pool, alloc_size);
+	if (result->data == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_gzip_metadata_response: ngx_palloc failed");
+		deflateEnd(&zstream);
+		return NGX_ERROR;
+	}
+
+	zstream.next_out = result->data;
+	zstream.avail_out = (uInt)alloc_size;
+
+	if (ctx->submodule_context.response_chain != NULL)
+	{
+		for (cl = ctx->submodule_context.response_chain; cl != NULL; cl = cl->next)
+		{
+			zstream.next_in = cl->buf->pos;
+			zstream.avail_in = cl->buf->last - cl->buf->pos;
+			if (zstream.avail_in == 0)
+			{
+				continue;
+			}
+
+			rc = deflate(&zstream, Z_NO_FLUSH);
+			if (rc != Z_OK)
+			{
+				break;
+			}
+		}
+	}
+	else
+	{
+		zstream.next_in = response->data;
+		zstream.avail_in = response->len;
+		rc = Z_OK;
+	}
+
+	if (rc == Z_OK)
+	{
+		rc = deflate(&zstream, Z_FINISH);
+	}
+
+	result->len = zstream.total_out;
+
+	deflateEnd(&zstream);
+
+	if (rc != Z_STREAM_END)
+	{
+		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_gzip_metadata_response: deflate failed %d", rc);
+		result->len = 0;
+		return NGX_ERROR;
 	}
 
-	if (track->media_info.media_type == MEDIA_TYPE_VIDEO)
+	return NGX_OK;
+}
+
+static ngx_flag_t
+ngx_http_vod_accept_gzip_response(ngx_http_request_t* r)
+{
+	ngx_table_elt_t* h;
+
+	// the response has a gzip variant, add Vary: Accept-Encoding (subject to gzip_vary)
+	r->gzip_vary = 1;
+
+	if (ngx_http_gzip_ok(r) != NGX_OK)
 	{
-		if (track->media_info.min_frame_duration != 0)
-		{
-			track->media_info.min_frame_duration =
-				rescale_time(track->media_info.min_frame_duration, cur_timescale, new_timescale);
-			if (track->media_info.min_frame_duration == 0)
-			{
-				ngx_log_error(NGX_LOG_WARN, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_update_track_timescale: min frame duration is zero following rescale");
-				track->media_info.min_frame_duration = 1;
-			}
-		}
+		return 0;
+	}
 
-		track->media_info.u.video.initial_pts_delay =
-			rescale_time(track->media_info.u.video.initial_pts_delay, cur_timescale, new_timescale);
+	h = ngx_list_push(&r->headers_out.headers);
+	if (h == NULL)
+	{
+		return 0;
 	}
 
-	track->media_info.timescale = new_timescale;
-	track->media_info.frames_timescale = new_timescale;
+	h->hash = 1;
+#if (nginx_version >= 1023000)
+	h->next = NULL;
+#endif
+	ngx_str_set(&h->key, "Content-Encoding");
+	ngx_str_set(&h->value, "gzip");
+	r->headers_out.content_encoding = h;
 
-	return NGX_OK;
+	return 1;
 }
+#endif // NGX_HTTP_GZIP && NGX_HAVE_ZLIB
 
 static ngx_int_t
-ngx_http_vod_update_timescale(ngx_http_vod_ctx_t *ctx)
+ngx_http_vod_send_response_chain(ngx_http_request_t* r, ngx_chain_t* out)
 {
-	media_set_t* media_set = &ctx->submodule_context.media_set;
-	media_track_t* track;
+	ngx_chain_t* cl;
 	ngx_int_t rc;
 
-	for (track = media_set->filtered_tracks; track < media_set->filtered_tracks_end; track++)
+	if (r->header_only || r->method == NGX_HTTP_HEAD)
 	{
-		rc = ngx_http_vod_update_track_timescale(
-			ctx, 
-			track, 
-			ctx->request->timescale, 
-			ctx->submodule_context.request_params.pts_delay);
-		if (rc != NGX_OK)
-		{
-			return rc;
-		}
+		return NGX_OK;
+	}
+
+	for (cl = out; cl->next != NULL; cl = cl->next);
+	cl->buf->last_buf = 1;
+
+	// Note: the output filters (e.g. gzip) process the chain buffer by buffer
+	rc = ngx_http_output_filter(r, out);
+	if (rc != NGX_OK && rc != NGX_AGAIN)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_send_response_chain: ngx_http_output_filter failed %i", rc);
+		return rc;
 	}
 
 	return NGX_OK;
 }
 
-////// Metadata request handling
-
 static ngx_int_t
 ngx_http_vod_handle_metadata_request(ngx_http_vod_ctx_t *ctx)
 {
 	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
-	response_cache_header_t cache_header;
 	ngx_buffer_cache_t* cache;
-	ngx_str_t cache_buffers[3];
 	ngx_str_t content_type;
 	ngx_str_t response = ngx_null_string;
+	ngx_str_t gzip_response = ngx_null_string;
 	ngx_int_t rc;
 	int cache_type;
 
@@ -2884,6 +4047,12 @@ ngx_http_vod_handle_metadata_request(ngx_http_vod_ctx_t *ctx)
 		&ctx->submodule_context,
 		&response,
 		&content_type);
+	if (rc == NGX_AGAIN)
+	{
+		// the requested media sequence is not available yet
+		return ngx_http_vod_wait_for_update(ctx);
+	}
+
 	if (rc != NGX_OK)
 	{
 		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
@@ -2904,26 +4073,28 @@ ngx_http_vod_handle_metadata_request(ngx_http_vod_ctx_t *ctx)
 	}
 
 	cache = conf->response_cache[cache_type];
-	if (cache != NULL && response.data != NULL)
+	if (cache != NULL && (response.data != NULL || ctx->submodule_context.response_chain != NULL))
 	{
-		cache_header.content_type_len = content_type.len;
-		cache_header.media_set_type = ctx->submodule_context.media_set.type;
-		cache_buffers[0].data = (u_char*)&cache_header;
-		cache_buffers[0].len = sizeof(cache_header);
-		cache_buffers[1] = content_type;
-		cache_buffers[2] = response;
-
-		if (ngx_buffer_cache_store_gather_perf(ctx->perf_counters, cache, ctx->request_key, cache_buffers, 3))
-		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_handle_metadata_request: stored in response cache");
-		}
-		else
+#if (NGX_HTTP_GZIP && NGX_HAVE_ZLIB)
+		// Note: on failure, the response is cached without a gzip variant
+		if (conf->response_cache_gzip_level > 0)
 		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_handle_metadata_request: failed to store response in cache");
+			(void)ngx_http_vod_gzip_metadata_response(ctx, &response, &gzip_response);
 		}
+#endif // NGX_HTTP_GZIP && NGX_HAVE_ZLIB
+
+		ngx_http_vod_store_metadata_response(ctx, cache, &content_type, &response, &gzip_response);
+	}
+
+	ngx_http_vod_cache_unlock(ctx, ctx->request_key);
+
+#if (NGX_HTTP_GZIP && NGX_HAVE_ZLIB)
+	if (gzip_response.len != 0 && ngx_http_vod_accept_gzip_response(ctx->submodule_context.r))
+	{
+		ctx->submodule_context.response_chain = NULL;
+		response = gzip_response;
 	}
+#endif // NGX_HTTP_GZIP && NGX_HAVE_ZLIB
 
 	rc = ngx_http_vod_send_header(
 		ctx->submodule_context.r, 
@@ -2935,12 +4106,318 @@ ngx_http_vod_handle_metadata_request(ngx_http_vod_ctx_t *ctx)
 	{
 		return rc;
 	}
+
+	if (ctx->submodule_context.response_chain != NULL)
+	{
+		return ngx_http_vod_send_response_chain(ctx->submodule_context.r, ctx->submodule_context.response_chain);
+	}
 	
 	return ngx_http_vod_send_response(ctx->submodule_context.r, &response, NULL);
 }
 
 ////// Segment request handling
 
+static ngx_int_t
+ngx_http_vod_init_segment_cache_key(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	media_sequence_t* cur_sequence;
+	drm_info_t* drm_info;
+	ngx_md5_t md5;
+	ngx_int_t rc;
+
+	// calc the key from the host + uri + the encryption keys of the sequences
+	ngx_md5_init(&md5);
+
+	rc = ngx_http_vod_update_base_url_key(ctx->submodule_context.r, conf, &md5);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	ngx_md5_update(&md5, ctx->submodule_context.r->uri.data, ctx->submodule_context.r->uri.len);
+
+	for (cur_sequence = ctx->submodule_context.media_set.sequences;
+		cur_sequence < ctx->submodule_context.media_set.sequences_end;
+		cur_sequence++)
+	{
+		if (conf->drm_enabled)
+		{
+			drm_info = cur_sequence->drm_info;
+			if (drm_info == NULL)
+			{
+				continue;
+			}
+
+			ngx_md5_update(&md5, drm_info->key_id, sizeof(drm_info->key_id));
+			ngx_md5_update(&md5, drm_info->key, sizeof(drm_info->key));
+			if (drm_info->iv_set)
+			{
+				ngx_md5_update(&md5, drm_info->iv, sizeof(drm_info->iv));
+			}
+		}
+		else if (conf->secret_key != NULL)
+		{
+			ngx_md5_update(&md5, cur_sequence->encryption_key, sizeof(cur_sequence->encryption_key));
+		}
+	}
+
+	ngx_md5_final(ctx->request_key, &md5);
+
+	return NGX_OK;
+}
+
+static void
+ngx_http_vod_cache_hold_cleanup(void *data)
+{
+	ngx_http_vod_cache_hold_t* hold = data;
+
+	if (hold->touch.timer_set)
+	{
+		ngx_del_timer(&hold->touch);
+	}
+
+	ngx_buffer_cache_release(hold->cache, hold->key, hold->token);
+}
+
+static void
+ngx_http_vod_cache_hold_touch_handler(ngx_event_t *ev)
+{
+	ngx_http_vod_cache_hold_t* hold = ev->data;
+
+	ngx_buffer_cache_touch(hold->cache, hold->key, hold->token);
+
+	ngx_add_timer(&hold->touch, CACHE_HOLD_TOUCH_INTERVAL);
+}
+
+/*
+	keeps a fetched cache entry referenced until the request completes, so that its buffer can be sent 
+	without copying it. the entry is touched periodically while the request is active, since a referenced 
+	entry is protected from eviction only for a few seconds after it is accessed
+*/
+static ngx_int_t
+ngx_http_vod_cache_hold(ngx_http_request_t* r, ngx_buffer_cache_t* cache, u_char* key, uint32_t token)
+{
+	ngx_http_vod_cache_hold_t* hold;
+	ngx_pool_cleanup_t *cln;
+
+	cln = ngx_pool_cleanup_add(r->pool, sizeof(*hold));
+	if (cln == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_cache_hold: ngx_pool_cleanup_add failed");
+		ngx_buffer_cache_release(cache, key, token);
+		return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+	}
+
+	hold = cln->data;
+	ngx_memzero(hold, sizeof(*hold));
+	hold->cache = cache;
+	ngx_memcpy(hold->key, key, BUFFER_CACHE_KEY_SIZE);
+	hold->token = token;
+
+	hold->touch.handler = ngx_http_vod_cache_hold_touch_handler;
+	hold->touch.data = hold;
+	hold->touch.log = r->connection->log;
+	hold->touch.cancelable = 1;
+
+	cln->handler = ngx_http_vod_cache_hold_cleanup;
+
+	ngx_add_timer(&hold->touch, CACHE_HOLD_TOUCH_INTERVAL);
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_state_machine_fetch_segment(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	response_cache_header_t cache_header;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_str_t cache_buffer;
+	ngx_str_t content_type;
+	ngx_str_t response;
+	ngx_int_t rc;
+	uint32_t token;
+
+	if (conf->segment_cache == NULL ||
+		ctx->request == NULL ||
+		ctx->request->handle_metadata_request != NULL)
+	{
+		return NGX_OK;
+	}
+
+	rc = ngx_http_vod_init_segment_cache_key(ctx);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	// try to fetch from cache
+	if (ngx_buffer_cache_fetch_perf(
+		ctx->perf_counters,
+		conf->segment_cache,
+		ctx->request_key,
+		&cache_buffer,
+		&token))
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_state_machine_fetch_segment: segment cache hit, size is %uz", cache_buffer.len);
+
+		// Note: the response is sent from the cache buffer, the entry is released when the request completes
+		rc = ngx_http_vod_cache_hold(r, conf->segment_cache, ctx->request_key, token);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+	}
+	else
+	{
+		cache_buffer.len = 0;
+	}
+
+	if (cache_buffer.len > sizeof(cache_header))
+	{
+		// extract the content type
+		ngx_memcpy(&cache_header, cache_buffer.data, sizeof(cache_header));
+		cache_buffer.data += sizeof(cache_header);
+		cache_buffer.len -= sizeof(cache_header);
+
+		content_type.data = cache_buffer.data;
+		content_type.len = cache_header.content_type_len;
+
+		if (cache_buffer.len >= content_type.len)
+		{
+			// extract the response buffer
+			response.data = cache_buffer.data + content_type.len;
+			response.len = cache_buffer.len - content_type.len;
+
+			// return the response
+			rc = ngx_http_vod_send_header(r, response.len, &content_type, MEDIA_SET_VOD, NULL);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+
+			rc = ngx_http_vod_send_response(r, &response, NULL);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+
+			return NGX_DONE;
+		}
+	}
+
+	ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+		"ngx_http_vod_state_machine_fetch_segment: segment cache miss");
+
+	return ngx_http_vod_cache_lock(ctx, conf->segment_cache, ctx->request_key);
+}
+
+static void
+ngx_http_vod_write_segment_cache_part(
+	ngx_http_vod_write_segment_context_t* context,
+	u_char* buffer,
+	uint32_t size,
+	ngx_flag_t head)
+{
+	ngx_array_t* parts = context->cache_parts;
+	ngx_str_t head_part;
+	ngx_str_t* part;
+
+	context->cache_size += size;
+
+	if (!head && parts->nelts > 0)
+	{
+		// extend the last part if the buffer follows it
+		part = (ngx_str_t*)parts->elts + parts->nelts - 1;
+		if (part->data + part->len == buffer)
+		{
+			part->len += size;
+			return;
+		}
+	}
+
+	part = ngx_array_push(parts);
+	if (part == NULL)
+	{
+		goto failed;
+	}
+
+	part->data = buffer;
+	part->len = size;
+
+	if (!head || parts->nelts == 1)
+	{
+		return;
+	}
+
+	// move the header part to the beginning
+	head_part = *part;
+	part = parts->elts;
+	ngx_memmove(part + 1, part, sizeof(part[0]) * (parts->nelts - 1));
+	part[0] = head_part;
+	return;
+
+failed:
+
+	ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
+		"ngx_http_vod_write_segment_cache_part: ngx_array_push failed, disabling segment caching");
+	context->cache_parts = NULL;
+}
+
+static void
+ngx_http_vod_store_segment(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_write_segment_context_t* context = &ctx->write_segment_buffer_context;
+	response_cache_header_t cache_header;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_str_t* buffers;
+	ngx_uint_t part_count = context->cache_parts->nelts;
+
+	if (context->cache_size != context->total_size)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_store_segment: cached size %uz different than response size %uz",
+			context->cache_size, context->total_size);
+		return;
+	}
+
+	buffers = ngx_palloc(r->pool, sizeof(buffers[0]) * (part_count + 2));
+	if (buffers == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_store_segment: ngx_palloc failed");
+		return;
+	}
+
+	cache_header.content_type_len = r->headers_out.content_type.len;
+	cache_header.gzip_response_len = 0;
+	cache_header.media_set_type = MEDIA_SET_VOD;
+	buffers[0].data = (u_char*)&cache_header;
+	buffers[0].len = sizeof(cache_header);
+	buffers[1] = r->headers_out.content_type;
+	ngx_memcpy(buffers + 2, context->cache_parts->elts, sizeof(buffers[0]) * part_count);
+
+	if (ngx_buffer_cache_store_gather_perf(
+		ctx->perf_counters, 
+		ctx->submodule_context.conf->segment_cache, 
+		ctx->request_key, 
+		buffers, 
+		part_count + 2,
+		0))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_store_segment: stored in segment cache");
+	}
+	else
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_store_segment: failed to store segment in cache");
+	}
+}
+
 static ngx_int_t
 ngx_http_vod_state_machine_open_files(ngx_http_vod_ctx_t *ctx)
 {
@@ -3039,6 +4516,11 @@ ngx_http_vod_write_segment_header_buffer(void* ctx, u_char* buffer, uint32_t siz
 		context->chain_end = chain;
 	}
 
+	if (context->cache_parts != NULL)
+	{
+		ngx_http_vod_write_segment_cache_part(context, buffer, size, 1);
+	}
+
 	context->total_size += size;
 
 	return VOD_OK;
@@ -3073,8 +4555,18 @@ ngx_http_vod_write_segment_buffer(void* ctx, u_char* buffer, uint32_t size)
 	b->last = buffer + size;
 	b->temporary = 1;
 
-	if (context->r->header_sent)
-	{
+	if (context->r->header_sent)
+	{
+		// make sure the response does not exceed the reported length (e.g. a wrong size was returned from the cache)
+		if (context->content_length != 0 &&
+			context->total_size + size > context->content_length)
+		{
+			ngx_log_error(NGX_LOG_ERR, context->r->connection->log, 0,
+				"ngx_http_vod_write_segment_buffer: actual content length exceeds the reported length %uz", 
+				context->content_length);
+			return VOD_UNEXPECTED;
+		}
+
 		// headers already sent, output the chunk
 		out.buf = b;
 		out.next = NULL;
@@ -3108,6 +4600,13 @@ ngx_http_vod_write_segment_buffer(void* ctx, u_char* buffer, uint32_t size)
 		context->chain_end->buf = b;
 	}
 
+	// Note: buffers passed to the segment writer are not reused until the request completes,
+	//		so the segment is saved to the cache from the output buffers, without copying them
+	if (context->cache_parts != NULL)
+	{
+		ngx_http_vod_write_segment_cache_part(context, buffer, size, 0);
+	}
+
 	context->total_size += size;
 
 	return VOD_OK;
@@ -3172,6 +4671,8 @@ ngx_http_vod_init_frame_processing(ngx_http_vod_ctx_t *ctx)
 			return rc;
 		}
 
+		ctx->write_segment_buffer_context.content_length = ctx->content_length;
+
 		if (r->header_only || r->method == NGX_HTTP_HEAD)
 		{
 			return NGX_DONE;
@@ -3189,6 +4690,12 @@ ngx_http_vod_init_frame_processing(ngx_http_vod_ctx_t *ctx)
 		}
 	}
 
+	// save the response buffers for the segment cache, unless only a part of the response is built
+	if (ctx->submodule_context.conf->segment_cache != NULL && ctx->size_limit == 0)
+	{
+		ctx->write_segment_buffer_context.cache_parts = ngx_array_create(r->pool, 4, sizeof(ngx_str_t));
+	}
+
 	// write the initial buffer if provided
 	if (output_buffer.len != 0)
 	{
@@ -3226,6 +4733,7 @@ ngx_http_vod_process_media_frames(ngx_http_vod_ctx_t *ctx)
 {
 	read_cache_get_read_buffer_t read_buf;
 	size_t cache_buffer_size;
+	ngx_buf_t map_buffer;
 	vod_status_t rc;
 
 	for (;;)
@@ -3264,6 +4772,30 @@ ngx_http_vod_process_media_frames(ngx_http_vod_ctx_t *ctx)
 			&ctx->read_cache_state,
 			&read_buf);
 
+		// use the file mapping instead of reading, when possible
+		if (ctx->submodule_context.conf->file_mmap &&
+			read_buf.source->reader->map != NULL)
+		{
+			rc = read_buf.source->reader->map(
+				read_buf.source->reader_context,
+				&map_buffer,
+				read_buf.size,
+				read_buf.offset,
+				VOD_BUFFER_PADDING_SIZE);
+			if (rc == NGX_OK)
+			{
+				read_cache_read_completed(&ctx->read_cache_state, &map_buffer);
+				continue;
+			}
+
+			if (rc != NGX_DECLINED)
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_process_media_frames: map failed %i", rc);
+				return rc;
+			}
+		}
+
 		cache_buffer_size = ctx->submodule_context.conf->cache_buffer_size;
 
 		ctx->read_buffer.start = read_buf.buffer;
@@ -3317,6 +4849,14 @@ ngx_http_vod_finalize_segment_response(ngx_http_vod_ctx_t *ctx)
 		return ngx_http_vod_status_to_ngx_error(r, rc);
 	}
 
+	if (ctx->write_segment_buffer_context.cache_parts != NULL)
+	{
+		ngx_http_vod_store_segment(ctx);
+	}
+
+	// let other requests waiting for this segment fetch it from the cache
+	ngx_http_vod_cache_unlock(ctx, ctx->request_key);
+
 	// if we already sent the headers and all the buffers, just signal completion and return
 	if (r->header_sent)
 	{
@@ -3326,6 +4866,9 @@ ngx_http_vod_finalize_segment_response(ngx_http_vod_ctx_t *ctx)
 			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
 				"ngx_http_vod_finalize_segment_response: actual content length %uz is different than reported length %uz",
 				ctx->write_segment_buffer_context.total_size, ctx->content_length);
+
+			// the body does not match the header, close the connection instead of completing the response
+			return NGX_ERROR;
 		}
 
 		rc = ngx_http_send_special(r, NGX_HTTP_LAST);
@@ -3381,6 +4924,10 @@ ngx_http_vod_init_process(ngx_cycle_t *cycle)
 
 	audio_filter_process_init(cycle->log);
 
+	ngx_queue_init(&update_waiters);
+	ngx_queue_init(&cache_lock_holders);
+	ngx_queue_init(&cache_lock_waiters);
+
 #if (NGX_HAVE_LIB_AV_CODEC)
 	audio_decoder_process_init(cycle->log);
 	audio_encoder_process_init(cycle->log);
@@ -3406,6 +4953,10 @@ ngx_http_vod_exit_process()
 #if (NGX_HAVE_LIBXML2)
 	dfxp_exit_process();
 #endif // NGX_HAVE_LIBXML2
+
+#if (NGX_HAVE_LIBURING)
+	ngx_io_uring_exit_process();
+#endif // NGX_HAVE_LIBURING
 }
 
 ////// Clipping
@@ -3635,10 +5186,24 @@ ngx_http_vod_run_state_machine(ngx_http_vod_ctx_t *ctx)
 			return rc;
 		}
 
-		ctx->state = STATE_READ_METADATA_INITIAL;
+		ctx->state = STATE_FETCH_SEGMENT;
 		ctx->cur_sequence = ctx->submodule_context.media_set.sequences;
 		// fall through
 
+	case STATE_FETCH_SEGMENT:
+		rc = ngx_http_vod_state_machine_fetch_segment(ctx);
+		if (rc != NGX_OK)
+		{
+			if (rc == NGX_DONE)
+			{
+				rc = NGX_OK;
+			}
+			return rc;
+		}
+
+		ctx->state = STATE_READ_METADATA_INITIAL;
+		// fall through
+
 	case STATE_READ_METADATA_INITIAL:
 	case STATE_READ_METADATA_OPEN_FILE:
 	case STATE_READ_METADATA_READ:
@@ -3897,6 +5462,25 @@ ngx_http_vod_handle_read_completed(void* context, ngx_int_t rc, ngx_buf_t* buf,
 
 		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
 			"ngx_http_vod_handle_read_completed: read failed %i", rc);
+
+		// Note: when a stale copy of the mapping exists, the state machine will use it
+		if (ctx->state == STATE_MAP_READ &&
+			ngx_http_vod_cache_upstream_error(
+				ctx,
+				ctx->mapping.caches,
+				ctx->mapping.cache_count,
+				ctx->mapping.cache_key,
+				rc) == NGX_OK)
+		{
+			ctx->state = STATE_MAP_INITIAL;
+
+			rc = ctx->state_machine(ctx);
+			if (rc == NGX_AGAIN)
+			{
+				return;
+			}
+		}
+
 		goto finalize_request;
 	}
 
@@ -4094,7 +5678,7 @@ ngx_http_vod_start_processing_media_file(ngx_http_vod_ctx_t *ctx)
 	}
 	else
 	{
-		ctx->state = STATE_READ_METADATA_INITIAL;
+		ctx->state = STATE_FETCH_SEGMENT;
 	}
 
 	return ngx_http_vod_run_state_machine(ctx);
@@ -4168,6 +5752,8 @@ ngx_http_vod_dump_request_to_fallback(ngx_http_request_t *r)
 	child_params.extra_header = conf->proxy_header;
 	child_params.proxy_range = 1;
 	child_params.proxy_all_headers = 1;
+	child_params.upstream_counter = ngx_perf_counter_get_upstream(
+		(ngx_perf_counters_t*)ngx_perf_counter_get_state(conf->perf_counters_zone), PU_FALLBACK_UPSTREAM);
 
 	return ngx_child_request_start(
 		r,
@@ -4254,6 +5840,18 @@ ngx_http_vod_init_file_reader_internal(ngx_http_request_t *r, ngx_str_t* path, v
 
 	*context = state;
 
+	state->perf_counters = ctx->perf_counters;
+#if (NGX_THREADS)
+	state->read_thread_pool = ctx->submodule_context.conf->read_file_thread_pool;
+#endif // NGX_THREADS
+
+#if (NGX_HAVE_LIBURING)
+	if (ctx->submodule_context.conf->file_io_uring)
+	{
+		flags |= OPEN_FILE_IO_URING;
+	}
+#endif // NGX_HAVE_LIBURING
+
 	ngx_perf_counter_start(ctx->perf_counter_context);
 
 #if (NGX_THREADS)
@@ -4397,6 +5995,8 @@ ngx_http_vod_async_http_read(ngx_http_vod_http_reader_state_t *state, ngx_buf_t
 	child_params.extra_args = ctx->upstream_extra_args;
 	child_params.range_start = offset;
 	child_params.range_end = offset + size;
+	child_params.upstream_counter = ngx_perf_counter_get_upstream(ctx->perf_counters, state->upstream_counter);
+	child_params.upstream_status = &ctx->upstream_status;
 
 	return ngx_child_request_start(
 		state->r,
@@ -4423,6 +6023,7 @@ ngx_http_vod_dump_http_part(void* context, off_t start, off_t end)
 	child_params.extra_args = ctx->upstream_extra_args;
 	child_params.range_start = start;
 	child_params.range_end = end;
+	child_params.upstream_counter = ngx_perf_counter_get_upstream(ctx->perf_counters, state->upstream_counter);
 
 	return ngx_child_request_start(
 		r,
@@ -4449,6 +6050,7 @@ ngx_http_vod_dump_http_request(void* context)
 	child_params.extra_args = ctx->upstream_extra_args;
 	child_params.proxy_range = 1;
 	child_params.proxy_all_headers = 1;
+	child_params.upstream_counter = ngx_perf_counter_get_upstream(ctx->perf_counters, state->upstream_counter);
 
 	return ngx_child_request_start(
 		r,
@@ -4494,10 +6096,12 @@ ngx_http_vod_http_reader_open_file(ngx_http_request_t* r, ngx_str_t* path, uint3
 	if (ctx->state == STATE_MAP_OPEN || ctx->submodule_context.conf->remote_upstream_location.len == 0)
 	{
 		state->upstream_location = ctx->submodule_context.conf->upstream_location;
+		state->upstream_counter = PU_UPSTREAM;
 	}
 	else
 	{
 		state->upstream_location = ctx->submodule_context.conf->remote_upstream_location;
+		state->upstream_counter = PU_REMOTE_UPSTREAM;
 	}
 	*context = state;
 
@@ -4591,6 +6195,25 @@ ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
 			ctx->mapping.cache_key,
 			&mapping,
 			&cache_token);
+		if (fetch_cache_index < 0)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_map_run_step: mapping cache miss");
+
+			rc = ngx_http_vod_cache_fetch_stale(
+				ctx,
+				ctx->mapping.caches,
+				ctx->mapping.cache_count,
+				ctx->mapping.cache_key,
+				&mapping,
+				&cache_token,
+				&fetch_cache_index);
+			if (rc != NGX_OK && rc != NGX_DECLINED)
+			{
+				return rc;
+			}
+		}
+
 		if (fetch_cache_index >= 0)
 		{
 			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
@@ -4610,10 +6233,18 @@ ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
 
 			break;
 		}
-		else
+
+		// Note: when refreshing a stale entry, the lock is already held
+		if (ctx->stale_cache == NULL)
 		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_map_run_step: mapping cache miss");
+			rc = ngx_http_vod_cache_lock(
+				ctx, 
+				ngx_http_vod_get_lock_cache(ctx->mapping.caches, ctx->mapping.cache_count, ctx->mapping.cache_key),
+				ctx->mapping.cache_key);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
 		}
 
 		// open the mapping file
@@ -4668,6 +6299,7 @@ ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
 
 		// read the mapping
 		ctx->state = STATE_MAP_READ;
+		ctx->upstream_status = 0;
 		ngx_perf_counter_start(ctx->perf_counter_context);
 
 		rc = ctx->mapping.reader->read(ctx->mapping.reader_context, &ctx->read_buffer, read_size, 0);
@@ -4746,6 +6378,11 @@ ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
 			}
 		}
 
+		ngx_http_vod_cache_unlock(ctx, ctx->mapping.cache_key);
+		ctx->stale_cache = NULL;
+
+		ngx_http_vod_update_notify(ctx->mapping.cache_key);
+
 		ctx->state = STATE_MAP_INITIAL;
 		break;
 
@@ -4944,6 +6581,7 @@ ngx_http_vod_send_notification(ngx_http_vod_ctx_t *ctx)
 	child_params.extra_args = ctx->upstream_extra_args;
 	child_params.range_start = 0;
 	child_params.range_end = 1;
+	child_params.upstream_counter = ngx_perf_counter_get_upstream(ctx->perf_counters, PU_UPSTREAM);
 
 	return ngx_child_request_start(
 		ctx->submodule_context.r,
@@ -5177,6 +6815,11 @@ ngx_http_vod_map_media_set_apply(ngx_http_vod_ctx_t *ctx, ngx_str_t* mapping, in
 	uint32_t request_flags;
 	u_char* override_str = NULL;
 
+	// save the mapping key, blocking reload requests wait for this mapping to be updated
+	ngx_memcpy(ctx->update_wait_key, ctx->mapping.cache_key, sizeof(ctx->update_wait_key));
+	ctx->update_wait_caches = ctx->mapping.caches;
+	ctx->update_wait_cache_count = ctx->mapping.cache_count;
+
 	if (conf->media_set_override_json != NULL)
 	{
 		if (ngx_http_complex_value(
@@ -5571,11 +7214,233 @@ ngx_http_vod_parse_uri(
 	return NGX_OK;
 }
 
+static ngx_int_t
+ngx_http_vod_send_cached_response(
+	ngx_http_request_t *r,
+	ngx_perf_counters_t* perf_counters,
+	const ngx_http_vod_request_t* request,
+	u_char* request_key,
+	uint32_t media_sequence)
+{
+	response_cache_header_t cache_header;
+	ngx_http_vod_loc_conf_t *conf;
+	ngx_str_t cache_buffer;
+	ngx_str_t content_type;
+	ngx_str_t response;
+	ngx_int_t rc;
+	int cache_type;
+
+	conf = ngx_http_get_module_loc_conf(r, ngx_http_vod_module);
+
+	cache_type = ngx_buffer_cache_fetch_copy_perf(
+		r,
+		perf_counters,
+		conf->response_cache,
+		CACHE_TYPE_COUNT,
+		request_key,
+		&cache_buffer);
+	if (cache_type < 0 ||
+		cache_buffer.len <= sizeof(cache_header))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_send_cached_response: response cache miss");
+		return NGX_DECLINED;
+	}
+
+	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+		"ngx_http_vod_send_cached_response: response cache hit, size is %uz", cache_buffer.len);
+
+	// extract the content type
+	ngx_memcpy(&cache_header, cache_buffer.data, sizeof(cache_header));
+	cache_buffer.data += sizeof(cache_header);
+	cache_buffer.len -= sizeof(cache_header);
+
+	if (cache_header.last_media_sequence != 0 && 
+		media_sequence > cache_header.last_media_sequence)
+	{
+		ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_send_cached_response: the cached playlist ends at media sequence %uD, requested %uD",
+			cache_header.last_media_sequence, media_sequence);
+		return NGX_DECLINED;
+	}
+
+	content_type.data = cache_buffer.data;
+	content_type.len = cache_header.content_type_len;
+
+	if (cache_buffer.len < content_type.len + cache_header.gzip_response_len)
+	{
+		return NGX_DECLINED;
+	}
+
+	// extract the response buffer
+	response.data = cache_buffer.data + content_type.len;
+	response.len = cache_buffer.len - content_type.len - cache_header.gzip_response_len;
+
+#if (NGX_HTTP_GZIP && NGX_HAVE_ZLIB)
+	if (cache_header.gzip_response_len != 0 && ngx_http_vod_accept_gzip_response(r))
+	{
+		response.data += response.len;
+		response.len = cache_header.gzip_response_len;
+	}
+#endif // NGX_HTTP_GZIP && NGX_HAVE_ZLIB
+
+	// update request flags
+	r->root_tested = !r->error_page;
+	r->allow_ranges = 1;
+
+	// return the response
+	rc = ngx_http_vod_send_header(r, response.len, &content_type, cache_header.media_set_type, request);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	return ngx_http_vod_send_response(r, &response, NULL);
+}
+
+static ngx_int_t
+ngx_http_vod_response_cache_lock_state_machine(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t *conf = ctx->submodule_context.conf;
+	ngx_http_request_t *r = ctx->submodule_context.r;
+	ngx_int_t rc;
+
+	if (ctx->cache_lock_waiting)
+	{
+		// another request was building the response, try to fetch it from cache
+		rc = ngx_http_vod_send_cached_response(
+			r, 
+			ctx->perf_counters, 
+			ctx->request, 
+			ctx->request_key, 
+			ctx->submodule_context.request_params.media_sequence);
+		if (rc != NGX_DECLINED)
+		{
+			return rc;
+		}
+	}
+
+	rc = ngx_http_vod_cache_lock(
+		ctx, 
+		ngx_http_vod_get_lock_cache(conf->response_cache, CACHE_TYPE_COUNT, ctx->request_key), 
+		ctx->request_key);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	// call the mode specific handler (remote/mapped/local)
+	return conf->request_handler(r);
+}
+
+static void
+ngx_http_vod_init_request_state(
+	ngx_http_vod_ctx_t *ctx,
+	request_params_t* request_params,
+	media_set_t* media_set)
+{
+	ngx_http_vod_loc_conf_t *conf = ctx->submodule_context.conf;
+	ngx_http_request_t *r = ctx->submodule_context.r;
+#if (NGX_DEBUG)
+	ngx_str_t time_str;
+#endif // NGX_DEBUG
+
+	ctx->submodule_context.request_params = *request_params;
+	ctx->submodule_context.media_set = *media_set;
+	ctx->submodule_context.media_set.segmenter_conf = &conf->segmenter;
+	ctx->submodule_context.media_set.version = request_params->version;
+	ctx->cur_source = media_set->sources_head;
+	ctx->submodule_context.request_context.pool = r->pool;
+	ctx->submodule_context.request_context.log = r->connection->log;
+	ctx->submodule_context.request_context.output_buffer_pool = conf->output_buffer_pool;
+
+#if (NGX_DEBUG)
+	// in debug builds allow overriding the server time
+	if (ngx_http_arg(r, (u_char *) "time", sizeof("time") - 1, &time_str) == NGX_OK)
+	{
+		ctx->submodule_context.request_context.time = ngx_atotm(time_str.data, time_str.len);
+	}
+#endif // NGX_DEBUG
+}
+
+static ngx_int_t
+ngx_http_vod_start_request(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t *conf = ctx->submodule_context.conf;
+
+	if (ctx->request != NULL &&
+		ctx->request->handle_metadata_request != NULL &&
+		conf->cache_lock)
+	{
+		// coalesce concurrent requests for the same response
+		ctx->state_machine = ngx_http_vod_response_cache_lock_state_machine;
+		return ngx_http_vod_response_cache_lock_state_machine(ctx);
+	}
+
+	// call the mode specific handler (remote/mapped/local)
+	return conf->request_handler(ctx->submodule_context.r);
+}
+
+/*
+	restarts a blocking reload request after the media set mapping was updated. the uri that was parsed
+	when the request started is reused, the rest of the request state is cleared
+*/
+static ngx_int_t
+ngx_http_vod_update_wait_restart(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_perf_counter_context(total_perf_counter_context);
+	ngx_http_vod_parsed_request_t* parsed_request = ctx->parsed_request;
+	const ngx_http_vod_request_t* request = ctx->request;
+	ngx_perf_counters_t* perf_counters = ctx->perf_counters;
+	ngx_http_vod_loc_conf_t *conf = ctx->submodule_context.conf;
+	ngx_http_request_t *r = ctx->submodule_context.r;
+	ngx_event_t cache_lock_wait;
+	ngx_event_t update_wait;
+	ngx_msec_t update_wait_start;
+	u_char request_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_int_t rc;
+
+	// another request may have already stored a playlist that contains the media sequence
+	rc = ngx_http_vod_send_cached_response(
+		r, 
+		perf_counters, 
+		request, 
+		ctx->request_key, 
+		parsed_request->request_params.media_sequence);
+	if (rc != NGX_DECLINED)
+	{
+		return rc;
+	}
+
+	// Note: the events are kept, since the pool cleanups that release them were already added
+	ngx_perf_counter_copy(total_perf_counter_context, ctx->total_perf_counter_context);
+	cache_lock_wait = ctx->cache_lock_wait;
+	update_wait = ctx->update_wait;
+	update_wait_start = ctx->update_wait_start;
+	ngx_memcpy(request_key, ctx->request_key, sizeof(request_key));
+
+	ngx_memzero(ctx, sizeof(*ctx));
+
+	ngx_perf_counter_copy(ctx->total_perf_counter_context, total_perf_counter_context);
+	ctx->cache_lock_wait = cache_lock_wait;
+	ctx->update_wait = update_wait;
+	ctx->update_wait_start = update_wait_start;
+	ngx_memcpy(ctx->request_key, request_key, sizeof(request_key));
+	ctx->parsed_request = parsed_request;
+	ctx->submodule_context.r = r;
+	ctx->submodule_context.conf = conf;
+	ctx->request = request;
+	ctx->perf_counters = perf_counters;
+
+	ngx_http_vod_init_request_state(ctx, &parsed_request->request_params, &parsed_request->media_set);
+
+	return ngx_http_vod_start_request(ctx);
+}
+
 ngx_int_t
 ngx_http_vod_handler(ngx_http_request_t *r)
 {
 	ngx_perf_counter_context(pcctx);
-	response_cache_header_t cache_header;
 	ngx_perf_counters_t* perf_counters;
 	ngx_http_vod_ctx_t *ctx;
 	request_params_t request_params;
@@ -5584,15 +7449,8 @@ ngx_http_vod_handler(ngx_http_request_t *r)
 	ngx_http_vod_loc_conf_t *conf;
 	u_char request_key[BUFFER_CACHE_KEY_SIZE];
 	ngx_md5_t md5;
-	ngx_str_t cache_buffer;
-	ngx_str_t content_type;
 	ngx_str_t response;
-	ngx_str_t base_url;
 	ngx_int_t rc;
-	int cache_type;
-#if (NGX_DEBUG)
-	ngx_str_t time_str;
-#endif // NGX_DEBUG
 
 	ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "ngx_http_vod_handler: started");
 
@@ -5682,76 +7540,27 @@ ngx_http_vod_handler(ngx_http_request_t *r)
 		// calc request key from host + uri
 		ngx_md5_init(&md5);
 
-		base_url.len = 0;
-		rc = ngx_http_vod_get_base_url(r, conf->base_url, &empty_string, &base_url);
+		rc = ngx_http_vod_update_base_url_key(r, conf, &md5);
 		if (rc != NGX_OK)
 		{
 			return rc;
 		}
-		ngx_md5_update(&md5, base_url.data, base_url.len);
 
-		if (conf->segments_base_url != NULL)
+		ngx_md5_update(&md5, r->uri.data, r->uri.len);
+
+		if ((request->flags & REQUEST_FLAG_DELTA_UPDATE) != 0)
 		{
-			base_url.len = 0;
-			rc = ngx_http_vod_get_base_url(r, conf->segments_base_url, &empty_string, &base_url);
-			if (rc != NGX_OK)
-			{
-				return rc;
-			}
-			ngx_md5_update(&md5, base_url.data, base_url.len);
+			// delta updates are cached separately from the full response
+			ngx_md5_update(&md5, delta_update_key_suffix, sizeof(delta_update_key_suffix) - 1);
 		}
 
-		ngx_md5_update(&md5, r->uri.data, r->uri.len);
-
 		ngx_md5_final(request_key, &md5);
 
 		// try to fetch from cache
-		cache_type = ngx_buffer_cache_fetch_copy_perf(
-			r,
-			perf_counters,
-			conf->response_cache,
-			CACHE_TYPE_COUNT,
-			request_key,
-			&cache_buffer);
-		if (cache_type >= 0 &&
-			cache_buffer.len > sizeof(cache_header))
-		{
-			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_handler: response cache hit, size is %uz", cache_buffer.len);
-
-			// extract the content type
-			ngx_memcpy(&cache_header, cache_buffer.data, sizeof(cache_header));
-			cache_buffer.data += sizeof(cache_header);
-			cache_buffer.len -= sizeof(cache_header);
-
-			content_type.data = cache_buffer.data;
-			content_type.len = cache_header.content_type_len;
-
-			if (cache_buffer.len >= content_type.len)
-			{
-				// extract the response buffer
-				response.data = cache_buffer.data + content_type.len;
-				response.len = cache_buffer.len - content_type.len;
-
-				// update request flags
-				r->root_tested = !r->error_page;
-				r->allow_ranges = 1;
-
-				// return the response
-				rc = ngx_http_vod_send_header(r, response.len, &content_type, cache_header.media_set_type, request);
-				if (rc != NGX_OK)
-				{
-					return rc;
-				}
-
-				rc = ngx_http_vod_send_response(r, &response, NULL);
-				goto done;
-			}
-		}
-		else
+		rc = ngx_http_vod_send_cached_response(r, perf_counters, request, request_key, request_params.media_sequence);
+		if (rc != NGX_DECLINED)
 		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_handler: response cache miss");
+			goto done;
 		}
 	}
 
@@ -5765,33 +7574,35 @@ ngx_http_vod_handler(ngx_http_request_t *r)
 		goto done;
 	}
 
+	if (request_params.media_sequence != 0)
+	{
+		// blocking reload requests may be restarted, keep the parsed uri
+		ctx->parsed_request = ngx_palloc(r->pool, sizeof(*ctx->parsed_request));
+		if (ctx->parsed_request == NULL)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_handler: ngx_palloc failed");
+			rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+			goto done;
+		}
+
+		ctx->parsed_request->request_params = request_params;
+		ctx->parsed_request->media_set = media_set;
+		ctx->update_wait_start = ngx_current_msec;
+	}
+
 	ngx_memcpy(ctx->request_key, request_key, sizeof(request_key));
 	ctx->submodule_context.r = r;
 	ctx->submodule_context.conf = conf;
-	ctx->submodule_context.request_params = request_params;
-	ctx->submodule_context.media_set = media_set;
-	ctx->submodule_context.media_set.segmenter_conf = &conf->segmenter;
-	ctx->submodule_context.media_set.version = request_params.version;
 	ctx->request = request;
-	ctx->cur_source = media_set.sources_head;
-	ctx->submodule_context.request_context.pool = r->pool;
-	ctx->submodule_context.request_context.log = r->connection->log;
-	ctx->submodule_context.request_context.output_buffer_pool = conf->output_buffer_pool;
 	ctx->perf_counters = perf_counters;
 	ngx_perf_counter_copy(ctx->total_perf_counter_context, pcctx);
 
-#if (NGX_DEBUG)
-	// in debug builds allow overriding the server time
-	if (ngx_http_arg(r, (u_char *) "time", sizeof("time") - 1, &time_str) == NGX_OK)
-	{
-		ctx->submodule_context.request_context.time = ngx_atotm(time_str.data, time_str.len);
-	}
-#endif // NGX_DEBUG
+	ngx_http_vod_init_request_state(ctx, &request_params, &media_set);
 
 	ngx_http_set_ctx(r, ctx, ngx_http_vod_module);
 
-	// call the mode specific handler (remote/mapped/local)
-	rc = conf->request_handler(r);
+	rc = ngx_http_vod_start_request(ctx);
 
 done:
 
@@ -52,7 +52,8 @@ ngx_http_vod_mss_handle_manifest(
 			&submodule_context->request_context,
 			&submodule_context->conf->mss.manifest_conf,
 			&submodule_context->media_set,
-			response);
+			&submodule_context->response_chain,
+			&response->len);
 	}
 	else
 #endif // NGX_HAVE_OPENSSL_EVP
@@ -64,7 +65,8 @@ ngx_http_vod_mss_handle_manifest(
 			0,
 			NULL,
 			NULL,
-			response);
+			&submodule_context->response_chain,
+			&response->len);
 	}
 	if (rc != VOD_OK)
 	{
@@ -13,6 +13,9 @@
 #define PATH_PERF_COUNTERS_OPEN "<performance_counters>\r\n"
 #define PATH_PERF_COUNTERS_CLOSE "</performance_counters>\r\n"
 #define PERF_COUNTER_FORMAT "<sum>%uA</sum>\r\n<count>%uA</count>\r\n<max>%uA</max>\r\n<max_time>%uA</max_time>\r\n<max_pid>%uA</max_pid>\r\n"
+#define UPSTREAM_COUNTERS_OPEN "<upstream_counters>\r\n"
+#define UPSTREAM_COUNTERS_CLOSE "</upstream_counters>\r\n"
+#define UPSTREAM_COUNTER_FORMAT "<%V>\r\n<requests>%uA</requests>\r\n<errors>%uA</errors>\r\n<bytes>%uA</bytes>\r\n<reused_connections>%uA</reused_connections>\r\n</%V>\r\n"
 
 #define PROM_STATUS_PREFIX								\
 	"nginx_vod_build_info{version=\"" NGINX_VOD_VERSION "\"} 1\n\n"
@@ -24,6 +27,12 @@
 	"vod_perf_counter_max_time{action=\"%V\"} %uA\n"	\
 	"vod_perf_counter_max_pid{action=\"%V\"} %uA\n\n"	\
 
+#define PROM_UPSTREAM_COUNTER_METRICS							\
+	"vod_upstream_requests{upstream=\"%V\"} %uA\n"				\
+	"vod_upstream_errors{upstream=\"%V\"} %uA\n"				\
+	"vod_upstream_bytes{upstream=\"%V\"} %uA\n"				\
+	"vod_upstream_reused_connections{upstream=\"%V\"} %uA\n\n"	\
+
 // typedefs
 typedef struct {
 	int conf_offset;
@@ -55,9 +64,13 @@ static ngx_http_vod_stat_def_t buffer_cache_stat_defs[] = {
 	DEFINE_STAT(fetch_hit),
 	DEFINE_STAT(fetch_bytes),
 	DEFINE_STAT(fetch_miss),
+	DEFINE_STAT(fetch_stale),
 	DEFINE_STAT(evicted),
 	DEFINE_STAT(evicted_bytes),
 	DEFINE_STAT(reset),
+	DEFINE_STAT(lock_ok),
+	DEFINE_STAT(lock_busy),
+	DEFINE_STAT(local_hit),
 	DEFINE_STAT(entries),
 	DEFINE_STAT(data_size),
 	{ ngx_null_string, 0 }
@@ -79,6 +92,16 @@ static ngx_http_vod_cache_info_t cache_infos[] = {
 		ngx_string("<live_response_cache>\r\n"),
 		ngx_string("</live_response_cache>\r\n"),
 	},
+	{
+		offsetof(ngx_http_vod_loc_conf_t, segment_cache),
+		ngx_string("<segment_cache>\r\n"),
+		ngx_string("</segment_cache>\r\n"),
+	},
+	{
+		offsetof(ngx_http_vod_loc_conf_t, segment_size_cache),
+		ngx_string("<segment_size_cache>\r\n"),
+		ngx_string("</segment_size_cache>\r\n"),
+	},
 	{
 		offsetof(ngx_http_vod_loc_conf_t, mapping_cache[CACHE_TYPE_VOD]),
 		ngx_string("<mapping_cache>\r\n"),
@@ -157,6 +180,14 @@ ngx_http_vod_status_reset(ngx_http_request_t *r)
 			perf_counters->counters[i].max_time = 0;
 			perf_counters->counters[i].max_pid = 0;
 		}
+
+		for (i = 0; i < PU_COUNT; i++)
+		{
+			perf_counters->upstreams[i].requests = 0;
+			perf_counters->upstreams[i].errors = 0;
+			perf_counters->upstreams[i].bytes = 0;
+			perf_counters->upstreams[i].reused_connections = 0;
+		}
 	}
 
 	return ngx_http_vod_send_response(r, &reset_response, &text_content_type);
@@ -205,6 +236,13 @@ ngx_http_vod_status_xml_handler(ngx_http_request_t *r)
 			result_size += perf_counters_open_tags[i].len + sizeof(PERF_COUNTER_FORMAT) + 5 * NGX_ATOMIC_T_LEN + perf_counters_close_tags[i].len;
 		}
 		result_size += sizeof(PATH_PERF_COUNTERS_CLOSE);
+
+		result_size += sizeof(UPSTREAM_COUNTERS_OPEN);
+		for (i = 0; i < PU_COUNT; i++)
+		{
+			result_size += sizeof(UPSTREAM_COUNTER_FORMAT) + 2 * perf_counters_upstream_names[i].len + 4 * NGX_ATOMIC_T_LEN;
+		}
+		result_size += sizeof(UPSTREAM_COUNTERS_CLOSE);
 	}
 
 	result_size += sizeof(status_postfix);
@@ -251,6 +289,19 @@ ngx_http_vod_status_xml_handler(ngx_http_request_t *r)
 			p = ngx_copy(p, perf_counters_close_tags[i].data, perf_counters_close_tags[i].len);
 		}
 		p = ngx_copy(p, PATH_PERF_COUNTERS_CLOSE, sizeof(PATH_PERF_COUNTERS_CLOSE) - 1);
+
+		p = ngx_copy(p, UPSTREAM_COUNTERS_OPEN, sizeof(UPSTREAM_COUNTERS_OPEN) - 1);
+		for (i = 0; i < PU_COUNT; i++)
+		{
+			p = ngx_sprintf(p, UPSTREAM_COUNTER_FORMAT,
+				&perf_counters_upstream_names[i],
+				perf_counters->upstreams[i].requests,
+				perf_counters->upstreams[i].errors,
+				perf_counters->upstreams[i].bytes,
+				perf_counters->upstreams[i].reused_connections,
+				&perf_counters_upstream_names[i]);
+		}
+		p = ngx_copy(p, UPSTREAM_COUNTERS_CLOSE, sizeof(UPSTREAM_COUNTERS_CLOSE) - 1);
 	}
 
 	p = ngx_copy(p, status_postfix, sizeof(status_postfix) - 1);
@@ -312,6 +363,11 @@ ngx_http_vod_status_prom_handler(ngx_http_request_t *r)
 		{
 			result_size += sizeof(PROM_PERF_COUNTER_METRICS) - 1 + (perf_counters_open_tags[i].len + NGX_ATOMIC_T_LEN) * 5;
 		}
+
+		for (i = 0; i < PU_COUNT; i++)
+		{
+			result_size += sizeof(PROM_UPSTREAM_COUNTER_METRICS) - 1 + (perf_counters_upstream_names[i].len + NGX_ATOMIC_T_LEN) * 4;
+		}
 	}
 
 	// allocate the buffer
@@ -361,6 +417,15 @@ ngx_http_vod_status_prom_handler(ngx_http_request_t *r)
 				&action, perf_counters->counters[i].max_time,
 				&action, perf_counters->counters[i].max_pid);
 		}
+
+		for (i = 0; i < PU_COUNT; i++)
+		{
+			p = ngx_sprintf(p, PROM_UPSTREAM_COUNTER_METRICS,
+				&perf_counters_upstream_names[i], perf_counters->upstreams[i].requests,
+				&perf_counters_upstream_names[i], perf_counters->upstreams[i].errors,
+				&perf_counters_upstream_names[i], perf_counters->upstreams[i].bytes,
+				&perf_counters_upstream_names[i], perf_counters->upstreams[i].reused_connections);
+		}
 	}
 
 	response.len = p - response.data;
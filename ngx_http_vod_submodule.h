@@ -47,6 +47,8 @@ typedef struct {
 	request_params_t request_params;
 	ngx_http_request_t* r;
 	struct ngx_http_vod_loc_conf_s* conf;
+	ngx_chain_t* response_chain;		// optionally set by handle_metadata_request, in this case response holds only the length
+	uint32_t last_media_sequence;		// optionally set by handle_metadata_request, the last media sequence of a blocking reload playlist
 } ngx_http_vod_submodule_context_t;
 
 // submodule request
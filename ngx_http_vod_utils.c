@@ -11,6 +11,7 @@ static const ngx_int_t error_map[VOD_ERROR_LAST - VOD_ERROR_FIRST] = {
 	NGX_HTTP_NOT_FOUND,				// VOD_EMPTY_MAPPING
 	NGX_HTTP_INTERNAL_SERVER_ERROR, // VOD_NOT_FOUND (not expected to reach top level)
 	NGX_HTTP_INTERNAL_SERVER_ERROR, // VOD_REDIRECT (not expected to reach top level)
+	NGX_HTTP_SERVICE_UNAVAILABLE,	// VOD_INCOMPLETE
 };
 
 static ngx_str_t error_codes[VOD_ERROR_LAST - VOD_ERROR_FIRST] = {
@@ -24,6 +25,7 @@ static ngx_str_t error_codes[VOD_ERROR_LAST - VOD_ERROR_FIRST] = {
 	ngx_string("EMPTY_MAPPING"),
 	ngx_string("UNEXPECTED"),
 	ngx_string("UNEXPECTED"),
+	ngx_string("INCOMPLETE"),
 };
 
 static ngx_uint_t ngx_http_vod_status_index;
@@ -298,6 +300,37 @@ ngx_http_vod_get_base_url(
 	return NGX_OK;
 }
 
+ngx_int_t
+ngx_http_vod_update_base_url_key(
+	ngx_http_request_t* r,
+	ngx_http_vod_loc_conf_t* conf,
+	ngx_md5_t* md5)
+{
+	ngx_str_t base_url;
+	ngx_int_t rc;
+
+	base_url.len = 0;
+	rc = ngx_http_vod_get_base_url(r, conf->base_url, &empty_string, &base_url);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+	ngx_md5_update(md5, base_url.data, base_url.len);
+
+	if (conf->segments_base_url != NULL)
+	{
+		base_url.len = 0;
+		rc = ngx_http_vod_get_base_url(r, conf->segments_base_url, &empty_string, &base_url);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+		ngx_md5_update(md5, base_url.data, base_url.len);
+	}
+
+	return NGX_OK;
+}
+
 ngx_int_t
 ngx_http_vod_merge_string_parts(ngx_http_request_t* r, ngx_str_t* parts, uint32_t part_count, ngx_str_t* result)
 {
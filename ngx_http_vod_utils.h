@@ -24,6 +24,12 @@ ngx_int_t ngx_http_vod_get_base_url(
 	ngx_str_t* file_uri,
 	ngx_str_t* result);
 
+// Note: updates the md5 with the base url / segments base url, used for building cache keys
+ngx_int_t ngx_http_vod_update_base_url_key(
+	ngx_http_request_t* r,
+	ngx_http_vod_loc_conf_t* conf,
+	ngx_md5_t* md5);
+
 ngx_int_t ngx_http_vod_merge_string_parts(
 	ngx_http_request_t* r,
 	ngx_str_t* parts,
@@ -0,0 +1,329 @@
+#include "ngx_io_uring.h"
+#include <ngx_event.h>
+#include <liburing.h>
+#include <sys/eventfd.h>
+
+// constants
+#define NGX_IO_URING_ENTRIES (256)
+#define NGX_IO_URING_SUBMIT_RETRY_DELAY (10)		// ms, doubled on each retry
+#define NGX_IO_URING_SUBMIT_MAX_RETRIES (5)
+
+enum {
+	NGX_IO_URING_STATE_NONE,
+	NGX_IO_URING_STATE_READY,
+	NGX_IO_URING_STATE_FAILED,
+};
+
+// globals
+// Note: the ring is created on first use, one per worker process
+static struct io_uring ngx_io_uring_ring;
+static int ngx_io_uring_state = NGX_IO_URING_STATE_NONE;
+static int ngx_io_uring_eventfd = -1;
+static ngx_connection_t* ngx_io_uring_conn;
+static ngx_event_t ngx_io_uring_submit_event;
+static ngx_io_uring_request_t* ngx_io_uring_pending_reqs[NGX_IO_URING_ENTRIES];	// queued, not submitted
+static ngx_uint_t ngx_io_uring_pending;
+static ngx_uint_t ngx_io_uring_inflight;		// submitted, not completed
+static ngx_uint_t ngx_io_uring_submit_retries;
+
+static void
+ngx_io_uring_close()
+{
+	ngx_io_uring_state = NGX_IO_URING_STATE_FAILED;
+
+	if (ngx_io_uring_submit_event.timer_set)
+	{
+		ngx_del_timer(&ngx_io_uring_submit_event);
+	}
+
+	if (ngx_io_uring_submit_event.posted)
+	{
+		ngx_delete_posted_event(&ngx_io_uring_submit_event);
+	}
+
+	// Note: closes the eventfd as well
+	ngx_close_connection(ngx_io_uring_conn);
+	ngx_io_uring_conn = NULL;
+	ngx_io_uring_eventfd = -1;
+
+	io_uring_queue_exit(&ngx_io_uring_ring);
+}
+
+/*
+	called when the reads that were queued cannot be submitted, and no reads are in flight 
+	(so that no completion will retry the submission). the ring is closed, and the queued
+	reads are completed with an error, later reads fall back to regular reads
+*/
+static void
+ngx_io_uring_abort(ngx_log_t* log, ngx_err_t err)
+{
+	ngx_io_uring_request_t* reqs[NGX_IO_URING_ENTRIES];
+	ngx_uint_t count;
+	ngx_uint_t i;
+
+	ngx_log_error(NGX_LOG_ALERT, log, err,
+		"ngx_io_uring_abort: failed to submit %ui reads, falling back to regular reads", ngx_io_uring_pending);
+
+	count = ngx_io_uring_pending;
+	ngx_memcpy(reqs, ngx_io_uring_pending_reqs, count * sizeof(reqs[0]));
+	ngx_io_uring_pending = 0;
+
+	ngx_io_uring_close();
+
+	for (i = 0; i < count; i++)
+	{
+		reqs[i]->handler(reqs[i]->data, -err);
+	}
+}
+
+static void
+ngx_io_uring_submit(ngx_log_t* log)
+{
+	ngx_msec_t delay;
+	ngx_err_t err;
+	int rc;
+
+	if (ngx_io_uring_pending == 0)
+	{
+		return;
+	}
+
+	rc = io_uring_submit(&ngx_io_uring_ring);
+	if (rc < 0)
+	{
+		err = -rc;
+		ngx_log_error(NGX_LOG_ALERT, log, err,
+			"ngx_io_uring_submit: io_uring_submit failed, pending %ui", ngx_io_uring_pending);
+		rc = 0;
+	}
+	else
+	{
+		err = NGX_EAGAIN;
+		ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+			"ngx_io_uring_submit: submitted %d, pending %ui", rc, ngx_io_uring_pending);
+	}
+
+	// Note: the entries are consumed in order, the ones that were not submitted remain in the submission queue
+	ngx_io_uring_pending -= rc;
+	ngx_io_uring_inflight += rc;
+	if (ngx_io_uring_pending == 0)
+	{
+		ngx_io_uring_submit_retries = 0;
+		return;
+	}
+
+	ngx_memmove(ngx_io_uring_pending_reqs, ngx_io_uring_pending_reqs + rc, 
+		ngx_io_uring_pending * sizeof(ngx_io_uring_pending_reqs[0]));
+
+	// retry with a backoff
+	if (ngx_io_uring_submit_retries < NGX_IO_URING_SUBMIT_MAX_RETRIES)
+	{
+		if (!ngx_io_uring_submit_event.timer_set)
+		{
+			delay = NGX_IO_URING_SUBMIT_RETRY_DELAY << ngx_io_uring_submit_retries;
+			ngx_io_uring_submit_retries++;
+			ngx_add_timer(&ngx_io_uring_submit_event, delay);
+		}
+		return;
+	}
+
+	// the completions of the reads in flight will retry the submission
+	if (ngx_io_uring_inflight > 0)
+	{
+		return;
+	}
+
+	ngx_io_uring_abort(log, err);
+}
+
+static void
+ngx_io_uring_submit_handler(ngx_event_t* ev)
+{
+	if (ngx_io_uring_state == NGX_IO_URING_STATE_READY)
+	{
+		ngx_io_uring_submit(ev->log);
+	}
+}
+
+static void
+ngx_io_uring_event_handler(ngx_event_t* ev)
+{
+	ngx_io_uring_request_t* req;
+	struct io_uring_cqe* cqe;
+	uint64_t value;
+	ssize_t res;
+
+	// reset the eventfd counter, the event is edge triggered
+	if (read(ngx_io_uring_eventfd, &value, sizeof(value)) < 0 &&
+		ngx_errno != NGX_EAGAIN)
+	{
+		ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
+			"ngx_io_uring_event_handler: read failed");
+	}
+
+	while (ngx_io_uring_state == NGX_IO_URING_STATE_READY &&
+		io_uring_peek_cqe(&ngx_io_uring_ring, &cqe) == 0)
+	{
+		req = io_uring_cqe_get_data(cqe);
+		res = cqe->res;
+		io_uring_cqe_seen(&ngx_io_uring_ring, cqe);
+		ngx_io_uring_inflight--;
+
+		req->handler(req->data, res);
+	}
+
+	// the handlers may have queued more reads
+	if (ngx_io_uring_state == NGX_IO_URING_STATE_READY)
+	{
+		ngx_io_uring_submit(ev->log);
+	}
+}
+
+static ngx_int_t
+ngx_io_uring_init(ngx_log_t* log)
+{
+	ngx_event_t* rev;
+	int rc;
+
+	rc = io_uring_queue_init(NGX_IO_URING_ENTRIES, &ngx_io_uring_ring, 0);
+	if (rc < 0)
+	{
+		ngx_log_error(NGX_LOG_WARN, log, -rc,
+			"ngx_io_uring_init: io_uring_queue_init failed, falling back to regular reads");
+		return NGX_ERROR;
+	}
+
+	ngx_io_uring_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ngx_io_uring_eventfd == -1)
+	{
+		ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+			"ngx_io_uring_init: eventfd failed");
+		goto failed;
+	}
+
+	rc = io_uring_register_eventfd(&ngx_io_uring_ring, ngx_io_uring_eventfd);
+	if (rc < 0)
+	{
+		ngx_log_error(NGX_LOG_ALERT, log, -rc,
+			"ngx_io_uring_init: io_uring_register_eventfd failed");
+		goto failed;
+	}
+
+	ngx_io_uring_conn = ngx_get_connection(ngx_io_uring_eventfd, ngx_cycle->log);
+	if (ngx_io_uring_conn == NULL)
+	{
+		ngx_log_error(NGX_LOG_ALERT, log, 0,
+			"ngx_io_uring_init: ngx_get_connection failed");
+		goto failed;
+	}
+
+	ngx_io_uring_conn->log = ngx_cycle->log;
+
+	rev = ngx_io_uring_conn->read;
+	rev->handler = ngx_io_uring_event_handler;
+	rev->log = ngx_cycle->log;
+
+	if (ngx_add_event(rev, NGX_READ_EVENT, NGX_CLEAR_EVENT) != NGX_OK)
+	{
+		ngx_log_error(NGX_LOG_ALERT, log, 0,
+			"ngx_io_uring_init: ngx_add_event failed");
+		ngx_free_connection(ngx_io_uring_conn);
+		ngx_io_uring_conn = NULL;
+		goto failed;
+	}
+
+	ngx_io_uring_submit_event.handler = ngx_io_uring_submit_handler;
+	ngx_io_uring_submit_event.log = ngx_cycle->log;
+
+	return NGX_OK;
+
+failed:
+
+	if (ngx_io_uring_eventfd != -1)
+	{
+		close(ngx_io_uring_eventfd);
+		ngx_io_uring_eventfd = -1;
+	}
+
+	io_uring_queue_exit(&ngx_io_uring_ring);
+
+	return NGX_ERROR;
+}
+
+ngx_int_t
+ngx_io_uring_read(
+	ngx_io_uring_request_t* req,
+	ngx_fd_t fd,
+	u_char* buf,
+	size_t size,
+	off_t offset,
+	ngx_log_t* log)
+{
+	struct io_uring_sqe* sqe;
+
+	switch (ngx_io_uring_state)
+	{
+	case NGX_IO_URING_STATE_READY:
+		break;
+
+	case NGX_IO_URING_STATE_NONE:
+		if (ngx_io_uring_init(log) != NGX_OK)
+		{
+			ngx_io_uring_state = NGX_IO_URING_STATE_FAILED;
+			return NGX_DECLINED;
+		}
+
+		ngx_io_uring_state = NGX_IO_URING_STATE_READY;
+		break;
+
+	default:
+		return NGX_DECLINED;
+	}
+
+	sqe = io_uring_get_sqe(&ngx_io_uring_ring);
+	if (sqe == NULL)
+	{
+		// the submission queue is full, flush it and retry
+		ngx_io_uring_submit(log);
+		if (ngx_io_uring_state != NGX_IO_URING_STATE_READY)
+		{
+			return NGX_DECLINED;
+		}
+
+		sqe = io_uring_get_sqe(&ngx_io_uring_ring);
+		if (sqe == NULL)
+		{
+			return NGX_DECLINED;
+		}
+	}
+
+	io_uring_prep_read(sqe, fd, buf, size, offset);
+	io_uring_sqe_set_data(sqe, req);
+	ngx_io_uring_pending_reqs[ngx_io_uring_pending] = req;
+
+	// Note: the submission is deferred to a posted event, in order to submit all the reads
+	//		that are issued during the current event loop iteration in a single system call
+	ngx_io_uring_pending++;
+	if (!ngx_io_uring_submit_event.posted)
+	{
+		ngx_post_event(&ngx_io_uring_submit_event, &ngx_posted_events);
+	}
+
+	return NGX_AGAIN;
+}
+
+void
+ngx_io_uring_exit_process()
+{
+	if (ngx_io_uring_state != NGX_IO_URING_STATE_READY)
+	{
+		return;
+	}
+
+	ngx_io_uring_state = NGX_IO_URING_STATE_FAILED;
+
+	close(ngx_io_uring_eventfd);
+	ngx_io_uring_eventfd = -1;
+
+	io_uring_queue_exit(&ngx_io_uring_ring);
+}
@@ -0,0 +1,31 @@
+#ifndef _NGX_IO_URING_H_INCLUDED_
+#define _NGX_IO_URING_H_INCLUDED_
+
+// includes
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+// typedefs
+typedef void(*ngx_io_uring_handler_t)(void* data, ssize_t res);
+
+typedef struct {
+	ngx_io_uring_handler_t handler;
+	void* data;
+} ngx_io_uring_request_t;
+
+// functions
+
+// Note: returns NGX_AGAIN when the read was queued, the handler is called on completion with 
+//		the number of bytes read, or a negative errno. NGX_DECLINED is returned when io_uring 
+//		is unavailable, in this case the caller should perform the read by other means
+ngx_int_t ngx_io_uring_read(
+	ngx_io_uring_request_t* req,
+	ngx_fd_t fd,
+	u_char* buf,
+	size_t size,
+	off_t offset,
+	ngx_log_t* log);
+
+void ngx_io_uring_exit_process();
+
+#endif // _NGX_IO_URING_H_INCLUDED_
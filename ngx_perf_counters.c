@@ -14,6 +14,13 @@ const ngx_str_t perf_counters_close_tags[] = {
 #undef PC
 };
 
+const ngx_str_t perf_counters_upstream_names[] = {
+	ngx_string("upstream"),
+	ngx_string("remote_upstream"),
+	ngx_string("drm_upstream"),
+	ngx_string("fallback_upstream"),
+};
+
 static ngx_int_t
 ngx_perf_counters_init(ngx_shm_zone_t *shm_zone, void *data)
 {
@@ -67,6 +67,9 @@ typedef struct timeval ngx_tick_count_t;
 
 #define ngx_perf_counter_copy(target, source)	target = source
 
+#define ngx_perf_counter_get_upstream(state, type)					\
+	((state) != NULL ? &(state)->upstreams[type] : NULL)
+
 // typedefs
 enum {
 #define PC(id, name) PC_##id,
@@ -88,11 +91,22 @@ typedef struct {
 #define ngx_perf_counter_start(ctx)
 #define ngx_perf_counter_end(state, ctx, type)
 #define ngx_perf_counter_copy(target, source)
+#define ngx_perf_counter_get_upstream(state, type) (NULL)
 
 #define PC_COUNT (0)
 
 #endif // NGX_PERF_COUNTERS_ENABLED
 
+// upstream counters
+enum {
+	PU_UPSTREAM,
+	PU_REMOTE_UPSTREAM,
+	PU_DRM_UPSTREAM,
+	PU_FALLBACK_UPSTREAM,
+
+	PU_COUNT
+};
+
 // typedefs
 typedef struct {
 	ngx_atomic_t sum;
@@ -102,13 +116,22 @@ typedef struct {
 	ngx_atomic_t max_pid;
 } ngx_perf_counter_t;
 
+typedef struct {
+	ngx_atomic_t requests;
+	ngx_atomic_t errors;
+	ngx_atomic_t bytes;
+	ngx_atomic_t reused_connections;	// requests sent on a cached keepalive connection
+} ngx_perf_upstream_counter_t;
+
 typedef struct {
 	ngx_perf_counter_t counters[PC_COUNT];
+	ngx_perf_upstream_counter_t upstreams[PU_COUNT];
 } ngx_perf_counters_t;
 
 // globals
 extern const ngx_str_t perf_counters_open_tags[];
 extern const ngx_str_t perf_counters_close_tags[];
+extern const ngx_str_t perf_counters_upstream_names[];
 
 // functions
 ngx_shm_zone_t* ngx_perf_counters_create_zone(ngx_conf_t *cf, ngx_str_t *name, void *tag);
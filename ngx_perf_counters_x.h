@@ -7,6 +7,8 @@ PC(OPEN_FILE,				open_file)
 PC(ASYNC_OPEN_FILE,			async_open_file)
 PC(READ_FILE,				read_file)
 PC(ASYNC_READ_FILE,			async_read_file)
+PC(READ_FILE_QUEUE,			read_file_queue)
+PC(READ_FILE_THREAD,		read_file_thread)
 PC(MEDIA_PARSE,				media_parse)
 PC(BUILD_MANIFEST,			build_manifest)
 PC(INIT_FRAME_PROCESS,		init_frame_processing)
@@ -0,0 +1,219 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <ngx_core.h>
+#include <vod/mp4/mp4_aes_ctr.h>
+
+// macros
+#define RAND(min, max) (rand() % ((max) - (min) + 1) + (min))
+
+#define TEST_BUFFER_SIZE (1024 * 1024)
+#define BENCHMARK_TOTAL_SIZE ((uint64_t)4 * 1024 * 1024 * 1024)
+#define BENCHMARK_SAMPLE_SIZE (4096)
+
+#define assert(cond) if (!(cond)) { printf("Error: assertion failed, file=%s line=%d\n", __FILE__, __LINE__); success = FALSE; }
+
+// globals
+volatile ngx_cycle_t  *ngx_cycle;
+ngx_log_t ngx_log;
+
+#if (NGX_HAVE_VARIADIC_MACROS)
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+
+#else
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, va_list args)
+
+#endif
+{
+}
+
+static u_char key[MP4_AES_CTR_KEY_SIZE] = {
+	0x0b, 0x63, 0x92, 0xd0, 0x4f, 0x24, 0x8d, 0x83, 0x1c, 0x3a, 0x54, 0x6e, 0x97, 0x11, 0xe2, 0x5d };
+
+// reference implementation - encrypts the counters with aes-ecb and xors byte by byte
+static bool_t
+reference_aes_ctr(u_char* iv, u_char* dest, const u_char* src, size_t size)
+{
+	EVP_CIPHER_CTX* cipher;
+	u_char counter[AES_BLOCK_SIZE];
+	u_char encrypted[AES_BLOCK_SIZE];
+	size_t i;
+	int out_size;
+
+	cipher = EVP_CIPHER_CTX_new();
+	if (cipher == NULL)
+	{
+		return FALSE;
+	}
+
+	if (1 != EVP_EncryptInit_ex(cipher, EVP_aes_128_ecb(), NULL, key, NULL))
+	{
+		EVP_CIPHER_CTX_free(cipher);
+		return FALSE;
+	}
+
+	vod_memcpy(counter, iv, MP4_AES_CTR_IV_SIZE);
+	vod_memzero(counter + MP4_AES_CTR_IV_SIZE, sizeof(counter) - MP4_AES_CTR_IV_SIZE);
+
+	for (i = 0; i < size; i++)
+	{
+		if ((i % AES_BLOCK_SIZE) == 0)
+		{
+			EVP_EncryptUpdate(cipher, encrypted, &out_size, counter, AES_BLOCK_SIZE);
+			mp4_aes_ctr_increment_be64(counter + MP4_AES_CTR_IV_SIZE);
+		}
+
+		dest[i] = src[i] ^ encrypted[i % AES_BLOCK_SIZE];
+	}
+
+	EVP_CIPHER_CTX_free(cipher);
+	return TRUE;
+}
+
+static bool_t
+init_request_context(request_context_t* request_context)
+{
+	vod_memzero(request_context, sizeof(*request_context));
+	request_context->log = &ngx_log;
+	request_context->pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &ngx_log);
+	return request_context->pool != NULL;
+}
+
+static bool_t
+test_aes_ctr(u_char* clear, u_char* expected, u_char* actual)
+{
+	request_context_t request_context;
+	mp4_aes_ctr_state_t state;
+	bool_t success = TRUE;
+	u_char iv[MP4_AES_CTR_IV_SIZE];
+	size_t sample_size;
+	size_t chunk_size;
+	size_t pos;
+	int i;
+
+	if (!init_request_context(&request_context))
+	{
+		return FALSE;
+	}
+
+	assert(mp4_aes_ctr_init(&state, &request_context, key) == VOD_OK);
+
+	for (i = 0; i < 1000; i++)
+	{
+		sample_size = RAND(1, 64 * 1024);
+		vod_memzero(iv, sizeof(iv));
+		iv[7] = i;
+		iv[6] = i >> 8;
+
+		assert(reference_aes_ctr(iv, expected, clear, sample_size));
+
+		// process the sample in chunks of random sizes
+		assert(mp4_aes_ctr_set_iv(&state, iv) == VOD_OK);
+		for (pos = 0; pos < sample_size; pos += chunk_size)
+		{
+			chunk_size = vod_min((size_t)RAND(1, 100), sample_size - pos);
+			assert(mp4_aes_ctr_process(&state, actual + pos, clear + pos, chunk_size) == VOD_OK);
+		}
+
+		assert(vod_memcmp(actual, expected, sample_size) == 0);
+
+		// in place
+		vod_memcpy(actual, clear, sample_size);
+		assert(mp4_aes_ctr_set_iv(&state, iv) == VOD_OK);
+		assert(mp4_aes_ctr_process(&state, actual, actual, sample_size) == VOD_OK);
+		assert(vod_memcmp(actual, expected, sample_size) == 0);
+	}
+
+	ngx_destroy_pool(request_context.pool);
+
+	return success;
+}
+
+static void
+benchmark_aes_ctr(u_char* clear, u_char* actual)
+{
+	request_context_t request_context;
+	mp4_aes_ctr_state_t state;
+	struct timeval start;
+	struct timeval end;
+	uint64_t processed;
+	u_char iv[MP4_AES_CTR_IV_SIZE];
+	double seconds;
+	size_t pos;
+
+	if (!init_request_context(&request_context))
+	{
+		return;
+	}
+
+	if (mp4_aes_ctr_init(&state, &request_context, key) != VOD_OK)
+	{
+		printf("Error: mp4_aes_ctr_init failed\n");
+		ngx_destroy_pool(request_context.pool);
+		return;
+	}
+
+	vod_memzero(iv, sizeof(iv));
+
+	gettimeofday(&start, NULL);
+
+	// simulate cenc encryption - a new iv per sample, the sample written in a single call
+	for (processed = 0; processed < BENCHMARK_TOTAL_SIZE; processed += TEST_BUFFER_SIZE)
+	{
+		for (pos = 0; pos < TEST_BUFFER_SIZE; pos += BENCHMARK_SAMPLE_SIZE)
+		{
+			assert(mp4_aes_ctr_set_iv(&state, iv) == VOD_OK);
+			mp4_aes_ctr_increment_be64(iv);
+			mp4_aes_ctr_process(&state, actual + pos, clear + pos, BENCHMARK_SAMPLE_SIZE);
+		}
+	}
+
+	gettimeofday(&end, NULL);
+
+	seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("processed %" PRIu64 " bytes in %.3f sec, %.2f GB/s\n",
+		processed, seconds, processed / seconds / (1024 * 1024 * 1024));
+
+	ngx_destroy_pool(request_context.pool);
+}
+
+int main()
+{
+	u_char* expected;
+	u_char* actual;
+	u_char* clear;
+	size_t i;
+
+	srand(time(NULL));
+
+	clear = malloc(TEST_BUFFER_SIZE);
+	expected = malloc(TEST_BUFFER_SIZE);
+	actual = malloc(TEST_BUFFER_SIZE);
+	if (clear == NULL || expected == NULL || actual == NULL)
+	{
+		printf("Error: allocation failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < TEST_BUFFER_SIZE; i++)
+	{
+		clear[i] = rand();
+	}
+
+	if (!test_aes_ctr(clear, expected, actual))
+	{
+		return 1;
+	}
+
+	printf("aes ctr test passed\n");
+
+	benchmark_aes_ctr(clear, actual);
+
+	return 0;
+}
@@ -9,7 +9,8 @@
 // globals
 ngx_time_t ngx_time;
 ngx_shm_zone_t shm_zone;
-volatile ngx_cycle_t  *ngx_cycle;
+ngx_cycle_t cycle;
+volatile ngx_cycle_t  *ngx_cycle = &cycle;
 volatile ngx_time_t	 *ngx_cached_time = &ngx_time;
 
 // nginx function stubs
@@ -157,6 +158,7 @@ int run_test_cycle(time_t seed, size_t cache_size, int iterations, int size_fact
 	ngx_buffer_cache_stats_t stats;
 	u_char key[BUFFER_CACHE_KEY_SIZE];
 	ngx_str_t fetch_buffer;
+	uint32_t token;
 	u_char* store_buffer;
 	size_t* sizes_buffer;
 	size_t size;
@@ -230,8 +232,10 @@ int run_test_cycle(time_t seed, size_t cache_size, int iterations, int size_fact
 		for (j = min_existing_index; j <= i; j++)
 		{
 			((uint32_t*)&key)[0] = j;
-			if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer))
+			if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
 			{
+				ngx_buffer_cache_release(cache, key, token);
+
 				if (sizes_buffer[j] != fetch_buffer.len)
 				{
 					printf("Error: invalid buffer size\n");
@@ -286,10 +290,552 @@ int run_test_cycle(time_t seed, size_t cache_size, int iterations, int size_fact
 	return 1;
 }
 
+// simulates concurrent requests for a single segment, only one of them should fill the cache
+int run_lock_test(int request_count)
+{
+	ngx_buffer_cache_stats_t stats;
+	ngx_buffer_cache_t *cache;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	u_char segment[1024];
+	ngx_str_t fetch_buffer;
+	uint32_t token;
+	int fills = 0;
+	int hits = 0;
+	int i;
+
+	printf("starting lock test - request count %d\n", request_count);
+
+	if (!init_buffer_cache(1024 * 1024))
+	{
+		printf("Error: failed to initialize the buffer cache\n");
+		return 0;
+	}
+
+	cache = shm_zone.data;
+	ngx_time.sec = 1000;
+	ngx_memzero(key, sizeof(key));
+	generate_random_buffer(1, segment, sizeof(segment));
+
+	// all the requests miss the cache before the segment is stored, only the first gets the lock
+	for (i = 0; i < request_count; i++)
+	{
+		if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+		{
+			printf("Error: unexpected cache hit\n");
+			return 0;
+		}
+
+		if (ngx_buffer_cache_lock(cache, key, 10))
+		{
+			fills++;
+		}
+	}
+
+	if (fills != 1)
+	{
+		printf("Error: unexpected number of fills, actual=%d expected=1\n", fills);
+		return 0;
+	}
+
+	// the lock holder stores the segment and releases the lock, the waiting requests get it from the cache
+	if (!ngx_buffer_cache_store(cache, key, segment, sizeof(segment)))
+	{
+		printf("Error: store failed\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_unlock(cache, key);
+
+	for (i = 1; i < request_count; i++)
+	{
+		if (!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+		{
+			continue;
+		}
+
+		if (fetch_buffer.len != sizeof(segment) ||
+			!validate_random_buffer(1, fetch_buffer.data, fetch_buffer.len))
+		{
+			printf("Error: invalid segment\n");
+			return 0;
+		}
+
+		ngx_buffer_cache_release(cache, key, token);
+		hits++;
+	}
+
+	if (hits != request_count - 1)
+	{
+		printf("Error: unexpected number of hits, actual=%d expected=%d\n", hits, request_count - 1);
+		return 0;
+	}
+
+	ngx_buffer_cache_get_stats(cache, &stats);
+	if (stats.lock_ok != 1 || stats.lock_busy != (ngx_atomic_t)request_count - 1)
+	{
+		printf("Error: invalid lock stats, lock_ok=%lu lock_busy=%lu\n", stats.lock_ok, stats.lock_busy);
+		return 0;
+	}
+
+	// a lock that is not released (e.g. the process was killed) is granted again once it expires
+	key[0] = 1;
+	if (!ngx_buffer_cache_lock(cache, key, 10) ||
+		ngx_buffer_cache_lock(cache, key, 10))
+	{
+		printf("Error: lock failed\n");
+		return 0;
+	}
+
+	ngx_time.sec += 10;
+	if (!ngx_buffer_cache_lock(cache, key, 10))
+	{
+		printf("Error: expired lock was not granted\n");
+		return 0;
+	}
+
+	free_buffer_cache();
+
+	printf("lock test passed\n");
+
+	return 1;
+}
+
+static ngx_flag_t
+is_local_buffer(ngx_str_t* buffer)
+{
+	return buffer->data < shm_zone.shm.addr || buffer->data >= shm_zone.shm.addr + shm_zone.shm.size;
+}
+
+// verifies that local copies are not returned after the shared entry is evicted or the cache is reset
+int run_local_test()
+{
+	ngx_buffer_cache_stats_t stats;
+	ngx_buffer_cache_t *cache;
+	u_char filler_key[BUFFER_CACHE_KEY_SIZE];
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	u_char buffer[1024];
+	ngx_str_t fetch_buffer;
+	uint32_t token;
+	int i;
+
+	printf("starting local cache test\n");
+
+	if (!init_buffer_cache(1024 * 1024))
+	{
+		printf("Error: failed to initialize the buffer cache\n");
+		return 0;
+	}
+
+	cache = shm_zone.data;
+	ngx_buffer_cache_set_local_size(cache, 64 * 1024);
+	ngx_time.sec = 1000;
+	ngx_memzero(key, sizeof(key));
+	ngx_memzero(filler_key, sizeof(filler_key));
+	filler_key[0] = 1;
+	generate_random_buffer(1, buffer, sizeof(buffer));
+
+	if (!ngx_buffer_cache_store(cache, key, buffer, sizeof(buffer)))
+	{
+		printf("Error: store failed\n");
+		return 0;
+	}
+
+	// the first fetch copies the entry to the local cache, the second is a local hit
+	for (i = 0; i < 2; i++)
+	{
+		if (!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token) ||
+			!is_local_buffer(&fetch_buffer) ||
+			!validate_random_buffer(1, fetch_buffer.data, fetch_buffer.len))
+		{
+			printf("Error: local fetch failed\n");
+			return 0;
+		}
+
+		ngx_buffer_cache_release(cache, key, token);
+	}
+
+	// evict the shared entry
+	ngx_buffer_cache_get_stats(cache, &stats);
+	for (i = 0; stats.evicted == 0; i++)
+	{
+		((uint32_t*)&filler_key)[1] = i;
+		if (!ngx_buffer_cache_store(cache, filler_key, buffer, sizeof(buffer)))
+		{
+			printf("Error: filler store failed\n");
+			return 0;
+		}
+
+		ngx_buffer_cache_get_stats(cache, &stats);
+	}
+
+	if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+	{
+		printf("Error: local copy of an evicted entry was returned\n");
+		return 0;
+	}
+
+	// store again and reset the cache
+	if (!ngx_buffer_cache_store(cache, key, buffer, sizeof(buffer)) ||
+		!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+	{
+		printf("Error: store failed\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	cache->sh->reset = 1;
+	ngx_time.sec += CACHE_LOCK_EXPIRATION;
+	filler_key[0] = 2;
+	if (!ngx_buffer_cache_store(cache, filler_key, buffer, sizeof(buffer)))
+	{
+		printf("Error: store after reset failed\n");
+		return 0;
+	}
+
+	if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+	{
+		printf("Error: local copy was returned after reset\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_get_stats(cache, &stats);
+	if (stats.local_hit != 1)
+	{
+		printf("Error: invalid local_hit value, actual=%lu expected=1\n", stats.local_hit);
+		return 0;
+	}
+
+	free_buffer_cache();
+
+	printf("local cache test passed\n");
+
+	return 1;
+}
+
+// verifies that expired entries are replaced when stale entries are kept, and that cached errors expire
+int run_stale_test()
+{
+	ngx_buffer_cache_entry_t* entry;
+	ngx_buffer_cache_t *cache;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	u_char buffer[1024];
+	ngx_str_t fetch_buffer;
+	ngx_int_t status;
+	uint32_t stale_token;
+	uint32_t token;
+
+	printf("starting stale cache test\n");
+
+	if (!init_buffer_cache(1024 * 1024))
+	{
+		printf("Error: failed to initialize the buffer cache\n");
+		return 0;
+	}
+
+	cache = shm_zone.data;
+	cache->expiration = 60;
+	ngx_buffer_cache_set_local_size(cache, 64 * 1024);
+	ngx_buffer_cache_set_stale_time(cache, 60);
+	ngx_buffer_cache_set_error_expiration(cache, 10);
+	ngx_time.sec = 1000;
+	ngx_memzero(key, sizeof(key));
+	generate_random_buffer(1, buffer, sizeof(buffer));
+
+	// store and copy the entry to the local cache
+	if (!ngx_buffer_cache_store(cache, key, buffer, sizeof(buffer)) ||
+		!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+	{
+		printf("Error: store failed\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	// expire the entry, and replace it while the stale copy is in use
+	ngx_time.sec += 60;
+	if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token) ||
+		!ngx_buffer_cache_fetch_stale(cache, key, &fetch_buffer, &stale_token))
+	{
+		printf("Error: stale fetch failed\n");
+		return 0;
+	}
+
+	entry = cache->sh->entries_start + (stale_token - 1);
+
+	generate_random_buffer(2, buffer, sizeof(buffer));
+	if (!ngx_buffer_cache_store(cache, key, buffer, sizeof(buffer)))
+	{
+		printf("Error: failed to replace the expired entry\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token) ||
+		!validate_random_buffer(2, fetch_buffer.data, fetch_buffer.len))
+	{
+		printf("Error: the local copy of the replaced entry was returned\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	ngx_buffer_cache_release(cache, key, stale_token);
+	if (entry->state != CES_DETACHED || entry->ref_count != 0)
+	{
+		printf("Error: the detached entry was not released\n");
+		return 0;
+	}
+
+	// errors expire after the error expiration, and can then be stored again
+	if (!ngx_buffer_cache_store_error(cache, key, 502) ||
+		!ngx_buffer_cache_fetch_error(cache, key, &status) ||
+		status != 502)
+	{
+		printf("Error: failed to fetch the stored error\n");
+		return 0;
+	}
+
+	ngx_time.sec += 9;
+	if (!ngx_buffer_cache_fetch_error(cache, key, &status))
+	{
+		printf("Error: the error expired too early\n");
+		return 0;
+	}
+
+	ngx_time.sec += 1;
+	if (ngx_buffer_cache_fetch_error(cache, key, &status))
+	{
+		printf("Error: the error did not expire\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_store_error(cache, key, 404) ||
+		!ngx_buffer_cache_fetch_error(cache, key, &status) ||
+		status != 404)
+	{
+		printf("Error: failed to replace the expired error\n");
+		return 0;
+	}
+
+	free_buffer_cache();
+
+	printf("stale cache test passed\n");
+
+	return 1;
+}
+
+// verifies that an entry is replaced regardless of its write time, and that its local copy is not returned
+int run_replace_test()
+{
+	ngx_buffer_cache_t *cache;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	u_char buffer[1024];
+	ngx_str_t store_buffer;
+	ngx_str_t fetch_buffer;
+	uint32_t token;
+	uint64_t first_id;
+	uint64_t id;
+
+	printf("starting replace test\n");
+
+	if (!init_buffer_cache(1024 * 1024))
+	{
+		printf("Error: failed to initialize the buffer cache\n");
+		return 0;
+	}
+
+	cache = shm_zone.data;
+	ngx_buffer_cache_set_local_size(cache, 64 * 1024);
+	ngx_time.sec = 1000;
+	ngx_memzero(key, sizeof(key));
+	generate_random_buffer(1, buffer, sizeof(buffer));
+
+	// store and copy the entry to the local cache
+	if (!ngx_buffer_cache_store(cache, key, buffer, sizeof(buffer)) ||
+		!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+	{
+		printf("Error: store failed\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	if (!ngx_buffer_cache_get_entry_id(cache, key, &first_id))
+	{
+		printf("Error: failed to get the entry id\n");
+		return 0;
+	}
+
+	// a store does not overwrite the entry, a replace does
+	generate_random_buffer(2, buffer, sizeof(buffer));
+	store_buffer.data = buffer;
+	store_buffer.len = sizeof(buffer);
+
+	if (ngx_buffer_cache_store(cache, key, buffer, sizeof(buffer)) ||
+		!ngx_buffer_cache_get_entry_id(cache, key, &id) || id != first_id)
+	{
+		printf("Error: the existing entry was overwritten\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_replace_gather(cache, key, &store_buffer, 1))
+	{
+		printf("Error: failed to replace the entry\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_get_entry_id(cache, key, &id) || id == first_id)
+	{
+		printf("Error: the entry id did not change after the replace\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token) ||
+		!validate_random_buffer(2, fetch_buffer.data, fetch_buffer.len))
+	{
+		printf("Error: the local copy of the replaced entry was returned\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	free_buffer_cache();
+
+	printf("replace test passed\n");
+
+	return 1;
+}
+
+// verifies that a gathered segment is fetched intact, and that a held entry is not evicted while it is touched
+int run_segment_test()
+{
+	ngx_buffer_cache_t *cache;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	u_char filler_key[BUFFER_CACHE_KEY_SIZE];
+	u_char header[16];
+	u_char body[3][20000];
+	ngx_str_t buffers[4];
+	ngx_str_t fetch_buffer;
+	ngx_flag_t stored;
+	uint32_t token;
+	uint32_t filler_token;
+	int i;
+
+	printf("starting segment cache test\n");
+
+	if (!init_buffer_cache(1024 * 1024))
+	{
+		printf("Error: failed to initialize the buffer cache\n");
+		return 0;
+	}
+
+	cache = shm_zone.data;
+	ngx_time.sec = 1000;
+	ngx_memzero(key, sizeof(key));
+
+	// store the segment from several output buffers
+	generate_random_buffer(1, header, sizeof(header));
+	buffers[0].data = header;
+	buffers[0].len = sizeof(header);
+	for (i = 0; i < 3; i++)
+	{
+		generate_random_buffer(2 + i, body[i], sizeof(body[i]));
+		buffers[i + 1].data = body[i];
+		buffers[i + 1].len = sizeof(body[i]);
+	}
+
+	if (!ngx_buffer_cache_store_gather(cache, key, buffers, 4))
+	{
+		printf("Error: store failed\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token) ||
+		fetch_buffer.len != sizeof(header) + sizeof(body))
+	{
+		printf("Error: fetch failed\n");
+		return 0;
+	}
+
+	if (!validate_random_buffer(1, fetch_buffer.data, sizeof(header)))
+	{
+		printf("Error: invalid segment header\n");
+		return 0;
+	}
+
+	for (i = 0; i < 3; i++)
+	{
+		if (!validate_random_buffer(2 + i, fetch_buffer.data + sizeof(header) + i * sizeof(body[i]), sizeof(body[i])))
+		{
+			printf("Error: invalid segment part %d\n", i);
+			return 0;
+		}
+	}
+
+	// fill the cache while the segment is held, touching it before the lock expires
+	ngx_memzero(filler_key, sizeof(filler_key));
+	stored = 1;
+	for (i = 0; i < 64 && stored; i++)
+	{
+		ngx_time.sec += ENTRY_LOCK_EXPIRATION - 1;
+		ngx_buffer_cache_touch(cache, key, token);
+
+		filler_key[0] = i + 1;
+		stored = ngx_buffer_cache_store(cache, filler_key, body[0], sizeof(body[0]));
+	}
+
+	if (stored)
+	{
+		printf("Error: the cache did not fill up\n");
+		return 0;
+	}
+
+	if (!validate_random_buffer(2, fetch_buffer.data + sizeof(header), sizeof(body[0])))
+	{
+		printf("Error: the held segment was overwritten\n");
+		return 0;
+	}
+
+	// once released, the segment can be evicted
+	ngx_buffer_cache_release(cache, key, token);
+
+	if (!ngx_buffer_cache_store(cache, filler_key, body[0], sizeof(body[0])))
+	{
+		printf("Error: the released segment was not evicted\n");
+		return 0;
+	}
+
+	if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+	{
+		printf("Error: the evicted segment was returned\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_fetch(cache, filler_key, &fetch_buffer, &filler_token))
+	{
+		printf("Error: failed to fetch the filler entry\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, filler_key, filler_token);
+
+	free_buffer_cache();
+
+	printf("segment cache test passed\n");
+
+	return 1;
+}
+
 int main()
 {
 	setbuf(stdout, NULL);		// disable stdout buffering (for progress indication)
 	
+	if (!run_lock_test(16) || !run_local_test() || !run_stale_test() || !run_replace_test() || 
+		!run_segment_test())
+	{
+		return 1;
+	}
+
 	while (run_test_cycle(time(NULL), RAND(2 * 1024 * 1024, 16 * 1024 * 1024), 1000, 1 << RAND(0, 6)));
 
 	return 0;
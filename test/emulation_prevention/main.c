@@ -0,0 +1,276 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <ngx_core.h>
+#include <vod/avc_hevc_parser.h>
+
+// macros
+#define RAND(min, max) (rand() % ((max) - (min) + 1) + (min))
+
+#define TEST_BUFFER_SIZE (1024 * 1024)
+#define BENCHMARK_TOTAL_SIZE ((uint64_t)4 * 1024 * 1024 * 1024)
+
+#define assert(cond) if (!(cond)) { printf("Error: assertion failed, file=%s line=%d\n", __FILE__, __LINE__); success = FALSE; }
+
+// globals
+volatile ngx_cycle_t  *ngx_cycle;
+ngx_log_t ngx_log;
+
+#if (NGX_HAVE_VARIADIC_MACROS)
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+
+#else
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, va_list args)
+
+#endif
+{
+}
+
+// reference implementations - byte by byte scanning
+static const u_char*
+reference_find_zero_pair(const u_char* cur_pos, const u_char* end_pos)
+{
+	for (; cur_pos + 1 < end_pos; cur_pos++)
+	{
+		if (cur_pos[0] == 0 && cur_pos[1] == 0)
+		{
+			return cur_pos;
+		}
+	}
+
+	return end_pos;
+}
+
+static uint32_t
+reference_encode_bytes(const u_char* cur_pos, const u_char* end_pos)
+{
+	uint32_t result = 0;
+
+	end_pos -= 2;
+	for (; cur_pos < end_pos; cur_pos++)
+	{
+		if (cur_pos[0] == 0 && cur_pos[1] == 0 && cur_pos[2] <= 3)
+		{
+			result++;
+			cur_pos += 2;
+		}
+	}
+
+	return result;
+}
+
+static size_t
+reference_decode(u_char* output, const u_char* buffer, size_t size)
+{
+	const u_char* cur_pos;
+	const u_char* end_pos = buffer + size;
+	const u_char* limit = end_pos - 2;
+	u_char* start = output;
+
+	for (cur_pos = buffer; cur_pos < limit; )
+	{
+		if (cur_pos[0] == 0 && cur_pos[1] == 0 && cur_pos[2] == 3)
+		{
+			*output++ = 0;
+			*output++ = 0;
+			cur_pos += 3;
+		}
+		else
+		{
+			*output++ = *cur_pos++;
+		}
+	}
+
+	while (cur_pos < end_pos)
+	{
+		*output++ = *cur_pos++;
+	}
+
+	return output - start;
+}
+
+static bool_t
+init_request_context(request_context_t* request_context)
+{
+	vod_memzero(request_context, sizeof(*request_context));
+	request_context->log = &ngx_log;
+	request_context->pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &ngx_log);
+	return request_context->pool != NULL;
+}
+
+static void
+fill_nal_like(u_char* buffer, size_t size)
+{
+	size_t i;
+
+	// mostly small values, in order to generate many zero runs and emulation prevention sequences
+	for (i = 0; i < size; i++)
+	{
+		buffer[i] = rand() % 3 == 0 ? rand() : RAND(0, 3);
+	}
+}
+
+static bool_t
+test_emulation_prevention(u_char* buffer, u_char* expected)
+{
+	request_context_t request_context;
+	bit_reader_state_t reader;
+	const u_char* cur_pos;
+	const u_char* end_pos;
+	bool_t success = TRUE;
+	size_t expected_size;
+	size_t offset;
+	size_t size;
+	int i;
+
+	if (!init_request_context(&request_context))
+	{
+		return FALSE;
+	}
+
+	for (i = 0; i < 100000; i++)
+	{
+		offset = RAND(0, 31);
+		size = RAND(0, 300);
+		fill_nal_like(buffer + offset, size);
+		cur_pos = buffer + offset;
+		end_pos = cur_pos + size;
+
+		// find zero pair - all the pairs in the buffer
+		for (; ; cur_pos++)
+		{
+			assert(avc_hevc_parser_find_zero_pair(cur_pos, end_pos) == reference_find_zero_pair(cur_pos, end_pos));
+
+			cur_pos = reference_find_zero_pair(cur_pos, end_pos);
+			if (cur_pos >= end_pos)
+			{
+				break;
+			}
+		}
+
+		// encode bytes
+		assert(avc_hevc_parser_emulation_prevention_encode_bytes(buffer + offset, end_pos) ==
+			reference_encode_bytes(buffer + offset, end_pos));
+
+		// decode
+		expected_size = reference_decode(expected, buffer + offset, size);
+		assert(avc_hevc_parser_emulation_prevention_decode(&request_context, &reader, buffer + offset, size) == VOD_OK);
+		assert((size_t)(reader.stream.end_pos - reader.stream.cur_pos) == expected_size);
+		assert(vod_memcmp(reader.stream.cur_pos, expected, expected_size) == 0);
+	}
+
+	// find zero pair - exact positions
+	for (i = 0; i < 10000; i++)
+	{
+		offset = RAND(0, 31);
+		size = RAND(0, 100);
+		vod_memset(buffer + offset, 0xff, size);
+		if (size >= 2 && rand() % 4 != 0)
+		{
+			buffer[offset + RAND(0, size - 2)] = 0;
+			buffer[offset + RAND(0, size - 1)] = 0;
+		}
+
+		assert(avc_hevc_parser_find_zero_pair(buffer + offset, buffer + offset + size) ==
+			reference_find_zero_pair(buffer + offset, buffer + offset + size));
+	}
+
+	ngx_destroy_pool(request_context.pool);
+
+	return success;
+}
+
+static void
+benchmark_scan(const char* name, uint32_t (*scan)(const u_char*, const u_char*), u_char* buffer, size_t size)
+{
+	struct timeval start;
+	struct timeval end;
+	uint64_t processed;
+	uint32_t result = 0;
+	double seconds;
+
+	gettimeofday(&start, NULL);
+
+	for (processed = 0; processed < BENCHMARK_TOTAL_SIZE; processed += size)
+	{
+		result += scan(buffer, buffer + size);
+	}
+
+	gettimeofday(&end, NULL);
+
+	seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("%s: processed %" PRIu64 " bytes in %.3f sec, %.2f GB/s (%u)\n",
+		name, processed, seconds, processed / seconds / (1024 * 1024 * 1024), result);
+}
+
+static size_t
+read_file(const char* path, u_char* buffer, size_t size)
+{
+	FILE* fp;
+	size_t result;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+	{
+		printf("Error: failed to open %s\n", path);
+		return 0;
+	}
+
+	result = fread(buffer, 1, size, fp);
+	fclose(fp);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	u_char* expected;
+	u_char* buffer;
+	size_t size;
+	size_t i;
+
+	srand(time(NULL));
+
+	buffer = malloc(TEST_BUFFER_SIZE);
+	expected = malloc(TEST_BUFFER_SIZE);
+	if (buffer == NULL || expected == NULL)
+	{
+		printf("Error: allocation failed\n");
+		return 1;
+	}
+
+	if (!test_emulation_prevention(buffer, expected))
+	{
+		return 1;
+	}
+
+	printf("emulation prevention test passed\n");
+
+	// benchmark on the provided bitstream (e.g. an h264/h265 elementary stream), or on random data
+	if (argc > 1)
+	{
+		size = read_file(argv[1], buffer, TEST_BUFFER_SIZE);
+		if (size == 0)
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		size = TEST_BUFFER_SIZE;
+		for (i = 0; i < size; i++)
+		{
+			buffer[i] = rand();
+		}
+	}
+
+	benchmark_scan("reference", reference_encode_bytes, buffer, size);
+	benchmark_scan("optimized", avc_hevc_parser_emulation_prevention_encode_bytes, buffer, size);
+
+	return 0;
+}
@@ -0,0 +1,17 @@
+#!/bin/bash
+
+if [ -z "$NGX_ROOT" ]; then
+	echo "NGX_ROOT not set"
+	exit 1
+fi
+
+if [ -z "$VOD_ROOT" ]; then
+	echo "VOD_ROOT not set"
+	exit 1
+fi
+
+if [ -z "$CC" ]; then
+	CC=cc
+fi
+
+$CC -Wall -O2 -g -ohlssegmentsizetest -DNGX_HAVE_OPENSSL_EVP=1 $VOD_ROOT/test/hls_segment_size/main.c $VOD_ROOT/vod/hls/mpegts_encoder_filter.c $VOD_ROOT/vod/hls/mp4_to_annexb_filter.c $VOD_ROOT/vod/hls/adts_encoder_filter.c $VOD_ROOT/vod/hls/buffer_filter.c $VOD_ROOT/vod/hls/frame_joiner_filter.c $VOD_ROOT/vod/hls/id3_encoder_filter.c $VOD_ROOT/vod/hls/frame_encrypt_filter.c $VOD_ROOT/vod/hls/eac3_encrypt_filter.c $VOD_ROOT/vod/hls/sample_aes_avc_filter.c $VOD_ROOT/vod/hls/aes_cbc_encrypt.c $VOD_ROOT/vod/input/frames_source_memory.c $VOD_ROOT/vod/input/frames_source_cache.c $VOD_ROOT/vod/input/read_cache.c $VOD_ROOT/vod/write_buffer_queue.c $VOD_ROOT/vod/buffer_pool.c $VOD_ROOT/vod/avc_hevc_parser.c $VOD_ROOT/vod/common.c $NGX_ROOT/src/core/ngx_palloc.c $NGX_ROOT/src/core/ngx_array.c $NGX_ROOT/src/os/unix/ngx_alloc.c -I $NGX_ROOT/src/core -I $NGX_ROOT/src/event -I $NGX_ROOT/src/event/modules -I $NGX_ROOT/src/os/unix -I $NGX_ROOT/objs -I $VOD_ROOT -lcrypto
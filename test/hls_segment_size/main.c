@@ -0,0 +1,429 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ngx_core.h>
+
+// Note: the muxer source is included in order to compare its static size functions
+#include <vod/hls/hls_muxer.c>
+
+// macros
+#define RAND(min, max) (rand() % ((max) - (min) + 1) + (min))
+
+#define assert(cond) if (!(cond)) { printf("Error: assertion failed, file=%s line=%d\n", __FILE__, __LINE__); success = FALSE; }
+
+// constants
+#define MAX_FRAMES (20000)
+#define RANDOM_ITERATIONS (2000)
+#define FIXTURE_SEGMENT_DURATION (10 * HLS_TIMESCALE)
+
+// typedefs
+typedef struct {
+	int media_type;
+	input_frame_t* frames;
+	uint32_t frame_count;
+} test_track_t;
+
+// globals
+volatile ngx_cycle_t  *ngx_cycle;
+ngx_log_t ngx_log;
+
+static u_char avcc_extra_data[] = {
+	0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x1f, 0xac, 0xd9, 0x40, 0x50, 0x05, 0xbb, 0x01, 0x10,
+	0x00, 0x00, 0x03, 0x00, 0x10, 0x00, 0x00, 0x03, 0x03, 0xc0, 0xf1, 0x83, 0x19, 0x60, 0x00, 0x00,
+	0x00, 0x01, 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+
+static u_char id3_data[] = "{\"timestamp\":1234567890}";
+
+#if (NGX_HAVE_VARIADIC_MACROS)
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+
+#else
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, va_list args)
+
+#endif
+{
+}
+
+static vod_status_t
+write_callback(void* context, u_char* buffer, uint32_t size)
+{
+	return VOD_OK;
+}
+
+static bool_t
+init_request_context(request_context_t* request_context)
+{
+	vod_memzero(request_context, sizeof(*request_context));
+	request_context->log = &ngx_log;
+	request_context->pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &ngx_log);
+	request_context->simulation_only = TRUE;
+	return request_context->pool != NULL;
+}
+
+// compares the calculated size of a segment to the simulated size
+static bool_t
+compare_segment_size(test_track_t* tracks, uint32_t track_count, hls_mpegts_muxer_conf_t* conf)
+{
+	hls_encryption_params_t encryption_params;
+	request_context_t request_context;
+	segmenter_conf_t segmenter_conf;
+	hls_muxer_state_t state;
+	media_track_t media_tracks[4];
+	media_track_t* track;
+	media_set_t media_set;
+	vod_str_t response_header;
+	bool_t simulation_supported;
+	bool_t success = TRUE;
+	size_t calculated_size;
+	size_t simulated_size;
+	uint32_t i;
+
+	if (!init_request_context(&request_context))
+	{
+		printf("Error: failed to initialize the request context\n");
+		return FALSE;
+	}
+
+	vod_memzero(&encryption_params, sizeof(encryption_params));
+	encryption_params.type = HLS_ENC_NONE;
+
+	vod_memzero(&segmenter_conf, sizeof(segmenter_conf));
+	segmenter_conf.manifest_duration_policy = MDP_MAX;
+
+	vod_memzero(media_tracks, sizeof(media_tracks));
+	for (i = 0; i < track_count; i++)
+	{
+		track = &media_tracks[i];
+		track->media_info.media_type = tracks[i].media_type;
+		track->frame_count = tracks[i].frame_count;
+		track->frames.first_frame = tracks[i].frames;
+		track->frames.last_frame = tracks[i].frames + tracks[i].frame_count;
+
+		if (tracks[i].media_type == MEDIA_TYPE_VIDEO)
+		{
+			track->media_info.codec_id = VOD_CODEC_ID_AVC;
+			track->media_info.u.video.nal_packet_size_length = 4;
+			track->media_info.extra_data.data = avcc_extra_data;
+			track->media_info.extra_data.len = sizeof(avcc_extra_data);
+		}
+		else
+		{
+			track->media_info.codec_id = VOD_CODEC_ID_AAC;
+			track->media_info.u.audio.codec_config.object_type = 2;
+			track->media_info.u.audio.codec_config.sample_rate_index = 3;
+			track->media_info.u.audio.codec_config.channel_config = 2;
+		}
+	}
+
+	vod_memzero(&media_set, sizeof(media_set));
+	media_set.segmenter_conf = &segmenter_conf;
+	media_set.clip_count = 1;
+	media_set.total_track_count = track_count;
+	media_set.filtered_tracks = media_tracks;
+	media_set.filtered_tracks_end = media_tracks + track_count;
+
+	vod_memzero(&state, sizeof(state));
+	write_buffer_queue_init(&state.queue, &request_context, write_callback, NULL, FALSE);
+
+	assert(hls_muxer_init_base(
+		&state,
+		&request_context,
+		conf,
+		&encryption_params,
+		0,
+		&media_set,
+		&simulation_supported,
+		&response_header) == VOD_OK);
+	if (!success)
+	{
+		goto done;
+	}
+
+	assert(simulation_supported);
+	assert(hls_muxer_calc_supported(&state));
+
+	assert(hls_muxer_calc_segment_size(&state, &calculated_size) == VOD_OK);
+
+	hls_muxer_simulation_reset(&state);
+
+	assert(hls_muxer_simulate_get_segment_size(&state, &simulated_size) == VOD_OK);
+
+	if (success && calculated_size != simulated_size)
+	{
+		printf("Error: calculated size %zu different than simulated size %zu\n", calculated_size, simulated_size);
+		success = FALSE;
+	}
+
+done:
+
+	ngx_destroy_pool(request_context.pool);
+
+	return success;
+}
+
+static void
+generate_track(test_track_t* track, int media_type, uint32_t duration)
+{
+	input_frame_t* cur_frame;
+	input_frame_t* last_frame;
+	uint32_t frame_duration;
+
+	frame_duration = media_type == MEDIA_TYPE_VIDEO ? RAND(1500, 3750) : RAND(1800, 2100);
+
+	track->media_type = media_type;
+	track->frame_count = duration / frame_duration;
+	last_frame = track->frames + track->frame_count;
+
+	for (cur_frame = track->frames; cur_frame < last_frame; cur_frame++)
+	{
+		vod_memzero(cur_frame, sizeof(*cur_frame));
+		cur_frame->duration = frame_duration;
+
+		if (media_type != MEDIA_TYPE_VIDEO)
+		{
+			cur_frame->size = RAND(4, 1600);
+			cur_frame->key_frame = 1;
+			continue;
+		}
+
+		cur_frame->key_frame = cur_frame == track->frames || RAND(0, 60) == 0;
+		cur_frame->size = cur_frame->key_frame ? RAND(1000, 200000) : RAND(10, 40000);
+		cur_frame->pts_delay = RAND(0, 2) * frame_duration;
+	}
+}
+
+// segments with random frames, the sizes are chosen to hit the pes and audio buffer boundaries
+static bool_t
+run_random_test()
+{
+	hls_mpegts_muxer_conf_t conf;
+	test_track_t tracks[3];
+	uint32_t track_count;
+	uint32_t duration;
+	uint32_t i;
+	int iteration;
+
+	printf("starting random test\n");
+
+	for (i = 0; i < vod_array_entries(tracks); i++)
+	{
+		tracks[i].frames = malloc(sizeof(tracks[i].frames[0]) * MAX_FRAMES);
+		if (tracks[i].frames == NULL)
+		{
+			printf("Error: malloc failed\n");
+			return FALSE;
+		}
+	}
+
+	for (iteration = 0; iteration < RANDOM_ITERATIONS; iteration++)
+	{
+		vod_memzero(&conf, sizeof(conf));
+		conf.align_frames = TRUE;
+		conf.align_pts = RAND(0, 1);
+		if (RAND(0, 3) == 0)
+		{
+			conf.id3_data.data = id3_data;
+			conf.id3_data.len = sizeof(id3_data) - 1;
+		}
+
+		duration = RAND(1, 12 * HLS_TIMESCALE);
+
+		track_count = 0;
+		switch (RAND(0, 3))
+		{
+		case 0:		// video only
+			generate_track(&tracks[track_count++], MEDIA_TYPE_VIDEO, duration);
+			break;
+
+		case 1:		// audio only
+			generate_track(&tracks[track_count++], MEDIA_TYPE_AUDIO, duration);
+			break;
+
+		case 2:		// video + audio
+			generate_track(&tracks[track_count++], MEDIA_TYPE_VIDEO, duration);
+			generate_track(&tracks[track_count++], MEDIA_TYPE_AUDIO, duration);
+			break;
+
+		case 3:		// video + 2 audio
+			generate_track(&tracks[track_count++], MEDIA_TYPE_VIDEO, duration);
+			generate_track(&tracks[track_count++], MEDIA_TYPE_AUDIO, duration);
+			generate_track(&tracks[track_count++], MEDIA_TYPE_AUDIO, duration);
+			break;
+		}
+
+		if (!compare_segment_size(tracks, track_count, &conf))
+		{
+			printf("Error: random test failed, iteration %d\n", iteration);
+			return FALSE;
+		}
+	}
+
+	for (i = 0; i < vod_array_entries(tracks); i++)
+	{
+		free(tracks[i].frames);
+	}
+
+	printf("random test passed\n");
+
+	return TRUE;
+}
+
+/*
+	fixture files list the packets of a real file, and are generated with:
+		ffprobe -v error -show_entries packet=codec_type,pts_time,dts_time,duration_time,size,flags -of csv=p=0 <file>
+	the packets are split to segments, and the sizes of the segments are compared
+*/
+static bool_t
+run_fixture_test(const char* path)
+{
+	hls_mpegts_muxer_conf_t conf;
+	test_track_t segment_tracks[2];
+	test_track_t tracks[2];
+	input_frame_t* frame;
+	test_track_t* track;
+	uint64_t segment_end;
+	uint64_t dts;
+	double duration_time;
+	double pts_time;
+	double dts_time;
+	uint32_t track_count;
+	uint32_t segment_count;
+	uint32_t size;
+	bool_t done;
+	char codec_type[16];
+	char flags[16];
+	FILE* fp;
+	int i;
+
+	printf("starting fixture test - %s\n", path);
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		printf("Error: failed to open %s\n", path);
+		return FALSE;
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		tracks[i].media_type = i == 0 ? MEDIA_TYPE_VIDEO : MEDIA_TYPE_AUDIO;
+		tracks[i].frame_count = 0;
+		tracks[i].frames = malloc(sizeof(tracks[i].frames[0]) * MAX_FRAMES);
+		if (tracks[i].frames == NULL)
+		{
+			printf("Error: malloc failed\n");
+			fclose(fp);
+			return FALSE;
+		}
+	}
+
+	vod_memzero(&conf, sizeof(conf));
+	conf.align_frames = TRUE;
+	conf.align_pts = TRUE;
+
+	segment_end = FIXTURE_SEGMENT_DURATION;
+	segment_count = 0;
+
+	for (done = FALSE; !done; )
+	{
+		if (fscanf(fp, " %15[^,],%lf,%lf,%lf,%u,%15s", codec_type, &pts_time, &dts_time, &duration_time, &size, flags) != 6)
+		{
+			done = TRUE;
+			dts = ULLONG_MAX;
+		}
+		else
+		{
+			dts = dts_time * HLS_TIMESCALE;
+		}
+
+		if (dts >= segment_end)
+		{
+			track_count = 0;
+			for (i = 0; i < 2; i++)
+			{
+				if (tracks[i].frame_count > 0)
+				{
+					segment_tracks[track_count++] = tracks[i];
+				}
+			}
+
+			if (track_count > 0 && !compare_segment_size(segment_tracks, track_count, &conf))
+			{
+				printf("Error: fixture test failed, segment %u\n", segment_count);
+				fclose(fp);
+				return FALSE;
+			}
+
+			tracks[0].frame_count = 0;
+			tracks[1].frame_count = 0;
+			segment_end += FIXTURE_SEGMENT_DURATION;
+			segment_count++;
+		}
+
+		if (done)
+		{
+			break;
+		}
+
+		if (strcmp(codec_type, "video") == 0)
+		{
+			track = &tracks[0];
+		}
+		else if (strcmp(codec_type, "audio") == 0)
+		{
+			track = &tracks[1];
+		}
+		else
+		{
+			continue;
+		}
+
+		if (track->frame_count >= MAX_FRAMES)
+		{
+			continue;
+		}
+
+		frame = &track->frames[track->frame_count++];
+		vod_memzero(frame, sizeof(*frame));
+		frame->size = size;
+		frame->duration = duration_time * HLS_TIMESCALE;
+		frame->key_frame = flags[0] == 'K';
+		frame->pts_delay = pts_time > dts_time ? (pts_time - dts_time) * HLS_TIMESCALE : 0;
+	}
+
+	fclose(fp);
+
+	printf("fixture test passed - %u segments\n", segment_count);
+
+	return TRUE;
+}
+
+int main(int argc, char* argv[])
+{
+	int i;
+
+	setbuf(stdout, NULL);		// disable stdout buffering (for progress indication)
+
+	srand(time(NULL));
+
+	if (!run_random_test())
+	{
+		return 1;
+	}
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!run_fixture_test(argv[i]))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -1,5 +1,11 @@
 #include "avc_hevc_parser.h"
 
+#if (defined(__SSE2__))
+#include <emmintrin.h>
+#elif (defined(__aarch64__))
+#include <arm_neon.h>
+#endif
+
 bool_t
 avc_hevc_parser_rbsp_trailing_bits(bit_reader_state_t* reader)
 {
@@ -69,6 +75,61 @@ avc_hevc_parser_get_ptr_array_item(vod_array_t* arr, size_t index, size_t size)
 }
 
 // emulation prevention
+const u_char*
+avc_hevc_parser_find_zero_pair(
+	const u_char* cur_pos,
+	const u_char* end_pos)
+{
+	const u_char* last_pos;
+#if (defined(__SSE2__))
+	__m128i zero = _mm_setzero_si128();
+	int mask;
+
+	// Note: each iteration reads 17 bytes - 16 pair starts + the second byte of the last pair
+	for (; end_pos - cur_pos > 16; cur_pos += 16)
+	{
+		mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)cur_pos), zero),
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(cur_pos + 1)), zero)));
+		if (mask != 0)
+		{
+			return cur_pos + __builtin_ctz(mask);
+		}
+	}
+#elif (defined(__aarch64__))
+	uint8x16_t pairs;
+
+	for (; end_pos - cur_pos > 16; cur_pos += 16)
+	{
+		pairs = vandq_u8(vceqzq_u8(vld1q_u8(cur_pos)), vceqzq_u8(vld1q_u8(cur_pos + 1)));
+		if (vmaxvq_u8(pairs) != 0)
+		{
+			break;		// the exact position is found by the loop below
+		}
+	}
+#endif
+
+	// Note: if the second byte is not zero, a pair can't start at the first or the second byte
+	last_pos = end_pos - 1;
+	while (cur_pos < last_pos)
+	{
+		if (cur_pos[1] != 0)
+		{
+			cur_pos += 2;
+			continue;
+		}
+
+		if (cur_pos[0] == 0)
+		{
+			return cur_pos;
+		}
+
+		cur_pos++;
+	}
+
+	return end_pos;
+}
+
 uint32_t
 avc_hevc_parser_emulation_prevention_encode_bytes(
 	const u_char* cur_pos,
@@ -76,13 +137,22 @@ avc_hevc_parser_emulation_prevention_encode_bytes(
 {
 	uint32_t result = 0;
 
-	end_pos -= 2;
-	for (; cur_pos < end_pos; cur_pos++)
+	for (;;)
 	{
-		if (cur_pos[0] == 0 && cur_pos[1] == 0 && cur_pos[2] <= 3)
+		cur_pos = avc_hevc_parser_find_zero_pair(cur_pos, end_pos);
+		if (end_pos - cur_pos <= 2)
+		{
+			break;
+		}
+
+		if (cur_pos[2] <= 3)
 		{
 			result++;
-			cur_pos += 2;
+			cur_pos += 3;
+		}
+		else
+		{
+			cur_pos++;
 		}
 	}
 
@@ -98,25 +168,22 @@ avc_hevc_parser_emulation_prevention_decode(
 {
 	const u_char* cur_pos;
 	const u_char* end_pos = buffer + size;
-	const u_char* limit = end_pos - 2;
+	const u_char* pair_pos;
 	u_char* output;
-	u_char cur_byte;
-	bool_t requires_strip;
 
-	requires_strip = FALSE;
-	for (cur_pos = buffer; cur_pos < limit; cur_pos++)
+	for (pair_pos = buffer; ; pair_pos++)
 	{
-		if (cur_pos[0] == 0 && cur_pos[1] == 0 && cur_pos[2] == 3)
+		pair_pos = avc_hevc_parser_find_zero_pair(pair_pos, end_pos);
+		if (end_pos - pair_pos <= 2)
 		{
-			requires_strip = TRUE;
-			break;
+			bit_read_stream_init(reader, buffer, size);
+			return VOD_OK;
 		}
-	}
 
-	if (!requires_strip)
-	{
-		bit_read_stream_init(reader, buffer, size);
-		return VOD_OK;
+		if (pair_pos[2] == 3)
+		{
+			break;
+		}
 	}
 
 	output = vod_alloc(request_context->pool, size);
@@ -129,27 +196,31 @@ avc_hevc_parser_emulation_prevention_decode(
 
 	bit_read_stream_init(reader, output, 0);	// size updated later
 
-	for (cur_pos = buffer; cur_pos < limit; )
+	// Note: pair_pos points to the first 00 00 03 sequence
+	cur_pos = buffer;
+	for (;;)
 	{
-		cur_byte = *cur_pos;
-		if (cur_byte == 0 && cur_pos[1] == 0 && cur_pos[2] == 3)
+		if (pair_pos[2] == 3)
 		{
-			*output++ = 0;
-			*output++ = 0;
-			cur_pos += 3;
+			// copy up to and including the zero pair, skip the emulation prevention byte
+			output = vod_copy(output, cur_pos, pair_pos + 2 - cur_pos);
+			cur_pos = pair_pos + 3;
+			pair_pos = cur_pos;
 		}
 		else
 		{
-			*output++ = cur_byte;
-			cur_pos++;
+			pair_pos++;
 		}
-	}
 
-	while (cur_pos < end_pos)
-	{
-		*output++ = *cur_pos++;
+		pair_pos = avc_hevc_parser_find_zero_pair(pair_pos, end_pos);
+		if (end_pos - pair_pos <= 2)
+		{
+			break;
+		}
 	}
 
+	output = vod_copy(output, cur_pos, end_pos - cur_pos);
+
 	reader->stream.end_pos = output;
 	return VOD_OK;
 }
@@ -62,6 +62,11 @@ bool_t avc_hevc_parser_rbsp_trailing_bits(bit_reader_state_t* reader);
 
 void* avc_hevc_parser_get_ptr_array_item(vod_array_t* arr, size_t index, size_t size);
 
+// Note: returns a pointer to the first 00 00 sequence in the buffer, or end_pos if there is none
+const u_char* avc_hevc_parser_find_zero_pair(
+	const u_char* cur_pos,
+	const u_char* end_pos);
+
 uint32_t avc_hevc_parser_emulation_prevention_encode_bytes(
 	const u_char* cur_pos,
 	const u_char* end_pos);
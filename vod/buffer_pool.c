@@ -107,3 +107,14 @@ buffer_pool_alloc(request_context_t* request_context, buffer_pool_t* buffer_pool
 
 	return result;
 }
+
+size_t
+buffer_pool_get_size(buffer_pool_t* buffer_pool, size_t default_size)
+{
+	if (buffer_pool == NULL)
+	{
+		return default_size;
+	}
+
+	return buffer_pool->size;
+}
@@ -7,5 +7,6 @@
 // functions
 buffer_pool_t* buffer_pool_create(vod_pool_t* pool, vod_log_t* log, size_t buffer_size, size_t count);
 void* buffer_pool_alloc(request_context_t* reqeust_context, buffer_pool_t* buffer_pool, size_t* buffer_size);
+size_t buffer_pool_get_size(buffer_pool_t* buffer_pool, size_t default_size);
 
 #endif // __BUFFER_POOL_H__
@@ -331,6 +331,7 @@ enum {
 	VOD_EMPTY_MAPPING,
 	VOD_NOT_FOUND,
 	VOD_REDIRECT,
+	VOD_INCOMPLETE,
 	VOD_ERROR_LAST,
 };
 
@@ -14,6 +14,7 @@ aes_cbc_encrypt_init(
 	write_callback_t callback,
 	void* callback_context,
 	buffer_pool_t* buffer_pool,
+	bool_t in_place,
 	const u_char* key,
 	const u_char* iv)
 {
@@ -51,6 +52,8 @@ aes_cbc_encrypt_init(
 	state->callback_context = callback_context;
 	state->request_context = request_context;
 	state->buffer_pool = buffer_pool;
+	state->in_place = in_place;
+	state->pending_size = 0;
 	
 	if (1 != EVP_EncryptInit_ex(state->cipher, EVP_aes_128_cbc(), NULL, key, iv))
 	{
@@ -144,6 +147,21 @@ aes_cbc_encrypt_write(
 		return aes_cbc_encrypt_flush(state);
 	}
 
+	if (state->in_place && state->pending_size == 0 && (size & 0x0F) == 0)
+	{
+		// Note: when in_place is set, the input buffers are owned by the writer (the write buffer queue 
+		//		of the mpegts muxer) and are not accessed after they are written. when the data is block
+		//		aligned, it can be encrypted in place, saving the allocation of an output buffer
+		if (1 != EVP_EncryptUpdate(state->cipher, buffer, &out_size, buffer, size))
+		{
+			vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+				"aes_cbc_encrypt_write: EVP_EncryptUpdate failed");
+			return VOD_UNEXPECTED;
+		}
+
+		return state->callback(state->callback_context, buffer, out_size);
+	}
+
 	required_size = aes_round_up_to_block(size);
 	buffer_size = required_size;
 
@@ -174,6 +192,8 @@ aes_cbc_encrypt_write(
 		return VOD_UNEXPECTED;
 	}
 
+	state->pending_size = (state->pending_size + size) & 0x0F;
+
 	if (out_size == 0)
 	{
 		return VOD_OK;
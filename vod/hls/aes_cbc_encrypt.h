@@ -8,9 +8,11 @@
 typedef struct {
 	request_context_t* request_context;
 	buffer_pool_t* buffer_pool;
+	bool_t in_place;
 	write_callback_t callback;
 	void* callback_context;
 	EVP_CIPHER_CTX* cipher;
+	uint32_t pending_size;
 	u_char last_block[AES_BLOCK_SIZE];
 } aes_cbc_encrypt_context_t;
 
@@ -21,6 +23,7 @@ vod_status_t aes_cbc_encrypt_init(
 	write_callback_t callback, 
 	void* callback_context, 
 	buffer_pool_t* buffer_pool,
+	bool_t in_place,
 	const u_char* key,
 	const u_char* iv);
 
@@ -29,7 +29,7 @@ struct id3_context_s {
 
 // forward decls
 static vod_status_t hls_muxer_start_frame(hls_muxer_state_t* state);
-static vod_status_t hls_muxer_simulate_get_segment_size(hls_muxer_state_t* state, size_t* result);
+static vod_status_t hls_muxer_get_segment_size(hls_muxer_state_t* state, size_t* result);
 static void hls_muxer_simulation_reset(hls_muxer_state_t* state);
 static vod_status_t hls_muxer_choose_stream(hls_muxer_state_t* state, hls_muxer_stream_state_t** result);
 
@@ -129,6 +129,7 @@ hls_muxer_init_stream(
 	stream->filter_context.request_context = state->request_context;
 	stream->filter_context.context[MEDIA_FILTER_MPEGTS] = &stream->mpegts_encoder_state;
 	stream->filter_context.context[MEDIA_FILTER_BUFFER] = NULL;
+	stream->frame_header_size = 0;
 
 	rc = mpegts_encoder_init(
 		&stream->filter,
@@ -248,6 +249,7 @@ hls_muxer_init_id3_stream(
 
 	// init the id3 encoder
 	id3_encoder_init(&context->encoder, &cur_stream->filter, &cur_stream->filter_context);
+	cur_stream->frame_header_size = sizeof(id3_text_frame_t);
 
 	// update the state
 	state->last_stream++;
@@ -386,6 +388,8 @@ hls_muxer_init_base(
 				{
 					return rc;
 				}
+
+				cur_stream->frame_header_size = sizeof_adts_frame_header;
 			}
 
 #if (VOD_HAVE_OPENSSL_EVP)
@@ -502,9 +506,14 @@ hls_muxer_init_segment(
 		return rc;
 	}
 
-	if (simulation_supported)
+	// Note: a non-zero response size on input is a previously calculated size (e.g. from a cache), no need to simulate
+	if (!simulation_supported)
 	{
-		rc = hls_muxer_simulate_get_segment_size(state, response_size);
+		*response_size = 0;
+	}
+	else if (*response_size == 0)
+	{
+		rc = hls_muxer_get_segment_size(state, response_size);
 		if (rc != VOD_OK)
 		{
 			return rc;
@@ -1191,6 +1200,264 @@ hls_muxer_simulate_get_segment_size(hls_muxer_state_t* state, size_t* result)
 	return VOD_OK;
 }
 
+/*
+	segment size calculation:
+	when frames are aligned to packets, and frames are not interleaved, every pes is stuffed
+	to the packet boundary, so the size of each pes can be calculated independently of the
+	other streams. the functions below calculate the segment size from the frame sizes, 
+	without going through the simulated filter chain. the logic of the buffer filter 
+	(buffer_filter_simulated_xxx) and the continuity counter padding of the mpegts encoder 
+	(mpegts_encoder_simulated_flush_frame) is replicated here - any change to them must be 
+	applied here as well. in debug builds, the result is validated against the simulation,
+	test/hls_segment_size compares the two in release builds.
+*/
+
+enum {
+	BUFFER_STATE_INITIAL,
+	BUFFER_STATE_STARTED,
+	BUFFER_STATE_FLUSHED,
+};
+
+static bool_t
+hls_muxer_calc_supported(hls_muxer_state_t* state)
+{
+	hls_muxer_stream_state_t* cur_stream;
+	mpegts_encoder_state_t* encoder_state;
+
+	if (state->first_stream >= state->last_stream)
+	{
+		return FALSE;
+	}
+
+	for (cur_stream = state->first_stream; cur_stream < state->last_stream; cur_stream++)
+	{
+		encoder_state = &cur_stream->mpegts_encoder_state;
+		if (!encoder_state->align_frames || encoder_state->interleave_frames)
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static off_t
+hls_muxer_calc_pes_size(hls_muxer_stream_state_t* stream, uint32_t size, bool_t last_stream_frame)
+{
+	uint32_t packet_count;
+
+	packet_count = mpegts_encoder_get_pes_packet_count(&stream->mpegts_encoder_state.stream_info, size);
+	stream->cc += packet_count;
+
+	// on the last frame, null packets are added to set the continuity counters
+	if (last_stream_frame)
+	{
+		if ((stream->cc & 0x0F) != 0 &&
+			stream->mpegts_encoder_state.stream_info.media_type != MEDIA_TYPE_NONE)
+		{
+			packet_count += 0x10 - (stream->cc & 0x0F);
+		}
+		stream->cc = stream->mpegts_encoder_state.initial_cc;
+	}
+
+	return (off_t)packet_count * MPEGTS_PACKET_SIZE;
+}
+
+static off_t
+hls_muxer_calc_buffer_flush(hls_muxer_stream_state_t* stream, uint64_t frame_dts, bool_t last_stream_frame)
+{
+	off_t result;
+
+	if (stream->buffer_flush_size <= 0)
+	{
+		return 0;
+	}
+
+	result = hls_muxer_calc_pes_size(stream, stream->buffer_flush_size, last_stream_frame);
+
+	stream->buffer_used_size -= stream->buffer_flush_size;
+	stream->buffer_flush_size = 0;
+
+	switch (stream->buffer_state)
+	{
+	case BUFFER_STATE_STARTED:
+		stream->buffer_dts = frame_dts;
+		break;
+
+	case BUFFER_STATE_FLUSHED:
+		stream->buffer_state = BUFFER_STATE_INITIAL;
+		break;
+	}
+
+	return result;
+}
+
+static off_t
+hls_muxer_calc_frame_size(
+	hls_muxer_stream_state_t* stream, 
+	uint64_t frame_dts, 
+	uint32_t size, 
+	bool_t last_stream_frame)
+{
+	off_t result = 0;
+
+	if (stream->filter_context.context[MEDIA_FILTER_BUFFER] == NULL)
+	{
+		return hls_muxer_calc_pes_size(stream, size, last_stream_frame);
+	}
+
+	// start frame
+	if (stream->buffer_state == BUFFER_STATE_INITIAL)
+	{
+		stream->buffer_dts = frame_dts;
+	}
+	stream->buffer_state = BUFFER_STATE_STARTED;
+
+	// write
+	if (stream->buffer_used_size + size > DEFAULT_PES_PAYLOAD_SIZE)
+	{
+		result += hls_muxer_calc_buffer_flush(stream, frame_dts, FALSE);
+	}
+
+	if (stream->buffer_used_size + size > DEFAULT_PES_PAYLOAD_SIZE)
+	{
+		// the frame does not fit in the buffer, written directly
+		result += hls_muxer_calc_pes_size(stream, stream->buffer_used_size + size, last_stream_frame);
+		stream->buffer_used_size = 0;
+		stream->buffer_state = BUFFER_STATE_INITIAL;
+		return result;
+	}
+
+	stream->buffer_used_size += size;
+
+	// flush frame
+	stream->buffer_flush_size = stream->buffer_used_size;
+	stream->buffer_state = BUFFER_STATE_FLUSHED;
+
+	if (last_stream_frame)
+	{
+		result += hls_muxer_calc_buffer_flush(stream, frame_dts, TRUE);
+	}
+
+	return result;
+}
+
+static vod_status_t
+hls_muxer_calc_segment_size(hls_muxer_state_t* state, size_t* result)
+{
+	hls_muxer_stream_state_t* selected_stream;
+	hls_muxer_stream_state_t* cur_stream;
+	input_frame_t* cur_frame;
+	uint64_t cur_frame_dts;
+	uint32_t size;
+	off_t segment_size;
+	vod_status_t rc;
+
+	for (cur_stream = state->first_stream; cur_stream < state->last_stream; cur_stream++)
+	{
+		cur_stream->buffer_state = BUFFER_STATE_INITIAL;
+		cur_stream->buffer_used_size = 0;
+		cur_stream->buffer_flush_size = 0;
+		cur_stream->cc = cur_stream->mpegts_encoder_state.initial_cc;
+	}
+
+	segment_size = 2 * MPEGTS_PACKET_SIZE;		// PAT & PMT
+
+	for (;;)
+	{
+		// get a frame
+		rc = hls_muxer_choose_stream(state, &selected_stream);
+		if (rc != VOD_OK)
+		{
+			if (rc == VOD_NOT_FOUND)
+			{
+				break;		// done
+			}
+			return rc;
+		}
+
+		cur_frame = selected_stream->cur_frame;
+		selected_stream->cur_frame++;
+		cur_frame_dts = selected_stream->next_frame_time_offset;
+		selected_stream->next_frame_time_offset += cur_frame->duration;
+
+		// flush any buffered frames if their delay becomes too big
+		for (cur_stream = state->first_stream; cur_stream < state->last_stream; cur_stream++)
+		{
+			if (selected_stream == cur_stream || 
+				cur_stream->filter_context.context[MEDIA_FILTER_BUFFER] == NULL ||
+				cur_stream->buffer_state == BUFFER_STATE_INITIAL)
+			{
+				continue;
+			}
+
+			if (cur_frame_dts > cur_stream->buffer_dts + HLS_DELAY / 2)
+			{
+				segment_size += hls_muxer_calc_buffer_flush(cur_stream, cur_frame_dts, FALSE);
+			}
+		}
+
+		// write the frame
+		size = cur_frame->size + selected_stream->frame_header_size;
+		if (selected_stream->media_type == MEDIA_TYPE_VIDEO)
+		{
+			size += mp4_to_annexb_get_simulated_header_size(&selected_stream->filter_context, cur_frame->key_frame);
+		}
+
+		segment_size += hls_muxer_calc_frame_size(
+			selected_stream,
+			cur_frame_dts,
+			size,
+			selected_stream->cur_frame >= selected_stream->cur_frame_part.last_frame &&
+				selected_stream->cur_frame_part.next == NULL);
+	}
+
+	*result = segment_size;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+hls_muxer_get_segment_size(hls_muxer_state_t* state, size_t* result)
+{
+	vod_status_t rc;
+#if (VOD_DEBUG)
+	size_t simulated_size;
+#endif // VOD_DEBUG
+
+	if (!hls_muxer_calc_supported(state))
+	{
+		return hls_muxer_simulate_get_segment_size(state, result);
+	}
+
+	rc = hls_muxer_calc_segment_size(state, result);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+#if (VOD_DEBUG)
+	// validate the calculated size against the simulation
+	hls_muxer_simulation_reset(state);
+
+	rc = hls_muxer_simulate_get_segment_size(state, &simulated_size);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	if (simulated_size != *result)
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"hls_muxer_get_segment_size: calculated size %uz different than simulated size %uz", 
+			*result, simulated_size);
+		*result = simulated_size;
+	}
+#endif // VOD_DEBUG
+
+	return VOD_OK;
+}
+
 static void 
 hls_muxer_simulation_reset(hls_muxer_state_t* state)
 {
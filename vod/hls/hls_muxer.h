@@ -50,6 +50,14 @@ typedef struct {
 	uint32_t prev_key_frame;
 	uint64_t prev_frame_pts;
 
+	// size calculation only
+	uint32_t frame_header_size;
+	int buffer_state;
+	uint32_t buffer_used_size;
+	uint32_t buffer_flush_size;
+	uint64_t buffer_dts;
+	unsigned cc;
+
 	// top filter
 	media_filter_t filter;
 	media_filter_context_t filter_context;
@@ -12,6 +12,14 @@
 #define M3U8_HEADER_VOD "#EXT-X-PLAYLIST-TYPE:VOD\n"
 #define M3U8_HEADER_EVENT "#EXT-X-PLAYLIST-TYPE:EVENT\n"
 #define M3U8_HEADER_PART2 "#EXT-X-VERSION:%d\n#EXT-X-MEDIA-SEQUENCE:%uD\n"
+#define M3U8_SERVER_CONTROL "#EXT-X-SERVER-CONTROL:"
+#define M3U8_SERVER_CONTROL_CAN_BLOCK_RELOAD "CAN-BLOCK-RELOAD=YES"
+#define M3U8_SERVER_CONTROL_CAN_SKIP "CAN-SKIP-UNTIL=%uL"
+#define M3U8_SKIP "#EXT-X-SKIP:SKIPPED-SEGMENTS=%uD\n"
+
+#define M3U8_SKIP_MIN_VERSION (9)
+#define M3U8_CAN_SKIP_TARGET_DURATIONS (6)		// the minimum allowed by the spec
+#define M3U8_MAX_BLOCKING_MSN_DISTANCE (2)
 
 #define M3U8_EXT_MEDIA_BASE "#EXT-X-MEDIA:TYPE=%s,GROUP-ID=\"%s%uD\",NAME=\"%V\","
 #define M3U8_EXT_MEDIA_LANG "LANGUAGE=\"%V\","
@@ -382,6 +390,69 @@ m3u8_builder_write_psshs(
 }
 #endif // NGX_HAVE_OPENSSL_EVP
 
+// Note: returns the number of segments that are older than skip_until from the end of the playlist,
+//		the skipped segments do not cross discontinuities, so that the init segment of the first segment
+//		that is returned is the one written in the playlist header
+static uint32_t
+m3u8_builder_get_skipped_segments(
+	segment_durations_t* segment_durations,
+	uint64_t skip_until,
+	segment_duration_item_t** first_item,
+	uint32_t* first_segment_index)
+{
+	segment_duration_item_t* last_item = segment_durations->items + segment_durations->item_count;
+	segment_duration_item_t* cur_item;
+	uint64_t total_duration = 0;
+	uint64_t start_time = 0;
+	uint64_t end_limit;
+	uint32_t skipped = 0;
+	uint64_t count;
+
+	*first_item = segment_durations->items;
+	*first_segment_index = segment_durations->items[0].segment_index;
+
+	for (cur_item = segment_durations->items; cur_item < last_item; cur_item++)
+	{
+		total_duration += cur_item->duration * cur_item->repeat_count;
+	}
+
+	skip_until *= segment_durations->timescale;
+	if (total_duration <= skip_until)
+	{
+		return 0;
+	}
+
+	end_limit = total_duration - skip_until;
+
+	for (cur_item = segment_durations->items; cur_item < last_item; cur_item++)
+	{
+		if (cur_item->discontinuity && cur_item > segment_durations->items)
+		{
+			break;
+		}
+
+		if (cur_item->duration == 0)
+		{
+			continue;
+		}
+
+		count = (end_limit - start_time) / cur_item->duration;
+		if (count < cur_item->repeat_count)
+		{
+			*first_item = cur_item;
+			*first_segment_index = cur_item->segment_index + count;
+			return skipped + count;
+		}
+
+		skipped += cur_item->repeat_count;
+		start_time += cur_item->duration * cur_item->repeat_count;
+	}
+
+	*first_item = cur_item;
+	*first_segment_index = cur_item < last_item ? cur_item->segment_index : 0;
+	return skipped;
+}
+
 vod_status_t
 m3u8_builder_build_index_playlist(
 	request_context_t* request_context,
@@ -390,14 +461,20 @@ m3u8_builder_build_index_playlist(
 	vod_str_t* segments_base_url,
 	hls_encryption_params_t* encryption_params,
 	vod_uint_t container_format,
+	bool_t skip_segments,
+	uint32_t media_sequence,
 	media_set_t* media_set,
-	vod_str_t* result)
+	uint32_t* last_media_sequence,
+	vod_chain_t** result,
+	size_t* result_size)
 {
 	segment_durations_t segment_durations;
+	segment_duration_item_t* first_item;
 	segment_duration_item_t* cur_item;
 	segment_duration_item_t* last_item;
 	hls_encryption_type_t encryption_type;
 	segmenter_conf_t* segmenter_conf = media_set->segmenter_conf;
+	write_chain_t chain;
 	vod_str_t name_suffix;
 	vod_str_t extinf;
 	vod_str_t* suffix;
@@ -406,10 +483,16 @@ m3u8_builder_build_index_playlist(
 	uint64_t duration_millis;
 	uint32_t segment_index;
 	uint32_t last_segment_index;
+	uint32_t first_segment_index;
+	uint32_t skipped_segments = 0;
 	uint32_t clip_index = 0;
+	bool_t can_block_reload;
+	bool_t can_skip;
+	int m3u8_version;
 	uint32_t scale;
 	size_t segment_length;
-	size_t result_size;
+	size_t map_length;
+	size_t header_size;
 	vod_status_t rc;
 	u_char* p;
 
@@ -463,30 +546,55 @@ m3u8_builder_build_index_playlist(
 	}
 	last_item = segment_durations.items + segment_durations.item_count;
 
-	// get the required buffer length
+	// blocking reload
+	*last_media_sequence = 0;
+	can_block_reload = conf->blocking_reload && media_set->type == MEDIA_SET_LIVE && !media_set->presentation_end;
+	if (can_block_reload)
+	{
+		// Note: the media sequence of a segment is its index + 1
+		*last_media_sequence = last_item[-1].segment_index + last_item[-1].repeat_count;
+		if (media_sequence > *last_media_sequence + M3U8_MAX_BLOCKING_MSN_DISTANCE)
+		{
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"m3u8_builder_build_index_playlist: requested media sequence %uD too far from the last media sequence %uD",
+				media_sequence, *last_media_sequence);
+			return VOD_BAD_REQUEST;
+		}
+
+		if (media_sequence > *last_media_sequence)
+		{
+			vod_log_debug2(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+				"m3u8_builder_build_index_playlist: media sequence %uD not available yet, last media sequence %uD",
+				media_sequence, *last_media_sequence);
+			return VOD_AGAIN;
+		}
+	}
+
+	// get the max lengths of the playlist parts
 	duration_millis = segment_durations.duration;
 	last_segment_index = last_item[-1].segment_index + last_item[-1].repeat_count;
 	segment_length = sizeof("#EXTINF:.000,\n") - 1 + vod_get_int_print_len(vod_div_ceil(duration_millis, 1000)) +
 		segments_base_url->len + conf->segment_file_name_prefix.len + 1 + vod_get_int_print_len(last_segment_index) + name_suffix.len;
 
-	result_size =
+	map_length = sizeof(m3u8_map_prefix) - 1 +
+		base_url->len +
+		conf->init_file_name_prefix.len +
+		sizeof(m3u8_clip_index) - 1 + VOD_INT32_LEN +
+		name_suffix.len +
+		sizeof(m3u8_map_suffix) - 1;
+
+	header_size =
 		sizeof(M3U8_HEADER_PART1) + VOD_INT64_LEN +
 		sizeof(M3U8_HEADER_EVENT) +
 		sizeof(M3U8_HEADER_PART2) + VOD_INT64_LEN + VOD_INT32_LEN +
-		segment_length * segment_durations.segment_count +
-		segment_durations.discontinuities * (sizeof(m3u8_discontinuity) - 1) +
-		(sizeof(m3u8_map_prefix) - 1 +
-		 base_url->len +
-		 conf->init_file_name_prefix.len +
-		 sizeof(m3u8_clip_index) - 1 + VOD_INT32_LEN +
-		 name_suffix.len +
-		 sizeof(m3u8_map_suffix) - 1) *
-		(segment_durations.discontinuities + 1) +
-		sizeof(m3u8_footer);
+		sizeof(M3U8_SERVER_CONTROL) - 1 + sizeof(M3U8_SERVER_CONTROL_CAN_BLOCK_RELOAD) +
+		sizeof(M3U8_SERVER_CONTROL_CAN_SKIP) + VOD_INT64_LEN +
+		sizeof(M3U8_SKIP) + VOD_INT32_LEN +
+		map_length;
 
 	if (encryption_type != HLS_ENC_NONE)
 	{
-		result_size +=
+		header_size +=
 			sizeof(encryption_key_tag_method) - 1 +
 			sizeof(encryption_type_sample_aes_cenc) - 1 +
 			sizeof(encryption_key_tag_uri) - 1 + 
@@ -494,7 +602,7 @@ m3u8_builder_build_index_playlist(
 
 		if (encryption_params->key_uri.len != 0)
 		{
-			result_size += encryption_params->key_uri.len;
+			header_size += encryption_params->key_uri.len;
 		}
 #if (NGX_HAVE_OPENSSL_EVP)
 		else if (encryption_params->type == HLS_ENC_SAMPLE_AES_CENC)
@@ -508,12 +616,12 @@ m3u8_builder_build_index_playlist(
 				return rc;
 			}
 
-			result_size += sizeof(sample_aes_cenc_uri_prefix) + vod_base64_encoded_length(psshs.len);
+			header_size += sizeof(sample_aes_cenc_uri_prefix) + vod_base64_encoded_length(psshs.len);
 		}
 #endif // NGX_HAVE_OPENSSL_EVP
 		else
 		{
-			result_size += base_url->len +
+			header_size += base_url->len +
 				conf->encryption_key_file_name.len +
 				sizeof("-f") - 1 + VOD_INT32_LEN +
 				sizeof(encryption_key_extension) - 1;
@@ -521,35 +629,26 @@ m3u8_builder_build_index_playlist(
 
 		if (encryption_params->return_iv)
 		{
-			result_size +=
+			header_size +=
 				sizeof(encryption_key_tag_iv) - 1 +
 				sizeof(encryption_params->iv_buf) * 2;
 		}
 
 		if (conf->encryption_key_format.len != 0)
 		{
-			result_size +=
+			header_size +=
 				sizeof(encryption_key_tag_key_format) +				// '"'
 				conf->encryption_key_format.len;
 		}
 
 		if (conf->encryption_key_format_versions.len != 0)
 		{
-			result_size +=
+			header_size +=
 				sizeof(encryption_key_tag_key_format_versions) +	// '"'
 				conf->encryption_key_format_versions.len;
 		}
 	}
 
-	// allocate the buffer
-	result->data = vod_alloc(request_context->pool, result_size);
-	if (result->data == NULL)
-	{
-		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"m3u8_builder_build_index_playlist: vod_alloc failed");
-		return VOD_ALLOC_FAILED;
-	}
-
 	// find the max segment duration
 	max_segment_duration = 0;
 	for (cur_item = segment_durations.items; cur_item < last_item; cur_item++)
@@ -572,9 +671,40 @@ m3u8_builder_build_index_playlist(
 		max_segment_duration = conf_max_segment_duration;
 	}
 
+	// delta updates
+	can_skip = conf->delta_updates && media_set->type == MEDIA_SET_LIVE && !media_set->presentation_end;
+	if (can_skip && skip_segments)
+	{
+		skipped_segments = m3u8_builder_get_skipped_segments(
+			&segment_durations,
+			M3U8_CAN_SKIP_TARGET_DURATIONS * max_segment_duration,
+			&first_item,
+			&first_segment_index);
+	}
+
+	if (skipped_segments <= 0)
+	{
+		first_item = segment_durations.items;
+		first_segment_index = first_item->segment_index;
+	}
+
+	m3u8_version = container_format == HLS_CONTAINER_FMP4 ? 6 : conf->m3u8_version;
+	if (skipped_segments > 0 && m3u8_version < M3U8_SKIP_MIN_VERSION)
+	{
+		m3u8_version = M3U8_SKIP_MIN_VERSION;
+	}
+
 	// write the header
+	write_chain_init(&chain, request_context);
+
+	rc = write_chain_get_bytes(&chain, header_size, &p);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
 	p = vod_sprintf(
-		result->data,
+		p,
 		M3U8_HEADER_PART1,
 		max_segment_duration);
 
@@ -660,9 +790,28 @@ m3u8_builder_build_index_playlist(
 	p = vod_sprintf(
 		p,
 		M3U8_HEADER_PART2,
-		container_format == HLS_CONTAINER_FMP4 ? 6 : conf->m3u8_version, 
+		m3u8_version, 
 		segment_durations.items[0].segment_index + 1);
 
+	if (can_block_reload || can_skip)
+	{
+		p = vod_copy(p, M3U8_SERVER_CONTROL, sizeof(M3U8_SERVER_CONTROL) - 1);
+		if (can_block_reload)
+		{
+			p = vod_copy(p, M3U8_SERVER_CONTROL_CAN_BLOCK_RELOAD, sizeof(M3U8_SERVER_CONTROL_CAN_BLOCK_RELOAD) - 1);
+			if (can_skip)
+			{
+				*p++ = ',';
+			}
+		}
+
+		if (can_skip)
+		{
+			p = vod_sprintf(p, M3U8_SERVER_CONTROL_CAN_SKIP, M3U8_CAN_SKIP_TARGET_DURATIONS * max_segment_duration);
+		}
+		*p++ = '\n';
+	}
+
 	if (container_format == HLS_CONTAINER_FMP4)
 	{
 		p = vod_copy(p, m3u8_map_prefix, sizeof(m3u8_map_prefix) - 1);
@@ -678,14 +827,35 @@ m3u8_builder_build_index_playlist(
 		p = vod_copy(p, m3u8_map_suffix, sizeof(m3u8_map_suffix) - 1);
 	}
 
+	if (skipped_segments > 0)
+	{
+		p = vod_sprintf(p, M3U8_SKIP, skipped_segments);
+	}
+
+	if ((size_t)(p - chain.write_buffer.cur_pos) > header_size)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"m3u8_builder_build_index_playlist: header length %uz exceeded allocated length %uz",
+			(size_t)(p - chain.write_buffer.cur_pos), header_size);
+		return VOD_UNEXPECTED;
+	}
+
+	chain.write_buffer.cur_pos = p;
+
 	// write the segments
-	for (cur_item = segment_durations.items; cur_item < last_item; cur_item++)
+	for (cur_item = first_item; cur_item < last_item; cur_item++)
 	{
-		segment_index = cur_item->segment_index;
-		last_segment_index = segment_index + cur_item->repeat_count;
+		segment_index = cur_item == first_item ? first_segment_index : cur_item->segment_index;
+		last_segment_index = cur_item->segment_index + cur_item->repeat_count;
 
-		if (cur_item->discontinuity)
+		if (cur_item->discontinuity && segment_index == cur_item->segment_index)
 		{
+			rc = write_chain_get_bytes(&chain, sizeof(m3u8_discontinuity) - 1 + map_length, &p);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
 			p = vod_copy(p, m3u8_discontinuity, sizeof(m3u8_discontinuity) - 1);
 			if (container_format == HLS_CONTAINER_FMP4 && 
 				cur_item > segment_durations.items &&
@@ -698,6 +868,8 @@ m3u8_builder_build_index_playlist(
 				p = vod_copy(p, name_suffix.data, name_suffix.len - suffix->len);
 				p = vod_copy(p, m3u8_map_suffix, sizeof(m3u8_map_suffix) - 1);
 			}
+
+			chain.write_buffer.cur_pos = p;
 		}
 
 		// ignore zero duration segments (caused by alignment to keyframes)
@@ -707,37 +879,46 @@ m3u8_builder_build_index_playlist(
 		}
 
 		// write the first segment
+		rc = write_chain_get_bytes(&chain, segment_length, &p);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
 		extinf.data = p;
 		p = m3u8_builder_append_extinf_tag(p, rescale_time(cur_item->duration, segment_durations.timescale, scale), scale);
 		extinf.len = p - extinf.data;
 		p = m3u8_builder_append_segment_name(p, segments_base_url, &conf->segment_file_name_prefix, segment_index, &name_suffix);
+		chain.write_buffer.cur_pos = p;
 		segment_index++;
 
 		// write any additional segments
+		// Note: the chain buffers are not reused, so extinf remains valid after moving to a new buffer
 		for (; segment_index < last_segment_index; segment_index++)
 		{
+			rc = write_chain_get_bytes(&chain, segment_length, &p);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
 			p = vod_copy(p, extinf.data, extinf.len);
 			p = m3u8_builder_append_segment_name(p, segments_base_url, &conf->segment_file_name_prefix, segment_index, &name_suffix);
+			chain.write_buffer.cur_pos = p;
 		}
 	}
 
 	// write the footer
 	if (media_set->presentation_end)
 	{
-		p = vod_copy(p, m3u8_footer, sizeof(m3u8_footer) - 1);
+		rc = write_buffer_write(&chain.write_buffer, m3u8_footer, sizeof(m3u8_footer) - 1);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
 	}
 
-	result->len = p - result->data;
-
-	if (result->len > result_size)
-	{
-		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-			"m3u8_builder_build_index_playlist: result length %uz exceeded allocated length %uz", 
-			result->len, result_size);
-		return VOD_UNEXPECTED;
-	}
-	
-	return VOD_OK;
+	return write_chain_finalize(&chain, result, result_size);
 }
 
 static uint32_t
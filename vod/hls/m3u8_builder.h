@@ -4,6 +4,7 @@
 // includes
 #include "../media_format.h"
 #include "../segmenter.h"
+#include "../write_chain.h"
 #include "hls_muxer.h"
 
 // constants
@@ -25,6 +26,8 @@ typedef struct {
 	size_t iframes_m3u8_header_len;
 	bool_t force_unmuxed_segments;
 	bool_t output_iframes_playlist;
+	bool_t delta_updates;
+	bool_t blocking_reload;
 	vod_str_t index_file_name_prefix;
 	vod_str_t iframes_file_name_prefix;
 	vod_str_t segment_file_name_prefix;
@@ -50,8 +53,12 @@ vod_status_t m3u8_builder_build_index_playlist(
 	vod_str_t* segments_base_url,
 	hls_encryption_params_t* encryption_params,
 	vod_uint_t container_format,
+	bool_t skip_segments,
+	uint32_t media_sequence,
 	media_set_t* media_set,
-	vod_str_t* result);
+	uint32_t* last_media_sequence,
+	vod_chain_t** result,
+	size_t* result_size);
 
 vod_status_t m3u8_builder_build_iframe_playlist(
 	request_context_t* request_context,
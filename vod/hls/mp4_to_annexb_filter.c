@@ -332,6 +332,19 @@ mp4_to_annexb_simulated_start_frame(media_filter_context_t* context, output_fram
 	state->next_filter.simulated_write(context, size);
 }
 
+uint32_t
+mp4_to_annexb_get_simulated_header_size(media_filter_context_t* context, bool_t key_frame)
+{
+	mp4_to_annexb_state_t* state = get_context(context);
+	uint32_t size;
+
+	size = state->aud_nal_packet_size;
+	if (key_frame)
+	{
+		size += state->extra_data_size;
+	}
+	return size;
+}
 
 vod_status_t
 mp4_to_annexb_init(
@@ -19,4 +19,8 @@ vod_status_t mp4_to_annexb_set_media_info(
 bool_t mp4_to_annexb_simulation_supported(
 	media_info_t* media_info);
 
+uint32_t mp4_to_annexb_get_simulated_header_size(
+	media_filter_context_t* context,
+	bool_t key_frame);
+
 #endif // __MP4_TO_ANNEXB_FILTER_H__
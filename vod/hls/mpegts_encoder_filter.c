@@ -703,12 +703,63 @@ mpegts_encoder_init_packet(mpegts_encoder_state_t* state, bool_t write_direct)
 
 	state->last_frame_pts = NO_TIMESTAMP;
 	state->cur_packet_end = state->cur_packet_start + MPEGTS_PACKET_SIZE;
-	state->cur_pos = mpegts_write_packet_header(state->cur_packet_start, state->stream_info.pid, state->cc);
+	state->cur_pos = vod_copy(state->cur_packet_start, state->packet_header, SIZEOF_MPEGTS_HEADER);
+	state->cur_packet_start[3] |= state->cc & 0x0f;
 	state->cc++;
 
 	return VOD_OK;
 }
 
+static vod_status_t
+mpegts_encoder_write_full_packets(mpegts_encoder_state_t* state, const u_char** buffer, uint32_t* size)
+{
+	const u_char* src = *buffer;
+	uint32_t packet_count;
+	uint32_t left = *size;
+	u_char* p;
+
+	while (left >= MPEGTS_PACKET_USABLE_SIZE)
+	{
+		// get as many packets as the current queue buffer can hold
+		p = write_buffer_queue_get_buffers(
+			state->queue,
+			MPEGTS_PACKET_SIZE,
+			left / MPEGTS_PACKET_USABLE_SIZE,
+			&packet_count,
+			state);
+		if (p == NULL)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+				"mpegts_encoder_write_full_packets: write_buffer_queue_get_buffers failed");
+			return VOD_ALLOC_FAILED;
+		}
+
+		left -= packet_count * MPEGTS_PACKET_USABLE_SIZE;
+
+		for (; packet_count > 0; packet_count--)
+		{
+			vod_memcpy(p, state->packet_header, SIZEOF_MPEGTS_HEADER);
+			p[3] |= state->cc & 0x0f;
+			state->cc++;
+
+			vod_memcpy(p + SIZEOF_MPEGTS_HEADER, src, MPEGTS_PACKET_USABLE_SIZE);
+			src += MPEGTS_PACKET_USABLE_SIZE;
+			p += MPEGTS_PACKET_SIZE;
+		}
+	}
+
+	// the current packet is the last one written
+	state->last_queue_offset = state->queue->cur_offset - MPEGTS_PACKET_SIZE;
+	state->last_frame_pts = NO_TIMESTAMP;
+	state->cur_packet_start = p - MPEGTS_PACKET_SIZE;
+	state->cur_packet_end = p;
+
+	*buffer = src;
+	*size = left;
+
+	return VOD_OK;
+}
+
 static vod_status_t
 mpegts_encoder_stuff_cur_packet(mpegts_encoder_state_t* state)
 {
@@ -1001,17 +1052,13 @@ mpegts_encoder_write(media_filter_context_t* context, const u_char* buffer, uint
 	// write full packets
 	initial_size = size;
 
-	while (size >= MPEGTS_PACKET_USABLE_SIZE)
+	if (size >= MPEGTS_PACKET_USABLE_SIZE)
 	{
-		rc = mpegts_encoder_init_packet(state, TRUE);
+		rc = mpegts_encoder_write_full_packets(state, &buffer, &size);
 		if (rc != VOD_OK)
 		{
 			return rc;
 		}
-
-		vod_memcpy(state->cur_pos, buffer, MPEGTS_PACKET_USABLE_SIZE);
-		buffer += MPEGTS_PACKET_USABLE_SIZE;
-		size -= MPEGTS_PACKET_USABLE_SIZE;
 	}
 
 	state->flushed_frame_bytes += initial_size - size;
@@ -1168,6 +1215,12 @@ mpegts_encoder_simulated_start_segment(write_buffer_queue_t* queue)
 	queue->last_writer_context = NULL;
 }
 
+uint32_t
+mpegts_encoder_get_pes_packet_count(mpegts_stream_info_t* stream_info, uint32_t size)
+{
+	return (mpegts_get_pes_header_size(stream_info) + size + MPEGTS_PACKET_USABLE_SIZE - 1) / MPEGTS_PACKET_USABLE_SIZE;
+}
+
 static void
 mpegts_encoder_simulated_stuff_cur_packet(mpegts_encoder_state_t* state)
 {
@@ -1349,6 +1402,8 @@ mpegts_encoder_init(
 		return rc;
 	}
 
+	mpegts_write_packet_header(state->packet_header, state->stream_info.pid, 0);
+
 	*filter = mpegts_encoder;
 
 	if (request_context->simulation_only || !interleave_frames)
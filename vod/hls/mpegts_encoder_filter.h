@@ -40,6 +40,7 @@ typedef struct {
 	u_char* cur_packet_end;
 	u_char* cur_pos;
 	u_char* temp_packet;
+	u_char packet_header[4];	// ts header template, cc is patched per packet
 	
 	// frame state
 	unsigned cc;
@@ -100,4 +101,9 @@ vod_status_t mpegts_encoder_start_sub_frame(
 
 void mpegts_encoder_simulated_start_segment(write_buffer_queue_t* queue);
 
+// Note: returns the number of packets of a pes that is stuffed to the packet boundary (align frames)
+uint32_t mpegts_encoder_get_pes_packet_count(
+	mpegts_stream_info_t* stream_info, 
+	uint32_t size);
+
 #endif // __MPEGTS_ENCODER_FILTER_H__
@@ -6,6 +6,7 @@
 
 #include <openssl/evp.h>
 #include "aes_cbc_encrypt.h"
+#include "../avc_hevc_parser.h"
 #include "../avc_defs.h"
 
 #define SAMPLE_AES_KEY_SIZE (16)
@@ -103,6 +104,21 @@ sample_aes_avc_write_emulation_prevention(
 
 	for (cur_pos = buffer; cur_pos < buffer_end; cur_pos++)
 	{
+		if (state->zero_run == 0)
+		{
+			// skip to the next zero pair
+			cur_pos = avc_hevc_parser_find_zero_pair(cur_pos, buffer_end);
+			if (cur_pos >= buffer_end)
+			{
+				state->zero_run = buffer_end[-1] == 0;
+				break;
+			}
+
+			cur_pos++;		// the loop increment skips the second zero
+			state->zero_run = 2;
+			continue;
+		}
+
 		if (state->zero_run < 2)
 		{
 			if (*cur_pos == 0)
@@ -160,7 +160,12 @@ read_cache_read_completed(read_cache_state_t* state, vod_buf_t* buf)
 	cache_buffer_t* target_buffer = state->target_buffer;
 
 	// update the buffer size
-	target_buffer->buffer_start = buf->start;
+	// Note: a buffer that is not owned by the cache (e.g. a file mapping) has no start, 
+	//		the previous buffer of the slot is kept so that it can be reused by the next read
+	if (buf->start != NULL)
+	{
+		target_buffer->buffer_start = buf->start;
+	}
 	target_buffer->buffer_pos = buf->pos;
 	target_buffer->buffer_size = buf->last - buf->pos;
 	target_buffer->end_offset = target_buffer->start_offset + target_buffer->buffer_size;
@@ -40,6 +40,9 @@
 #define MEDIA_READ_FLAG_REALLOC_BUFFER	(0x1)
 #define MEDIA_READ_FLAG_ALLOW_EMPTY_READ (0x2)
 
+// metadata reader flags
+#define MEDIA_READER_FLAG_CACHED		(0x1)	// the metadata is saved to a cache, allows more expensive parsing
+
 // parse flags
 
 // media info
@@ -81,6 +84,7 @@
 #define REQUEST_FLAG_LOOK_AHEAD_SEGMENTS			(0x10)
 #define REQUEST_FLAG_NO_DISCONTINUITY				(0x20)
 #define REQUEST_FLAG_FORCE_PLAYLIST_TYPE_VOD		(0x40)
+#define REQUEST_FLAG_DELTA_UPDATE					(0x80)
 
 // audio channels (aligned with ffmpeg AV_CH_XXX)
 #define VOD_CH_FRONT_LEFT				0x00000001
@@ -353,6 +357,7 @@ typedef struct {
 		request_context_t* request_context,
 		vod_str_t* buffer,
 		size_t max_metadata_size,
+		uint32_t flags,
 		void** ctx);
 
 	vod_status_t(*read_metadata)(
@@ -397,6 +402,15 @@ typedef struct {
 		media_format_read_request_t* read_req,		// VOD_AGAIN
 		media_track_array_t* result);				// VOD_OK
 
+	// continues reading metadata that was previously returned by the reader, optional.
+	// used when read_frames returns VOD_INCOMPLETE
+	vod_status_t(*resume_metadata_reader)(
+		request_context_t* request_context,
+		vod_str_t* metadata_parts,
+		size_t metadata_part_count,
+		size_t max_metadata_size,
+		void** ctx);
+
 } media_format_t;
 
 // functions
@@ -172,6 +172,7 @@ typedef struct {
 
 typedef struct {
 	int64_t segment_time;		// used in mss
+	uint32_t media_sequence;	// used in hls blocking reload, 0 = not requested
 	segment_time_type_t segment_time_type;
 	uint32_t segment_index;
 	uint32_t clip_index;
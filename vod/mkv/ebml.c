@@ -34,7 +34,8 @@ static const uint64_t ebml_max_sizes[] = {
 	8,			// float
 	0x1000000,	// string - 16MB
 	0x10000000, // binary - 256MB
-	0			// master
+	0,			// master
+	0,			// custom
 };
 
 static ebml_spec_t ebml_header[] = {
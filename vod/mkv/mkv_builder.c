@@ -759,7 +759,12 @@ mkv_builder_write_frame_header(mkv_fragment_writer_state_t* state)
 		*p++ = 0x01;	// encrypted
 		p = vod_copy(p, state->iv, MP4_AES_CTR_IV_SIZE);
 
-		mp4_aes_ctr_set_iv(&state->cipher, state->iv);
+		rc = mp4_aes_ctr_set_iv(&state->cipher, state->iv);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
 		mp4_aes_ctr_increment_be64(state->iv);
 	}
 	else
@@ -30,6 +30,21 @@
 */
 #define READ_FRAMES_EXTRA_SIZE (51)
 
+/* the size that is read when scanning a top level element -
+	enough for the cluster header, the cluster timecode, a few optional elements (crc, position,
+	prev size) and the header of the first block */
+#define CLUSTER_SCAN_HEADER_SIZE (128)
+
+// the minimum size required for parsing an element header, including the header of a block
+#define CLUSTER_SCAN_MIN_SIZE (24)
+
+// the maximum number of blocks of other tracks that are skipped when looking for a key frame in a cluster
+#define CLUSTER_SCAN_MAX_BLOCKS (16)
+
+// the maximum number of reads a request performs when building the cluster index,
+//	when the index is cached, the scan is continued by later requests
+#define CLUSTER_SCAN_MAX_READS (256)
+
 // prototypes
 static vod_status_t mkv_parse_seek_entry(ebml_context_t* context, ebml_spec_t* spec, void* dst);
 static vod_status_t mkv_simple_block(ebml_context_t* context, ebml_spec_t* spec, void* dst);
@@ -89,6 +104,18 @@ typedef struct {
 	vod_str_t block;
 } mkv_block_group_t;
 
+typedef struct {
+	uint64_t pos;				// relative to the segment data
+	uint64_t time;				// the timecode of the key frame, or the cluster timecode if it was not found
+	uint32_t key_track;			// the track number of the key frame, zero if it was not found
+	uint32_t key_relative_pos;	// the position of the key frame block relative to the cluster data
+} mkv_cluster_index_t;
+
+typedef struct {
+	uint64_t end_pos;			// the clusters that start before this position are indexed, relative to the segment data
+	bool_t failed;				// the scan failed at end_pos, and cannot be continued
+} mkv_cluster_index_info_t;
+
 // matroksa specs
 
 // seekhead
@@ -209,6 +236,8 @@ enum {
 	SECTION_TRACKS,
 	SECTION_CUES,
 	SECTION_LAYOUT,		// a virtual section for holding mkv_base_layout_t
+	SECTION_CLUSTERS,	// a virtual section for holding an array of mkv_cluster_index_t
+	SECTION_CLUSTERS_INFO,	// a virtual section for holding mkv_cluster_index_info_t
 	SECTION_COUNT,
 
 	SECTION_FILE_COUNT = SECTION_LAYOUT,
@@ -219,6 +248,7 @@ enum {
 	MRS_INITIAL,
 	MRS_READ_SECTION_HEADER,
 	MRS_READ_SECTION_DATA,
+	MRS_SCAN_CLUSTERS,
 };
 
 // frame reader states
@@ -249,6 +279,8 @@ typedef struct {
 	media_base_metadata_t base;
 	mkv_base_layout_t base_layout;
 	vod_str_t cues;
+	vod_str_t clusters;
+	mkv_cluster_index_info_t clusters_info;
 	uint64_t start_time;
 	uint64_t end_time;
 	uint32_t max_frame_count;
@@ -265,8 +297,26 @@ typedef struct {
 	mkv_file_layout_t layout;
 	mkv_base_metadata_t result;
 	uint64_t read_offset;
+	uint32_t flags;
+	uint64_t key_track;			// the track whose key frames are indexed, zero = any track
+	uint64_t scan_pos;			// the position of the next top level element
+	uint64_t scan_end;
+	uint32_t scan_reads;
+	uint64_t cluster_pos;		// the position of the next element of the current cluster, zero = not in a cluster
+	uint64_t cluster_data_pos;
+	uint64_t cluster_end;
+	uint32_t cluster_blocks;
+	bool_t cluster_timecode_found;
+	vod_array_t clusters;		// array of mkv_cluster_index_t
+	mkv_cluster_index_info_t clusters_info;
 } mkv_metadata_reader_state_t;
 
+typedef struct {
+	ebml_context_t context;
+	const u_char* cur_cluster;
+	const u_char* last_cluster;
+} mkv_index_reader_t;
+
 typedef struct {
 	input_frame_t* frame;
 	frame_list_part_t* part;
@@ -365,6 +415,7 @@ mkv_metadata_reader_init(
 	request_context_t* request_context,
 	vod_str_t* buffer,
 	size_t max_metadata_size,
+	uint32_t flags,
 	void** ctx)
 {
 	mkv_metadata_reader_state_t* state;
@@ -401,6 +452,7 @@ mkv_metadata_reader_init(
 	vod_memzero(state, sizeof(*state));
 	state->request_context = request_context;
 	state->size_limit = max_metadata_size;
+	state->flags = flags;
 
 	*ctx = state;
 	return VOD_OK;
@@ -539,6 +591,12 @@ mkv_get_file_layout(
 	{
 		if (result->positions[i].pos == 0)
 		{
+			if (i == SECTION_CUES)
+			{
+				// the cues are optional, the cluster index is used when they are missing
+				continue;
+			}
+
 			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
 				"mkv_get_file_layout: missing position for index %d", i);
 			return VOD_BAD_DATA;
@@ -557,6 +615,408 @@ mkv_get_file_layout(
 	return VOD_OK;
 }
 
+static vod_status_t
+mkv_get_key_track(
+	request_context_t* request_context,
+	vod_str_t* tracks,
+	uint64_t* result)
+{
+	ebml_context_t context;
+	mkv_track_t track;
+	vod_status_t rc;
+
+	context.request_context = request_context;
+	context.cur_pos = tracks->data;
+	context.end_pos = context.cur_pos + tracks->len;
+	context.offset_delta = -1;
+
+	*result = 0;
+
+	while (context.cur_pos < context.end_pos)
+	{
+		vod_memzero(&track, sizeof(track));
+		rc = ebml_parse_single(&context, mkv_spec_track, &track);
+		if (rc != VOD_OK)
+		{
+			vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+				"mkv_get_key_track: ebml_parse_single failed %i", rc);
+			return rc;
+		}
+
+		if (track.type == MKV_TRACK_TYPE_VIDEO)
+		{
+			*result = track.num;
+			break;
+		}
+	}
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mkv_metadata_reader_resume(
+	request_context_t* request_context,
+	vod_str_t* metadata_parts,
+	size_t metadata_part_count,
+	size_t max_metadata_size,
+	void** ctx)
+{
+	mkv_metadata_reader_state_t* state;
+	vod_str_t* clusters;
+	vod_status_t rc;
+	size_t size;
+	u_char* p;
+	int i;
+
+	if (metadata_part_count < SECTION_COUNT ||
+		metadata_parts[SECTION_LAYOUT].len != sizeof(state->layout.base) ||
+		metadata_parts[SECTION_CLUSTERS_INFO].len != sizeof(state->clusters_info))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mkv_metadata_reader_resume: invalid metadata parts");
+		return VOD_UNEXPECTED;
+	}
+
+	clusters = &metadata_parts[SECTION_CLUSTERS];
+
+	size = 0;
+	for (i = 0; i < SECTION_FILE_COUNT; i++)
+	{
+		size += metadata_parts[i].len;
+	}
+
+	if (size + clusters->len > max_metadata_size)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mkv_metadata_reader_resume: metadata size %uz exceeds the limit %uz",
+			size + clusters->len, max_metadata_size);
+		return VOD_BAD_DATA;
+	}
+
+	state = vod_alloc(request_context->pool, sizeof(*state) + size);
+	if (state == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mkv_metadata_reader_resume: vod_alloc failed (1)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memzero(state, sizeof(*state));
+	state->request_context = request_context;
+	state->size_limit = max_metadata_size - size - clusters->len;
+	state->flags = MEDIA_READER_FLAG_CACHED;
+
+	// Note: the metadata parts point to the cache, and are not kept beyond this call
+	p = (u_char*)(state + 1);
+	for (i = 0; i < SECTION_FILE_COUNT; i++)
+	{
+		state->sections[i].data = p;
+		state->sections[i].len = metadata_parts[i].len;
+		p = vod_copy(p, metadata_parts[i].data, metadata_parts[i].len);
+	}
+
+	vod_memcpy(&state->layout.base, metadata_parts[SECTION_LAYOUT].data, sizeof(state->layout.base));
+	vod_memcpy(&state->clusters_info, metadata_parts[SECTION_CLUSTERS_INFO].data, sizeof(state->clusters_info));
+
+	if (vod_array_init(&state->clusters, request_context->pool, 
+		clusters->len / sizeof(mkv_cluster_index_t) + 64, sizeof(mkv_cluster_index_t)) != VOD_OK)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mkv_metadata_reader_resume: vod_array_init failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memcpy(state->clusters.elts, clusters->data, clusters->len);
+	state->clusters.nelts = clusters->len / sizeof(mkv_cluster_index_t);
+
+	rc = mkv_get_key_track(request_context, &state->sections[SECTION_TRACKS], &state->key_track);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	// continue the cluster scan from the end of the index
+	state->state = MRS_SCAN_CLUSTERS;
+	state->section = SECTION_FILE_COUNT;
+	state->scan_pos = state->layout.base.position_reference + state->clusters_info.end_pos;
+	state->scan_end = state->layout.base.position_reference + state->layout.base.segment_size;
+
+	*ctx = state;
+	return VOD_OK;
+}
+
+static void
+mkv_metadata_reader_stop_scan(mkv_metadata_reader_state_t* state, bool_t failed)
+{
+	mkv_cluster_index_t* cluster;
+
+	if (state->cluster_pos != 0)
+	{
+		// stopped inside a cluster, remove it from the index, it is scanned again if the scan is continued
+		state->clusters.nelts--;
+		state->size_limit += sizeof(*cluster);
+
+		cluster = (mkv_cluster_index_t*)state->clusters.elts + state->clusters.nelts;
+		state->clusters_info.end_pos = cluster->pos;
+	}
+	else
+	{
+		state->clusters_info.end_pos = state->scan_pos - state->layout.base.position_reference;
+	}
+
+	state->clusters_info.failed = failed;
+}
+
+static vod_status_t
+mkv_metadata_reader_scan_clusters(
+	mkv_metadata_reader_state_t* state,
+	uint64_t offset,
+	vod_str_t* buffer,
+	media_format_read_metadata_result_t* result)
+{
+	mkv_cluster_index_t* cluster;
+	ebml_context_t context;
+	vod_status_t rc;
+	uint64_t track_number;
+	uint64_t timecode;
+	uint64_t data_pos;
+	uint64_t size;
+	uint64_t pos;
+	uint64_t id;
+	u_char* start_pos;
+	int16_t block_timecode;
+	uint8_t flags;
+	bool_t failed;
+	bool_t eof;
+
+	// Note: walking the top level elements of the segment, recording the position of each cluster.
+	//		inside a cluster, the blocks are walked until the first block of the key track.
+	//		only the element headers are read, the frames are skipped according to the element size
+	for (;;)
+	{
+		if (state->cluster_pos != 0)
+		{
+			if (state->cluster_pos >= state->cluster_end || 
+				state->cluster_blocks >= CLUSTER_SCAN_MAX_BLOCKS)
+			{
+				state->cluster_pos = 0;
+				continue;
+			}
+
+			pos = state->cluster_pos;
+		}
+		else if (state->scan_pos < state->scan_end)
+		{
+			pos = state->scan_pos;
+		}
+		else
+		{
+			break;
+		}
+
+		eof = FALSE;
+
+		if (pos < offset || pos + CLUSTER_SCAN_MIN_SIZE > offset + buffer->len)
+		{
+			if (state->read_offset != pos)
+			{
+				if (state->scan_reads >= CLUSTER_SCAN_MAX_READS)
+				{
+					// Note: a cached index is continued by the requests that need the clusters that follow it
+					failed = (state->flags & MEDIA_READER_FLAG_CACHED) == 0;
+					if (failed)
+					{
+						vod_log_error(VOD_LOG_WARN, state->request_context->log, 0,
+							"mkv_metadata_reader_scan_clusters: exceeded the max number of reads, "
+							"the cluster index is incomplete since it is not cached");
+					}
+					else
+					{
+						vod_log_debug1(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+							"mkv_metadata_reader_scan_clusters: exceeded the max number of reads, stopping at %uL", pos);
+					}
+
+					mkv_metadata_reader_stop_scan(state, failed);
+					return VOD_OK;
+				}
+
+				state->scan_reads++;
+				state->read_offset = pos;
+
+				result->read_req.read_offset = pos;
+				result->read_req.read_size = CLUSTER_SCAN_HEADER_SIZE;
+				return VOD_AGAIN;
+			}
+
+			// already read from this position, and got less than the requested size
+			if (pos >= offset + buffer->len)
+			{
+				break;
+			}
+
+			eof = TRUE;
+		}
+
+		start_pos = buffer->data + pos - offset;
+
+		context.request_context = state->request_context;
+		context.cur_pos = start_pos;
+		context.end_pos = buffer->data + buffer->len;
+		context.offset_delta = offset - (intptr_t)buffer->data;
+
+		rc = ebml_read_id(&context, &id);
+		if (rc < 0)
+		{
+			goto failed;
+		}
+
+		rc = ebml_read_num(&context, &size, 8, 1);
+		if (rc < 0)
+		{
+			goto failed;
+		}
+
+		if (is_unknown_size(size, rc))
+		{
+			vod_log_error(VOD_LOG_WARN, state->request_context->log, 0,
+				"mkv_metadata_reader_scan_clusters: element 0x%uxL at %uL has unknown size, truncating the cluster index",
+				id, pos);
+			mkv_metadata_reader_stop_scan(state, TRUE);
+			return VOD_OK;
+		}
+
+		data_pos = pos + (context.cur_pos - start_pos);
+
+		if (state->cluster_pos == 0)
+		{
+			// top level element
+			state->scan_pos = data_pos + size;
+
+			if (id != MKV_ID_CLUSTER)
+			{
+				continue;
+			}
+
+			if (state->size_limit < sizeof(*cluster))
+			{
+				vod_log_error(VOD_LOG_WARN, state->request_context->log, 0,
+					"mkv_metadata_reader_scan_clusters: cluster index size exceeds the limit, truncating the cluster index");
+				state->scan_pos = pos;
+				mkv_metadata_reader_stop_scan(state, TRUE);
+				return VOD_OK;
+			}
+
+			cluster = vod_array_push(&state->clusters);
+			if (cluster == NULL)
+			{
+				vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+					"mkv_metadata_reader_scan_clusters: vod_array_push failed");
+				return VOD_ALLOC_FAILED;
+			}
+
+			vod_memzero(cluster, sizeof(*cluster));
+			cluster->pos = pos - state->layout.base.position_reference;
+
+			state->size_limit -= sizeof(*cluster);
+			state->cluster_pos = data_pos;
+			state->cluster_data_pos = data_pos;
+			state->cluster_end = data_pos + size;
+			state->cluster_blocks = 0;
+			state->cluster_timecode_found = FALSE;
+			continue;
+		}
+
+		// cluster element
+		cluster = (mkv_cluster_index_t*)state->clusters.elts + state->clusters.nelts - 1;
+
+		switch (id)
+		{
+		case MKV_ID_CLUSTERTIMECODE:
+			if (size > sizeof(timecode) || size > (uint64_t)(context.end_pos - context.cur_pos))
+			{
+				goto failed;
+			}
+
+			for (timecode = 0; context.cur_pos < start_pos + (data_pos - pos) + size; context.cur_pos++)
+			{
+				timecode = (timecode << 8) | *context.cur_pos;
+			}
+
+			cluster->time = timecode;
+			state->cluster_timecode_found = TRUE;
+			break;
+
+		case MKV_ID_SIMPLEBLOCK:
+			if (!state->cluster_timecode_found)
+			{
+				state->cluster_pos = 0;		// the block times are relative to the cluster timecode
+				continue;
+			}
+
+			rc = ebml_read_num(&context, &track_number, 8, 1);
+			if (rc < 0)
+			{
+				goto failed;
+			}
+
+			if (context.cur_pos + 3 > context.end_pos)
+			{
+				goto failed;
+			}
+
+			if (state->key_track != 0 && track_number != state->key_track)
+			{
+				state->cluster_blocks++;
+				break;
+			}
+
+			read_be16(context.cur_pos, block_timecode);
+			flags = *context.cur_pos++;
+
+			if ((flags & 0x80) != 0 && track_number <= VOD_MAX_UINT32_VALUE)
+			{
+				if (block_timecode >= 0 || (uint64_t)-block_timecode <= cluster->time)
+				{
+					cluster->time += block_timecode;
+				}
+
+				cluster->key_track = track_number;
+				cluster->key_relative_pos = data_pos - state->cluster_data_pos;
+			}
+
+			// only the first block of the key track is checked
+			state->cluster_pos = 0;
+			continue;
+
+		case MKV_ID_BLOCKGROUP:
+			// Note: the key frame flag of a block group depends on its reference block elements,
+			//		which usually follow the frame data, only simple blocks are used as key points
+			state->cluster_blocks++;
+			break;
+		}
+
+		state->cluster_pos = data_pos + size;
+		continue;
+
+	failed:
+
+		if (eof)
+		{
+			// truncated file, use the clusters that were found
+			break;
+		}
+
+		vod_log_error(VOD_LOG_WARN, state->request_context->log, 0,
+			"mkv_metadata_reader_scan_clusters: failed to parse element at %uL, truncating the cluster index",
+			pos);
+		mkv_metadata_reader_stop_scan(state, TRUE);
+		return VOD_OK;
+	}
+
+	state->clusters_info.end_pos = state->layout.base.segment_size;
+	return VOD_OK;
+}
+
 static vod_status_t
 mkv_metadata_reader_read(
 	void* ctx,
@@ -589,6 +1049,10 @@ mkv_metadata_reader_read(
 	for (; state->section < SECTION_FILE_COUNT; state->section++)
 	{
 		position = state->layout.positions + state->section;
+		if (position->id == 0)
+		{
+			continue;		// missing optional section
+		}
 
 		// read the section header
 		if (position->pos < offset || position->pos + 16 >= offset + buffer->len)
@@ -680,15 +1144,61 @@ mkv_metadata_reader_read(
 		result->read_req.flags = MEDIA_READ_FLAG_REALLOC_BUFFER;
 	}
 
+	// build the cluster index
+	// Note: the scan performs a read per cluster, it is done only when the result is saved to a cache,
+	//		or when the file has no cues
+	if (state->state != MRS_SCAN_CLUSTERS &&
+		((state->flags & MEDIA_READER_FLAG_CACHED) != 0 || state->sections[SECTION_CUES].len <= 0))
+	{
+		if (vod_array_init(&state->clusters, state->request_context->pool, 64, sizeof(mkv_cluster_index_t)) != VOD_OK)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+				"mkv_metadata_reader_read: vod_array_init failed");
+			return VOD_ALLOC_FAILED;
+		}
+
+		// index the key frames of the first video track, or of any track when there is no video
+		rc = mkv_get_key_track(state->request_context, &state->sections[SECTION_TRACKS], &state->key_track);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		state->state = MRS_SCAN_CLUSTERS;
+		state->scan_pos = state->layout.base.position_reference;
+		state->scan_end = state->layout.base.position_reference + state->layout.base.segment_size;
+	}
+
+	if (state->state == MRS_SCAN_CLUSTERS)
+	{
+		// Note: when sections were found in the current buffer, the read flags keep it from being reused
+		rc = mkv_metadata_reader_scan_clusters(state, offset, buffer, result);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		vod_log_debug3(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"mkv_metadata_reader_read: cluster index contains %uz entries, end=%uL failed=%d", 
+			(size_t)state->clusters.nelts, state->clusters_info.end_pos, (int)state->clusters_info.failed);
+	}
+
 	state->sections[SECTION_LAYOUT].data = (u_char*)&state->layout.base;
 	state->sections[SECTION_LAYOUT].len = sizeof(state->layout.base);
 
+	state->sections[SECTION_CLUSTERS].data = state->clusters.elts;
+	state->sections[SECTION_CLUSTERS].len = state->clusters.nelts * sizeof(mkv_cluster_index_t);
+
+	state->sections[SECTION_CLUSTERS_INFO].data = (u_char*)&state->clusters_info;
+	state->sections[SECTION_CLUSTERS_INFO].len = sizeof(state->clusters_info);
+
 	result->parts = state->sections;
 	result->part_count = SECTION_COUNT;
 
 	return VOD_OK;
 }
 
+
 static vod_status_t
 mkv_metadata_parse(
 	request_context_t* request_context,
@@ -1010,10 +1520,145 @@ mkv_metadata_parse(
 	metadata->base.duration = info.duration;
 	metadata->cues = metadata_parts[SECTION_CUES];
 	metadata->base_layout = *(mkv_base_layout_t*)metadata_parts[SECTION_LAYOUT].data;
+
+	if (metadata_part_count > SECTION_CLUSTERS)
+	{
+		metadata->clusters = metadata_parts[SECTION_CLUSTERS];
+	}
+	else
+	{
+		metadata->clusters.data = NULL;
+		metadata->clusters.len = 0;
+	}
+
+	if (metadata_part_count > SECTION_CLUSTERS_INFO &&
+		metadata_parts[SECTION_CLUSTERS_INFO].len == sizeof(metadata->clusters_info))
+	{
+		vod_memcpy(&metadata->clusters_info, metadata_parts[SECTION_CLUSTERS_INFO].data, sizeof(metadata->clusters_info));
+	}
+	else
+	{
+		// Note: entries that were cached without the index info hold either a complete index or no index
+		metadata->clusters_info.end_pos = metadata->base_layout.segment_size;
+		metadata->clusters_info.failed = FALSE;
+	}
 	*result = &metadata->base;
 	return VOD_OK;
 }
 
+static uint64_t
+mkv_get_cluster_end_pos(mkv_base_metadata_t* metadata, uint64_t cluster_pos)
+{
+	mkv_cluster_index_t cluster;
+	vod_uint_t left;
+	vod_uint_t right;
+	vod_uint_t middle;
+
+	// find the first cluster that starts after the given position
+	// Note: the entries are copied since the metadata parts are not necessarily aligned
+	left = 0;
+	right = metadata->clusters.len / sizeof(cluster);
+	while (left < right)
+	{
+		middle = (left + right) / 2;
+		vod_memcpy(&cluster, metadata->clusters.data + middle * sizeof(cluster), sizeof(cluster));
+		if (cluster.pos <= cluster_pos)
+		{
+			left = middle + 1;
+		}
+		else
+		{
+			right = middle;
+		}
+	}
+
+	if (left >= metadata->clusters.len / sizeof(cluster))
+	{
+		return metadata->base_layout.segment_size;
+	}
+
+	vod_memcpy(&cluster, metadata->clusters.data + left * sizeof(cluster), sizeof(cluster));
+	return cluster.pos;
+}
+
+static vod_status_t
+mkv_index_reader_init(
+	request_context_t* request_context,
+	mkv_base_metadata_t* metadata,
+	mkv_index_reader_t* reader)
+{
+	reader->context.request_context = request_context;
+	reader->context.cur_pos = metadata->cues.data;
+	reader->context.end_pos = reader->context.cur_pos + metadata->cues.len;
+	reader->context.offset_delta = -1;
+
+	if (metadata->cues.len > 0)
+	{
+		reader->cur_cluster = NULL;
+		reader->last_cluster = NULL;
+		return VOD_OK;
+	}
+
+	if (metadata->clusters.len <= 0)
+	{
+		if (!metadata->clusters_info.failed &&
+			metadata->clusters_info.end_pos < metadata->base_layout.segment_size)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+				"mkv_index_reader_init: the cluster index is empty, the scan has to be continued");
+			return VOD_INCOMPLETE;
+		}
+
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mkv_index_reader_init: the file has no cues and no cluster index");
+		return VOD_BAD_DATA;
+	}
+
+	// the file has no cues, use the clusters that start with a key frame instead
+	reader->cur_cluster = metadata->clusters.data;
+	reader->last_cluster = metadata->clusters.data + metadata->clusters.len;
+	return VOD_OK;
+}
+
+static vod_status_t
+mkv_index_reader_next(mkv_index_reader_t* reader, mkv_index_t* index)
+{
+	mkv_cluster_index_t cluster;
+	vod_status_t rc;
+
+	if (reader->context.cur_pos < reader->context.end_pos)
+	{
+		rc = ebml_parse_single(&reader->context, mkv_spec_index, index);
+		if (rc != VOD_OK)
+		{
+			vod_log_debug1(VOD_LOG_DEBUG_LEVEL, reader->context.request_context->log, 0,
+				"mkv_index_reader_next: ebml_parse_single failed %i", rc);
+			return rc;
+		}
+
+		return VOD_OK;
+	}
+
+	for (; reader->cur_cluster + sizeof(cluster) <= reader->last_cluster; reader->cur_cluster += sizeof(cluster))
+	{
+		vod_memcpy(&cluster, reader->cur_cluster, sizeof(cluster));
+		if (cluster.key_track == 0)
+		{
+			continue;
+		}
+
+		index->track = cluster.key_track;
+		index->time = cluster.time;
+		index->cluster_pos = cluster.pos;
+		index->relative_pos = cluster.key_relative_pos;
+
+		reader->cur_cluster += sizeof(cluster);
+		return VOD_OK;
+	}
+
+	return VOD_DONE;
+}
+
 static vod_status_t
 mkv_get_read_frames_request(
 	request_context_t* request_context,
@@ -1021,7 +1666,7 @@ mkv_get_read_frames_request(
 	uint32_t end_margin,
 	media_format_read_request_t* read_req)
 {
-	ebml_context_t context;
+	mkv_index_reader_t reader;
 	media_track_t* cur_track;
 	vod_uint_t i;
 	uint64_t segment_duration;
@@ -1030,6 +1675,7 @@ mkv_get_read_frames_request(
 	uint64_t all_tracks_mask;
 	uint64_t cur_track_mask;
 	uint64_t initial_time;
+	uint64_t cluster_extra_size;
 	mkv_index_t prev_index;
 	mkv_index_t index;
 	vod_status_t rc;
@@ -1047,10 +1693,11 @@ mkv_get_read_frames_request(
 	seen_tracks_mask = 0;
 	done_tracks_mask = 0;
 
-	context.request_context = request_context;
-	context.cur_pos = metadata->cues.data;
-	context.end_pos = context.cur_pos + metadata->cues.len;
-	context.offset_delta = -1;
+	rc = mkv_index_reader_init(request_context, metadata, &reader);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
 
 	align_timestamps = TRUE;	// XXXX conf param
 
@@ -1062,16 +1709,9 @@ mkv_get_read_frames_request(
 		vod_memzero(&index, sizeof(index));
 		cur_track_mask = 0;
 
-		if (context.cur_pos < context.end_pos)
+		rc = mkv_index_reader_next(&reader, &index);
+		if (rc == VOD_OK)
 		{
-			rc = ebml_parse_single(&context, mkv_spec_index, &index);
-			if (rc != VOD_OK)
-			{
-				vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-					"mkv_get_read_frames_request: ebml_parse_single failed %i", rc);
-				return rc;
-			}
-
 			for (i = 0; i < metadata->base.tracks.nelts; i++)
 			{
 				cur_track = (media_track_t*)metadata->base.tracks.elts + i;
@@ -1089,12 +1729,34 @@ mkv_get_read_frames_request(
 				"mkv_get_read_frames_request: track=%uL, time=%uL, cluster_pos=%uL, relative_pos=%uL",
 				index.track, index.time, index.cluster_pos, index.relative_pos);
 		}
-		else
+		else if (rc == VOD_DONE)
 		{
+			if (metadata->cues.len <= 0 &&
+				metadata->clusters_info.end_pos < metadata->base_layout.segment_size)
+			{
+				// the cluster index does not cover the requested range
+				if (metadata->clusters_info.failed)
+				{
+					vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+						"mkv_get_read_frames_request: the file has no cues and the cluster index ends at %uL",
+						metadata->clusters_info.end_pos);
+					return VOD_BAD_DATA;
+				}
+
+				vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+					"mkv_get_read_frames_request: the cluster index ends at %uL, the scan has to be continued",
+					metadata->clusters_info.end_pos);
+				return VOD_INCOMPLETE;
+			}
+
 			index.time = metadata->base.duration;
 			index.cluster_pos = metadata->base_layout.segment_size;
 			done = TRUE;
 		}
+		else
+		{
+			return rc;
+		}
 
 		if (read_req->read_offset == ULLONG_MAX)
 		{
@@ -1166,6 +1828,18 @@ mkv_get_read_frames_request(
 			segment_duration = index.time - initial_time;
 		}
 		extra_read_size = read_req->read_size * 1000 / segment_duration;
+
+		if (metadata->clusters.len > 0)
+		{
+			// the frames that follow the end cue are usually in the same cluster, when the cluster
+			// index is available, avoid reading beyond the end of this cluster
+			cluster_extra_size = mkv_get_cluster_end_pos(metadata, index.cluster_pos) - 
+				index.cluster_pos - index.relative_pos + READ_FRAMES_EXTRA_SIZE;
+			if (cluster_extra_size < extra_read_size)
+			{
+				extra_read_size = cluster_extra_size;
+			}
+		}
 	}
 	else
 	{
@@ -2150,7 +2824,10 @@ mkv_prepare_read_frames_request(
 	else
 	{
 		range = BITRATE_ESTIMATE_SEC * metadata->base.timescale;
-		if (metadata->base.duration > range)
+
+		// Note: when the cluster index does not cover the whole file, the beginning of the file is used
+		if (metadata->base.duration > range &&
+			(metadata->cues.len > 0 || metadata->clusters_info.end_pos >= metadata->base_layout.segment_size))
 		{
 			metadata->start_time = (metadata->base.duration - range) / 2;
 		}
@@ -2248,4 +2925,5 @@ media_format_t mkv_format = {
 	NULL,
 	mkv_metadata_parse,
 	mkv_read_frames,
+	mkv_metadata_reader_resume,
 };
@@ -37,7 +37,8 @@ mp4_aes_ctr_init(
 	cln->handler = (vod_pool_cleanup_pt)mp4_aes_ctr_cleanup;
 	cln->data = state;
 
-	if (1 != EVP_EncryptInit_ex(state->cipher, EVP_aes_128_ecb(), NULL, key, NULL))
+	// Note: the key schedule is computed once here, mp4_aes_ctr_set_iv only resets the counter
+	if (1 != EVP_EncryptInit_ex(state->cipher, EVP_aes_128_ctr(), NULL, key, NULL))
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
 			"mp4_aes_ctr_init: EVP_EncryptInit_ex failed");
@@ -47,15 +48,29 @@ mp4_aes_ctr_init(
 	return VOD_OK;
 }
 
-void 
+vod_status_t
 mp4_aes_ctr_set_iv(
 	mp4_aes_ctr_state_t* state, 
 	u_char* iv)
 {
-	vod_memcpy(state->counter, iv, MP4_AES_CTR_IV_SIZE);
-	vod_memzero(state->counter + MP4_AES_CTR_IV_SIZE, sizeof(state->counter) - MP4_AES_CTR_IV_SIZE);
-	state->encrypted_pos = NULL;
-	state->encrypted_end = NULL;
+	u_char counter[AES_BLOCK_SIZE];
+
+	// the counter block is the 64 bit iv followed by a 64 bit block counter that starts at zero.
+	// openssl increments the whole 128 bit block, but since the block counter starts at zero,
+	// a carry into the iv part would require a sample of 2^68 bytes, so the result is identical 
+	// to incrementing only the lower 64 bits
+	vod_memcpy(counter, iv, MP4_AES_CTR_IV_SIZE);
+	vod_memzero(counter + MP4_AES_CTR_IV_SIZE, sizeof(counter) - MP4_AES_CTR_IV_SIZE);
+
+	// resets the keystream position, the key is retained
+	if (1 != EVP_EncryptInit_ex(state->cipher, NULL, NULL, NULL, counter))
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"mp4_aes_ctr_set_iv: EVP_EncryptInit_ex failed");
+		return VOD_UNEXPECTED;
+	}
+
+	return VOD_OK;
 }
 
 void
@@ -76,78 +91,21 @@ mp4_aes_ctr_increment_be64(u_char* counter)
 vod_status_t
 mp4_aes_ctr_process(mp4_aes_ctr_state_t* state, u_char* dest, const u_char* src, uint32_t size)
 {
-	const u_char* src_end = src + size;
-	const u_char* cur_end_pos;
-	u_char* encrypted_counter_pos;
-	u_char* cur_block;
-	u_char* next_block;
-	u_char* end_block;
-	size_t encrypted_size;
 	int out_size;
 
-	while (src < src_end)
+	// Note: the ctr mode implementation of openssl keeps the position within the current keystream 
+	//		block between calls, so the data does not have to be block aligned
+	if (1 != EVP_EncryptUpdate(
+		state->cipher,
+		dest,
+		&out_size,
+		src,
+		size) ||
+		out_size != (int)size)
 	{
-		if (state->encrypted_pos >= state->encrypted_end)
-		{
-			// find the size of the data to encrypt
-			encrypted_size = aes_round_up_to_block_exact(src_end - src);
-			if (encrypted_size > sizeof(state->counter))
-			{
-				encrypted_size = sizeof(state->counter);
-			}
-
-			// initialize the clear counters (the first counter is already initialized)
-			end_block = state->counter + encrypted_size - AES_BLOCK_SIZE;
-			for (cur_block = state->counter; cur_block < end_block; cur_block = next_block)
-			{
-				next_block = cur_block + AES_BLOCK_SIZE;
-				vod_memcpy(next_block, cur_block, AES_BLOCK_SIZE);
-				mp4_aes_ctr_increment_be64(next_block + 8);
-			}
-
-			// encrypt the clear counters
-			if (1 != EVP_EncryptUpdate(
-				state->cipher,
-				state->encrypted_counter,
-				&out_size,
-				state->counter,
-				encrypted_size) ||
-				out_size != (int)encrypted_size)
-			{
-				vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
-					"mp4_aes_ctr_process: EVP_EncryptUpdate failed");
-				return VOD_UNEXPECTED;
-			}
-
-			// update the first counter
-			if (encrypted_size > AES_BLOCK_SIZE)
-			{
-				vod_memcpy(state->counter, end_block, AES_BLOCK_SIZE);
-			}
-			mp4_aes_ctr_increment_be64(state->counter + 8);
-
-			state->encrypted_end = state->encrypted_counter + encrypted_size;
-
-			encrypted_counter_pos = state->encrypted_counter;
-			cur_end_pos = src + encrypted_size;
-		}
-		else
-		{
-			encrypted_counter_pos = state->encrypted_pos;
-			cur_end_pos = src + (state->encrypted_end - encrypted_counter_pos);
-		}
-
-		if (src_end < cur_end_pos)
-		{
-			cur_end_pos = src_end;
-		}
-
-		while (src < cur_end_pos)
-		{
-			*dest++ = *src++ ^ *encrypted_counter_pos++;
-		}
-
-		state->encrypted_pos = encrypted_counter_pos;
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"mp4_aes_ctr_process: EVP_EncryptUpdate failed");
+		return VOD_UNEXPECTED;
 	}
 
 	return VOD_OK;
@@ -7,16 +7,11 @@
 
 #define MP4_AES_CTR_KEY_SIZE (16)
 #define MP4_AES_CTR_IV_SIZE (8)
-#define MP4_AES_CTR_COUNTER_BUFFER_SIZE (AES_BLOCK_SIZE * 64)
 
 // typedefs
 typedef struct {
 	request_context_t* request_context;
 	EVP_CIPHER_CTX* cipher;
-	u_char counter[MP4_AES_CTR_COUNTER_BUFFER_SIZE];
-	u_char encrypted_counter[MP4_AES_CTR_COUNTER_BUFFER_SIZE];
-	u_char* encrypted_pos;
-	u_char* encrypted_end;
 } mp4_aes_ctr_state_t;
 
 // functions
@@ -25,7 +20,7 @@ vod_status_t mp4_aes_ctr_init(
 	request_context_t* request_context,
 	u_char* key);
 
-void mp4_aes_ctr_set_iv(
+vod_status_t mp4_aes_ctr_set_iv(
 	mp4_aes_ctr_state_t* state,
 	u_char* iv);
 
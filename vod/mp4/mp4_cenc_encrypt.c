@@ -138,6 +138,8 @@ mp4_cenc_encrypt_move_to_next_frame(mp4_cenc_encrypt_state_t* state, bool_t* ini
 static vod_status_t
 mp4_cenc_encrypt_start_frame(mp4_cenc_encrypt_state_t* state)
 {
+	vod_status_t rc;
+
 	// make sure we have a frame
 	if (state->cur_frame >= state->last_frame)
 	{
@@ -151,7 +153,12 @@ mp4_cenc_encrypt_start_frame(mp4_cenc_encrypt_state_t* state)
 	state->cur_frame++;
 
 	// set and increment the iv
-	mp4_aes_ctr_set_iv(&state->cipher, state->iv);
+	rc = mp4_aes_ctr_set_iv(&state->cipher, state->iv);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
 	mp4_aes_ctr_increment_be64(state->iv);
 
 	return VOD_OK;
@@ -42,6 +42,7 @@ mp4_metadata_reader_init(
 	request_context_t* request_context, 
 	vod_str_t* buffer, 
 	size_t max_metadata_size,
+	uint32_t flags,
 	void** ctx)
 {
 	mp4_read_metadata_state_t* state;
@@ -1812,7 +1812,9 @@ mp4_parser_parse_stsz_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 	input_frame_t* last_frame = cur_frame + context->frame_count;
 	uint32_t first_frame_index_in_chunk = context->first_frame - context->first_chunk_frame_index;
 	const u_char* cur_pos;
+	uint64_t total_size = 0;
 	uint32_t uniform_size;
+	uint32_t max_size = 0;
 	uint32_t cur_size;
 	uint32_t entries;
 	unsigned field_size;
@@ -1843,18 +1845,21 @@ mp4_parser_parse_stsz_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 		{
 			context->first_frame_chunk_offset += parse_be32(cur_pos);
 		}
+		// Note: the size is validated once, after the loop, to keep the loop branch free
 		for (; cur_frame < last_frame; cur_frame++)
 		{
 			read_be32(cur_pos, cur_size);
-			if (cur_size > MAX_FRAME_SIZE)
-			{
-				vod_log_error(VOD_LOG_ERR, context->request_context->log, 0,
-					"mp4_parser_parse_stsz_atom: frame size %uD too big", cur_size);
-				return VOD_BAD_DATA;
-			}
-			context->total_frames_size += cur_size;
+			max_size = vod_max(max_size, cur_size);
+			total_size += cur_size;
 			cur_frame->size = cur_size;
 		}
+
+		if (max_size > MAX_FRAME_SIZE)
+		{
+			vod_log_error(VOD_LOG_ERR, context->request_context->log, 0,
+				"mp4_parser_parse_stsz_atom: frame size %uD too big", max_size);
+			return VOD_BAD_DATA;
+		}
 		break;
 
 	case 16:
@@ -1867,7 +1872,7 @@ mp4_parser_parse_stsz_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 		{
 			read_be16(cur_pos, cur_size);
 			// Note: no need to validate the size here, since MAX_UINT16 < MAX_FRAME_SIZE
-			context->total_frames_size += cur_size;
+			total_size += cur_size;
 			cur_frame->size = cur_size;
 		}
 		break;
@@ -1882,7 +1887,7 @@ mp4_parser_parse_stsz_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 		{
 			cur_size = *cur_pos++;
 			// Note: no need to validate the size here, since MAX_UINT8 < MAX_FRAME_SIZE
-			context->total_frames_size += cur_size;
+			total_size += cur_size;
 			cur_frame->size = cur_size;
 		}
 		break;
@@ -1895,6 +1900,9 @@ mp4_parser_parse_stsz_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 			"mp4_parser_parse_stsz_atom: unsupported field size %ud", field_size);
 		return VOD_BAD_DATA;
 	}
+
+	// Note: accumulating in a local, since the frame writes may alias context->total_frames_size
+	context->total_frames_size += total_size;
 	
 	return VOD_OK;
 }
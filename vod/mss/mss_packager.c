@@ -113,13 +113,15 @@ static const char* stream_type_by_media_type[] = {
 	MSS_STREAM_TYPE_TEXT
 };
 
-static u_char*
-mss_write_manifest_chunks(u_char* p, segment_durations_t* segment_durations)
+static vod_status_t
+mss_write_manifest_chunks(write_chain_t* chain, segment_durations_t* segment_durations)
 {
 	segment_duration_item_t* cur_item;
 	segment_duration_item_t* last_item = segment_durations->items + segment_durations->item_count;
 	uint32_t last_segment_index;
 	uint32_t segment_index;
+	vod_status_t rc;
+	u_char* p;
 
 	for (cur_item = segment_durations->items; cur_item < last_item; cur_item++)
 	{
@@ -127,20 +129,28 @@ mss_write_manifest_chunks(u_char* p, segment_durations_t* segment_durations)
 		last_segment_index = segment_index + cur_item->repeat_count;
 		for (; segment_index < last_segment_index; segment_index++)
 		{
-			p = vod_sprintf(p, MSS_CHUNK_TAG, segment_index, rescale_time(cur_item->duration, segment_durations->timescale, MSS_TIMESCALE));
+			rc = write_chain_get_bytes(chain, sizeof(MSS_CHUNK_TAG) + VOD_INT32_LEN + VOD_INT64_LEN, &p);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
+			chain->write_buffer.cur_pos = vod_sprintf(p, MSS_CHUNK_TAG, segment_index, rescale_time(cur_item->duration, segment_durations->timescale, MSS_TIMESCALE));
 		}
 	}
 
-	return p;
+	return VOD_OK;
 }
 
-static u_char*
-mss_write_manifest_chunks_live(u_char* p, segment_durations_t* segment_durations)
+static vod_status_t
+mss_write_manifest_chunks_live(write_chain_t* chain, segment_durations_t* segment_durations)
 {
 	segment_duration_item_t* cur_item;
 	segment_duration_item_t* last_item = segment_durations->items + segment_durations->item_count;
 	uint32_t repeat_count;
 	bool_t first_time = TRUE;
+	vod_status_t rc;
+	u_char* p;
 
 	for (cur_item = segment_durations->items; cur_item < last_item; cur_item++)
 	{
@@ -154,7 +164,13 @@ mss_write_manifest_chunks_live(u_char* p, segment_durations_t* segment_durations
 		// output the timestamp in the first chunk
 		if (first_time)
 		{
-			p = vod_sprintf(p, MSS_CHUNK_TAG_LIVE_FIRST, 
+			rc = write_chain_get_bytes(chain, sizeof(MSS_CHUNK_TAG_LIVE_FIRST) + 2 * VOD_INT64_LEN, &p);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
+			chain->write_buffer.cur_pos = vod_sprintf(p, MSS_CHUNK_TAG_LIVE_FIRST, 
 				mss_rescale_millis(segment_durations->start_time), 
 				rescale_time(cur_item->duration, segment_durations->timescale, MSS_TIMESCALE));
 			repeat_count--;
@@ -164,11 +180,17 @@ mss_write_manifest_chunks_live(u_char* p, segment_durations_t* segment_durations
 		// output only the duration in subsequent chunks
 		for (; repeat_count > 0; repeat_count--)
 		{
-			p = vod_sprintf(p, MSS_CHUNK_TAG_LIVE, rescale_time(cur_item->duration, segment_durations->timescale, MSS_TIMESCALE));
+			rc = write_chain_get_bytes(chain, sizeof(MSS_CHUNK_TAG_LIVE) + VOD_INT64_LEN, &p);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
+			chain->write_buffer.cur_pos = vod_sprintf(p, MSS_CHUNK_TAG_LIVE, rescale_time(cur_item->duration, segment_durations->timescale, MSS_TIMESCALE));
 		}
 	}
 
-	return p;
+	return VOD_OK;
 }
 
 static bool_t 
@@ -312,16 +334,17 @@ mss_packager_build_manifest(
 	size_t extra_tags_size,
 	mss_write_tags_callback_t write_extra_tags,
 	void* extra_tags_writer_context,
-	vod_str_t* result)
+	vod_chain_t** result,
+	size_t* result_size)
 {
 	adaptation_sets_t adaptation_sets;
 	adaptation_set_t* adaptation_set;
 	segmenter_conf_t* segmenter_conf = media_set->segmenter_conf;
 	media_sequence_t* cur_sequence;
 	media_track_t** cur_track_ptr;
-	media_track_t* last_track;
 	media_track_t* cur_track;
 	segment_durations_t segment_durations[MEDIA_TYPE_COUNT];
+	write_chain_t chain;
 	vod_str_t* fourcc;
 	uint64_t duration_100ns;
 	uint32_t media_type;
@@ -329,8 +352,7 @@ mss_packager_build_manifest(
 	uint32_t bitrate;
 	uint32_t audio_tag;
 	vod_status_t rc;
-	size_t adaptation_set_size = 0;
-	size_t result_size;
+	size_t size;
 	u_char* p;
 
 	if (media_set->use_discontinuity)
@@ -353,16 +375,6 @@ mss_packager_build_manifest(
 		return rc;
 	}
 
-	// calculate the result size
-	result_size =
-		sizeof(MSS_MANIFEST_HEADER_PREFIX) - 1 + VOD_INT64_LEN + sizeof(MSS_MANIFEST_HEADER_SUFFIX) - 1 +
-		extra_tags_size +
-		sizeof(MSS_MANIFEST_FOOTER);
-	if (media_set->type == MEDIA_SET_LIVE)
-	{
-		result_size += sizeof(MSS_MANIFEST_HEADER_LIVE_ATTRIBUTES) - 1 + VOD_INT64_LEN + VOD_INT32_LEN;
-	}
-
 	for (media_type = 0; media_type < MEDIA_TYPE_COUNT; media_type++)
 	{
 		if (adaptation_sets.count[media_type] == 0)
@@ -383,76 +395,18 @@ mss_packager_build_manifest(
 			return rc;
 		}
 
-		// add the segments size
-		switch (media_set->type)
+		if (media_set->type == MEDIA_SET_LIVE && !media_set->presentation_end)
 		{
-		case MEDIA_SET_VOD:
-			adaptation_set_size = segment_durations[media_type].segment_count * (sizeof(MSS_CHUNK_TAG) + VOD_INT32_LEN + VOD_INT64_LEN);
-			break;
-
-		case MEDIA_SET_LIVE:
-			if (!media_set->presentation_end)
+			if (segment_durations[media_type].segment_count <= MAX_LOOK_AHEAD_SEGMENTS)
 			{
-				if (segment_durations[media_type].segment_count <= MAX_LOOK_AHEAD_SEGMENTS)
-				{
-					vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-						"mss_packager_build_manifest: segment count %uD smaller than look ahead segment count", 
-						segment_durations[media_type].segment_count);
-					return VOD_BAD_REQUEST;
-				}
-
-				mss_packager_remove_segment_durations(&segment_durations[media_type], MAX_LOOK_AHEAD_SEGMENTS);
+				vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+					"mss_packager_build_manifest: segment count %uD smaller than look ahead segment count", 
+					segment_durations[media_type].segment_count);
+				return VOD_BAD_REQUEST;
 			}
 
-			adaptation_set_size = segment_durations[media_type].segment_count * (sizeof(MSS_CHUNK_TAG_LIVE) + VOD_INT64_LEN) +
-				sizeof(MSS_CHUNK_TAG_LIVE_FIRST) + 2 * VOD_INT64_LEN;
-			break;
+			mss_packager_remove_segment_durations(&segment_durations[media_type], MAX_LOOK_AHEAD_SEGMENTS);
 		}
-
-		result_size += adaptation_sets.count[media_type] * adaptation_set_size;
-	}
-
-	// add the stream indexes
-	for (adaptation_set = adaptation_sets.first;
-		adaptation_set < adaptation_sets.last;
-		adaptation_set++)
-	{
-		cur_track = *adaptation_set->first;
-
-		result_size += cur_track->media_info.tags.label.len + cur_track->media_info.tags.lang_str.len;
-	}
-
-	result_size +=
-		(sizeof(MSS_STREAM_INDEX_HEADER) - 1 + 2 * sizeof(MSS_STREAM_TYPE_VIDEO) + 2 * VOD_INT32_LEN +
-		sizeof(MSS_STREAM_INDEX_FOOTER)) * adaptation_sets.count[ADAPTATION_TYPE_VIDEO] + 
-		(sizeof(MSS_STREAM_INDEX_HEADER_LABEL) - 1 + 2 * sizeof(MSS_STREAM_TYPE_AUDIO) + 2 * VOD_INT32_LEN +
-		sizeof(MSS_STREAM_INDEX_FOOTER)) * adaptation_sets.count[ADAPTATION_TYPE_AUDIO] + 
-		(sizeof(MSS_STREAM_INDEX_HEADER_SUBTITLE) - 1 + 2 * VOD_INT32_LEN +
-		sizeof(MSS_STREAM_INDEX_FOOTER)) * adaptation_sets.count[ADAPTATION_TYPE_SUBTITLE];
-
-	// add the quality levels
-	cur_track = media_set->filtered_tracks;
-	last_track = cur_track + media_set->total_track_count;
-	for (; cur_track < last_track; cur_track++)
-	{
-		result_size += cur_track->media_info.extra_data.len * 2;
-	}
-
-	result_size += 
-		(sizeof(MSS_VIDEO_QUALITY_LEVEL_HEADER) - 1 + 4 * VOD_INT32_LEN + 
-		sizeof(MSS_QUALITY_LEVEL_FOOTER) - 1) * media_set->track_count[MEDIA_TYPE_VIDEO] + 
-		(sizeof(MSS_AUDIO_QUALITY_LEVEL_HEADER) - 1 + 7 * VOD_INT32_LEN + mss_fourcc_aac.len + 
-		sizeof(MSS_QUALITY_LEVEL_FOOTER) - 1) * media_set->track_count[MEDIA_TYPE_AUDIO] + 
-		(sizeof(MSS_SUBTITLE_QUALITY_LEVEL) - 1 + 2 * VOD_INT32_LEN) * 
-		media_set->track_count[MEDIA_TYPE_SUBTITLE];
-
-	// allocate the result
-	result->data = vod_alloc(request_context->pool, result_size);
-	if (result->data == NULL)
-	{
-		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"mss_packager_build_manifest: vod_alloc failed");
-		return VOD_ALLOC_FAILED;
 	}
 
 	// header
@@ -465,7 +419,19 @@ mss_packager_build_manifest(
 		duration_100ns = 0;
 	}
 
-	p = vod_sprintf(result->data, MSS_MANIFEST_HEADER_PREFIX, duration_100ns);
+	write_chain_init(&chain, request_context);
+
+	rc = write_chain_get_bytes(&chain, 
+		sizeof(MSS_MANIFEST_HEADER_PREFIX) - 1 + VOD_INT64_LEN + 
+		sizeof(MSS_MANIFEST_HEADER_LIVE_ATTRIBUTES) - 1 + VOD_INT64_LEN + VOD_INT32_LEN +
+		sizeof(MSS_MANIFEST_HEADER_SUFFIX) - 1, 
+		&p);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	p = vod_sprintf(p, MSS_MANIFEST_HEADER_PREFIX, duration_100ns);
 	if (media_set->type == MEDIA_SET_LIVE)
 	{
 		media_type = media_set->track_count[MEDIA_TYPE_VIDEO] != 0 ? MEDIA_TYPE_VIDEO : MEDIA_TYPE_AUDIO;
@@ -473,7 +439,7 @@ mss_packager_build_manifest(
 			mss_rescale_millis(segment_durations[media_type].segment_count * segmenter_conf->segment_duration),
 			MAX_LOOK_AHEAD_SEGMENTS);
 	}
-	p = vod_copy(p, MSS_MANIFEST_HEADER_SUFFIX, sizeof(MSS_MANIFEST_HEADER_SUFFIX) - 1);
+	chain.write_buffer.cur_pos = vod_copy(p, MSS_MANIFEST_HEADER_SUFFIX, sizeof(MSS_MANIFEST_HEADER_SUFFIX) - 1);
 
 	for (adaptation_set = adaptation_sets.first;
 		adaptation_set < adaptation_sets.last;
@@ -482,12 +448,24 @@ mss_packager_build_manifest(
 		media_type = adaptation_set->type;
 
 		// print the stream index
+		cur_track = *adaptation_set->first;
+
+		// Note: using the sum of the labeled headers as an upper bound for all stream index types
+		rc = write_chain_get_bytes(&chain,
+			sizeof(MSS_STREAM_INDEX_HEADER_LABEL) - 1 + 2 * sizeof(MSS_STREAM_TYPE_AUDIO) + 
+			sizeof(MSS_STREAM_INDEX_HEADER_SUBTITLE) - 1 + 2 * VOD_INT32_LEN +
+			cur_track->media_info.tags.label.len + cur_track->media_info.tags.lang_str.len,
+			&p);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
 		switch (media_type)
 		{
 		case MEDIA_TYPE_AUDIO:
 			if (adaptation_sets.multi_audio)
 			{
-				cur_track = *adaptation_set->first;
 				p = vod_sprintf(p,
 					MSS_STREAM_INDEX_HEADER_LABEL,
 					MSS_STREAM_TYPE_AUDIO,
@@ -510,7 +488,6 @@ mss_packager_build_manifest(
 			break;
 
 		case MEDIA_TYPE_SUBTITLE:
-			cur_track = *adaptation_set->first;
 			p = vod_sprintf(p,
 				MSS_STREAM_INDEX_HEADER_SUBTITLE,
 				&cur_track->media_info.tags.label,
@@ -520,6 +497,8 @@ mss_packager_build_manifest(
 			break;
 		}
 
+		chain.write_buffer.cur_pos = p;
+
 		stream_index = 0;
 
 		// print the quality levels
@@ -533,6 +512,17 @@ mss_packager_build_manifest(
 			bitrate = cur_track->media_info.bitrate;
 			bitrate = mss_encode_indexes(bitrate, cur_sequence->index, cur_track->index);
 
+			// Note: the audio quality level is the longest
+			size = sizeof(MSS_AUDIO_QUALITY_LEVEL_HEADER) - 1 + 7 * VOD_INT32_LEN + mss_fourcc_aac.len +
+				cur_track->media_info.extra_data.len * 2 +
+				sizeof(MSS_QUALITY_LEVEL_FOOTER) - 1;
+
+			rc = write_chain_get_bytes(&chain, size, &p);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
 			switch (media_type)
 			{
 			case MEDIA_TYPE_VIDEO:
@@ -569,7 +559,7 @@ mss_packager_build_manifest(
 				break;
 
 			case MEDIA_TYPE_SUBTITLE:
-				p = vod_sprintf(p, MSS_SUBTITLE_QUALITY_LEVEL,
+				chain.write_buffer.cur_pos = vod_sprintf(p, MSS_SUBTITLE_QUALITY_LEVEL,
 					stream_index++,
 					bitrate);
 				continue;
@@ -577,22 +567,37 @@ mss_packager_build_manifest(
 
 			p = vod_append_hex_string(p, cur_track->media_info.extra_data.data, cur_track->media_info.extra_data.len);
 
-			p = vod_copy(p, MSS_QUALITY_LEVEL_FOOTER, sizeof(MSS_QUALITY_LEVEL_FOOTER) - 1);
+			chain.write_buffer.cur_pos = vod_copy(p, MSS_QUALITY_LEVEL_FOOTER, sizeof(MSS_QUALITY_LEVEL_FOOTER) - 1);
 		}
 
 		// print the chunk list
 		switch (media_set->type)
 		{
 		case MEDIA_SET_VOD:
-			p = mss_write_manifest_chunks(p, &segment_durations[media_type]);
+			rc = mss_write_manifest_chunks(&chain, &segment_durations[media_type]);
 			break;
 
-		case MEDIA_SET_LIVE:
-			p = mss_write_manifest_chunks_live(p, &segment_durations[media_type]);
+		default:		// MEDIA_SET_LIVE
+			rc = mss_write_manifest_chunks_live(&chain, &segment_durations[media_type]);
 			break;
 		}
 
-		p = vod_copy(p, MSS_STREAM_INDEX_FOOTER, sizeof(MSS_STREAM_INDEX_FOOTER) - 1);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		rc = write_buffer_write(&chain.write_buffer, (u_char*)MSS_STREAM_INDEX_FOOTER, sizeof(MSS_STREAM_INDEX_FOOTER) - 1);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	rc = write_chain_get_bytes(&chain, extra_tags_size + sizeof(MSS_MANIFEST_FOOTER) - 1, &p);
+	if (rc != VOD_OK)
+	{
+		return rc;
 	}
 
 	if (write_extra_tags != NULL)
@@ -600,19 +605,9 @@ mss_packager_build_manifest(
 		p = write_extra_tags(extra_tags_writer_context, p, media_set);
 	}
 
-	p = vod_copy(p, MSS_MANIFEST_FOOTER, sizeof(MSS_MANIFEST_FOOTER) - 1);
+	chain.write_buffer.cur_pos = vod_copy(p, MSS_MANIFEST_FOOTER, sizeof(MSS_MANIFEST_FOOTER) - 1);
 
-	result->len = p - result->data;
-	
-	if (result->len > result_size)
-	{
-		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-			"mss_packager_build_manifest: result length %uz exceeded allocated length %uz",
-			result->len, result_size);
-		return VOD_UNEXPECTED;
-	}
-	
-	return VOD_OK;
+	return write_chain_finalize(&chain, result, result_size);
 }
 
 static u_char*
@@ -4,6 +4,7 @@
 // includes
 #include "../media_format.h"
 #include "../segmenter.h"
+#include "../write_chain.h"
 #include "../common.h"
 
 // constants
@@ -37,7 +38,8 @@ vod_status_t mss_packager_build_manifest(
 	size_t extra_tags_size,
 	mss_write_tags_callback_t write_extra_tags,
 	void* extra_tags_writer_context,
-	vod_str_t* result);
+	vod_chain_t** result,
+	size_t* result_size);
 
 vod_status_t mss_packager_build_fragment_header(
 	request_context_t* request_context,
@@ -75,7 +75,8 @@ mss_playready_build_manifest(
 	request_context_t* request_context,
 	mss_manifest_config_t* conf,
 	media_set_t* media_set,
-	vod_str_t* result)
+	vod_chain_t** result,
+	size_t* result_size)
 {
 	// Note: taking only the first sequence, in mss all renditions must have the same key
 	drm_info_t* drm_info = (drm_info_t*)media_set->sequences[0].drm_info;
@@ -100,7 +101,8 @@ mss_playready_build_manifest(
 		extra_tags_size,
 		mss_playready_write_protection_tag,
 		NULL,
-		result);
+		result,
+		result_size);
 }
 
 static u_char*
@@ -11,7 +11,8 @@ vod_status_t mss_playready_build_manifest(
 	request_context_t* request_context,
 	mss_manifest_config_t* conf,
 	media_set_t* media_set,
-	vod_str_t* result);
+	vod_chain_t** result,
+	size_t* result_size);
 
 vod_status_t mss_playready_get_fragment_writer(
 	segment_writer_t* segment_writer,
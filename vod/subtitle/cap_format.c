@@ -52,6 +52,7 @@ cap_reader_init(
 	request_context_t* request_context,
 	vod_str_t* buffer,
 	size_t max_metadata_size,
+	uint32_t flags,
 	void** ctx)
 {
 	u_char* p = buffer->data;
@@ -140,24 +141,6 @@ cap_get_duration(vod_str_t* source)
 	return result;
 }
 
-static vod_status_t
-cap_parse(
-	request_context_t* request_context,
-	media_parse_params_t* parse_params,
-	vod_str_t* source,
-	size_t metadata_part_count,
-	media_base_metadata_t** result)
-{
-	return subtitle_parse(
-		request_context,
-		parse_params,
-		source,
-		NULL,
-		cap_get_duration(source),
-		metadata_part_count,
-		result);
-}
-
 static u_char*
 cap_get_next_block(u_char* p, u_char* end)
 {
@@ -260,88 +243,33 @@ cap_parse_text(u_char* dest, u_char* src, u_char* src_end)
 }
 
 static vod_status_t
-cap_parse_frames(
+cap_build_cue_index(
 	request_context_t* request_context,
-	media_base_metadata_t* base,
-	media_parse_params_t* parse_params,
-	struct segmenter_conf_s* segmenter,
-	read_cache_state_t* read_cache_state,
-	vod_str_t* frame_data,
-	media_format_read_request_t* read_req,
-	media_track_array_t* result)
+	vod_str_t* source,
+	vod_str_t* result)
 {
-	subtitle_base_metadata_t* metadata = vod_container_of(base, subtitle_base_metadata_t, base);
-	media_track_t* track = base->tracks.elts;
-	input_frame_t* cur_frame = NULL;
-	vod_array_t frames;
-	vod_str_t* source = &metadata->source;
-	vod_str_t* header = &track->media_info.extra_data;
-	uint64_t last_start_time = 0;
-	uint64_t start_time = 0;
-	uint64_t end_time = 0;
-	uint64_t base_time;
-	uint64_t clip_to;
-	uint64_t start;
-	uint64_t end;
+	subtitle_cue_index_builder_t builder;
+	uint64_t start_time;
+	uint64_t end_time;
+	vod_str_t text;
 	u_char* cur_pos = source->data + CAP_DATA_START_OFFSET;
 	u_char* end_pos = source->data + source->len;
 	u_char* next;
 	u_char* text_start;
 	u_char* text_end;
-	u_char* p;
 	u_char hours_base = 0;
 	bool_t first_time = TRUE;
 	size_t frame_size;
-	
-	vod_memzero(result, sizeof(*result));
-	result->first_track = track;
-	result->last_track = track + 1;
-	result->track_count[MEDIA_TYPE_SUBTITLE] = 1;
-	result->total_track_count = 1;
+	vod_status_t rc;
 
-	header->len = sizeof(WEBVTT_HEADER_NEWLINES) - 1;
-	header->data = (u_char*)WEBVTT_HEADER_NEWLINES;
-	
-	if ((parse_params->parse_type & PARSE_FLAG_FRAMES_ALL) == 0)
+	rc = subtitle_cue_index_init(request_context, NULL, &builder);
+	if (rc != VOD_OK)
 	{
-		return VOD_OK;
+		return rc;
 	}
 
-	// cues
-	if (vod_array_init(&frames, request_context->pool, 5, sizeof(*cur_frame)) != VOD_OK)
-	{
-		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"cap_parse_frames: vod_array_init failed");
-		return VOD_ALLOC_FAILED;
-	}
-
-	start = parse_params->range->start + parse_params->clip_from;
-
-	if ((parse_params->parse_type & PARSE_FLAG_RELATIVE_TIMESTAMPS) != 0)
-	{
-		base_time = start;
-		clip_to = parse_params->range->end - parse_params->range->start;
-		end = clip_to;
-	}
-	else
+	for (cur_pos = cap_get_next_block(cur_pos, end_pos); cur_pos != NULL; cur_pos = next)
 	{
-		base_time = parse_params->clip_from;
-		clip_to = parse_params->clip_to;
-		end = parse_params->range->end;		// Note: not adding clip_from, since end is checked after the clipping is applied to the timestamps
-	}
-
-	for (cur_pos = cap_get_next_block(cur_pos, end_pos); ; cur_pos = next)
-	{
-		if (cur_pos == NULL)
-		{
-			if (cur_frame != NULL)
-			{
-				cur_frame->duration = end_time - start_time;
-				track->total_frames_duration = end_time - track->first_frame_time_offset;
-			}
-			break;
-		}
-		
 		next = cap_get_next_block(cur_pos + cur_pos[0], end_pos);
 
 		// get start / end
@@ -367,64 +295,19 @@ cap_parse_frames(
 				end_time = start_time + CAP_LAST_FRAME_DURATION;
 			}
 		}
-		
-		if (end_time < start)
-		{
-			track->first_frame_index++;
-			continue;
-		}
-		
+
 		if (start_time >= end_time)
 		{
-			continue;
-		}
-		
-		// apply clipping
-		if (start_time >= base_time)
-		{
-			start_time -= base_time;
-			if (start_time > clip_to)
+			// add the cue so that it will be counted in first_frame_index
+			rc = subtitle_cue_index_add(&builder, end_time, end_time, NULL, NULL);
+			if (rc != VOD_OK)
 			{
-				start_time = clip_to;
+				return rc;
 			}
-		}
-		else
-		{
-			start_time = 0;
-		}
-
-		end_time -= base_time;
-		if ((uint64_t)end_time > clip_to)
-		{
-			end_time = clip_to;
-		}
-
-		// adjust the duration of the previous frame
-		if (cur_frame != NULL)
-		{
-			cur_frame->duration = start_time - last_start_time;
-		}
-		else
-		{
-			track->first_frame_time_offset = start_time;
-		}
-
-		if ((uint64_t)start_time >= end)
-		{
-			track->total_frames_duration = start_time - track->first_frame_time_offset;
-			break;
+			continue;
 		}
 
-		// allocate the frame
-		cur_frame = vod_array_push(&frames);
-		if (cur_frame == NULL)
-		{
-			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-				"cap_parse_frames: vod_array_push failed");
-			return VOD_ALLOC_FAILED;
-		}
-		
-		// allocate the text
+		// get the text
 		if ((cur_pos[1] & CAP_FLAG_HAS_END_TIME) != 0)
 		{
 			text_start = cur_pos + CAP_HEADER_SIZE_END_TIME;
@@ -437,43 +320,106 @@ cap_parse_frames(
 
 		frame_size = cap_get_max_text_len(text_start, text_end);
 
-		p = vod_alloc(request_context->pool, frame_size);
-		if (p == NULL)
+		text.data = vod_alloc(request_context->pool, frame_size);
+		if (text.data == NULL)
 		{
 			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-				"cap_parse_frames: vod_alloc failed");
+				"cap_build_cue_index: vod_alloc failed");
 			return VOD_ALLOC_FAILED;
 		}
-		
-		// Note: mapping of cue into input_frame_t:
-		//	- offset = pointer to buffer containing: cue id, cue settings list, cue payload
-		//	- size = size of data pointed by offset
-		//	- key_frame = cue id length
-		//	- dts = start time
-		//	- pts = end time
-
-		cur_frame->size = cap_parse_text(p, text_start, text_end) - p;
-		if (cur_frame->size > frame_size)
+
+		text.len = cap_parse_text(text.data, text_start, text_end) - text.data;
+		if (text.len > frame_size)
 		{
 			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-				"cap_parse_frames: result length %uD exceeded allocated length %uz",
-				cur_frame->size, frame_size);
+				"cap_build_cue_index: result length %uz exceeded allocated length %uz",
+				text.len, frame_size);
 			return VOD_UNEXPECTED;
 		}
 
-		cur_frame->offset = (uintptr_t)p;
-		cur_frame->pts_delay = end_time - start_time;
-		cur_frame->key_frame = 0;
-		track->total_frames_size += cur_frame->size;
+		rc = subtitle_cue_index_add(&builder, start_time, end_time, NULL, &text);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	return subtitle_cue_index_finalize(&builder, cap_get_duration(source), result);
+}
 
-		last_start_time = start_time;		
+static vod_status_t
+cap_parse(
+	request_context_t* request_context,
+	media_parse_params_t* parse_params,
+	vod_str_t* metadata_parts,
+	size_t metadata_part_count,
+	media_base_metadata_t** result)
+{
+	vod_str_t local_index;
+	vod_str_t* source;
+	vod_str_t* index;
+	vod_status_t rc;
+
+	subtitle_get_metadata_parts(metadata_parts, metadata_part_count, &source, &index);
+
+	if (index == NULL)
+	{
+		index = &local_index;
+		index->len = 0;
 	}
 
-	track->frame_count = frames.nelts;
-	track->frames.first_frame = frames.elts;
-	track->frames.last_frame = track->frames.first_frame + frames.nelts;
+	if (index->len == 0)
+	{
+		// Note: when index points to the metadata parts, the built index will be saved to cache
+		rc = cap_build_cue_index(request_context, source, index);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
 
-	return VOD_OK;
+	return subtitle_parse(
+		request_context,
+		parse_params,
+		source,
+		index,
+		result);
+}
+
+static vod_status_t
+cap_parse_frames(
+	request_context_t* request_context,
+	media_base_metadata_t* base,
+	media_parse_params_t* parse_params,
+	struct segmenter_conf_s* segmenter,
+	read_cache_state_t* read_cache_state,
+	vod_str_t* frame_data,
+	media_format_read_request_t* read_req,
+	media_track_array_t* result)
+{
+	subtitle_base_metadata_t* metadata = vod_container_of(base, subtitle_base_metadata_t, base);
+	media_track_t* track = base->tracks.elts;
+	vod_str_t* header = &track->media_info.extra_data;
+	
+	vod_memzero(result, sizeof(*result));
+	result->first_track = track;
+	result->last_track = track + 1;
+	result->track_count[MEDIA_TYPE_SUBTITLE] = 1;
+	result->total_track_count = 1;
+
+	header->len = sizeof(WEBVTT_HEADER_NEWLINES) - 1;
+	header->data = (u_char*)WEBVTT_HEADER_NEWLINES;
+	
+	if ((parse_params->parse_type & PARSE_FLAG_FRAMES_ALL) == 0)
+	{
+		return VOD_OK;
+	}
+
+	return subtitle_parse_frames(
+		request_context,
+		metadata,
+		parse_params,
+		track);
 }
 
 media_format_t cap_format = {
@@ -4,7 +4,6 @@
 #include "subtitle_format.h"
 
 #include <libxml/parser.h>
-#include <libxml/tree.h>
 
 #define DFXP_PREFIX "<tt"
 #define DFXP_XML_PREFIX1 "<?xml"
@@ -13,6 +12,7 @@
 #define DFXP_DURATION_ESTIMATE_NODES (10)
 #define DFXP_MAX_STACK_DEPTH (10)
 #define DFXP_FRAME_RATE (30)
+#define DFXP_MAX_TIMESTAMP_LEN (64)
 
 #define DFXP_ELEMENT_P (u_char*)"p"
 #define DFXP_ELEMENT_BR (u_char*)"br"
@@ -22,11 +22,41 @@
 #define DFXP_ATTR_END (u_char*)"end"
 #define DFXP_ATTR_DUR (u_char*)"dur"
 
+// typedefs
+typedef struct {
+	bool_t found;
+	int64_t value;
+} dfxp_timestamp_attr_t;
+
+typedef struct {
+	request_context_t* request_context;
+	xmlParserCtxtPtr ctxt;
+	subtitle_cue_index_builder_t builder;
+	vod_status_t rc;
+
+	// element state
+	unsigned depth;
+	unsigned skip_depth;		// non-zero when skipping the children of an element
+	unsigned p_depth;			// non-zero when inside a p element
+	unsigned span_depth;
+
+	// p element state
+	dfxp_timestamp_attr_t begin;
+	dfxp_timestamp_attr_t end;
+	dfxp_timestamp_attr_t dur;
+	vod_array_t text;
+
+	// duration estimate
+	int64_t end_times[DFXP_DURATION_ESTIMATE_NODES];
+	unsigned end_time_count;
+} dfxp_sax_state_t;
+
 static vod_status_t
 dfxp_reader_init(
 	request_context_t* request_context,
 	vod_str_t* buffer,
 	size_t max_metadata_size,
+	uint32_t flags,
 	void** ctx)
 {
 	u_char* p = buffer->data;
@@ -55,24 +85,6 @@ dfxp_reader_init(
 		ctx);
 }
 
-// a simplified version of xmlGetProp that does not copy memory, but is also limited to a single child
-static xmlChar* 
-dfxp_get_xml_prop(xmlNode* node, xmlChar* name)
-{
-	xmlAttrPtr prop;
-
-	prop = xmlHasProp(node, name);
-	if (prop == NULL ||
-		prop->children == NULL ||
-		prop->children->next != NULL ||
-		(prop->children->type != XML_TEXT_NODE && prop->children->type != XML_CDATA_SECTION_NODE))
-	{
-		return NULL;
-	}
-
-	return prop->children->content;
-}
-
 static int64_t 
 dfxp_parse_timestamp(u_char* ts)
 {
@@ -223,110 +235,6 @@ dfxp_parse_timestamp(u_char* ts)
 	return -1;
 }
 
-static int64_t 
-dfxp_get_end_time(xmlNode *cur_node)
-{
-	xmlChar* attr;
-	int64_t begin;
-	int64_t dur;
-	
-	// prefer the end attribute
-	attr = dfxp_get_xml_prop(cur_node, DFXP_ATTR_END);
-	if (attr != NULL)
-	{
-		return dfxp_parse_timestamp(attr);
-	}
-	
-	// fall back to dur + start
-	attr = dfxp_get_xml_prop(cur_node, DFXP_ATTR_DUR);
-	if (attr == NULL)
-	{
-		return -1;
-	}
-	
-	dur = dfxp_parse_timestamp(attr);
-	if (dur < 0)
-	{
-		return -1;
-	}
-	
-	attr = dfxp_get_xml_prop(cur_node, DFXP_ATTR_BEGIN);
-	if (attr == NULL)
-	{
-		return -1;
-	}
-	
-	begin = dfxp_parse_timestamp(attr);
-	if (begin < 0)
-	{
-		return -1;
-	}
-	
-	return begin + dur;
-}
-
-static uint64_t
-dfxp_get_duration(xmlDoc *doc)
-{
-	xmlNode* node_stack[DFXP_MAX_STACK_DEPTH];
-	xmlNode* cur_node;
-	xmlNode temp_node;
-	unsigned node_stack_pos = 0;
-	int nodes_left = DFXP_DURATION_ESTIMATE_NODES;
-	int64_t result = 0;
-	int64_t cur;
-
-	for (cur_node = xmlDocGetRootElement(doc); ; cur_node = cur_node->prev)
-	{
-		// traverse the tree dfs order (reverse child order)
-		if (cur_node == NULL)
-		{
-			if (node_stack_pos <= 0)
-			{
-				break;
-			}
-
-			cur_node = node_stack[--node_stack_pos];
-			continue;
-		}
-
-		if (cur_node->type != XML_ELEMENT_NODE)
-		{
-			continue;
-		}
-
-		// recurse into non-p nodes
-		if (vod_strcmp(cur_node->name, DFXP_ELEMENT_P) != 0)
-		{
-			if (cur_node->last == NULL || 
-				node_stack_pos >= vod_array_entries(node_stack))
-			{
-				continue;
-			}
-
-			node_stack[node_stack_pos++] = cur_node;
-			temp_node.prev = cur_node->last;
-			cur_node = &temp_node;
-			continue;
-		}
-
-		// get the end time of this p node
-		cur = dfxp_get_end_time(cur_node);
-		if (cur > result)
-		{
-			result = cur;
-		}
-
-		nodes_left--;
-		if (nodes_left <= 0)
-		{
-			break;
-		}
-	}
-	
-	return result;
-}
-
 static void
 dfxp_strip_new_lines(u_char* buf, size_t n)
 {
@@ -396,240 +304,96 @@ dfxp_xml_schema_error(void *data, const char *msg, ...)
 }
 
 static void
-dfxp_free_xml_doc(void *data)
+dfxp_sax_set_error(dfxp_sax_state_t* state, vod_status_t rc)
 {
-	xmlFreeDoc(data);
+	if (state->rc == VOD_OK)
+	{
+		state->rc = rc;
+	}
+
+	xmlStopParser(state->ctxt);
 }
 
-static vod_status_t
-dfxp_parse(
-	request_context_t* request_context,
-	media_parse_params_t* parse_params,
-	vod_str_t* source,
-	size_t metadata_part_count,
-	media_base_metadata_t** result)
+static void
+dfxp_sax_get_timestamp_attr(
+	const xmlChar** attr, 
+	dfxp_timestamp_attr_t* result)
 {
-	vod_pool_cleanup_t *cln;
-	xmlParserCtxtPtr ctxt;
-	xmlDoc *doc;
+	u_char buf[DFXP_MAX_TIMESTAMP_LEN];
+	size_t len;
 
-	// parse the xml
-	cln = vod_pool_cleanup_add(request_context->pool, 0);
-	if (cln == NULL)
+	if (result->found)
 	{
-		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"dfxp_parse: vod_pool_cleanup_add failed");
-		return VOD_ALLOC_FAILED;
+		return;		// use the first attribute, same as xmlHasProp
 	}
 
-	ctxt = xmlCreateDocParserCtxt(source->data);
-	if (ctxt == NULL)
+	// Note: attr = localname/prefix/URI/value/end, the value is not null terminated
+	len = attr[4] - attr[3];
+	if (len <= 0)
 	{
-		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-			"dfxp_parse: xmlCreateDocParserCtxt failed");
-		return VOD_ALLOC_FAILED;
+		return;		// an empty attribute has no text child, treated as missing
 	}
 
-	xmlCtxtUseOptions(ctxt, XML_PARSE_RECOVER | XML_PARSE_NOWARNING | XML_PARSE_NONET);
-	
-	ctxt->sax->setDocumentLocator = NULL;
-	ctxt->sax->error = dfxp_xml_sax_error;
-	ctxt->sax->fatalError = dfxp_xml_sax_error;
-	ctxt->vctxt.error = dfxp_xml_schema_error;
-	ctxt->sax->_private = request_context;
+	result->found = TRUE;
 
-	if (xmlParseDocument(ctxt) != 0 ||
-		ctxt->myDoc == NULL ||
-		(!ctxt->wellFormed && !ctxt->recovery))
+	if (len >= sizeof(buf))
 	{
-		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"dfxp_parse: xml parsing failed");
-		if (ctxt->myDoc != NULL)
-		{
-			xmlFreeDoc(ctxt->myDoc);
-		}
-		xmlFreeParserCtxt(ctxt);
-		return VOD_BAD_DATA;
+		result->value = -1;
+		return;
 	}
 
-	doc = ctxt->myDoc;
-	ctxt->myDoc = NULL;
-
-	xmlFreeParserCtxt(ctxt);
-
-	cln->handler = dfxp_free_xml_doc;
-	cln->data = doc;
+	vod_memcpy(buf, attr[3], len);
+	buf[len] = '\0';
 
-	return subtitle_parse(
-		request_context,
-		parse_params,
-		source,
-		doc,
-		dfxp_get_duration(doc),
-		metadata_part_count,
-		result);
+	result->value = dfxp_parse_timestamp(buf);
 }
 
-static u_char* 
-dfxp_append_string(u_char* p, u_char* s)
+static void
+dfxp_sax_start_p(
+	dfxp_sax_state_t* state,
+	int nb_attributes,
+	const xmlChar** attributes)
 {
-	// Note: not using strcpy as it would require an extra strlen to get the end position
-	while (*s)
-	{
-		*p++ = *s++;
-	}
-	return p;
-}
+	const xmlChar** attr_end;
+	const xmlChar** attr;
 
-static size_t
-dfxp_get_text_content_len(xmlNode* cur_node)
-{
-	xmlNode* node_stack[DFXP_MAX_STACK_DEPTH];
-	unsigned node_stack_pos = 0;
-	size_t result = 0;
+	state->p_depth = state->depth;
+	state->span_depth = 0;
+	state->begin.found = FALSE;
+	state->end.found = FALSE;
+	state->dur.found = FALSE;
 
-	for (;;)
+	attr_end = attributes + nb_attributes * 5;
+	for (attr = attributes; attr < attr_end; attr += 5)
 	{
-		// traverse the tree dfs order
-		if (cur_node == NULL)
-		{
-			if (node_stack_pos <= 0)
-			{
-				break;
-			}
-
-			cur_node = node_stack[--node_stack_pos];
-			continue;
-		}
-
-		switch (cur_node->type)
+		if (vod_strcmp(attr[0], DFXP_ATTR_BEGIN) == 0)
 		{
-		case XML_TEXT_NODE:
-		case XML_CDATA_SECTION_NODE:
-			result += vod_strlen(cur_node->content);
-			break;
-
-		case XML_ELEMENT_NODE:
-			if (vod_strcmp(cur_node->name, DFXP_ELEMENT_BR) == 0)
-			{
-				result++;		// \n
-				break;
-			}
-
-			if (vod_strcmp(cur_node->name, DFXP_ELEMENT_SPAN) != 0 ||
-				cur_node->children == NULL ||
-				node_stack_pos >= vod_array_entries(node_stack))
-			{
-				break;
-			}
-
-			node_stack[node_stack_pos++] = cur_node->next;
-			cur_node = cur_node->children;
-			continue;
-
-		default:
-			break;
+			dfxp_sax_get_timestamp_attr(attr, &state->begin);
 		}
-
-		cur_node = cur_node->next;
-	}
-
-	return result;
-}
-
-static u_char* 
-dfxp_append_text_content(xmlNode* cur_node, u_char* p)
-{
-	xmlNode* node_stack[DFXP_MAX_STACK_DEPTH];
-	unsigned node_stack_pos = 0;
-
-	for (;;)
-	{
-		// traverse the tree dfs order
-		if (cur_node == NULL)
+		else if (vod_strcmp(attr[0], DFXP_ATTR_END) == 0)
 		{
-			if (node_stack_pos <= 0)
-			{
-				break;
-			}
-
-			cur_node = node_stack[--node_stack_pos];
-			continue;
+			dfxp_sax_get_timestamp_attr(attr, &state->end);
 		}
-
-		switch (cur_node->type)
+		else if (vod_strcmp(attr[0], DFXP_ATTR_DUR) == 0)
 		{
-		case XML_TEXT_NODE:
-		case XML_CDATA_SECTION_NODE:
-			p = dfxp_append_string(p, cur_node->content);
-			break;
-
-		case XML_ELEMENT_NODE:
-			if (vod_strcmp(cur_node->name, DFXP_ELEMENT_BR) == 0)
-			{
-				*p++ = '\n';
-				break;
-			}
-
-			if (vod_strcmp(cur_node->name, DFXP_ELEMENT_SPAN) != 0 ||
-				cur_node->children == NULL ||
-				node_stack_pos >= vod_array_entries(node_stack))
-			{
-				break;
-			}
-
-			node_stack[node_stack_pos++] = cur_node->next;
-			cur_node = cur_node->children;
-			continue;
-
-		default:
-			break;
+			dfxp_sax_get_timestamp_attr(attr, &state->dur);
 		}
-
-		cur_node = cur_node->next;
 	}
 
-	return p;
+	// the first byte is reserved for the leading new line
+	state->text.nelts = 1;
 }
 
 static vod_status_t
-dfxp_get_frame_body(
-	request_context_t* request_context, 
-	xmlNode* cur_node, 
-	vod_str_t* result)
+dfxp_sax_get_text(dfxp_sax_state_t* state, vod_str_t* result)
 {
-	size_t alloc_size;
 	u_char* start;
 	u_char* end;
-	
-	// get the buffer length
-	alloc_size = dfxp_get_text_content_len(cur_node);
-	if (alloc_size == 0)
-	{
-		return VOD_NOT_FOUND;
-	}
-
-	alloc_size += 3;		// \n * 3
-
-	// get the text content
-	start = vod_alloc(request_context->pool, alloc_size);
-	if (start == NULL)
-	{
-		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"dfxp_get_frame_body: vod_alloc failed");
-		return VOD_ALLOC_FAILED;
-	}
-
-	start++;	// save space for prepending \n
+	u_char* p;
+	size_t len;
 
-	end = dfxp_append_text_content(cur_node, start);
-	if ((size_t)(end - start + 2) > alloc_size)
-	{
-		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-			"dfxp_get_frame_body: result length %uz exceeded allocated length %uz",
-			(size_t)(end - start + 2), alloc_size);
-		return VOD_UNEXPECTED;
-	}
+	start = (u_char*)state->text.elts + 1;
+	end = (u_char*)state->text.elts + state->text.nelts;
 
 	// trim spaces
 	for (;;)
@@ -649,11 +413,6 @@ dfxp_get_frame_body(
 
 	for (;;)
 	{
-		if (start >= end)
-		{
-			return VOD_NOT_FOUND;
-		}
-
 		if (!isspace(end[-1]))
 		{
 			break;
@@ -665,269 +424,401 @@ dfxp_get_frame_body(
 	// add leading/trailing newlines
 	start--;
 	*start = '\n';
-	*end++ = '\n';
-	*end++ = '\n';
 
-	result->data = start;
-	result->len = end - start;
+	len = end - start;
+	state->text.nelts = end - (u_char*)state->text.elts;
+
+	p = vod_array_push_n(&state->text, 2);
+	if (p == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"dfxp_sax_get_text: vod_array_push_n failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	*p++ = '\n';
+	*p++ = '\n';
+
+	// Note: the array may have been reallocated
+	result->data = p - len - 2;
+	result->len = len + 2;
 
 	return VOD_OK;
 }
 
-static vod_status_t
-dfxp_parse_frames(
-	request_context_t* request_context,
-	media_base_metadata_t* base,
-	media_parse_params_t* parse_params,
-	struct segmenter_conf_s* segmenter,
-	read_cache_state_t* read_cache_state,
-	vod_str_t* frame_data,
-	media_format_read_request_t* read_req,
-	media_track_array_t* result)
+static void
+dfxp_sax_end_p(dfxp_sax_state_t* state)
 {
-	subtitle_base_metadata_t* metadata = vod_container_of(base, subtitle_base_metadata_t, base);
-	media_track_t* track = base->tracks.elts;
-	input_frame_t* cur_frame = NULL;
-	vod_array_t frames;
-	vod_str_t* header = &track->media_info.extra_data;
-	uint64_t base_time;
-	uint64_t clip_to;
-	uint64_t start;
-	uint64_t end;
-	int64_t last_start_time = 0;
-	int64_t start_time = 0;
-	int64_t end_time = 0;
-	int64_t duration;
-	xmlNode* node_stack[DFXP_MAX_STACK_DEPTH];
-	xmlNode* cur_node;
-	xmlNode temp_node;
-	xmlChar* attr;
-	unsigned node_stack_pos = 0;
+	int64_t start_time;
+	int64_t end_time;
 	vod_str_t text;
 	vod_status_t rc;
 
-	// initialize the result
-	vod_memzero(result, sizeof(*result));
-	result->first_track = track;
-	result->last_track = track + 1;
-	result->track_count[MEDIA_TYPE_SUBTITLE] = 1;
-	result->total_track_count = 1;
+	state->p_depth = 0;
 
-	header->len = sizeof(WEBVTT_HEADER_NEWLINES) - 1;
-	header->data = (u_char*)WEBVTT_HEADER_NEWLINES;
-	
-	if ((parse_params->parse_type & PARSE_FLAG_FRAMES_ALL) == 0)
+	// save the end time for estimating the duration
+	if (state->end.found)
 	{
-		return VOD_OK;
+		end_time = state->end.value;
 	}
-
-	// init the frames array
-	if (vod_array_init(&frames, request_context->pool, 5, sizeof(*cur_frame)) != VOD_OK)
+	else if (state->dur.found && state->dur.value >= 0 && 
+		state->begin.found && state->begin.value >= 0)
 	{
-		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"dfxp_parse_frames: vod_array_init failed");
-		return VOD_ALLOC_FAILED;
+		end_time = state->begin.value + state->dur.value;
+	}
+	else
+	{
+		end_time = -1;
 	}
 
-	// get the start / end offsets
-	start = parse_params->range->start + parse_params->clip_from;
+	state->end_times[state->end_time_count % DFXP_DURATION_ESTIMATE_NODES] = end_time;
+	state->end_time_count++;
 
-	if ((parse_params->parse_type & PARSE_FLAG_RELATIVE_TIMESTAMPS) != 0)
+	// get the cue timing
+	if (state->end.found)
 	{
-		base_time = start;
-		clip_to = parse_params->range->end - parse_params->range->start;
-		end = clip_to;
+		end_time = state->end.value;
+		if (end_time < 0)
+		{
+			return;
+		}
+
+		start_time = state->begin.found ? state->begin.value : -1;
 	}
 	else
 	{
-		base_time = parse_params->clip_from;
-		clip_to = parse_params->clip_to;
-		end = parse_params->range->end;		// Note: not adding clip_from, since end is checked after the clipping is applied to the timestamps
+		if (!state->dur.found || state->dur.value < 0 ||
+			!state->begin.found || state->begin.value < 0)
+		{
+			return;
+		}
+
+		start_time = state->begin.value;
+		end_time = start_time + state->dur.value;
 	}
 
-	for (cur_node = xmlDocGetRootElement(metadata->context); ; cur_node = cur_node->next)
+	if (start_time < 0 || start_time >= end_time)
 	{
-		// traverse the tree dfs order
-		if (cur_node == NULL)
+		// add the cue so that it will be counted in first_frame_index
+		rc = subtitle_cue_index_add(&state->builder, end_time, end_time, NULL, NULL);
+		if (rc != VOD_OK)
 		{
-			if (node_stack_pos <= 0)
-			{
-				if (cur_frame != NULL)
-				{
-					cur_frame->duration = end_time - start_time;
-					track->total_frames_duration = end_time - track->first_frame_time_offset;
-				}
-				break;
-			}
-
-			cur_node = node_stack[--node_stack_pos];
-			continue;
+			dfxp_sax_set_error(state, rc);
 		}
+		return;
+	}
 
-		if (cur_node->type != XML_ELEMENT_NODE)
-		{
-			continue;
-		}
+	// get the text
+	rc = dfxp_sax_get_text(state, &text);
+	switch (rc)
+	{
+	case VOD_NOT_FOUND:
+		rc = subtitle_cue_index_add(&state->builder, end_time, end_time, NULL, NULL);
+		break;
 
-		if (vod_strcmp(cur_node->name, DFXP_ELEMENT_P) != 0)
-		{
-			if (cur_node->children == NULL ||
-				node_stack_pos >= vod_array_entries(node_stack))
-			{
-				continue;
-			}
+	case VOD_OK:
+		rc = subtitle_cue_index_add(&state->builder, start_time, end_time, NULL, &text);
+		break;
+	}
 
-			node_stack[node_stack_pos++] = cur_node;
-			temp_node.next = cur_node->children;
-			cur_node = &temp_node;
-			continue;
-		}
+	if (rc != VOD_OK)
+	{
+		dfxp_sax_set_error(state, rc);
+	}
+}
 
-		// handle p element
-		attr = dfxp_get_xml_prop(cur_node, DFXP_ATTR_END);
-		if (attr != NULL)
-		{
-			// has end time
-			end_time = dfxp_parse_timestamp(attr);
-			if (end_time < 0)
-			{
-				continue;
-			}
+// Note: the sax handlers follow the traversal of the previous dom based implementation - 
+//		p elements are searched up to DFXP_MAX_STACK_DEPTH levels deep, the text of a p element
+//		includes the text of nested spans (up to DFXP_MAX_STACK_DEPTH levels), and br elements
+static void
+dfxp_sax_start_element(
+	void* ctx,
+	const xmlChar* localname,
+	const xmlChar* prefix,
+	const xmlChar* URI,
+	int nb_namespaces,
+	const xmlChar** namespaces,
+	int nb_attributes,
+	int nb_defaulted,
+	const xmlChar** attributes)
+{
+	xmlParserCtxtPtr ctxt = ctx;
+	dfxp_sax_state_t* state = ctxt->_private;
+	u_char* p;
 
-			if ((uint64_t)end_time < start)
-			{
-				track->first_frame_index++;
-				continue;
-			}
+	state->depth++;
 
-			attr = dfxp_get_xml_prop(cur_node, DFXP_ATTR_BEGIN);
-			if (attr == NULL)
-			{
-				continue;
-			}
+	if (state->skip_depth != 0)
+	{
+		return;
+	}
 
-			start_time = dfxp_parse_timestamp(attr);
-			if (start_time < 0)
+	if (state->p_depth != 0)
+	{
+		// inside p
+		if (vod_strcmp(localname, DFXP_ELEMENT_BR) == 0)
+		{
+			p = vod_array_push(&state->text);
+			if (p == NULL)
 			{
-				continue;
+				vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+					"dfxp_sax_start_element: vod_array_push failed");
+				dfxp_sax_set_error(state, VOD_ALLOC_FAILED);
+				return;
 			}
+
+			*p = '\n';
 		}
-		else
+		else if (vod_strcmp(localname, DFXP_ELEMENT_SPAN) == 0 &&
+			state->span_depth < DFXP_MAX_STACK_DEPTH)
 		{
-			// no end time
-			attr = dfxp_get_xml_prop(cur_node, DFXP_ATTR_DUR);
-			if (attr == NULL)
-			{
-				continue;
-			}
+			state->span_depth++;
+			return;
+		}
 
-			duration = dfxp_parse_timestamp(attr);
-			if (duration < 0)
-			{
-				continue;
-			}
+		state->skip_depth = state->depth;
+		return;
+	}
 
-			attr = dfxp_get_xml_prop(cur_node, DFXP_ATTR_BEGIN);
-			if (attr == NULL)
-			{
-				continue;
-			}
+	if (vod_strcmp(localname, DFXP_ELEMENT_P) == 0)
+	{
+		dfxp_sax_start_p(state, nb_attributes, attributes);
+		return;
+	}
 
-			start_time = dfxp_parse_timestamp(attr);
-			if (start_time < 0)
-			{
-				continue;
-			}
+	if (state->depth > DFXP_MAX_STACK_DEPTH)
+	{
+		state->skip_depth = state->depth;
+	}
+}
 
-			end_time = start_time + duration;
-			if ((uint64_t)end_time < start)
-			{
-				track->first_frame_index++;
-				continue;
-			}
-		}
+static void
+dfxp_sax_end_element(
+	void* ctx,
+	const xmlChar* localname,
+	const xmlChar* prefix,
+	const xmlChar* URI)
+{
+	xmlParserCtxtPtr ctxt = ctx;
+	dfxp_sax_state_t* state = ctxt->_private;
 
-		if (start_time >= end_time)
+	if (state->skip_depth != 0)
+	{
+		if (state->skip_depth == state->depth)
 		{
-			continue;
+			state->skip_depth = 0;
 		}
+	}
+	else if (state->p_depth == state->depth)
+	{
+		dfxp_sax_end_p(state);
+	}
+	else if (state->p_depth != 0)
+	{
+		state->span_depth--;
+	}
 
-		// apply clipping
-		if (start_time >= (int64_t)base_time)
-		{
-			start_time -= base_time;
-			if ((uint64_t)start_time > clip_to)
-			{
-				start_time = clip_to;
-			}
-		}
-		else
-		{
-			start_time = 0;
-		}
+	state->depth--;
+}
 
-		end_time -= base_time;
-		if ((uint64_t)end_time > clip_to)
-		{
-			end_time = clip_to;
-		}
+static void
+dfxp_sax_characters(void* ctx, const xmlChar* ch, int len)
+{
+	xmlParserCtxtPtr ctxt = ctx;
+	dfxp_sax_state_t* state = ctxt->_private;
+	u_char* p;
 
-		// get the text
-		rc = dfxp_get_frame_body(
-			request_context,
-			cur_node->children,
-			&text);
-		switch (rc)
-		{
-		case VOD_NOT_FOUND:
-			continue;
+	if (state->p_depth == 0 || state->skip_depth != 0 || len <= 0)
+	{
+		return;
+	}
 
-		case VOD_OK:
-			break;
+	p = vod_array_push_n(&state->text, len);
+	if (p == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"dfxp_sax_characters: vod_array_push_n failed");
+		dfxp_sax_set_error(state, VOD_ALLOC_FAILED);
+		return;
+	}
 
-		default:
-			return rc;
-		}
+	vod_memcpy(p, ch, len);
+}
 
-		// adjust the duration of the previous frame
-		if (cur_frame != NULL)
-		{
-			cur_frame->duration = start_time - last_start_time;
-		}
-		else
+static uint64_t
+dfxp_sax_get_duration(dfxp_sax_state_t* state)
+{
+	unsigned count;
+	unsigned i;
+	int64_t result = 0;
+
+	// Note: estimated from the last few p elements, since a previous cue may end after the last cue
+	count = vod_min(state->end_time_count, DFXP_DURATION_ESTIMATE_NODES);
+	for (i = 0; i < count; i++)
+	{
+		if (state->end_times[i] > result)
 		{
-			track->first_frame_time_offset = start_time;
+			result = state->end_times[i];
 		}
+	}
+
+	return result;
+}
 
-		if ((uint64_t)start_time >= end)
+static vod_status_t
+dfxp_build_cue_index(
+	request_context_t* request_context,
+	vod_str_t* source,
+	vod_str_t* result)
+{
+	dfxp_sax_state_t state;
+	xmlParserCtxtPtr ctxt;
+	xmlSAXHandler* sax;
+	vod_status_t rc;
+
+	vod_memzero(&state, sizeof(state));
+	state.request_context = request_context;
+
+	rc = subtitle_cue_index_init(request_context, NULL, &state.builder);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	if (vod_array_init(&state.text, request_context->pool, 256, 1) != VOD_OK)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"dfxp_build_cue_index: vod_array_init failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	// parse the xml
+	ctxt = xmlCreateDocParserCtxt(source->data);
+	if (ctxt == NULL)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"dfxp_build_cue_index: xmlCreateDocParserCtxt failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	xmlCtxtUseOptions(ctxt, XML_PARSE_RECOVER | XML_PARSE_NOWARNING | XML_PARSE_NONET);
+
+	// replace the tree builder handlers, the document is never materialized
+	sax = ctxt->sax;
+	vod_memzero(sax, sizeof(*sax));
+	sax->initialized = XML_SAX2_MAGIC;
+	sax->startElementNs = dfxp_sax_start_element;
+	sax->endElementNs = dfxp_sax_end_element;
+	sax->characters = dfxp_sax_characters;
+	sax->ignorableWhitespace = dfxp_sax_characters;
+	sax->cdataBlock = dfxp_sax_characters;
+	sax->error = dfxp_xml_sax_error;
+	sax->fatalError = dfxp_xml_sax_error;
+	sax->_private = request_context;
+
+	ctxt->vctxt.error = dfxp_xml_schema_error;
+	ctxt->_private = &state;
+	state.ctxt = ctxt;
+
+	if (xmlParseDocument(ctxt) != 0 ||
+		(!ctxt->wellFormed && !ctxt->recovery))
+	{
+		xmlFreeParserCtxt(ctxt);
+
+		if (state.rc != VOD_OK)
 		{
-			track->total_frames_duration = start_time - track->first_frame_time_offset;
-			break;
+			return state.rc;
 		}
 
-		// add the frame
-		cur_frame = vod_array_push(&frames);
-		if (cur_frame == NULL)
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"dfxp_build_cue_index: xml parsing failed");
+		return VOD_BAD_DATA;
+	}
+
+	xmlFreeParserCtxt(ctxt);
+
+	if (state.rc != VOD_OK)
+	{
+		return state.rc;
+	}
+
+	return subtitle_cue_index_finalize(&state.builder, dfxp_sax_get_duration(&state), result);
+}
+
+static vod_status_t
+dfxp_parse(
+	request_context_t* request_context,
+	media_parse_params_t* parse_params,
+	vod_str_t* metadata_parts,
+	size_t metadata_part_count,
+	media_base_metadata_t** result)
+{
+	vod_str_t local_index;
+	vod_str_t* source;
+	vod_str_t* index;
+	vod_status_t rc;
+
+	subtitle_get_metadata_parts(metadata_parts, metadata_part_count, &source, &index);
+
+	if (index == NULL)
+	{
+		index = &local_index;
+		index->len = 0;
+	}
+
+	if (index->len == 0)
+	{
+		// Note: when index points to the metadata parts, the built index will be saved to cache
+		rc = dfxp_build_cue_index(request_context, source, index);
+		if (rc != VOD_OK)
 		{
-			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-				"dfxp_parse_frames: vod_array_push failed");
-			return VOD_ALLOC_FAILED;
+			return rc;
 		}
+	}
 
-		cur_frame->offset = (uintptr_t)text.data;
-		cur_frame->size = text.len;
-		cur_frame->pts_delay = end_time - start_time;
-		cur_frame->key_frame = 0;
-		track->total_frames_size += cur_frame->size;
+	return subtitle_parse(
+		request_context,
+		parse_params,
+		source,
+		index,
+		result);
+}
 
-		last_start_time = start_time;
-	}
+static vod_status_t
+dfxp_parse_frames(
+	request_context_t* request_context,
+	media_base_metadata_t* base,
+	media_parse_params_t* parse_params,
+	struct segmenter_conf_s* segmenter,
+	read_cache_state_t* read_cache_state,
+	vod_str_t* frame_data,
+	media_format_read_request_t* read_req,
+	media_track_array_t* result)
+{
+	subtitle_base_metadata_t* metadata = vod_container_of(base, subtitle_base_metadata_t, base);
+	media_track_t* track = base->tracks.elts;
+	vod_str_t* header = &track->media_info.extra_data;
 
-	track->frame_count = frames.nelts;
-	track->frames.first_frame = frames.elts;
-	track->frames.last_frame = track->frames.first_frame + frames.nelts;
+	// initialize the result
+	vod_memzero(result, sizeof(*result));
+	result->first_track = track;
+	result->last_track = track + 1;
+	result->track_count[MEDIA_TYPE_SUBTITLE] = 1;
+	result->total_track_count = 1;
 
-	return VOD_OK;
+	header->len = sizeof(WEBVTT_HEADER_NEWLINES) - 1;
+	header->data = (u_char*)WEBVTT_HEADER_NEWLINES;
+	
+	if ((parse_params->parse_type & PARSE_FLAG_FRAMES_ALL) == 0)
+	{
+		return VOD_OK;
+	}
+
+	return subtitle_parse_frames(
+		request_context,
+		metadata,
+		parse_params,
+		track);
 }
 
 void
@@ -952,3 +843,4 @@ media_format_t dfxp_format = {
 	dfxp_parse,
 	dfxp_parse_frames,
 };
+
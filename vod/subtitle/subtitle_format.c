@@ -1,13 +1,22 @@
 #include "subtitle_format.h"
 #include "../media_set.h"
 
+// constants
+#define SUBTITLE_CUE_INDEX_FLAG_TEXT (0x1)		// cue offsets are relative to the index text, not the source
+
 // typedefs
 typedef struct {
 	size_t size_limit;
 	bool_t first_time;
-	vod_str_t buffer;
+	vod_str_t parts[2];
 } subtitle_reader_state_t;
 
+typedef struct {
+	uint64_t duration;
+	uint32_t cue_count;
+	uint32_t flags;
+} subtitle_cue_index_header_t;
+
 vod_status_t
 subtitle_reader_init(
 	request_context_t* request_context,
@@ -41,9 +50,12 @@ subtitle_reader_read(
 
 	if (!state->first_time)
 	{
-		state->buffer = *buffer;
-		result->parts = &state->buffer;
-		result->part_count = 1;
+		// Note: the cue index is filled by the parser
+		state->parts[0].data = NULL;
+		state->parts[0].len = 0;
+		state->parts[1] = *buffer;
+		result->parts = state->parts;
+		result->part_count = vod_array_entries(state->parts);
 		return VOD_OK;
 	}
 
@@ -55,20 +67,247 @@ subtitle_reader_read(
 	return VOD_AGAIN;
 }
 
+void
+subtitle_get_metadata_parts(
+	vod_str_t* metadata_parts,
+	size_t metadata_part_count,
+	vod_str_t** source,
+	vod_str_t** index)
+{
+	if (metadata_part_count > 1)
+	{
+		*index = &metadata_parts[0];
+		*source = &metadata_parts[metadata_part_count - 1];		// must be last - the cache null terminates it
+	}
+	else
+	{
+		*index = NULL;
+		*source = &metadata_parts[0];
+	}
+}
+
+vod_status_t
+subtitle_cue_index_init(
+	request_context_t* request_context,
+	u_char* source,
+	subtitle_cue_index_builder_t* builder)
+{
+	builder->request_context = request_context;
+	builder->source = source;
+	builder->max_end_time = 0;
+
+	if (vod_array_init(&builder->cues, request_context->pool, 32, sizeof(subtitle_cue_t)) != VOD_OK)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"subtitle_cue_index_init: vod_array_init failed (1)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	if (source != NULL)
+	{
+		vod_memzero(&builder->text, sizeof(builder->text));
+		return VOD_OK;
+	}
+
+	if (vod_array_init(&builder->text, request_context->pool, 1024, 1) != VOD_OK)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"subtitle_cue_index_init: vod_array_init failed (2)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	return VOD_OK;
+}
+
+static vod_status_t
+subtitle_cue_index_add_text(
+	subtitle_cue_index_builder_t* builder,
+	vod_str_t* str,
+	uint32_t* offset)
+{
+	u_char* p;
+
+	if (builder->source != NULL)
+	{
+		*offset = str->data - builder->source;
+		return VOD_OK;
+	}
+
+	*offset = builder->text.nelts;
+
+	if (str->len <= 0)
+	{
+		return VOD_OK;
+	}
+
+	p = vod_array_push_n(&builder->text, str->len);
+	if (p == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, builder->request_context->log, 0,
+			"subtitle_cue_index_add_text: vod_array_push_n failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memcpy(p, str->data, str->len);
+
+	return VOD_OK;
+}
+
+vod_status_t
+subtitle_cue_index_add(
+	subtitle_cue_index_builder_t* builder,
+	uint64_t start_time,
+	uint64_t end_time,
+	vod_str_t* id,
+	vod_str_t* body)
+{
+	subtitle_cue_t* cue;
+	vod_status_t rc;
+
+	cue = vod_array_push(&builder->cues);
+	if (cue == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, builder->request_context->log, 0,
+			"subtitle_cue_index_add: vod_array_push failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	if (end_time > builder->max_end_time)
+	{
+		builder->max_end_time = end_time;
+	}
+
+	cue->start_time = start_time;
+	cue->end_time = end_time;
+	cue->max_end_time = builder->max_end_time;
+	cue->id_offset = 0;
+	cue->id_len = 0;
+	cue->body_offset = 0;
+	cue->body_len = 0;
+
+	if (id != NULL)
+	{
+		rc = subtitle_cue_index_add_text(builder, id, &cue->id_offset);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		cue->id_len = id->len;
+	}
+
+	if (body != NULL)
+	{
+		rc = subtitle_cue_index_add_text(builder, body, &cue->body_offset);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		cue->body_len = body->len;
+	}
+
+	return VOD_OK;
+}
+
+vod_status_t
+subtitle_cue_index_finalize(
+	subtitle_cue_index_builder_t* builder,
+	uint64_t duration,
+	vod_str_t* result)
+{
+	subtitle_cue_index_header_t* header;
+	size_t cues_size;
+	u_char* p;
+
+	cues_size = builder->cues.nelts * sizeof(subtitle_cue_t);
+
+	result->len = sizeof(*header) + cues_size + builder->text.nelts;
+	p = vod_alloc(builder->request_context->pool, result->len);
+	if (p == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, builder->request_context->log, 0,
+			"subtitle_cue_index_finalize: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	result->data = p;
+
+	header = (void*)p;
+	header->duration = duration;
+	header->cue_count = builder->cues.nelts;
+	header->flags = builder->source == NULL ? SUBTITLE_CUE_INDEX_FLAG_TEXT : 0;
+	p += sizeof(*header);
+
+	p = vod_copy(p, builder->cues.elts, cues_size);
+	vod_memcpy(p, builder->text.elts, builder->text.nelts);
+
+	return VOD_OK;
+}
+
+static vod_status_t
+subtitle_parse_cue_index(
+	request_context_t* request_context,
+	vod_str_t* source,
+	vod_str_t* index,
+	subtitle_base_metadata_t* metadata)
+{
+	subtitle_cue_index_header_t* header;
+	size_t cues_size;
+	u_char* p;
+
+	// Note: the index is either allocated from the pool, or is the first part of a cache buffer,
+	//		in both cases it is aligned to 8 bytes
+	if (index->len < sizeof(*header))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"subtitle_parse_cue_index: index size %uz smaller than header size", index->len);
+		return VOD_BAD_DATA;
+	}
+
+	header = (void*)index->data;
+	p = index->data + sizeof(*header);
+
+	cues_size = (size_t)header->cue_count * sizeof(subtitle_cue_t);
+	if (index->len - sizeof(*header) < cues_size)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"subtitle_parse_cue_index: index size %uz too small to hold %uD cues", 
+			index->len, header->cue_count);
+		return VOD_BAD_DATA;
+	}
+
+	metadata->first_cue = (void*)p;
+	metadata->last_cue = metadata->first_cue + header->cue_count;
+	p += cues_size;
+
+	if ((header->flags & SUBTITLE_CUE_INDEX_FLAG_TEXT) != 0)
+	{
+		metadata->cue_data.data = p;
+		metadata->cue_data.len = index->data + index->len - p;
+	}
+	else
+	{
+		metadata->cue_data = *source;
+	}
+
+	return VOD_OK;
+}
+
 vod_status_t
 subtitle_parse(
 	request_context_t* request_context,
 	media_parse_params_t* parse_params,
 	vod_str_t* source,
-	void* context,
-	uint64_t full_duration,
-	size_t metadata_part_count,
+	vod_str_t* index,
 	media_base_metadata_t** result)
 {
 	subtitle_base_metadata_t* metadata;
 	media_track_t* track;
 	media_tags_t tags;
+	uint64_t full_duration;
 	uint64_t duration;
+	vod_status_t rc;
 
 	metadata = vod_alloc(request_context->pool, sizeof(*metadata));
 	if (metadata == NULL)
@@ -86,6 +325,14 @@ subtitle_parse(
 		return VOD_OK;
 	}
 
+	rc = subtitle_parse_cue_index(request_context, source, index, metadata);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	full_duration = ((subtitle_cue_index_header_t*)index->data)->duration;
+
 	// inherit the sequence language and label
 	tags = parse_params->source->sequence->tags;
 	if (tags.label.len == 0)
@@ -138,10 +385,193 @@ subtitle_parse(
 	track->media_info.bitrate = (source->len * 1000 * 8) / full_duration;
 
 	metadata->source = *source;
-	metadata->context = context;
 	metadata->base.duration = duration;
 	metadata->base.timescale = 1000;
 
 	return VOD_OK;
 }
 
+static subtitle_cue_t*
+subtitle_find_first_cue(subtitle_cue_t* first, subtitle_cue_t* last, uint64_t start)
+{
+	subtitle_cue_t* cur;
+
+	// find the first cue whose max end time is >= start, all the cues before it end before start
+	while (first < last)
+	{
+		cur = first + (last - first) / 2;
+		if (cur->max_end_time < start)
+		{
+			first = cur + 1;
+		}
+		else
+		{
+			last = cur;
+		}
+	}
+
+	return first;
+}
+
+vod_status_t
+subtitle_parse_frames(
+	request_context_t* request_context,
+	subtitle_base_metadata_t* metadata,
+	media_parse_params_t* parse_params,
+	media_track_t* track)
+{
+	subtitle_cue_t* cur_cue;
+	subtitle_cue_t* last_cue = metadata->last_cue;
+	input_frame_t* cur_frame = NULL;
+	vod_array_t frames;
+	uint64_t last_start_time = 0;
+	uint64_t start_time = 0;
+	uint64_t end_time = 0;
+	uint64_t base_time;
+	uint64_t clip_to;
+	uint64_t start;
+	uint64_t end;
+	u_char* data = metadata->cue_data.data;
+	size_t data_len = metadata->cue_data.len;
+	u_char* p;
+
+	if (vod_array_init(&frames, request_context->pool, 5, sizeof(*cur_frame)) != VOD_OK)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"subtitle_parse_frames: vod_array_init failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	start = parse_params->range->start + parse_params->clip_from;
+
+	if ((parse_params->parse_type & PARSE_FLAG_RELATIVE_TIMESTAMPS) != 0)
+	{
+		base_time = start;
+		clip_to = parse_params->range->end - parse_params->range->start;
+		end = clip_to;
+	}
+	else
+	{
+		base_time = parse_params->clip_from;
+		clip_to = parse_params->clip_to;
+		end = parse_params->range->end;		// Note: not adding clip_from, since end is checked after the clipping is applied to the timestamps
+	}
+
+	cur_cue = subtitle_find_first_cue(metadata->first_cue, last_cue, start);
+	track->first_frame_index = cur_cue - metadata->first_cue;
+
+	for (;; cur_cue++)
+	{
+		if (cur_cue >= last_cue)
+		{
+			if (cur_frame != NULL)
+			{
+				cur_frame->duration = end_time - start_time;
+				track->total_frames_duration = end_time - track->first_frame_time_offset;
+			}
+			break;
+		}
+
+		end_time = cur_cue->end_time;
+		if (end_time < start)
+		{
+			track->first_frame_index++;
+			continue;
+		}
+
+		start_time = cur_cue->start_time;
+		if (start_time >= end_time)
+		{
+			continue;
+		}
+
+		// apply clipping
+		if (start_time >= base_time)
+		{
+			start_time -= base_time;
+			if (start_time > clip_to)
+			{
+				start_time = clip_to;
+			}
+		}
+		else
+		{
+			start_time = 0;
+		}
+
+		end_time -= base_time;
+		if (end_time > clip_to)
+		{
+			end_time = clip_to;
+		}
+
+		// adjust the duration of the previous frame
+		if (cur_frame != NULL)
+		{
+			cur_frame->duration = start_time - last_start_time;
+		}
+		else
+		{
+			track->first_frame_time_offset = start_time;
+		}
+
+		if (start_time >= end)
+		{
+			track->total_frames_duration = start_time - track->first_frame_time_offset;
+			break;
+		}
+
+		if (cur_cue->id_offset > data_len || cur_cue->id_len > data_len - cur_cue->id_offset ||
+			cur_cue->body_offset > data_len || cur_cue->body_len > data_len - cur_cue->body_offset)
+		{
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"subtitle_parse_frames: cue %uD exceeds the data size %uz", 
+				(uint32_t)(cur_cue - metadata->first_cue), data_len);
+			return VOD_BAD_DATA;
+		}
+
+		// allocate the frame
+		cur_frame = vod_array_push(&frames);
+		if (cur_frame == NULL)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+				"subtitle_parse_frames: vod_array_push failed");
+			return VOD_ALLOC_FAILED;
+		}
+
+		// Note: mapping of cue into input_frame_t:
+		//	- offset = pointer to buffer containing: cue id, cue settings list, cue payload
+		//	- size = size of data pointed by offset
+		//	- key_frame = cue id length
+		//	- dts = start time
+		//	- pts = end time
+
+		cur_frame->pts_delay = end_time - start_time;
+		cur_frame->size = cur_cue->id_len + cur_cue->body_len;
+		cur_frame->key_frame = cur_cue->id_len;
+
+		track->total_frames_size += cur_frame->size;
+
+		// Note: the cue data may be a cache buffer that is released before the frames are used
+		p = vod_alloc(request_context->pool, cur_frame->size);
+		if (p == NULL)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+				"subtitle_parse_frames: vod_alloc failed");
+			return VOD_ALLOC_FAILED;
+		}
+
+		cur_frame->offset = (uintptr_t)p;
+
+		p = vod_copy(p, data + cur_cue->id_offset, cur_cue->id_len);
+		vod_memcpy(p, data + cur_cue->body_offset, cur_cue->body_len);
+
+		last_start_time = start_time;
+	}
+
+	track->frame_count = frames.nelts;
+	track->frames.first_frame = frames.elts;
+	track->frames.last_frame = track->frames.first_frame + frames.nelts;
+
+	return VOD_OK;
+}
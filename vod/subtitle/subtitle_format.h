@@ -9,10 +9,30 @@
 #define UTF8_BOM ("\xEF\xBB\xBF")
 
 // typedefs
+typedef struct {
+	uint64_t start_time;
+	uint64_t end_time;
+	uint64_t max_end_time;		// the max end time of this cue and all the cues preceding it
+	uint32_t id_offset;
+	uint32_t id_len;
+	uint32_t body_offset;
+	uint32_t body_len;
+} subtitle_cue_t;
+
+typedef struct {
+	request_context_t* request_context;
+	vod_array_t cues;
+	vod_array_t text;
+	u_char* source;				// when null, the cue id & body are copied to the index
+	uint64_t max_end_time;
+} subtitle_cue_index_builder_t;
+
 typedef struct {
 	media_base_metadata_t base;
 	vod_str_t source;
-	void* context;
+	subtitle_cue_t* first_cue;
+	subtitle_cue_t* last_cue;
+	vod_str_t cue_data;
 } subtitle_base_metadata_t;
 
 // functions
@@ -26,13 +46,45 @@ vod_status_t subtitle_reader_read(
 	vod_str_t* buffer,
 	media_format_read_metadata_result_t* result);
 
+// Note: the subtitle metadata parts are [cue index, source], the index part is empty 
+//		on the first read, and gets filled by the format parser so that it is saved to cache 
+//		along with the source. a single part (no index) is also supported.
+void subtitle_get_metadata_parts(
+	vod_str_t* metadata_parts,
+	size_t metadata_part_count,
+	vod_str_t** source,
+	vod_str_t** index);
+
+vod_status_t subtitle_cue_index_init(
+	request_context_t* request_context,
+	u_char* source,
+	subtitle_cue_index_builder_t* builder);
+
+// Note: a cue whose start time is invalid should be added with start_time = end_time, 
+//		it is not returned, but is counted in first_frame_index when it precedes the segment
+vod_status_t subtitle_cue_index_add(
+	subtitle_cue_index_builder_t* builder,
+	uint64_t start_time,
+	uint64_t end_time,
+	vod_str_t* id,
+	vod_str_t* body);
+
+vod_status_t subtitle_cue_index_finalize(
+	subtitle_cue_index_builder_t* builder,
+	uint64_t duration,
+	vod_str_t* result);
+
 vod_status_t subtitle_parse(
 	request_context_t* request_context,
 	media_parse_params_t* parse_params,
 	vod_str_t* source,
-	void* context,
-	uint64_t full_duration,
-	size_t metadata_part_count,
+	vod_str_t* index,
 	media_base_metadata_t** result);
 
+vod_status_t subtitle_parse_frames(
+	request_context_t* request_context,
+	subtitle_base_metadata_t* metadata,
+	media_parse_params_t* parse_params,
+	media_track_t* track);
+
 #endif //__SUBTITLE_FORMAT_H__
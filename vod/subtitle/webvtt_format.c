@@ -167,6 +167,7 @@ webvtt_reader_init(
 	request_context_t* request_context,
 	vod_str_t* buffer,
 	size_t max_metadata_size,
+	uint32_t flags,
 	void** ctx)
 {
 	u_char* p = buffer->data;
@@ -411,17 +412,169 @@ webvtt_estimate_duration(vod_str_t* source)
 	return duration;
 }
 
+static u_char*
+webvtt_skip_magic_line(u_char* cur_pos)
+{
+	for (;;)
+	{
+		switch (*cur_pos)
+		{
+		case '\r':
+			cur_pos++;
+			if (*cur_pos == '\n')
+			{
+				cur_pos++;
+			}
+			return cur_pos;
+
+		case '\n':
+			return cur_pos + 1;
+
+		case '\0':
+			return NULL;
+		}
+
+		cur_pos++;
+	}
+}
+
+static vod_status_t
+webvtt_build_cue_index(
+	request_context_t* request_context,
+	vod_str_t* source,
+	vod_str_t* result)
+{
+	subtitle_cue_index_builder_t builder;
+	vod_str_t cue_id;
+	vod_str_t body;
+	int64_t start_time;
+	int64_t end_time;
+	u_char* timings_end;
+	u_char* cur_pos = source->data;
+	u_char* start_pos;
+	u_char* cue_start;
+	u_char* prev_line;
+	vod_status_t rc;
+
+	rc = subtitle_cue_index_init(request_context, source->data, &builder);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	// skip the file magic line
+	if (vod_strncmp(cur_pos, UTF8_BOM, sizeof(UTF8_BOM) - 1) == 0)
+	{
+		cur_pos += sizeof(UTF8_BOM) - 1;
+	}
+
+	start_pos = cur_pos;
+
+	if (vod_strncmp(cur_pos, WEBVTT_HEADER, sizeof(WEBVTT_HEADER) - 1) == 0)
+	{
+		cur_pos = webvtt_skip_magic_line(cur_pos + sizeof(WEBVTT_HEADER) - 1);
+		if (cur_pos == NULL)
+		{
+			// no cues, the error is reported by webvtt_parse_frames
+			return subtitle_cue_index_finalize(&builder, 0, result);
+		}
+	}
+
+	for (;;)
+	{
+		// find next cue
+		cue_start = webvtt_find_next_cue(cur_pos);
+		if (cue_start == NULL)
+		{
+			break;
+		}
+
+		// parse end time
+		cur_pos = cue_start;
+		for (; *cur_pos == ' ' || *cur_pos == '\t'; cur_pos++);
+
+		end_time = webvtt_read_timestamp(cur_pos, &timings_end);
+		if (end_time < 0)
+		{
+			continue;
+		}
+
+		// start time
+		cue_start = webvtt_find_prev_newline_no_limit(cue_start - (sizeof(WEBVTT_CUE_MARKER) - 1));
+
+		start_time = webvtt_read_timestamp(cue_start + 1, NULL);
+		if (start_time < 0 || start_time >= end_time)
+		{
+			// add the cue so that it will be counted in first_frame_index
+			rc = subtitle_cue_index_add(&builder, end_time, end_time, NULL, NULL);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+			continue;
+		}
+
+		// identifier
+		prev_line = webvtt_skip_newline_reverse_no_limit(cue_start);
+		if (*prev_line != '\r' && *prev_line != '\n')
+		{
+			cue_id.data = webvtt_find_prev_newline(prev_line, start_pos);
+			if (cue_id.data == NULL)
+			{
+				cue_id.data = start_pos;
+			}
+			else
+			{
+				cue_id.data++;
+			}
+			cue_id.len = cue_start + 1 - cue_id.data;
+		}
+		else
+		{
+			cue_id.data = cue_start;
+			cue_id.len = 0;
+		}
+
+		// find the end of the cue
+		cur_pos = webvtt_find_next_empty_line(timings_end, FALSE);
+		if (cur_pos == NULL)
+		{
+			cur_pos = source->data + source->len;
+		}
+
+		body.data = timings_end;
+		body.len = cur_pos - timings_end;
+
+		rc = subtitle_cue_index_add(&builder, start_time, end_time, &cue_id, &body);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	return subtitle_cue_index_finalize(&builder, webvtt_estimate_duration(source), result);
+}
+
 static vod_status_t
 webvtt_parse(
 	request_context_t* request_context,
 	media_parse_params_t* parse_params,
-	vod_str_t* source,
+	vod_str_t* metadata_parts,
 	size_t metadata_part_count,
 	media_base_metadata_t** result)
 {
-#if (VOD_HAVE_ICONV)
-	u_char* p = source->data;
+	vod_str_t local_index;
+	vod_str_t* source;
+	vod_str_t* index;
 	vod_status_t rc;
+#if (VOD_HAVE_ICONV)
+	u_char* p;
+#endif // VOD_HAVE_ICONV
+
+	subtitle_get_metadata_parts(metadata_parts, metadata_part_count, &source, &index);
+
+#if (VOD_HAVE_ICONV)
+	p = source->data;
 
 	if (webvtt_is_utf16le_bom(p))
 	{
@@ -451,13 +604,27 @@ webvtt_parse(
 	}
 #endif // VOD_HAVE_ICONV
 
+	if (index == NULL)
+	{
+		index = &local_index;
+		index->len = 0;
+	}
+
+	if (index->len == 0)
+	{
+		// Note: when index points to the metadata parts, the built index will be saved to cache
+		rc = webvtt_build_cue_index(request_context, source, index);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
 	return subtitle_parse(
 		request_context,
 		parse_params,
 		source,
-		NULL,
-		webvtt_estimate_duration(source),
-		metadata_part_count,
+		index,
 		result);
 }
 
@@ -474,24 +641,11 @@ webvtt_parse_frames(
 {
 	subtitle_base_metadata_t* metadata = vod_container_of(base, subtitle_base_metadata_t, base);
 	media_track_t* track = base->tracks.elts;
-	input_frame_t* cur_frame = NULL;
-	vod_array_t frames;
 	vod_str_t* source = &metadata->source;
 	vod_str_t* header = &track->media_info.extra_data;
-	vod_str_t cue_id = vod_null_string;
-	uint64_t base_time;
-	uint64_t clip_to;
-	uint64_t start;
-	uint64_t end;
-	int64_t last_start_time = 0;
-	int64_t start_time = 0;
-	int64_t end_time = 0;
-	u_char* timings_end;
 	u_char* cur_pos = source->data;
 	u_char* start_pos;
-	u_char* cue_start;
 	u_char* prev_line;
-	u_char* p;
 
 	// XXXXX consider adding a separate segmenter for subtitles
 
@@ -517,32 +671,12 @@ webvtt_parse_frames(
 
 	if (vod_strncmp(cur_pos, WEBVTT_HEADER, sizeof(WEBVTT_HEADER) - 1) == 0)
 	{
-		cur_pos += sizeof(WEBVTT_HEADER) - 1;
-
-		for (;;)
+		cur_pos = webvtt_skip_magic_line(cur_pos + sizeof(WEBVTT_HEADER) - 1);
+		if (cur_pos == NULL)
 		{
-			if (*cur_pos == '\r')
-			{
-				cur_pos++;
-				if (*cur_pos == '\n')
-				{
-					cur_pos++;
-				}
-				break;
-			}
-			else if (*cur_pos == '\n')
-			{
-				cur_pos++;
-				break;
-			}
-			else if (*cur_pos == '\0')
-			{
-				vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-					"webvtt_parse_frames: eof while reading file magic line");
-				return VOD_BAD_DATA;
-			}
-
-			cur_pos++;
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"webvtt_parse_frames: eof while reading file magic line");
+			return VOD_BAD_DATA;
 		}
 
 		// find the start of the first cue
@@ -595,174 +729,11 @@ webvtt_parse_frames(
 		return VOD_OK;
 	}
 
-	// cues
-	if (vod_array_init(&frames, request_context->pool, 5, sizeof(*cur_frame)) != VOD_OK)
-	{
-		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"webvtt_parse_frames: vod_array_init failed");
-		return VOD_ALLOC_FAILED;
-	}
-
-	start = parse_params->range->start + parse_params->clip_from;
-
-	if ((parse_params->parse_type & PARSE_FLAG_RELATIVE_TIMESTAMPS) != 0)
-	{
-		base_time = start;
-		clip_to = parse_params->range->end - parse_params->range->start;
-		end = clip_to;
-	}
-	else
-	{
-		base_time = parse_params->clip_from;
-		clip_to = parse_params->clip_to;
-		end = parse_params->range->end;		// Note: not adding clip_from, since end is checked after the clipping is applied to the timestamps
-	}
-
-	for (;;)
-	{
-		// find next cue
-		cue_start = webvtt_find_next_cue(cur_pos);
-		if (cue_start == NULL)
-		{
-			if (cur_frame != NULL)
-			{
-				cur_frame->duration = end_time - start_time;
-				track->total_frames_duration = end_time - track->first_frame_time_offset;
-			}
-			break;
-		}
-
-		// parse end time
-		cur_pos = cue_start;
-		for (; *cur_pos == ' ' || *cur_pos == '\t'; cur_pos++);
-
-		end_time = webvtt_read_timestamp(cur_pos, &timings_end);
-		if (end_time < 0)
-		{
-			continue;
-		}
-
-		if ((uint64_t)end_time < start)
-		{
-			track->first_frame_index++;
-			continue;
-		}
-
-		// start time
-		cue_start = webvtt_find_prev_newline_no_limit(cue_start - (sizeof(WEBVTT_CUE_MARKER) - 1));
-
-		start_time = webvtt_read_timestamp(cue_start + 1, NULL);
-		if (start_time < 0 || start_time >= end_time)
-		{
-			continue;
-		}
-
-		// apply clipping
-		if (start_time >= (int64_t)base_time)
-		{
-			start_time -= base_time;
-			if ((uint64_t)start_time > clip_to)
-			{
-				start_time = clip_to;
-			}
-		}
-		else
-		{
-			start_time = 0;
-		}
-
-		end_time -= base_time;
-		if ((uint64_t)end_time > clip_to)
-		{
-			end_time = clip_to;
-		}
-
-		// adjust the duration of the previous frame
-		if (cur_frame != NULL)
-		{
-			cur_frame->duration = start_time - last_start_time;
-		}
-		else
-		{
-			track->first_frame_time_offset = start_time;
-		}
-
-		if ((uint64_t)start_time >= end)
-		{
-			track->total_frames_duration = start_time - track->first_frame_time_offset;
-			break;
-		}
-
-		// identifier
-		prev_line = webvtt_skip_newline_reverse_no_limit(cue_start);
-		if (*prev_line != '\r' && *prev_line != '\n')
-		{
-			cue_id.data = webvtt_find_prev_newline(prev_line, start_pos);
-			if (cue_id.data == NULL)
-			{
-				cue_id.data = start_pos;
-			}
-			else
-			{
-				cue_id.data++;
-			}
-			cue_id.len = cue_start + 1 - cue_id.data;
-		}
-		else
-		{
-			cue_id.len = 0;
-		}
-
-		// find the end of the cue
-		cur_pos = webvtt_find_next_empty_line(timings_end, FALSE);
-		if (cur_pos == NULL)
-		{
-			cur_pos = source->data + source->len;
-		}
-
-		// allocate the frame
-		cur_frame = vod_array_push(&frames);
-		if (cur_frame == NULL)
-		{
-			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-				"webvtt_parse_frames: vod_array_push failed");
-			return VOD_ALLOC_FAILED;
-		}
-
-		// Note: mapping of cue into input_frame_t:
-		//	- offset = pointer to buffer containing: cue id, cue settings list, cue payload
-		//	- size = size of data pointed by offset
-		//	- key_frame = cue id length
-		//	- dts = start time
-		//	- pts = end time
-
-		cur_frame->pts_delay = end_time - start_time;
-		cur_frame->size = cue_id.len + (cur_pos - timings_end);
-		cur_frame->key_frame = cue_id.len;
-
-		track->total_frames_size += cur_frame->size;
-
-		p = vod_alloc(request_context->pool, cur_frame->size);
-		if (p == NULL)
-		{
-			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-				"webvtt_parse_frames: vod_alloc failed");
-			return VOD_ALLOC_FAILED;
-		}
-
-		cur_frame->offset = (uintptr_t)p;
-
-		p = vod_copy(p, cue_id.data, cue_id.len);
-		vod_memcpy(p, timings_end, cur_pos - timings_end);
-
-		last_start_time = start_time;
-	}
-
-	track->frame_count = frames.nelts;
-	track->frames.first_frame = frames.elts;
-	track->frames.last_frame = track->frames.first_frame + frames.nelts;
-
-	return VOD_OK;
+	return subtitle_parse_frames(
+		request_context,
+		metadata,
+		parse_params,
+		track);
 }
 
 media_format_t webvtt_format = {
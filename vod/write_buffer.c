@@ -1,9 +1,6 @@
 #include "write_buffer.h"
 #include "buffer_pool.h"
 
-// constants
-#define WRITE_BUFFER_SIZE (65536)
-
 void
 write_buffer_init(
 	write_buffer_state_t* state,
@@ -4,6 +4,9 @@
 // includes
 #include "common.h"
 
+// constants
+#define WRITE_BUFFER_SIZE (65536)
+
 // typedefs
 typedef struct {
 	request_context_t* request_context;
@@ -99,6 +99,39 @@ write_buffer_queue_get_buffer(write_buffer_queue_t* queue, uint32_t size, void*
 	return result;
 }
 
+// Note: returns a contiguous run of 1..max_count units, all taken from the same buffer
+u_char*
+write_buffer_queue_get_buffers(
+	write_buffer_queue_t* queue,
+	uint32_t unit_size,
+	uint32_t max_count,
+	uint32_t* count,
+	void* writer_context)
+{
+	buffer_header_t* write_buffer;
+	uint32_t extra_count;
+	u_char* result;
+
+	result = write_buffer_queue_get_buffer(queue, unit_size, writer_context);
+	if (result == NULL)
+	{
+		return NULL;
+	}
+
+	write_buffer = queue->cur_write_buffer;
+	extra_count = (write_buffer->end_pos - write_buffer->cur_pos) / unit_size;
+	if (extra_count > max_count - 1)
+	{
+		extra_count = max_count - 1;
+	}
+
+	write_buffer->cur_pos += extra_count * unit_size;
+	queue->cur_offset += extra_count * unit_size;
+
+	*count = extra_count + 1;
+	return result;
+}
+
 vod_status_t
 write_buffer_queue_send(write_buffer_queue_t* queue, off_t max_offset)
 {
@@ -173,3 +206,9 @@ write_buffer_queue_flush(write_buffer_queue_t* queue)
 	// done
 	return VOD_OK;
 }
+
+size_t
+write_buffer_queue_get_buffer_size(request_context_t* request_context)
+{
+	return buffer_pool_get_size(request_context->output_buffer_pool, BUFFER_SIZE);
+}
@@ -36,7 +36,14 @@ void write_buffer_queue_init(
 	void* write_context,
 	bool_t reuse_buffers);
 u_char* write_buffer_queue_get_buffer(write_buffer_queue_t* queue, uint32_t size, void* writer_context);
+u_char* write_buffer_queue_get_buffers(
+	write_buffer_queue_t* queue,
+	uint32_t unit_size,
+	uint32_t max_count,
+	uint32_t* count,
+	void* writer_context);
 vod_status_t write_buffer_queue_send(write_buffer_queue_t* queue, off_t max_offset);
 vod_status_t write_buffer_queue_flush(write_buffer_queue_t* queue);
+size_t write_buffer_queue_get_buffer_size(request_context_t* request_context);
 
 #endif // __WRITE_BUFFER_QUEUE_H__
@@ -0,0 +1,113 @@
+#include "write_chain.h"
+#include "buffer_pool.h"
+
+// typedefs
+typedef struct {
+	vod_chain_t cl;
+	vod_buf_t b;
+} vod_chain_buf_t;
+
+static vod_status_t
+write_chain_append(void* context, u_char* buffer, uint32_t size)
+{
+	write_chain_t* state = context;
+	vod_chain_buf_t* elt;
+
+	elt = vod_alloc(state->write_buffer.request_context->pool, sizeof(*elt));
+	if (elt == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->write_buffer.request_context->log, 0,
+			"write_chain_append: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memzero(&elt->b, sizeof(elt->b));
+	elt->b.pos = buffer;
+	elt->b.last = buffer + size;
+	elt->b.temporary = 1;
+
+	elt->cl.buf = &elt->b;
+	*state->last = &elt->cl;
+	state->last = &elt->cl.next;
+
+	state->total_size += size;
+
+	return VOD_OK;
+}
+
+void
+write_chain_init(
+	write_chain_t* state,
+	request_context_t* request_context)
+{
+	// Note: the buffers are not reused, since they are kept on the chain until the response is sent
+	write_buffer_init(&state->write_buffer, request_context, write_chain_append, state, FALSE);
+	state->head = NULL;
+	state->last = &state->head;
+	state->total_size = 0;
+}
+
+vod_status_t
+write_chain_get_bytes(
+	write_chain_t* state,
+	size_t max_size,
+	u_char** buffer)
+{
+	write_buffer_state_t* write_buffer = &state->write_buffer;
+	request_context_t* request_context = write_buffer->request_context;
+	vod_status_t rc;
+	size_t size;
+
+	if (write_buffer->cur_pos + max_size > write_buffer->end_pos &&
+		max_size > buffer_pool_get_size(request_context->output_buffer_pool, WRITE_BUFFER_SIZE))
+	{
+		// larger than a chain buffer (e.g. a playlist header with many variants), use a dedicated buffer
+		rc = write_buffer_flush(write_buffer, FALSE);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		write_buffer->start_pos = vod_alloc(request_context->pool, max_size);
+		if (write_buffer->start_pos == NULL)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+				"write_chain_get_bytes: vod_alloc failed");
+			return VOD_ALLOC_FAILED;
+		}
+
+		write_buffer->cur_pos = write_buffer->start_pos;
+		write_buffer->end_pos = write_buffer->start_pos + max_size;
+	}
+
+	return write_buffer_get_bytes(write_buffer, max_size, &size, buffer);
+}
+
+vod_status_t
+write_chain_finalize(
+	write_chain_t* state,
+	vod_chain_t** result,
+	size_t* result_size)
+{
+	vod_status_t rc;
+
+	rc = write_buffer_flush(&state->write_buffer, FALSE);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	if (state->head == NULL)
+	{
+		vod_log_error(VOD_LOG_ERR, state->write_buffer.request_context->log, 0,
+			"write_chain_finalize: no data was written");
+		return VOD_UNEXPECTED;
+	}
+
+	*state->last = NULL;
+
+	*result = state->head;
+	*result_size = state->total_size;
+
+	return VOD_OK;
+}
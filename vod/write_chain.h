@@ -0,0 +1,31 @@
+#ifndef __WRITE_CHAIN_H__
+#define __WRITE_CHAIN_H__
+
+// includes
+#include "write_buffer.h"
+
+// typedefs
+typedef struct {
+	write_buffer_state_t write_buffer;
+	vod_chain_t* head;
+	vod_chain_t** last;
+	size_t total_size;
+} write_chain_t;
+
+// functions
+void write_chain_init(
+	write_chain_t* state,
+	request_context_t* request_context);
+
+// Note: returns a pointer with at least max_size free bytes, the caller must update write_buffer.cur_pos
+vod_status_t write_chain_get_bytes(
+	write_chain_t* state,
+	size_t max_size,
+	u_char** buffer);
+
+vod_status_t write_chain_finalize(
+	write_chain_t* state,
+	vod_chain_t** result,
+	size_t* result_size);
+
+#endif // __WRITE_CHAIN_H__